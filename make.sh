@@ -2,6 +2,8 @@
 mkdir -p bin # create directory for executable
 rm -f ./bin/FluidX3D.exe # prevent execution of old version if compiling fails
 g++ ./src/*.cpp -o ./bin/FluidX3D.exe -std=c++17 -pthread -I./src/OpenCL/include -L./src/OpenCL/lib -lOpenCL -I./src/include # compile on Linux
+#g++ ./src/*.cpp -o ./bin/FluidX3D.exe -std=c++17 -O3 -march=native -fno-math-errno -pthread -I./src/OpenCL/include -L./src/OpenCL/lib -lOpenCL -I./src/include # compile on Linux with CPU_NATIVE, vectorized for the CPU of this machine only
+#mpicxx ./src/*.cpp -o ./bin/FluidX3D.exe -std=c++17 -DMPI_TRANSPORT -pthread -I./src/OpenCL/include -L./src/OpenCL/lib -lOpenCL -I./src/include # compile on Linux with MPI_TRANSPORT, start with mpirun -n <ranks> ./bin/FluidX3D.exe
 #g++ ./src/*.cpp -o ./bin/FluidX3D.exe -std=c++17 -pthread -I./src/OpenCL/include -framework OpenCL -I./src/include # compile on macOS
 #g++ ./src/*.cpp -o ./bin/FluidX3D.exe -std=c++17 -pthread -I./src/OpenCL/include -L/system/vendor/lib64 -lOpenCL -I./src/include # compile on Android
 ./bin/FluidX3D.exe $1 # run FluidX3D
@@ -9,10 +9,17 @@
 
 #define SRT // choose single-relaxation-time LBM collision operator; (default)
 //#define TRT // choose two-relaxation-time LBM collision operator
+//#define RLB // choose recursive regularized LBM collision operator; discards the non-hydrodynamic (ghost) moments, stays stable at higher Reynolds number on coarse grids than SRT/TRT
 
 //#define FP16S // compress LBM DDFs to range-shifted IEEE-754 FP16; number conversion is done in hardware; all arithmetic is still done in FP32
 //#define FP16C // compress LBM DDFs to more accurate custom FP16C format; number conversion is emulated in software; all arithmetic is still done in FP32
 
+//#define CPU_NATIVE // run the LBM with native multithreaded C++ code on all CPU cores instead of OpenCL, no OpenCL runtime is needed; supports VOLUME_FORCE, FORCE_FIELD, EQUILIBRIUM_BOUNDARIES and SUBGRID; compile with -O3 -march=native -fno-math-errno to vectorize with AVX2/AVX-512 (ENABLE_NATIVE_ARCH in CMake, the commented line in make.sh)
+
+// MPI_TRANSPORT is set by the build, with -DENABLE_MPI=ON in CMake or the mpicxx line in make.sh: split the lattice across processes started with mpirun, each rank owns the slabs of its selected devices; without it, FLUIDX3D_RANKS/FLUIDX3D_RANK environment variables split it across processes on the same machine via shared memory
+
+//#define SPARSE_BRICKS // launch stream_collide only over bricks of 16x4x4 nodes that are not entirely solid or gas, faster for setups where most of the box is solid or gas; only on a single device
+
 #define BENCHMARK // disable all extensions and setups and run benchmark setup instead
 
 //#define VOLUME_FORCE // enables global force per volume in one direction, specified in the LBM class constructor; the force can be changed on-the-fly between time steps at no performance cost
@@ -36,6 +43,7 @@
 #define GRAPHICS_BOUNDARY_FORCE_SCALE 100.0f // scaling factor for visualization of forces on solid boundaries if VOLUME_FORCE is enabled and lbm.calculate_force_on_boundaries(); is called (default: 100.0f)
 #define GRAPHICS_STREAMLINE_SPARSE 4 // set how many streamlines there are every x lattice points
 #define GRAPHICS_STREAMLINE_LENGTH 128 // set maximum length of streamlines
+//#define GRAPHICS_SNAPSHOT // render from device-side copies of the fields, so time steps don't wait for rendering; costs 13 to 33 Byte/node of device memory and a copy of the rendered fields per frame
 
 
 
@@ -13,11 +13,13 @@ struct Info { // contains redundant information for console printing
 	string collision = "";
 	void initialize(LBM* lbm);
 	void append(const ulong steps, const ulong t);
-	void update(const double dt);
+	void update(const double dt, const ulong n=1ull); // dt is the average time per step over the last n steps
 	double time() const; // returns either elapsed time or remaining time
 	void print_logo() const;
 	void print_initialize(); // enables interactive rendering
 	void print_update() const;
 	void print_finalize(); // disables interactive rendering
+	void print_profile() const; // print per-kernel device time and bandwidth table, requires PROFILING
+	string profile_status() const; // per-kernel device time and bandwidth for status report, requires PROFILING
 };
 extern Info info; // declared in info.cpp
\ No newline at end of file
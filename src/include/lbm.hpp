@@ -3,6 +3,78 @@
 #include "defines.hpp"
 #include "opencl.hpp"
 #include "graphics.hpp"
+#include "thread_pool.hpp"
+#include "transport.hpp"
+
+enum Collision { COLLISION_SRT, COLLISION_TRT, COLLISION_RLB }; // LBM collision operator
+enum DDF_Format { DDF_FP32, DDF_FP16S, DDF_FP16C }; // storage format of the DDFs in memory, all arithmetic is done in FP32
+
+struct LBM_Options { // velocity set, collision operator, DDF format and extensions, the OpenCL C code is compiled for them at runtime; the defaults are the macros in defines.hpp
+	uint velocity_set = 19u; // 9 (D2Q9), 15 (D3Q15), 19 (D3Q19) or 27 (D3Q27)
+	Collision collision = COLLISION_SRT;
+	DDF_Format ddf_format = DDF_FP32;
+	bool volume_force=false, force_field=false, moving_boundaries=false, equilibrium_boundaries=false, surface=false, temperature=false, subgrid=false, update_fields=false; // extensions, see defines.hpp
+	bool specialized_indexing = true; // neighbor indices without modulo, with bit masks if Nx and Ny are powers of 2 and with branchless wrap otherwise; false selects the generic modulo path
+	uint ddf_buffers = 0u; // number of device buffers the DDFs are split into by direction, so that the maximum buffer size of the device does not limit the lattice; 0 uses the fewest buffers that fit; only on a single OpenCL device
+	LBM_Options() {
+#if defined(D2Q9)
+		velocity_set = 9u;
+#elif defined(D3Q15)
+		velocity_set = 15u;
+#elif defined(D3Q27)
+		velocity_set = 27u;
+#endif // D3Q27
+#if defined(TRT)
+		collision = COLLISION_TRT;
+#elif defined(RLB)
+		collision = COLLISION_RLB;
+#endif // RLB
+#if defined(FP16S)
+		ddf_format = DDF_FP16S;
+#elif defined(FP16C)
+		ddf_format = DDF_FP16C;
+#endif // FP16C
+#ifdef VOLUME_FORCE
+		volume_force = true;
+#endif // VOLUME_FORCE
+#ifdef FORCE_FIELD
+		force_field = true;
+#endif // FORCE_FIELD
+#ifdef MOVING_BOUNDARIES
+		moving_boundaries = true;
+#endif // MOVING_BOUNDARIES
+#ifdef EQUILIBRIUM_BOUNDARIES
+		equilibrium_boundaries = true;
+#endif // EQUILIBRIUM_BOUNDARIES
+#ifdef SURFACE
+		surface = true;
+#endif // SURFACE
+#ifdef TEMPERATURE
+		temperature = true;
+#endif // TEMPERATURE
+#ifdef SUBGRID
+		subgrid = true;
+#endif // SUBGRID
+#ifdef UPDATE_FIELDS
+		update_fields = true;
+#endif // UPDATE_FIELDS
+	}
+	uint dimensions() const { return velocity_set==9u ? 2u : 3u; }
+	uint ddf_bytes() const { return ddf_format==DDF_FP32 ? 4u : 2u; } // size of one DDF in memory
+	uint ddf_per_buffer(const uint buffers) const { return (velocity_set+buffers-1u)/buffers; } // directions in each DDF buffer, the last one may hold fewer
+	uint largest_buffer_bytes(const uint buffers) const { return max(max(ddf_per_buffer(buffers)*ddf_bytes(), 12u), temperature ? 7u*ddf_bytes() : 0u); } // largest device buffer per lattice point in Byte: fi, u/F or gi
+	bool neighbor_flags() const { return moving_boundaries||surface||temperature; } // stream_collide loads the flags of all neighbors
+	string name() const { return "D"+to_string(dimensions())+"Q"+to_string(velocity_set)+" "+(collision==COLLISION_TRT ? "TRT" : collision==COLLISION_RLB ? "RLB" : "SRT")+(ddf_format==DDF_FP16S ? " (FP32/FP16S)" : ddf_format==DDF_FP16C ? " (FP32/FP16C)" : " (FP32/FP32)"); }
+	LBM_Options& with_implied() { // extensions that other extensions depend on, same as at the end of defines.hpp
+		volume_force = volume_force||force_field||temperature;
+		update_fields = update_fields||surface; // (rho, u) need to be updated exactly every LBM step
+		return *this;
+	}
+};
+
+#ifdef CPU_NATIVE
+struct Native_Step; // arguments of the native CPU kernels, implemented in lbm_cpu.cpp
+#endif // CPU_NATIVE
 
 class LBM {
 private:
@@ -10,52 +82,117 @@ private:
 	Kernel kernel_initialize; // initialization kernel
 	Kernel kernel_stream_collide; // main LBM kernel
 	Kernel kernel_update_fields; // reads DDFs and updates (rho, u, T) in device memory
-	Memory<fpxx> fi; // LBM density distribution functions (DDFs); only exist in device memory
+	LBM_Options options; // velocity set, collision operator, DDF format and extensions the kernels are compiled for
+	uint velocity_set=19u, dimensions=3u; // from options
+	Memory<uchar> fi; // LBM density distribution functions (DDFs) in the format of options.ddf_format; only exist in device memory
+	uint ddf_buffers=1u, ddf_per_buffer=19u; // the DDFs are split by direction into ddf_buffers buffers of ddf_per_buffer directions each, fi holds the first ones
+	Memory<uchar>* fi_split = nullptr; // DDF buffers after fi, only if ddf_buffers>1
 	ulong t_last_update_fields = 0ull; // optimization to not call kernel_update_fields multiple times if (rho, u, T) are already up-to-date
 	bool schedule_graphics_reallocation = false; // Schedule a graphics reallocation for screen resizing
+	uint sync_interval = 1u; // number of time steps that are enqueued back-to-back before the host waits for the device
 
-#if defined(D2Q9)
-	const uint velocity_set = 9u;
-	const uint dimensions = 2u;
-#elif defined(D3Q15)
-	const uint velocity_set = 15u;
-	const uint dimensions = 3u;
-#elif defined(D3Q19)
-	const uint velocity_set = 19u;
-	const uint dimensions = 3u;
-#elif defined(D3Q27)
-	const uint velocity_set = 27u;
-	const uint dimensions = 3u;
-#endif // D3Q27
-
-#ifdef FORCE_FIELD
-	Kernel kernel_calculate_force_on_boundaries; // calculate forces from fluid on TYPE_S nodes
-#endif // FORCE_FIELD
+	Kernel kernel_calculate_force_on_boundaries; // calculate forces from fluid on TYPE_S nodes, only with options.force_field
 
-#ifdef MOVING_BOUNDARIES
-	Kernel kernel_update_moving_boundaries; // mark/unmark nodes next to TYPE_S nodes with velocity!=0 with TYPE_MS
-#endif // MOVING_BOUNDARIES
+	Kernel kernel_update_moving_boundaries; // mark/unmark nodes next to TYPE_S nodes with velocity!=0 with TYPE_MS, only with options.moving_boundaries
 
-#ifdef SURFACE
-	Kernel kernel_surface_0; // additional kernel for computing mass conservation and mass flux computation
+	Kernel kernel_surface_0; // additional kernel for computing mass conservation and mass flux computation, the surface kernels and buffers only exist with options.surface
 	Kernel kernel_surface_1; // additional kernel for flag handling
 	Kernel kernel_surface_2; // additional kernel for flag handling
 	Kernel kernel_surface_3; // additional kernel for flag handling and mass conservation
 	Memory<float> mass; // fluid mass; phi=mass/rho
 	Memory<float> massex; // excess mass; used for mass conservation
-#endif // SURFACE
 
-#ifdef TEMPERATURE
-	Memory<fpxx> gi; // thermal DDFs
-#endif // TEMPERATURE
+	Memory<uchar> gi; // thermal DDFs in the format of options.ddf_format, only with options.temperature
+
+#ifdef SPARSE_BRICKS
+	uint brick_x=16u, brick_y=4u, brick_z=4u; // nodes per brick, consecutive along x for coalesced memory access, 16x16x1 for D2Q9
+	Kernel kernel_update_bricks; // list bricks that contain at least one node which is not solid or gas
+	Memory<uint> bricks; // indices of active bricks, only exists in device memory
+	Memory<uint> active_bricks; // number of active bricks
+	ulong get_bricks() const { return (ulong)((Nx+brick_x-1u)/brick_x)*(ulong)((Ny+brick_y-1u)/brick_y)*(ulong)((Nz+brick_z-1u)/brick_z); } // number of all bricks
+	bool bricks_pending = false; // number of active bricks is being read back
+	void update_bricks(const bool wait=false); // rebuild the list of active bricks after flags have changed, the launch range is narrowed right away with wait=true, otherwise by narrow_bricks() after the next sync
+	void narrow_bricks(); // launch kernel_stream_collide and kernel_update_fields only over the active bricks, once their number has been read back
+#endif // SPARSE_BRICKS
+
+#ifdef CPU_NATIVE
+	Thread_Pool thread_pool; // threads of the native CPU kernels, each thread processes one slab of consecutive x-rows
+	Native_Step native_step(); // pointers to host buffers and parameters for the native CPU kernels
+	void native_initialize(); // native CPU implementation of kernel_initialize
+	void native_stream_collide(); // native CPU implementation of kernel_stream_collide, blocks until the time step is done
+	void native_update_fields(); // native CPU implementation of kernel_update_fields
+	void native_calculate_force_on_boundaries(); // native CPU implementation of kernel_calculate_force_on_boundaries
+	void native_gather_moments(const Memory<ulong>& nodes, Memory<float>& moments); // native CPU implementation of kernel gather_moments
+	void native_scatter_moments(const Memory<ulong>& nodes, const Memory<float>& moments, const float scale); // native CPU implementation of kernel scatter_moments
+#endif // CPU_NATIVE
+
+	struct Domain { // slab of lattice layers [z0, z0+Nz) on its own device, with one halo layer below and above
+		Device device; // OpenCL device of this domain, compiled with the local lattice size Nx*Ny*(Nz+2)
+		uint z0=0u, Nz=0u; // first layer and number of layers of the slab in the whole lattice
+		Kernel kernel_initialize, kernel_stream_collide, kernel_update_fields; // same kernels as on a single device
+		Memory<uchar> fi; // DDFs of the slab and both halo layers
+		Memory<float> rho, u; // fields of the slab and both halo layers, the host buffers of LBM::rho/u are split across all domains
+		Memory<uchar> flags;
+		Kernel kernel_calculate_force_on_boundaries; // only with options.force_field
+		Memory<float> F;
+		Memory<uchar> transfer; // host-only, DDFs leaving the slab: lower half to the domain below, upper half to the domain above
+		cl::Event event_boundary; // both boundary layers of the current time step are done, so the exchange can start while the interior is streamed
+	};
+	Domain* domains = nullptr; // only used if the lattice is split across several devices or ranks
+	uint Dz = 1u; // number of domains along z on this rank
+	uint rank=0u, ranks=1u; // this process and number of processes, each rank owns Dz consecutive domains
+	Memory<uchar> received_below, received_above; // host-only, DDFs entering the outermost domains from the neighbor ranks
+	void domains_exchange(const ulong t); // exchange DDFs that were streamed into the halo layers with the neighbor domains after time step t
+	ulong rank_begin(const uint r) const { return (ulong)Nx*(ulong)Ny*((ulong)Nz*(ulong)(r*Dz)/((ulong)ranks*(ulong)Dz)); } // first node of the slabs of rank r, rank_begin(ranks) is N
+	template<typename U> bool gather(Memory<U>& field); // collect the slabs of all ranks in the host buffer of rank 0, returns true on rank 0
+
+	struct Refinement { // finer level in the box of nodes [x0, x1] x [y0, y1] x [z0, z1] of this level, with half the lattice spacing and two time steps per time step of this level
+		LBM* lbm = nullptr; // finer level, its node (xf, yf, zf) is at position (x0+xf/2, y0+yf/2, z0+zf/2) of this level
+		uint x0=0u, y0=0u, z0=0u, x1=0u, y1=0u, z1=0u;
+		Memory<ulong> coarse_nodes; // fluid nodes on the box surface, their moments are interpolated to the ghost layer of the finer level
+		Memory<float> coarse_moments; // (rho, u, Pi_neq) of coarse_nodes in the current time step
+		Memory<float> coarse_moments_last; // same in the previous time step, for interpolation in time
+		Memory<ulong> ghost_nodes; // fluid nodes in the outermost layer of the finer level, their outgoing DDFs are rebuilt from the coarse moments before each fine time step
+		Memory<float> ghost_moments; // interpolated (rho, u, Pi_neq) of ghost_nodes
+		Memory<uint> ghost_sources; // 8 entries of coarse_nodes per ghost node for interpolation in space
+		Memory<float> ghost_weights; // interpolation weights of ghost_sources, 0 for unused entries
+		Memory<ulong> fine_nodes; // nodes of the finer level at the positions of restricted_nodes
+		Memory<float> fine_moments; // (rho, u, Pi_neq) of fine_nodes, both levels share the device, so they are scattered to restricted_nodes in place
+		Memory<ulong> restricted_nodes; // fluid nodes one layer inside the box surface, their outgoing DDFs are rebuilt from the fine moments before each time step
+		Kernel kernel_gather_coarse, kernel_scatter_restricted; // on the device of this level
+		Kernel kernel_gather_fine, kernel_scatter_ghost, kernel_interpolate_ghosts; // on the device of the finer level
+	};
+	vector<Refinement*> refinements; // finer levels, each of them may be refined further
+	uint level = 0u; // refinement level, the lattice spacing and time step are 1/2^level of level 0
+	float3 level_center = float3(0.0f); // center of the box of this level in lattice units of level 0, relative to the center of level 0, for rendering and .vtk export
+	LBM(const LBM* parent, const LBM_Options& options, const uint Nx, const uint Ny, const uint Nz, const float nu, const float fx=0.0f, const float fy=0.0f, const float fz=0.0f, const float sigma=0.0f, const float alpha=0.0f, const float beta=0.0f); // finer level on the device of parent, or a new level 0 on the selected devices if parent is nullptr
+	void initialize_refinements(); // mark interface nodes, fill the finer levels with the interpolated fields of this level and list the coupled nodes
+	void restrict_refinement(Refinement& r); // copy the state of the finer level to the nodes of this level next to the box surface
+	void interpolate_ghosts(Refinement& r, const float a); // rebuild the DDFs of the ghost nodes of the finer level from the moments of this level
+	void keep_coarse_moments(Refinement& r); // the coarse moments of the current time step become those of the previous time step
+	void couple_refinements(); // after a time step of this level, advance every finer level by two time steps and exchange moments at the interfaces
+	void gather_moments(Kernel& kernel, const Memory<ulong>& nodes, Memory<float>& moments); // (rho, u, Pi_neq) of the listed nodes in the current time step
+	void scatter_moments(Kernel& kernel, const Memory<ulong>& nodes, Memory<float>& moments, const float ratio); // rebuild the DDFs the listed nodes stream into the next time step from (rho, u, Pi_neq), Pi_neq is rescaled with ratio = tau/tau_other
 
 	bool initialized = false;
-	void sanity_checks_constructor(); // sanity checks during constructor call on grid resolution and parameters
+	void sanity_checks_constructor(); // sanity checks during constructor call on grid resolution, parameters and options
 	void sanity_checks_initialization(); // sanity checks during initialization on used extensions based on used flags
 	void allocate(Device& device); // allocate all memory for data fields on host and device and set up kernels
+	void allocate_domains(); // allocate host buffers of data fields and the buffers and kernels of every domain
 	void initialize(); // write all data fields to device and call kernel_initialize
-	void do_time_step(); // call kernel_stream_collide to perform one LBM time step
-	string device_defines() const; // returns preprocessor constants for embedding in OpenCL C code
+	struct Saved_Field { // device-side copy of a field buffer that has no host buffer, while autotune_kernels() measures
+		Device* device = nullptr; // device of field and copy
+		Memory<float>* field = nullptr;
+		Memory<float> copy;
+	};
+	vector<Saved_Field*> saved_fields;
+	vector<Memory<float>*> downloaded_fields; // fields that got a temporary host buffer instead, as their copy didn't fit into device memory
+	void save_device_fields(); // copy fields that have no host buffer before measuring advances them, initialize() only uploads the others again
+	void restore_device_fields(); // copy them back and free the copies
+	bool autotune_kernels(const bool measure=true); // set fastest workgroup size for each time step kernel, returns true if kernels were run and fields have to be initialized again; with measure=false only checks if any kernel would be run
+	void voxelize_mesh_on_device(const Mesh* mesh, const uchar flag); // voxelize mesh on this level only
+	void do_time_step(); // enqueue kernel_stream_collide to perform one LBM time step, does not wait for the device
+	string device_defines(const Domain* domain=nullptr) const; // returns preprocessor constants for embedding in OpenCL C code, with the local lattice size of a domain
 
 public:
 	uint Nx=1u, Ny=1u, Nz=1u; // lattice dimensions
@@ -69,30 +206,29 @@ public:
 	Memory<float> u; // velocity of every node
 	Memory<uchar> flags; // flags of every node
 
-#ifdef FORCE_FIELD
-	Memory<float> F; // individual force for every node
-#endif // FORCE_FIELD
+	static uint device_bytes_per_node(const LBM_Options& options=LBM_Options()); // device memory per lattice point in Byte for the velocity set, DDF format and extensions of options
+	static uint host_bytes_per_node(const LBM_Options& options=LBM_Options()); // host memory per lattice point in Byte for the extensions of options if all host buffers are allocated
+	static uint3 resolution(const float3& box_aspect_ratio, const ulong memory, const ulong max_buffer=max_ulong, const LBM_Options& options=LBM_Options()); // largest grid resolution with given aspect ratio whose buffers fit into memory and whose largest buffer fits into max_buffer (both in Byte), the DDFs may be split into options.ddf_buffers buffers, the result may be used directly in the constructor
+	static uint3 resolution(const float3& box_aspect_ratio, const Device_Info& device_info, const uint reserved=512u, const LBM_Options& options=LBM_Options()); // largest grid resolution that fits into device memory, reserved MB are kept free for graphics and the OpenCL runtime
 
-#ifdef SURFACE
-	Memory<float> phi; // fill level of every node
-#endif // SURFACE
-
-#ifdef TEMPERATURE
-	Memory<float> T; // temperature of every node
-#endif // TEMPERATURE
+	Memory<float> F; // individual force for every node, only with options.force_field
+	Memory<float> phi; // fill level of every node, only with options.surface
+	Memory<float> T; // temperature of every node, only with options.temperature
 
-	LBM(const uint Nx, const uint Ny, const uint Nz, const float nu, const float fx=0.0f, const float fy=0.0f, const float fz=0.0f, const float sigma=0.0f, const float alpha=0.0f, const float beta=0.0f);
+	LBM(const uint Nx, const uint Ny, const uint Nz, const float nu, const float fx=0.0f, const float fy=0.0f, const float fz=0.0f, const float sigma=0.0f, const float alpha=0.0f, const float beta=0.0f); // with the options of defines.hpp
+	LBM(const LBM_Options& options, const uint Nx, const uint Ny, const uint Nz, const float nu, const float fx=0.0f, const float fy=0.0f, const float fz=0.0f, const float sigma=0.0f, const float alpha=0.0f, const float beta=0.0f); // with options chosen at runtime
 	~LBM();
 
 	void set_fx(const float fx) { this->fx = fx; } // set global froce per volume
 	void set_fy(const float fy) { this->fy = fy; } // set global froce per volume
 	void set_fz(const float fz) { this->fz = fz; } // set global froce per volume
 	void set_f(const float fx, const float fy, const float fz) { this->fx = fx; this->fy = fy; this->fz = fz; } // set global froce per volume
+	void set_sync_interval(const uint sync_interval) { this->sync_interval = max(sync_interval, 1u); } // host waits for device (and updates info, checks for pause) only every sync_interval time steps
 
 	uint get_Nx() const { return Nx; }
 	uint get_Ny() const { return Ny; }
 	uint get_Nz() const { return Nz; }
-	uint get_N() const { return Nx*Ny*Nz; }
+	ulong get_N() const { return (ulong)Nx*(ulong)Ny*(ulong)Nz; } // 64-bit, the lattice may have more than 2^32 points
 	float get_nu() const { return nu; }
 	float get_tau() const { return 3.0f*nu+0.5f; }
 	float get_fx() const { return fx; }
@@ -104,20 +240,34 @@ public:
 	float get_beta() const { return beta; }
 	ulong get_t() const { return t; }
 	uint get_velocity_set() const { return velocity_set; }
+	uint get_ddf_buffers() const { return ddf_buffers; } // number of device buffers the DDFs are split into
+	ulong get_largest_buffer() const { return get_N()*(ulong)options.largest_buffer_bytes(ddf_buffers); } // largest device buffer in Byte
+	const LBM_Options& get_options() const { return options; }
+	uint get_sync_interval() const { return sync_interval; }
+	ulong get_host_memory_used() const { return device.info.host_memory_used; } // host memory of all currently allocated host buffers in Byte
+	uint get_Dz() const { return Dz; } // number of devices the lattice is split across along z on this rank
+	uint get_rank() const { return rank; }
+	uint get_ranks() const { return ranks; } // number of processes the lattice is split across along z
+	vector<Kernel_Profile> get_kernel_profiles() const { const Device& d = domains ? domains[0].device : device; return d.profiler ? d.profiler->get_profiles() : vector<Kernel_Profile>(); } // per-kernel device time of the first device, requires PROFILING
+	uint get_level() const { return level; } // refinement level, 0 for the coarsest
+	float get_spacing() const { return 1.0f/(float)(1u<<level); } // lattice spacing in lattice units of level 0
+	uint get_refinements() const { return (uint)refinements.size(); } // number of finer levels directly nested in this one
+	LBM& get_refinement(const uint i) { return *refinements[i]->lbm; }
+	ulong get_N_updated() const { ulong N_updated = get_N(); for(const Refinement* refinement : refinements) N_updated += 2ull*refinement->lbm->get_N_updated(); return N_updated; } // node updates per time step, including all finer levels
 	float get_Re_max() const { return 0.57735027f*(float)min(min(Nx, Ny), Nz)/nu; } // Re < c*L/nu
-	void coordinates(const uint n, uint& x, uint& y, uint& z) const { // disassemble 1D linear index to 3D coordinates (n -> x,y,z)
-		const uint t = n%(Nx*Ny); // n = x+(y+z*Ny)*Nx
+	void coordinates(const ulong n, uint& x, uint& y, uint& z) const { // disassemble 1D linear index to 3D coordinates (n -> x,y,z)
+		const uint t = (uint)(n%((ulong)Nx*(ulong)Ny)); // n = x+(y+z*Ny)*Nx
 		x = t%Nx;
 		y = t/Nx;
-		z = n/(Nx*Ny);
+		z = (uint)(n/((ulong)Nx*(ulong)Ny));
 	}
-	uint index(const uint x, const uint y, const uint z) const { // turn 3D coordinates into 1D linear index
-		return x+(y+z*Ny)*Nx;
+	ulong index(const uint x, const uint y, const uint z) const { // turn 3D coordinates into 1D linear index
+		return (ulong)x+((ulong)y+(ulong)z*(ulong)Ny)*(ulong)Nx;
 	}
 	float3 position(const uint x, const uint y, const uint z) const { // returns position in box [-Nx/2, Nx/2] x [-Ny/2, Ny/2] x [-Nz/2, Nz/2]
 		return float3((float)x-0.5f*(float)Nx+0.5f, (float)y-0.5f*(float)Ny+0.5f, (float)z-0.5f*(float)Nz+0.5f);
 	}
-	float3 position(const uint n) const { // returns position in box [-Nx/2, Nx/2] x [-Ny/2, Ny/2] x [-Nz/2, Nz/2]
+	float3 position(const ulong n) const { // returns position in box [-Nx/2, Nx/2] x [-Ny/2, Ny/2] x [-Nz/2, Nz/2]
 		uint x, y, z;
 		coordinates(n, x, y, z);
 		return position(x, y, z);
@@ -137,29 +287,27 @@ public:
 	float3 relative_position(const uint x, const uint y, const uint z) const { // returns relative position in box [-0.5, 0.5] x [-0.5, 0.5] x [-0.5, 0.5]
 		return float3(((float)x+0.5f)/(float)Nx-0.5f, ((float)y+0.5f)/(float)Ny-0.5f, ((float)z+0.5f)/(float)Nz-0.5f);
 	}
-	float3 relative_position(const uint n) const { // returns relative position in box [-0.5, 0.5] x [-0.5, 0.5] x [-0.5, 0.5]
+	float3 relative_position(const ulong n) const { // returns relative position in box [-0.5, 0.5] x [-0.5, 0.5] x [-0.5, 0.5]
 		uint x, y, z;
 		coordinates(n, x, y, z);
 		return relative_position(x, y, z);
 	}
 
+	LBM& refine(const uint x0, const uint y0, const uint z0, const uint x1, const uint y1, const uint z1); // add a finer level with half the lattice spacing in the box of nodes [x0, x1] x [y0, y1] x [z0, z1], before voxelize_stl() and run(); returns the finer level, which can be refined further
 	void run(const ulong steps=max_ulong); // initializes the LBM simulation (copies data to device and runs initialize kernel), then runs LBM
 	void update_fields(); // update fields (rho, u, T) manually
-	void reset(); // reset simulation (takes effect in following run() call)
+	void reset(); // reset simulation (takes effect in following run() call), starts from the host buffers and, for fields without host buffer, from the current device fields
+	void delete_host_buffers(); // free host memory of all fields after geometry setup, fields are downloaded again on next host access or export; reset() then starts from the current device fields
 
 	string default_filename(const string& path, const string& name, const string& extension); // generate a default filename with timestamp
 	string default_filename(const string& name, const string& extension); // generate a default filename with timestamp at exe_path/export/
 
-#ifdef FORCE_FIELD
-	void calculate_force_on_boundaries(); // calculate forces from fluid on TYPE_S nodes
+	void calculate_force_on_boundaries(); // calculate forces from fluid on TYPE_S nodes, requires options.force_field
 	float3 calculate_force_on_object(const uchar flag_marker=TYPE_S); // add up force for all nodes flagged with flag_marker
 	float3 calculate_torque_on_object(const uchar flag_marker=TYPE_S); // add up torque around center of mass for all nodes flagged with flag_marker
 	float3 calculate_torque_on_object(const float3& rotation_center, const uchar flag_marker=TYPE_S); // add up torque around specified rotation_center for all nodes flagged with flag_marker
-#endif // FORCE_FIELD
 
-#ifdef MOVING_BOUNDARIES
-	void update_moving_boundaries(); // mark/unmark nodes next to TYPE_S nodes with velocity!=0 with TYPE_MS
-#endif // MOVING_BOUNDARIES
+	void update_moving_boundaries(); // mark/unmark nodes next to TYPE_S nodes with velocity!=0 with TYPE_MS, requires options.moving_boundaries
 
 	void write_status(const string& path=""); // write LBM status report to a .txt file
 
@@ -169,18 +317,12 @@ public:
 	void u_write_device_to_vtk(const string& path=""); // write binary .vtk file
 	void flags_write_host_to_vtk(const string& path=""); // write binary .vtk file
 	void flags_write_device_to_vtk(const string& path=""); // write binary .vtk file
-#ifdef FORCE_FIELD
-	void F_write_host_to_vtk(const string& path=""); // write binary .vtk file
-	void F_write_device_to_vtk(const string& path=""); // write binary .vtk file
-#endif // FORCE_FIELD
-#ifdef SURFACE
-	void phi_write_host_to_vtk(const string& path=""); // write binary .vtk file
-	void phi_write_device_to_vtk(const string& path=""); // write binary .vtk file
-#endif // SURFACE
-#ifdef TEMPERATURE
-	void T_write_host_to_vtk(const string& path=""); // write binary .vtk file
-	void T_write_device_to_vtk(const string& path=""); // write binary .vtk file
-#endif // TEMPERATURE
+	void F_write_host_to_vtk(const string& path=""); // write binary .vtk file, requires options.force_field
+	void F_write_device_to_vtk(const string& path=""); // write binary .vtk file, requires options.force_field
+	void phi_write_host_to_vtk(const string& path=""); // write binary .vtk file, requires options.surface
+	void phi_write_device_to_vtk(const string& path=""); // write binary .vtk file, requires options.surface
+	void T_write_host_to_vtk(const string& path=""); // write binary .vtk file, requires options.temperature
+	void T_write_device_to_vtk(const string& path=""); // write binary .vtk file, requires options.temperature
 
 	void voxelize_mesh(const Mesh* mesh, const uchar flag=TYPE_S); // voxelize mesh
 	void voxelize_stl(const string& path, const float3& center, const float3x3& rotation, const float size=-1.0f, const uchar flag=TYPE_S); // read and voxelize binary .stl file
@@ -200,18 +342,25 @@ public:
 		ulong t_last_frame = 0ull; // optimization to not call draw_frame() multiple times if camera_parameters and LBM time step are unchanged
 		std::atomic_int running_encoders = 0;
 
+#ifdef GRAPHICS_SNAPSHOT
+		Memory<uchar> snapshot_flags; // snapshots of the LBM fields on the device, copied in order with the LBM kernels, so rendering never reads fields that later time steps are writing
+		Memory<float> snapshot_u;
+		Memory<float> snapshot_F; // only with options.force_field
+		Memory<float> snapshot_phi; // only with options.surface
+		Memory<float> snapshot_T; // only with options.temperature
+		void snapshot_fields(vector<cl::Event>& scene); // enqueue the copies the selected rendering kernels read, scene gets an event that completes with them
+#endif // GRAPHICS_SNAPSHOT
+
 		Kernel kernel_graphics_flags; // render flag lattice
 		Kernel kernel_graphics_field; // render a colored velocity vector for each node
 		Kernel kernel_graphics_streamline; // render streamlines
 		Kernel kernel_graphics_q; // render vorticity (Q-criterion)
 
-#ifdef SURFACE
 		const string path_skybox = get_exe_path()+"../../skybox/skybox8k.png";
 		Image* skybox_image = nullptr;
-		Memory<uint> skybox; // skybox for free surface raytracing
+		Memory<uint> skybox; // skybox for free surface raytracing, only with options.surface
 		Kernel kernel_graphics_rasterize_phi; // rasterize free surface
 		Kernel kernel_graphics_raytrace_phi; // raytrace free surface
-#endif // SURFACE
 
 		void default_settings(); // set what is viewed at startup
 		bool update_camera(); // update camera_parameters and return if they are changed from their previous state
@@ -231,20 +380,14 @@ public:
 		}
 		Graphics(LBM* lbm) {
 			this->lbm = lbm;
-#ifdef SURFACE
-			skybox_image = read_png(path_skybox);
-#endif // SURFACE
+			if(lbm->options.surface) skybox_image = read_png(path_skybox);
 		}
 		Graphics& operator=(const Graphics& graphics) { // copy assignment
 			lbm = graphics.lbm;
-#ifdef SURFACE
 			skybox_image = graphics.get_skybox_image();
-#endif // SURFACE
 			return *this;
 		}
-#ifdef SURFACE
 		Image* get_skybox_image() const { return skybox_image; }
-#endif // SURFACE
 
 		void allocate(Device& device, bool set_defaults); // allocate memory for bitmap and zbuffer
 		void* draw_frame(); // main rendering function, calls rendering kernels
@@ -268,4 +411,7 @@ public:
 	void reallocate_graphics();
 	void do_reallocate_graphics();
 #endif // GRAPHICS
-}; // LBM
\ No newline at end of file
+}; // LBM
+
+Device_Info select_lbm_device(); // device the LBM constructor uses: ID from first command line argument, otherwise the device with the best measured performance
+vector<Device_Info> select_lbm_devices(); // devices the LBM constructor splits the lattice across: IDs from all leading numeric command line arguments, a repeated ID is partitioned into sub-devices
\ No newline at end of file
@@ -1,9 +1,12 @@
 #pragma once
 
-#define WORKGROUP_SIZE 64 // needs to be 64 to fully use AMD GPUs
+#define WORKGROUP_SIZE 64 // default workgroup size, kernels that are autotuned may use a different one
 //#define PTX
 //#define LOG
 //#define USE_OPENCL_1_1
+//#define PROFILING // record OpenCL profiling events for every kernel launch, printed as per-kernel table by Info::print_profile()
+//#define NO_PROGRAM_CACHE // always compile OpenCL C code from source instead of reusing binaries from kernel_cache/ next to the executable
+//#define NO_AUTOTUNE // use WORKGROUP_SIZE for all kernels instead of measuring the fastest workgroup size per kernel once per device and caching it in kernel_cache/
 
 #ifdef USE_OPENCL_1_1
 #define CL_USE_DEPRECATED_OPENCL_1_1_APIS
@@ -13,18 +16,23 @@
 #endif // _WIN32
 #include <CL/cl.hpp> // OpenCL 1.0, 1.1, 1.2
 #include "utilities.hpp"
+#include <memory> // for shared_ptr
+#include <mutex>
 
 struct Device_Info {
 	cl::Device cl_device;
 	string name, vendor; // device name, vendor
 	string driver_version, opencl_c_version; // device driver version, OpenCL C version
 	uint memory=0u; // global memory in MB
-	uint memory_used=0u; // track global memory usage in MB
+	ulong memory_used=0ull; // track global memory usage in Byte
+	ulong host_memory_used=0ull; // track host memory usage of host buffers linked to this device in Byte
 	uint global_cache=0u, local_cache=0u; // global cache in KB, local cache in KB
 	uint max_global_buffer=0u, max_constant_buffer=0u; // maximum global buffer size in MB, maximum constant buffer size in KB
 	uint compute_units=0u; // compute units (CUs) can contain multiple cores depending on the microarchitecture
 	uint clock_frequency=0u; // in MHz
 	bool is_cpu=false, is_gpu=false;
+	bool uses_host_memory=false; // CPUs and integrated GPUs share physical memory with the host
+	bool supports_out_of_order=false; // commands of one queue can execute out of order, then only explicit event dependencies order them
 	uint is_fp64_capable=0u, is_fp32_capable=0u, is_fp16_capable=0u, is_int64_capable=0u, is_int32_capable=0u, is_int16_capable=0u, is_int8_capable=0u;
 	uint cores=0u; // for CPUs, compute_units is the number of threads (twice the number of cores with hyperthreading)
 	float tflops=0.0f; // estimated device FP32 floating point performance in TeraFLOPs/s
@@ -50,6 +58,8 @@ struct Device_Info {
 		is_int8_capable = (uint)cl_device.getInfo<CL_DEVICE_NATIVE_VECTOR_WIDTH_CHAR>();
 		is_cpu = cl_device.getInfo<CL_DEVICE_TYPE>()==CL_DEVICE_TYPE_CPU;
 		is_gpu = cl_device.getInfo<CL_DEVICE_TYPE>()==CL_DEVICE_TYPE_GPU;
+		uses_host_memory = is_cpu||(bool)cl_device.getInfo<CL_DEVICE_HOST_UNIFIED_MEMORY>();
+		supports_out_of_order = (bool)(cl_device.getInfo<CL_DEVICE_QUEUE_PROPERTIES>()&CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE);
 		const uint ipc = is_gpu?2u:32u; // IPC (instructions per cycle) is 2 for GPUs and 32 for most modern CPUs
 		const bool nvidia_192_cores_per_cu = contains_any(to_lower(name), {" 6", " 7", "ro k", "la k"}) || (clock_frequency<1000u&&contains(to_lower(name), "titan")); // identify Kepler GPUs
 		const bool nvidia_64_cores_per_cu = contains_any(to_lower(name), {"p100", "v100", "a100", "a30", " 16", " 20", "titan v", "titan rtx", "ro t", "la t", "ro rtx"}) && !contains(to_lower(name), "rtx a"); // identify P100, Volta, Turing, A100, A30
@@ -111,6 +121,31 @@ inline Device_Info select_device_with_most_flops(const vector<Device_Info>& devi
 	if(print_info) print_device_info(devices[best_i], best_i);
 	return devices[best_i];
 }
+struct Device_Benchmark { // result of a short LBM probe on a device
+	float mlups=0.0f; // D3Q19 FP32 stream-collide performance in MLUPs/s
+	float bandwidth=0.0f; // copy bandwidth in GB/s
+};
+Device_Benchmark benchmark_device(const Device_Info& device_info); // implemented in opencl.cpp, result is cached on disk per device and driver, mlups is 0 if the probe fails
+inline Device_Info select_device_with_most_mlups(const vector<Device_Info>& devices=get_devices(), const bool print_info=true) { // returns device with best measured LBM performance, LBM is bandwidth-bound so this is more reliable than estimated FLOPs
+	if((uint)devices.size()==1u) return select_device_with_most_flops(devices, print_info); // nothing to choose from, no need to benchmark
+	float best_value = 0.0f;
+	uint best_i = 0u;
+	vector<Device_Benchmark> benchmarks;
+	for(uint i=0u; i<(uint)devices.size(); i++) benchmarks.push_back(benchmark_device(devices[i])); // probes print their own info, so run them before the table
+	if(print_info) println("\r|----------------.------------------------------------------------------------|");
+	for(uint i=0u; i<(uint)devices.size(); i++) { // find device with highest measured performance
+		const Device_Benchmark& benchmark = benchmarks[i];
+		if(print_info) println("| Device ID "+alignr(4u, i)+" | "+alignl(58u, to_string(to_uint(benchmark.mlups))+" MLUPs/s, "+to_string(to_uint(benchmark.bandwidth))+" GB/s")+" |");
+		if(benchmark.mlups>best_value) {
+			best_value = benchmark.mlups;
+			best_i = i;
+		}
+	}
+	if(print_info) println("|----------------'------------------------------------------------------------|");
+	if(best_value==0.0f) return select_device_with_most_flops(devices, print_info); // no probe succeeded
+	if(print_info) print_device_info(devices[best_i], best_i);
+	return devices[best_i];
+}
 inline Device_Info select_device_with_most_memory(const vector<Device_Info>& devices=get_devices(), const bool print_info=true) { // returns device with largest memory capacity
 	uint best_value = 0u;
 	uint best_i = 0u;
@@ -132,12 +167,115 @@ inline Device_Info select_device_with_id(const uint id, const vector<Device_Info
 		return devices[0]; // is never executed, just to avoid compiler warnings
 	}
 }
+inline vector<Device_Info> get_sub_devices(const Device_Info& device_info, const uint count) { // partitions device into count sub-devices with equal numbers of compute units, or returns device count times if it can't be partitioned
+	vector<Device_Info> sub_devices;
+#ifndef USE_OPENCL_1_1
+	cl_uint max_sub_devices = 0u;
+	clGetDeviceInfo(device_info.cl_device(), CL_DEVICE_PARTITION_MAX_SUB_DEVICES, sizeof(cl_uint), &max_sub_devices, nullptr);
+	if(count>1u&&(uint)max_sub_devices>=count&&device_info.compute_units>=count) {
+		const cl_device_partition_property properties[] = { CL_DEVICE_PARTITION_EQUALLY, (cl_device_partition_property)(device_info.compute_units/count), 0 };
+		cl::Device cl_device = device_info.cl_device;
+		vector<cl::Device> cl_sub_devices;
+		if(cl_device.createSubDevices(properties, &cl_sub_devices)==CL_SUCCESS&&(uint)cl_sub_devices.size()>=count) {
+			for(uint i=0u; i<count; i++) sub_devices.push_back(Device_Info(cl_sub_devices[i])); // surplus compute units are left unused
+			return sub_devices;
+		}
+	}
+#endif // USE_OPENCL_1_1
+	if(count>1u) print_warning("Device \""+device_info.name+"\" can't be partitioned into "+to_string(count)+" sub-devices, so it is used "+to_string(count)+" times.");
+	for(uint i=0u; i<count; i++) sub_devices.push_back(device_info);
+	return sub_devices;
+}
+
+struct Kernel_Profile { // accumulated device execution time of all launches of one kernel
+	string name;
+	ulong launches = 0ull; // number of evaluated launches
+	double time = 0.0; // total device execution time in s
+	ulong transfer = 0ull; // memory transfer per launch in Byte, 0 if unknown
+};
+class Profiler { // collects OpenCL profiling events of kernel launches, shared by all kernels of one Device
+private:
+	std::mutex mutex; // kernels are enqueued from both the simulation and the rendering thread
+	vector<Kernel_Profile> profiles;
+	vector<std::pair<uint, cl::Event>> pending; // (kernel ID, event) of launches which have not been evaluated yet
+	inline void evaluate_completed() { // mutex has to be locked already
+		ulong j = 0ull;
+		for(ulong i=0ull; i<(ulong)pending.size(); i++) {
+			cl_int status = CL_QUEUED;
+			pending[i].second.getInfo(CL_EVENT_COMMAND_EXECUTION_STATUS, &status);
+			if(status==CL_COMPLETE) {
+				cl_ulong start=0ull, end=0ull;
+				pending[i].second.getProfilingInfo(CL_PROFILING_COMMAND_START, &start);
+				pending[i].second.getProfilingInfo(CL_PROFILING_COMMAND_END, &end);
+				profiles[pending[i].first].launches++;
+				profiles[pending[i].first].time += 1E-9*(double)(end-start);
+			} else if(status<0) { // launch failed, drop event
+			} else {
+				pending[j++] = pending[i];
+			}
+		}
+		pending.resize(j);
+	}
+public:
+	inline uint add_kernel(const string& name) { // returns ID of the kernel, kernels with the same name share one entry
+		std::lock_guard<std::mutex> lock(mutex);
+		for(uint i=0u; i<(uint)profiles.size(); i++) if(profiles[i].name==name) return i;
+		profiles.push_back(Kernel_Profile());
+		profiles.back().name = name;
+		return (uint)profiles.size()-1u;
+	}
+	inline void set_transfer(const uint id, const ulong transfer) {
+		std::lock_guard<std::mutex> lock(mutex);
+		profiles[id].transfer = transfer;
+	}
+	inline void record(const uint id, const cl::Event& event) {
+		std::lock_guard<std::mutex> lock(mutex);
+		pending.push_back(std::make_pair(id, event));
+		if(pending.size()%256u==0u) evaluate_completed(); // don't let the list of pending events grow indefinitely if the queue is never finished
+	}
+	inline vector<Kernel_Profile> get_profiles() { // evaluates all completed launches and returns profiles of all kernels that have been launched at least once
+		std::lock_guard<std::mutex> lock(mutex);
+		evaluate_completed();
+		vector<Kernel_Profile> r;
+		for(uint i=0u; i<(uint)profiles.size(); i++) if(profiles[i].launches>0ull) r.push_back(profiles[i]);
+		return r;
+	}
+	inline void reset() {
+		std::lock_guard<std::mutex> lock(mutex);
+		pending.clear();
+		for(uint i=0u; i<(uint)profiles.size(); i++) {
+			profiles[i].launches = 0ull;
+			profiles[i].time = 0.0;
+		}
+	}
+};
+
+enum Queue_Type { // every Device has one command queue for each type, commands in different queues can execute concurrently
+	QUEUE_COMPUTE = 0, // LBM kernels and everything else by default
+	QUEUE_TRANSFER = 1, // host<->device transfers of data fields, ordered against QUEUE_COMPUTE with events
+	QUEUE_GRAPHICS = 2 // rendering kernels and bitmap readback, out-of-order if the device supports it, so commands have to pass their dependencies as events
+};
+
+inline const vector<cl::Event>* event_waitlist_or_null(const vector<cl::Event>* event_waitlist) { // OpenCL rejects empty wait lists
+	return event_waitlist!=nullptr&&!event_waitlist->empty() ? event_waitlist : nullptr;
+}
+
+// Program binary cache, implemented in opencl.cpp
+std::string program_cache_key(Device_Info const& info, std::string const& kernel_code, std::string const& build_options);
+std::string program_cache_path(std::string const& key);
+bool save_program_binary_to_disk(std::string const& path, std::string const& key, std::string const& binary);
+bool load_program_binary_from_disk(std::string const& path, std::string const& key, std::string& binary);
+bool save_workgroup_size_to_disk(std::string const& key, uint workgroup_size);
+bool load_workgroup_size_from_disk(std::string const& key, uint& workgroup_size);
 
 class Device {
 private:
+	string program_key; // key of the program in kernel_cache/, also used for cached workgroup sizes
 	cl::Context cl_context;
 	cl::Program cl_program;
-	cl::CommandQueue cl_queue;
+	cl::CommandQueue cl_queue; // compute queue
+	cl::CommandQueue cl_queue_transfer; // host<->device transfer queue
+	cl::CommandQueue cl_queue_graphics; // rendering queue
 	bool exists = false;
 	inline string enable_device_capabilities() const { return // enable FP64/FP16 capabilities if available
 		"\n	#define def_workgroup_size "+to_string(WORKGROUP_SIZE)+"u"
@@ -151,35 +289,130 @@ private:
 		"\n	#pragma OPENCL EXTENSION cl_khr_int64_base_atomics : enable" // make sure cl_khr_int64_base_atomics extension is enabled
 		"\n	#endif"
 	;}
-public:
-	Device_Info info;
-	inline Device(const Device_Info& info, const string& opencl_c_code=get_opencl_c_code()) {
-		this->info = info;
-		cl_context = cl::Context(info.cl_device);
-		cl_queue = cl::CommandQueue(cl_context, info.cl_device); // queue to push commands for the device
+	inline void build_from_source(const string& kernel_code, const string& build_options) {
 		cl::Program::Sources cl_source;
-		const string kernel_code = enable_device_capabilities()+"\n"+opencl_c_code;
 		cl_source.push_back({ kernel_code.c_str(), kernel_code.length() });
 		cl_program = cl::Program(cl_context, cl_source);
+		int error = cl_program.build(build_options.c_str()); // compile OpenCL C code
 #ifndef LOG
-		int error = cl_program.build("-cl-fast-relaxed-math -w"); // compile OpenCL C code, disable warnings
 		if(error) print_warning(cl_program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(info.cl_device)); // print build log
 #else // LOG, generate logfile for OpenCL code compilation
-		int error = cl_program.build("-cl-fast-relaxed-math"); // compile OpenCL C code
 		const string log = cl_program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(info.cl_device);
 		write_file("bin/kernel.log", log); // save build log
 		if((uint)log.length()>2u) print_warning(log); // print build log
 #endif // LOG
 		if(error) print_error("OpenCL C code compilation failed with error code "+to_string(error)+". Make sure there are no errors in kernel.cpp (\"#define LOG\" might help). If your GPU is old, try uncommenting \"#define USE_OPENCL_1_1\".");
-		else print_info("OpenCL C code successfully compiled.");
+	}
+	inline bool build_from_cache(const string& cache_path, const string& cache_key, const string& build_options) { // returns false if there is no valid cached binary for this exact source, device and driver
+		string binary;
+		if(!load_program_binary_from_disk(cache_path, cache_key, binary)) return false;
+		const cl::Program::Binaries cl_binary = { { (const void*)binary.data(), binary.length() } };
+		vector<cl_int> binary_status;
+		int error = 0;
+		cl_program = cl::Program(cl_context, vector<cl::Device>{ info.cl_device }, cl_binary, &binary_status, &error);
+		if(error||binary_status.empty()||binary_status[0]!=CL_SUCCESS||cl_program.build(build_options.c_str())) {
+			std::remove(cache_path.c_str()); // binary was rejected by the driver, invalidate cache entry
+			print_warning("Cached OpenCL program binary was rejected by the driver and has been removed.");
+			return false;
+		}
+		return true;
+	}
+	inline string get_program_binary() const { // returns compiled binary of cl_program for the single device in cl_context
+		size_t size = 0;
+		if(clGetProgramInfo(cl_program(), CL_PROGRAM_BINARY_SIZES, sizeof(size_t), &size, nullptr)!=CL_SUCCESS||size==0) return "";
+		string binary(size, '\0');
+		char* data = binary.data();
+		if(clGetProgramInfo(cl_program(), CL_PROGRAM_BINARIES, sizeof(char*), &data, nullptr)!=CL_SUCCESS) return "";
+		return binary;
+	}
+	inline void build_program(const string& opencl_c_code) { // build from the program cache or from source
+		const string kernel_code = enable_device_capabilities()+"\n"+opencl_c_code;
+#ifndef LOG
+		const string build_options = "-cl-fast-relaxed-math -w"; // disable warnings
+#else // LOG
+		const string build_options = "-cl-fast-relaxed-math";
+#endif // LOG
+		program_key = program_cache_key(info, kernel_code, build_options);
+#if !defined(LOG)&&!defined(NO_PROGRAM_CACHE)
+		const string& cache_key = program_key;
+		const string cache_path = program_cache_path(cache_key);
+		if(build_from_cache(cache_path, cache_key, build_options)) {
+			print_info("OpenCL C code loaded from program cache (hit).");
+		} else {
+			build_from_source(kernel_code, build_options);
+			const string binary = get_program_binary();
+			if(binary.length()>0u&&save_program_binary_to_disk(cache_path, cache_key, binary)) print_info("OpenCL C code successfully compiled (program cache miss, binary saved).");
+			else print_info("OpenCL C code successfully compiled (program cache miss, binary could not be saved).");
+		}
+#else // LOG || NO_PROGRAM_CACHE
+		build_from_source(kernel_code, build_options);
+		print_info("OpenCL C code successfully compiled.");
+#endif // LOG || NO_PROGRAM_CACHE
 #ifdef PTX // generate assembly (ptx) file for OpenCL code
-		write_file("bin/kernel.ptx", cl_program.getInfo<CL_PROGRAM_BINARIES>()[0]); // save binary (ptx file)
+		write_file("bin/kernel.ptx", get_program_binary()); // save binary (ptx file)
 #endif // PTX
+	}
+public:
+	Device_Info info;
+	std::shared_ptr<Profiler> profiler; // only exists with PROFILING, shared between copies of this Device
+	inline Device(const Device_Info& info, const string& opencl_c_code=get_opencl_c_code()) {
+		this->info = info;
+		cl_context = cl::Context(info.cl_device);
+#ifndef PROFILING
+		const cl_command_queue_properties queue_properties = 0;
+#else // PROFILING
+		const cl_command_queue_properties queue_properties = CL_QUEUE_PROFILING_ENABLE; // record start/end time of every command
+		profiler = std::make_shared<Profiler>();
+#endif // PROFILING
+		cl_queue = cl::CommandQueue(cl_context, info.cl_device, queue_properties); // queues to push commands for the device
+		cl_queue_transfer = cl::CommandQueue(cl_context, info.cl_device, queue_properties);
+		cl_queue_graphics = cl::CommandQueue(cl_context, info.cl_device, queue_properties|(info.supports_out_of_order ? CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE : 0)); // independent rendering commands of one frame can overlap
+		build_program(opencl_c_code);
+		this->exists = true;
+	}
+	inline Device(const Device& device, const string& opencl_c_code) { // another program on the same device, sharing the context and the command queues of device, so buffers can be used by the kernels of both and commands of both are ordered in the same queues
+		this->info = device.info; // memory tracking starts with the memory device has allocated so far
+		this->profiler = device.profiler;
+		cl_context = device.cl_context;
+		cl_queue = device.cl_queue;
+		cl_queue_transfer = device.cl_queue_transfer;
+		cl_queue_graphics = device.cl_queue_graphics;
+		build_program(opencl_c_code);
 		this->exists = true;
 	}
 	inline Device() {} // default constructor
-	inline void finish_queue() {
+	inline const string& get_program_key() const { // identifies source, build options, device and driver of the program
+		return program_key;
+	}
+	inline void finish_queue(const Queue_Type queue=QUEUE_COMPUTE) {
+		get_cl_queue(queue).finish();
+	}
+	inline void finish_queues() {
 		cl_queue.finish();
+		cl_queue_transfer.finish();
+		cl_queue_graphics.finish();
+	}
+	inline void queue_wait_for(const Queue_Type waiting, const Queue_Type signaling) { // commands enqueued in waiting queue from now on only start after all commands enqueued in signaling queue so far have completed, does not block the host
+		if(waiting==signaling) return; // queues are in-order
+		cl::CommandQueue waiting_queue=get_cl_queue(waiting), signaling_queue=get_cl_queue(signaling);
+		vector<cl::Event> events(1);
+#ifndef USE_OPENCL_1_1
+		signaling_queue.enqueueMarkerWithWaitList(nullptr, &events[0]);
+		waiting_queue.enqueueBarrierWithWaitList(&events);
+#else // USE_OPENCL_1_1
+		signaling_queue.enqueueMarker(&events[0]);
+		waiting_queue.enqueueWaitForEvents(events);
+#endif // USE_OPENCL_1_1
+	}
+	inline cl::Event enqueue_marker(const Queue_Type queue, const vector<cl::Event>* event_waitlist=nullptr) { // returned event completes when the events in event_waitlist or, without them, all commands enqueued in queue so far have completed, does not block the host
+		cl::Event event;
+#ifndef USE_OPENCL_1_1
+		get_cl_queue(queue).enqueueMarkerWithWaitList(event_waitlist_or_null(event_waitlist), &event);
+#else // USE_OPENCL_1_1
+		if(event_waitlist_or_null(event_waitlist)) get_cl_queue(queue).enqueueWaitForEvents(*event_waitlist);
+		get_cl_queue(queue).enqueueMarker(&event);
+#endif // USE_OPENCL_1_1
+		return event;
 	}
 	inline cl::Context get_cl_context() const {
 		return cl_context;
@@ -187,84 +420,322 @@ public:
 	inline cl::Program get_cl_program() const {
 		return cl_program;
 	}
-	inline cl::CommandQueue get_cl_queue() const {
-		return cl_queue;
+	inline cl::CommandQueue get_cl_queue(const Queue_Type queue=QUEUE_COMPUTE) const {
+		switch(queue) {
+			case QUEUE_TRANSFER: return cl_queue_transfer;
+			case QUEUE_GRAPHICS: return cl_queue_graphics;
+			default: return cl_queue;
+		}
 	}
 	inline bool is_initialized() const {
 		return exists;
 	}
 };
 
+enum Host_Memory { // allocation mode of the host buffer of a Memory<T>
+	HOST_MEMORY_PAGEABLE = 0, // malloc(), the driver stages every transfer through its own pinned bounce buffer
+	HOST_MEMORY_PINNED = 1, // page-locked memory of a CL_MEM_ALLOC_HOST_PTR buffer that stays mapped, transfers are direct DMA
+	HOST_MEMORY_ZERO_COPY = 2 // device buffer is created with CL_MEM_USE_HOST_PTR on the host buffer, transfers are only map/unmap without copy; used automatically for every device buffer on CPUs and integrated GPUs
+};
+
+template<typename T> class Memory;
+template<typename T> class Host_Pointer { // auxiliary pointer to one vector dimension of the host buffer of a Memory<T>, non-const access marks the host buffer as modified and allocates it if it does not exist yet
+private:
+	Memory<T>* memory = nullptr; // Memory<T> this pointer belongs to
+	uint dimension = 0u;
+public:
+	inline Host_Pointer(Memory<T>* memory, const uint dimension) {
+		this->memory = memory;
+		this->dimension = dimension;
+	}
+	inline T& operator[](const ulong i) { // element access only marks the host buffer as modified until the next transfer
+		return memory->host_access(dimension)[i];
+	}
+	inline const T& operator[](const ulong i) const {
+		return ((const Memory<T>*)memory)->data(dimension)[i];
+	}
+	inline operator T*() { // pointer escapes, so the host buffer counts as modified from now on
+		return memory->data(dimension);
+	}
+	inline operator const T*() const {
+		return ((const Memory<T>*)memory)->data(dimension);
+	}
+};
+
 template<typename T> class Memory {
 private:
 	ulong N = 0ull; // buffer length
 	uint d = 1u; // buffer dimensions
+	ulong allocated = 0ull; // number of allocated elements of host and device buffer, can be larger than N*d after resize()
 	bool host_buffer_exists = false;
 	bool device_buffer_exists = false;
 	bool external_host_buffer = false;
+	Host_Memory host_memory = HOST_MEMORY_PAGEABLE; // allocation mode of host_buffer
 	T* host_buffer = nullptr; // host buffer
 	cl::Buffer device_buffer; // device buffer
+	cl::Buffer pinned_buffer; // only for HOST_MEMORY_PINNED, host_buffer is its persistent mapping
 	Device* device = nullptr; // pointer to linked Device
 	cl::CommandQueue cl_queue; // command queue
-	inline void initialize_auxiliary_pointers() {
-		x = s0 = host_buffer;
-		if(d>0x1u) y = s1 = host_buffer+N;
-		if(d>0x2u) z = s2 = host_buffer+N*0x2ull;
-		if(d>0x3u) w = s3 = host_buffer+N*0x3ull;
-		if(d>0x4u) s4 = host_buffer+N*0x4ull;
-		if(d>0x5u) s5 = host_buffer+N*0x5ull;
-		if(d>0x6u) s6 = host_buffer+N*0x6ull;
-		if(d>0x7u) s7 = host_buffer+N*0x7ull;
-		if(d>0x8u) s8 = host_buffer+N*0x8ull;
-		if(d>0x9u) s9 = host_buffer+N*0x9ull;
-		if(d>0xAu) sA = host_buffer+N*0xAull;
-		if(d>0xBu) sB = host_buffer+N*0xBull;
-		if(d>0xCu) sC = host_buffer+N*0xCull;
-		if(d>0xDu) sD = host_buffer+N*0xDull;
-		if(d>0xEu) sE = host_buffer+N*0xEull;
-		if(d>0xFu) sF = host_buffer+N*0xFull;
+	Queue_Type queue_type = QUEUE_COMPUTE; // queue used for transfers of this buffer
+	bool host_modified = true; // host buffer was accessed non-const since the last full transfer, so it may differ from the device buffer
+	bool host_pointer_escaped = false; // a non-const pointer to the host buffer was handed out, writes through it can't be tracked, so transfers are never skipped until the buffers are reallocated
+	std::shared_ptr<bool> device_modified = std::make_shared<bool>(true); // a kernel was enqueued with this buffer since the last full transfer, shared with every Kernel that links this buffer
+	struct Part { // elements [begin, end) of every vector dimension are stored at [offset, offset+end-begin) in the device buffer of memory
+		Memory<T>* memory = nullptr;
+		ulong begin=0ull, end=0ull, offset=0ull;
+		bool read = true; // false for copies that are only written to the device, like halo layers
+	};
+	vector<Part> parts; // for fields that are split across several devices, this Memory<T> has no device buffer itself and its transfers go to the device buffers of all parts
+	inline bool synchronized() const { // host buffer and device buffer have the same content, so any transfer is redundant
+		bool modified = host_modified||host_pointer_escaped||*device_modified;
+		for(uint p=0u; p<(uint)parts.size(); p++) modified = modified||*parts[p].memory->device_modified;
+		return !modified;
+	}
+	inline void set_synchronized() {
+		host_modified = false;
+		*device_modified = false;
+		for(uint p=0u; p<(uint)parts.size(); p++) *parts[p].memory->device_modified = false;
+	}
+	inline bool device_side_exists() const { // own device buffer or device buffers of parts
+		return device_buffer_exists||!parts.empty();
+	}
+	inline ulong allocated_capacity() const { // allocated size of the buffer in Byte
+		return allocated*sizeof(T);
+	}
+	inline void allocate_host_buffer_on_access() { // host buffer of a device buffer is only allocated once the host side is accessed
+		if(!host_buffer_exists&&device_side_exists()) add_host_buffer();
+	}
+	inline T* host_access() { // non-const element access, marks the host buffer as modified until the next transfer and allocates it if needed
+		if(!host_buffer_exists) allocate_host_buffer_on_access();
+		host_modified = true;
+		return host_buffer;
+	}
+	inline T* host_access(const uint dimension) {
+		return dimension<d ? host_access()+(ulong)dimension*N : nullptr;
+	}
+	friend class Host_Pointer<T>;
+	inline void synchronize_begin() { // a transfer in QUEUE_TRANSFER must not start before kernels enqueued in QUEUE_COMPUTE so far have finished with the buffer
+		if(queue_type==QUEUE_TRANSFER) device->queue_wait_for(QUEUE_TRANSFER, QUEUE_COMPUTE);
+	}
+	inline void synchronize_end() { // kernels enqueued in QUEUE_COMPUTE from now on must not start before the transfer has completed
+		if(queue_type==QUEUE_TRANSFER) device->queue_wait_for(QUEUE_COMPUTE, QUEUE_TRANSFER);
+	}
+	inline void transfer_parts(const bool write, const ulong offset, const ulong length, const bool blocking, const vector<cl::Event>* event_waitlist=nullptr, cl::Event* event_returned=nullptr) { // transfer host buffer elements [offset, offset+length) to or from the device buffers of all parts that contain them; events of different devices can't be mixed, so the host waits for event_waitlist and event_returned is already complete
+		if(event_waitlist_or_null(event_waitlist)) cl::WaitForEvents(*event_waitlist);
+		for(uint p=0u; p<(uint)parts.size(); p++) {
+			const Part& part = parts[p];
+			Memory<T>& memory = *part.memory;
+			if(!write&&!part.read) continue;
+			memory.synchronize_begin();
+			for(uint i=0u; i<d; i++) { // intersect with [begin, end) of every vector dimension
+				const ulong x0=max(offset, (ulong)i*N+part.begin), x1=min(offset+length, (ulong)i*N+part.end);
+				if(x1<=x0) continue;
+				const ulong device_offset = ((ulong)i*memory.N+part.offset+x0-((ulong)i*N+part.begin))*sizeof(T);
+				if(write) memory.cl_queue.enqueueWriteBuffer(memory.device_buffer, false, device_offset, (x1-x0)*sizeof(T), (void*)(host_buffer+x0));
+				else memory.cl_queue.enqueueReadBuffer(memory.device_buffer, false, device_offset, (x1-x0)*sizeof(T), (void*)(host_buffer+x0));
+			}
+			memory.synchronize_end();
+		}
+		if(blocking||event_returned) finish_queue();
+		if(event_returned) *event_returned = parts[0].memory->device->enqueue_marker(parts[0].memory->queue_type);
+	}
+	inline void transfer_zero_copy(const bool write, const ulong offset, const ulong length, const bool blocking, const vector<cl::Event>* event_waitlist=nullptr, cl::Event* event_returned=nullptr) { // host buffer is the memory of the device buffer, map/unmap only makes the latest writes of one side visible to the other
+#ifndef USE_OPENCL_1_1
+		const cl_map_flags map_flags = write ? CL_MAP_WRITE_INVALIDATE_REGION : CL_MAP_READ; // invalidating keeps drivers that cache the buffer from overwriting host writes with device contents
+#else // USE_OPENCL_1_1
+		if(write) { // without CL_MAP_WRITE_INVALIDATE_REGION, mapping for writing could overwrite host writes
+			cl_queue.enqueueWriteBuffer(device_buffer, blocking, offset*sizeof(T), length*sizeof(T), (void*)(host_buffer+offset), event_waitlist_or_null(event_waitlist), event_returned);
+			return;
+		}
+		const cl_map_flags map_flags = CL_MAP_READ;
+#endif // USE_OPENCL_1_1
+		int error = 0;
+		void* mapped = cl_queue.enqueueMapBuffer(device_buffer, false, map_flags, offset*sizeof(T), length*sizeof(T), event_waitlist_or_null(event_waitlist), nullptr, &error);
+		if(error) print_error("Mapping zero-copy buffer failed with error code "+to_string(error)+".");
+		cl_queue.enqueueUnmapMemObject(device_buffer, mapped, nullptr, event_returned);
+		if(blocking) cl_queue.finish();
+	}
+	inline void transfer_rect(const bool write, const ulong x0, const ulong x1, const ulong y0, const ulong y1, const ulong z0, const ulong z1, const ulong Nx, const ulong Ny, const ulong sy, const ulong sz, const int dimension, const bool blocking) { // one rectangular transfer per vector dimension for x in [x0, x1), every sy-th y in [y0, y1) and every sz-th z in [z0, z1)
+		if(!write) allocate_host_buffer_on_access(); // downloads the entire buffer once
+		if(!host_buffer_exists||!device_side_exists()||synchronized()||x1<=x0||y1<=y0||z1<=z0) return;
+		if(sy==0ull||sz==0ull) print_error("Stride of rectangular transfer must be larger than 0.");
+		const ulong rows=(y1-y0+sy-1ull)/sy, slices=(z1-z0+sz-1ull)/sz; // number of transferred rows per slice and number of transferred slices
+		const ulong n_first=x0+(y0+z0*Ny)*Nx, n_last=x1-1ull+(y0+(rows-1ull)*sy+(z0+(slices-1ull)*sz)*Ny)*Nx; // first and last element of each dimension
+		if(x1>Nx||n_last>=N) print_error("Rectangular transfer is out of bounds of buffer with length "+to_string(N)+".");
+		if(!parts.empty()) { // parts may begin at any row, so rows are transferred one by one, or whole slices if the rows are contiguous
+			const bool whole_rows = x0==0ull&&x1==Nx&&sy==1ull;
+			const uint i0=(uint)max(0, dimension), i1=dimension<0 ? d : i0+1u;
+			for(uint i=i0; i<i1; i++) {
+				for(ulong k=0ull; k<slices; k++) {
+					const ulong n_slice = (ulong)i*N+n_first+k*sz*Nx*Ny;
+					if(whole_rows) transfer_parts(write, n_slice, rows*Nx, false);
+					else for(ulong r=0ull; r<rows; r++) transfer_parts(write, n_slice+r*sy*Nx, x1-x0, false);
+				}
+			}
+			if(blocking) finish_queue();
+			return;
+		}
+		const ulong row_pitch=sy*Nx*sizeof(T), slice_pitch=sz*Nx*Ny*sizeof(T);
+		const bool single_call = slices==1ull||(slice_pitch%row_pitch==0ull&&slice_pitch>=rows*row_pitch); // otherwise slices have to be transferred one by one
+		const uint i0=(uint)max(0, dimension), i1=dimension<0 ? d : i0+1u;
+		synchronize_begin();
+		for(uint i=i0; i<i1; i++) {
+			if(host_memory==HOST_MEMORY_ZERO_COPY) { // mapping the span from first to last element costs the same as the rectangle
+				transfer_zero_copy(write, (ulong)i*N+n_first, n_last-n_first+1ull, false);
+				continue;
+			}
+			for(ulong k=0ull; k<(single_call ? 1ull : slices); k++) {
+				cl::size_t<3> origin, region; // buffer and host buffer have the same layout, so they use the same origin and pitches
+				origin[0] = ((ulong)i*N+n_first+k*sz*Nx*Ny)*sizeof(T); // linear offset in Byte
+				origin[1] = 0u;
+				origin[2] = 0u;
+				region[0] = (x1-x0)*sizeof(T);
+				region[1] = rows;
+				region[2] = single_call ? slices : 1ull;
+				const ulong rect_slice_pitch = region[2]>1ull ? slice_pitch : rows*row_pitch;
+				if(write) cl_queue.enqueueWriteBufferRect(device_buffer, false, origin, origin, region, row_pitch, rect_slice_pitch, row_pitch, rect_slice_pitch, (void*)host_buffer);
+				else cl_queue.enqueueReadBufferRect(device_buffer, false, origin, origin, region, row_pitch, rect_slice_pitch, row_pitch, rect_slice_pitch, (void*)host_buffer);
+			}
+		}
+		synchronize_end();
+		if(blocking) cl_queue.finish();
+	}
+	inline static bool is_zero(const T& value) { // true if all bytes of value are 0
+		const uchar* bytes = (const uchar*)&value;
+		for(uint i=0u; i<(uint)sizeof(T); i++) if(bytes[i]!=0u) return false;
+		return true;
+	}
+	inline void fill_host_buffer(const T value) { // fill host buffer with multiple threads
+		const ulong range = N*(ulong)d;
+		const uint threads = range*(ulong)sizeof(T)<16777216ull ? 1u : clamp((uint)thread::hardware_concurrency(), 1u, 64u); // not worth spawning threads for less than 16 MB
+		vector<thread> workers;
+		for(uint t=1u; t<threads; t++) workers.push_back(thread([this, range, t, threads, value]() { std::fill(host_buffer+range*(ulong)t/(ulong)threads, host_buffer+range*(ulong)(t+1u)/(ulong)threads, value); }));
+		std::fill(host_buffer, host_buffer+range/(ulong)threads, value);
+		for(uint t=0u; t<(uint)workers.size(); t++) workers[t].join();
+	}
+	inline void fill_device_buffer(const T value) { // fill device buffer with clEnqueueFillBuffer without any PCIe transfer, does not block
+		*device_modified = true; // only in sync with the host buffer again if that is filled with the same value
+#ifndef USE_OPENCL_1_1
+		const bool valid_pattern = sizeof(T)<=128u&&(sizeof(T)&(sizeof(T)-1u))==0u; // pattern size has to be a power of 2 up to 128 Byte
+		if(valid_pattern||is_zero(value)) {
+			synchronize_begin();
+			if(valid_pattern) cl_queue.enqueueFillBuffer(device_buffer, value, 0u, capacity());
+			else cl_queue.enqueueFillBuffer(device_buffer, (uchar)0u, 0u, capacity());
+			synchronize_end();
+			return;
+		}
+#endif // USE_OPENCL_1_1
+		if(host_buffer_exists) { // fall back to upload from host buffer
+			host_modified = true; // force upload
+			write_to_device();
+		} else {
+			Memory<T> staging(*device, N, d, true, false, value); // temporary host buffer
+			synchronize_begin();
+			cl_queue.enqueueWriteBuffer(device_buffer, true, 0u, capacity(), (void*)staging.data());
+			synchronize_end();
+		}
+	}
+	inline void allocate_host_buffer(const bool zero_initialized=false) { // allocates host_buffer according to host_memory, falls back to pageable memory if pinned memory is not available
+		if(host_memory==HOST_MEMORY_PINNED) {
+			int error = 0;
+			pinned_buffer = cl::Buffer(device->get_cl_context(), CL_MEM_READ_WRITE|CL_MEM_ALLOC_HOST_PTR, allocated_capacity(), nullptr, &error);
+			if(!error) host_buffer = (T*)cl_queue.enqueueMapBuffer(pinned_buffer, true, CL_MAP_READ|CL_MAP_WRITE, 0u, allocated_capacity(), nullptr, nullptr, &error);
+			if(error) {
+				print_warning("Pinned host memory allocation failed with error code "+to_string(error)+", falling back to pageable host memory.");
+				pinned_buffer = nullptr;
+				host_memory = HOST_MEMORY_PAGEABLE;
+			}
+		}
+		if(host_memory==HOST_MEMORY_ZERO_COPY) {
+			const size_t size = ((allocated_capacity()+4095ull)/4096ull)*4096ull; // USE_HOST_PTR needs page-aligned memory with a size that is a multiple of the cache line size to avoid copies
+#ifdef _WIN32
+			host_buffer = (T*)_aligned_malloc(size, 4096u);
+#else // Linux
+			host_buffer = (T*)std::aligned_alloc(4096u, size);
+#endif // Linux
+			if(host_buffer==nullptr) print_error("Host memory allocation of "+to_string((uint)(allocated_capacity()/1048576ull))+" MB failed.");
+		}
+		if(host_memory==HOST_MEMORY_PAGEABLE) {
+			host_buffer = (T*)(zero_initialized ? std::calloc(allocated, sizeof(T)) : std::malloc(allocated_capacity())); // large calloc() memory is zeroed lazily by the OS when pages are first touched
+			if(host_buffer==nullptr) print_error("Host memory allocation of "+to_string((uint)(allocated_capacity()/1048576ull))+" MB failed.");
+		}
+		device->info.host_memory_used += allocated_capacity(); // track host memory usage
+	}
+	inline void free_host_buffer() {
+		if(host_buffer!=nullptr) device->info.host_memory_used -= allocated_capacity(); // track host memory usage, a moved-from Memory has no host buffer anymore
+		switch(host_memory) {
+			case HOST_MEMORY_PINNED:
+				cl_queue.enqueueUnmapMemObject(pinned_buffer, (void*)host_buffer);
+				cl_queue.finish();
+				pinned_buffer = nullptr;
+				break;
+			case HOST_MEMORY_ZERO_COPY:
+#ifdef _WIN32
+				_aligned_free((void*)host_buffer);
+#else // Linux
+				std::free((void*)host_buffer);
+#endif // Linux
+				break;
+			default:
+				std::free((void*)host_buffer);
+		}
+		host_buffer = nullptr;
 	}
 	inline void allocate_device_buffer(Device& device, const bool allocate_device) {
 		this->device = &device;
-		this->cl_queue = device.get_cl_queue();
+		this->cl_queue = device.get_cl_queue(queue_type);
 		if(allocate_device) {
-			device.info.memory_used += (uint)(capacity()/1048576ull); // track device memory usage
-			if(device.info.memory_used>device.info.memory) print_error("Device \""+device.info.name+"\" does not have enough memory. Allocating another "+to_string((uint)(capacity()/1048576ull))+" MB would use a total of "+to_string(device.info.memory_used)+" MB / "+to_string(device.info.memory)+" MB.");
+			device.info.memory_used += allocated_capacity(); // track device memory usage
+			if(device.info.memory_used>(ulong)device.info.memory*1048576ull) print_error("Device \""+device.info.name+"\" does not have enough memory. Allocating another "+to_string((uint)(allocated_capacity()/1048576ull))+" MB would use a total of "+to_string((uint)(device.info.memory_used/1048576ull))+" MB / "+to_string(device.info.memory)+" MB.");
 			int error = 0;
-			device_buffer = cl::Buffer(device.get_cl_context(), CL_MEM_READ_WRITE, capacity(), nullptr, &error);
-			if(error==-61) print_error("Memory size is too large at "+to_string((uint)(capacity()/1048576ull))+" MB. Device \""+device.info.name+"\" accepts a maximum buffer size of "+to_string(device.info.max_global_buffer)+" MB.");
+			if(host_memory==HOST_MEMORY_ZERO_COPY) device_buffer = cl::Buffer(device.get_cl_context(), CL_MEM_READ_WRITE|CL_MEM_USE_HOST_PTR, allocated_capacity(), (void*)host_buffer, &error); // host_buffer has to be allocated already
+			else device_buffer = cl::Buffer(device.get_cl_context(), CL_MEM_READ_WRITE, allocated_capacity(), nullptr, &error);
+			if(error==-61) print_error("Memory size is too large at "+to_string((uint)(allocated_capacity()/1048576ull))+" MB. Device \""+device.info.name+"\" accepts a maximum buffer size of "+to_string(device.info.max_global_buffer)+" MB.");
 			else if(error) print_error("Device buffer allocation failed with error code "+to_string(error)+".");
 			device_buffer_exists = true;
 		}
 	}
 public:
-	T *x=nullptr, *y=nullptr, *z=nullptr, *w=nullptr; // host buffer auxiliary pointers for multi-dimensional array access (array of structures)
-	T *s0=nullptr, *s1=nullptr, *s2=nullptr, *s3=nullptr, *s4=nullptr, *s5=nullptr, *s6=nullptr, *s7=nullptr, *s8=nullptr, *s9=nullptr, *sA=nullptr, *sB=nullptr, *sC=nullptr, *sD=nullptr, *sE=nullptr, *sF=nullptr;
-	inline Memory(Device& device, const ulong N, const uint dimensions=1u, const bool allocate_host=true, const bool allocate_device=true, const T value=(T)0) {
-		if(!device.is_initialized()) print_error("No Device selected. Call Device constructor.");
+	Host_Pointer<T> x{this, 0x0u}, y{this, 0x1u}, z{this, 0x2u}, w{this, 0x3u}; // host buffer auxiliary pointers for multi-dimensional array access (array of structures)
+	Host_Pointer<T> s0{this, 0x0u}, s1{this, 0x1u}, s2{this, 0x2u}, s3{this, 0x3u}, s4{this, 0x4u}, s5{this, 0x5u}, s6{this, 0x6u}, s7{this, 0x7u}, s8{this, 0x8u}, s9{this, 0x9u}, sA{this, 0xAu}, sB{this, 0xBu}, sC{this, 0xCu}, sD{this, 0xDu}, sE{this, 0xEu}, sF{this, 0xFu};
+	inline Memory(Device& device, const ulong N, const uint dimensions=1u, const bool allocate_host=true, const bool allocate_device=true, const T value=(T)0, const Host_Memory host_memory=HOST_MEMORY_PAGEABLE) {
+		if(!device.is_initialized()&&allocate_device) print_error("No Device selected. Call Device constructor."); // host-only buffers don't need an OpenCL device
 		if(N*(ulong)dimensions==0ull) print_error("Memory size must be larger than 0.");
 		this->N = N;
 		this->d = dimensions;
+		this->allocated = N*(ulong)dimensions;
+		this->device = &device;
+		this->cl_queue = device.get_cl_queue(queue_type);
+		this->host_memory = host_memory; // without allocate_host, host_memory applies to a host buffer that is allocated on first access
+		if(device.info.uses_host_memory) this->host_memory = allocate_device ? HOST_MEMORY_ZERO_COPY : HOST_MEMORY_PAGEABLE; // device and host share memory, so the device buffer is created on host memory, also if there is no host access yet
+		if(!device.is_initialized()) this->host_memory = HOST_MEMORY_PAGEABLE; // pinned memory needs an OpenCL context
+		if(this->host_memory==HOST_MEMORY_ZERO_COPY) { // device buffer is created on top of host buffer, which already contains value then
+			allocate_host_buffer();
+			fill_host_buffer(value);
+		}
 		allocate_device_buffer(device, allocate_device);
 		if(allocate_host) {
-			host_buffer = new T[N*(ulong)d];
-			for(ulong i=0ull; i<N*(ulong)d; i++) host_buffer[i] = value;
-			initialize_auxiliary_pointers();
+			const bool zero = is_zero(value);
+			if(this->host_memory!=HOST_MEMORY_ZERO_COPY) allocate_host_buffer(zero);
+			if(!zero||this->host_memory==HOST_MEMORY_PINNED) fill_host_buffer(value); // pageable zero-initialized memory is already 0
 			host_buffer_exists = true;
 		}
-		write_to_device();
+		if(device_buffer_exists&&this->host_memory!=HOST_MEMORY_ZERO_COPY) fill_device_buffer(value); // no need to upload the host buffer, it contains only value
+		if(host_buffer_exists&&device_buffer_exists) set_synchronized(); // both contain only value
 	}
 	inline Memory(Device& device, const ulong N, const uint dimensions, T* const host_buffer, const bool allocate_device=true) {
 		if(!device.is_initialized()) print_error("No Device selected. Call Device constructor.");
 		if(N*(ulong)dimensions==0ull) print_error("Memory size must be larger than 0.");
 		this->N = N;
 		this->d = dimensions;
+		this->allocated = N*(ulong)dimensions;
 		allocate_device_buffer(device, allocate_device);
 		this->host_buffer = host_buffer;
-		initialize_auxiliary_pointers();
 		host_buffer_exists = true;
 		external_host_buffer = true;
+		host_pointer_escaped = true; // the caller keeps writing through its own pointer
 		write_to_device();
+		if(!device_buffer_exists) host_modified = true; // no device buffer yet to be in sync with
 	}
 	inline Memory() {} // default constructor
 	inline ~Memory() {
@@ -274,67 +745,133 @@ public:
 		delete_buffers(); // delete existing buffers and restore default state
 		N = memory.length(); // copy values/pointers from memory
 		d = memory.dimensions();
+		allocated = memory.allocated;
 		device = memory.device;
-		cl_queue = memory.device->get_cl_queue();
+		queue_type = memory.queue_type;
+		cl_queue = memory.device->get_cl_queue(queue_type);
+		host_memory = memory.host_memory;
+		pinned_buffer = memory.pinned_buffer;
+		external_host_buffer = memory.external_host_buffer;
+		parts = memory.parts;
+		host_modified = memory.host_modified;
+		host_pointer_escaped = memory.host_pointer_escaped;
+		*device_modified = *memory.device_modified; // keep own flag, Kernels linked to memory are re-linked to this anyway
+		memory.host_memory = HOST_MEMORY_PAGEABLE; // memory no longer owns the host buffer
+		memory.external_host_buffer = false;
 		if(memory.device_buffer_exists) {
 			device_buffer = memory.get_cl_buffer(); // transfer device_buffer pointer
-			device->info.memory_used += (uint)(capacity()/1048576ull); // track device memory usage
+			device->info.memory_used += allocated_capacity(); // track device memory usage
 			device_buffer_exists = true;
 		}
-		if(memory.host_buffer_exists) {
+		if(memory.host_buffer!=nullptr) { // also zero-copy memory of a device buffer that was not accessed on the host yet
+			host_buffer_exists = memory.host_buffer_exists;
 			host_buffer = memory.exchange_host_buffer(nullptr); // transfer host_buffer pointer
-			initialize_auxiliary_pointers();
-			host_buffer_exists = true;
 		}
 		return *this; // destructor of memory will be called automatically
 	}
 	inline T* exchange_host_buffer(T* const host_buffer) { // sets host_buffer to new pointer and returns old pointer
+		host_modified = true;
 		T* const swap = this->host_buffer;
 		this->host_buffer = host_buffer;
 		return swap;
 	}
-	inline void add_host_buffer() { // makes only sense if there is no host buffer yet but an existing device buffer
-		if(!host_buffer_exists&&device_buffer_exists) {
-			host_buffer = new T[N*(ulong)d];
-			initialize_auxiliary_pointers();
-			read_from_device();
+	inline void add_host_buffer() { // makes only sense if there is no host buffer yet but an existing device buffer, happens automatically on first host access
+		if(!host_buffer_exists&&device_side_exists()) {
+			if(host_memory!=HOST_MEMORY_ZERO_COPY) allocate_host_buffer(); // zero-copy device buffer already lives in the host buffer
 			host_buffer_exists = true;
-		} else if(!device_buffer_exists) {
+			host_modified = true; // force download
+			read_from_device();
+		} else if(!host_buffer_exists) {
 			print_error("There is no existing device buffer, so can't add host buffer.");
 		}
 	}
 	inline void add_device_buffer() { // makes only sense if there is no device buffer yet but an existing host buffer
 		if(!device_buffer_exists&&host_buffer_exists) {
 			allocate_device_buffer(*device, true);
+			host_modified = true; // force upload
 			write_to_device();
 		} else if(!host_buffer_exists) {
 			print_error("There is no existing host buffer, so can't add device buffer.");
 		}
 	}
-	inline void delete_host_buffer() {
+	inline void add_part(Memory<T>& memory, const ulong begin, const ulong end, const ulong offset, const bool read=true) { // elements [begin, end) of every vector dimension are stored at [offset, offset+end-begin) in the device buffer of memory, for fields that are split across several devices; read=false for copies that are only written to the device
+		if(device_buffer_exists) print_error("Memory with its own device buffer can't be split across devices.");
+		if(!memory.device_buffer_exists||memory.dimensions()!=d||end>N||begin>=end||offset+(end-begin)>memory.length()) print_error("Part of split Memory is out of bounds.");
+		Part part;
+		part.memory = &memory;
+		part.begin = begin;
+		part.end = end;
+		part.offset = offset;
+		part.read = read;
+		parts.push_back(part);
+	}
+	inline void delete_host_buffer() { // with an existing device buffer, the host buffer is allocated again and downloaded on next host access
+		const bool host_buffer_existed = host_buffer_exists;
 		host_buffer_exists = false;
-		if(!external_host_buffer) delete[] host_buffer;
-		if(!device_buffer_exists) {
+		if(!external_host_buffer&&host_buffer_existed&&!(host_memory==HOST_MEMORY_ZERO_COPY&&device_buffer_exists)) free_host_buffer(); // zero-copy host buffer is freed only after the device buffer that uses it
+		if(!device_side_exists()) {
 			N = 0ull;
 			d = 1u;
+			allocated = 0ull;
 		}
 	}
 	inline void delete_device_buffer() {
-		if(device_buffer_exists) device->info.memory_used -= (uint)(capacity()/1048576ull); // track device memory usage
+		if(device_buffer_exists) device->info.memory_used -= allocated_capacity(); // track device memory usage
 		device_buffer_exists = false;
 		device_buffer = nullptr;
+		if(host_memory==HOST_MEMORY_ZERO_COPY&&!host_buffer_exists&&host_buffer!=nullptr) free_host_buffer();
 		if(!host_buffer_exists) {
 			N = 0ull;
 			d = 1u;
+			allocated = 0ull;
 		}
 	}
 	inline void delete_buffers() {
 		delete_device_buffer();
 		delete_host_buffer();
+		parts.clear();
+		host_modified = true;
+		host_pointer_escaped = false; // pointers handed out so far point to freed memory
+		*device_modified = true;
+	}
+	inline bool resize(const ulong N) { // change length without reallocation if the buffers are large enough, otherwise reallocate with 25% headroom; contents are undefined afterwards; returns true if buffers were reallocated, then Kernels have to be linked again
+		if(N*(ulong)d==0ull) print_error("Memory size must be larger than 0.");
+		if(external_host_buffer) print_error("Memory with external host buffer can't be resized.");
+		if(N*(ulong)d<=allocated) {
+			this->N = N;
+			invalidate();
+			return false;
+		}
+		const uint d = this->d;
+		const bool reallocate_host=host_buffer_exists, reallocate_device=device_buffer_exists;
+		delete_buffers();
+		this->N = N;
+		this->d = d;
+		this->allocated = N*(ulong)d+N*(ulong)d/4ull;
+		if(reallocate_device&&host_memory==HOST_MEMORY_ZERO_COPY) allocate_host_buffer(); // device buffer is created on top of host buffer
+		allocate_device_buffer(*device, reallocate_device);
+		if(reallocate_host) {
+			if(host_memory!=HOST_MEMORY_ZERO_COPY) allocate_host_buffer();
+			host_buffer_exists = true;
+		}
+		return true;
 	}
 	inline void reset(const T value=(T)0) {
-		if(host_buffer_exists) for(ulong i=0ull; i<N*(ulong)d; i++) host_buffer[i] = value;
-		write_to_device();
+		if(device_buffer_exists&&host_memory==HOST_MEMORY_ZERO_COPY) { // host buffer is the memory of the device buffer
+			device->finish_queues(); // no kernel may use the memory while the host fills it
+			fill_host_buffer(value);
+			transfer_zero_copy(true, 0ull, range(), true);
+			set_synchronized();
+			return;
+		}
+		if(host_buffer_exists) fill_host_buffer(value);
+		if(device_buffer_exists) fill_device_buffer(value);
+		for(uint p=0u; p<(uint)parts.size(); p++) parts[p].memory->fill_device_buffer(value); // also fills halo layers
+		if(host_buffer_exists&&device_side_exists()) set_synchronized();
+	}
+	inline void reset_device(const T value=(T)0) { // only fill the device buffer, in order with the kernels in its queue and without waiting for the device, the host buffer is out of date afterwards
+		if(device_buffer_exists) fill_device_buffer(value);
+		for(uint p=0u; p<(uint)parts.size(); p++) parts[p].memory->fill_device_buffer(value); // also fills halo layers
 	}
 	inline ulong length() const {
 		return N;
@@ -348,20 +885,40 @@ public:
 	inline ulong capacity() const { // returns capacity of the buffer in Byte
 		return N*(ulong)d*sizeof(T);
 	}
-	inline T* data() {
-		return host_buffer;
+	inline Host_Memory get_host_memory() const { // returns actual allocation mode of the host buffer
+		return host_memory;
+	}
+	inline bool host_buffer_allocated() const { // false if the host buffer was never accessed or deleted, then const accessors return nullptr
+		return host_buffer_exists;
+	}
+	inline void invalidate() { // forces the next transfer
+		host_modified = true;
+		*device_modified = true;
+	}
+	inline std::shared_ptr<bool> get_device_modified() const { // for Kernel to mark the device buffer as modified when enqueued
+		return device_modified;
+	}
+	inline T* data() { // non-const pointer escapes, so the host buffer counts as modified from now on and transfers are never skipped; use const accessors, operator()(i) or [] for element access
+		host_pointer_escaped = true;
+		return host_access();
 	}
 	inline const T* data() const {
 		return host_buffer;
 	}
+	inline T* data(const uint dimension) { // start of one vector dimension, nullptr if there are fewer dimensions
+		return dimension<d ? data()+(ulong)dimension*N : nullptr;
+	}
+	inline const T* data(const uint dimension) const {
+		return dimension<d&&host_buffer_exists ? host_buffer+(ulong)dimension*N : nullptr;
+	}
 	inline T* operator()() {
-		return host_buffer;
+		return data();
 	}
 	inline const T* operator()() const {
 		return host_buffer;
 	}
 	inline T& operator[](const ulong i) {
-		return host_buffer[i];
+		return host_access()[i];
 	}
 	inline const T& operator[](const ulong i) const {
 		return host_buffer[i];
@@ -372,120 +929,158 @@ public:
 	inline const T operator()(const ulong i, const uint dimension) const {
 		return host_buffer[i+(ulong)dimension*N]; // array of structures
 	}
-	inline void read_from_device(const bool blocking=true) {
-		if(host_buffer_exists&&device_buffer_exists) cl_queue.enqueueReadBuffer(device_buffer, blocking, 0u, capacity(), (void*)host_buffer);
+	inline void read_from_device(const bool blocking=true, const vector<cl::Event>* event_waitlist=nullptr, cl::Event* event_returned=nullptr) { // skipped if host buffer and device buffer are already in sync; the transfer also waits for event_waitlist, event_returned completes with it
+		allocate_host_buffer_on_access(); // first download allocates the host buffer
+		if(host_buffer_exists&&!parts.empty()&&!synchronized()) {
+			transfer_parts(false, 0ull, range(), blocking, event_waitlist, event_returned);
+			set_synchronized();
+		} else if(host_buffer_exists&&device_buffer_exists&&!synchronized()) {
+			synchronize_begin();
+			if(host_memory==HOST_MEMORY_ZERO_COPY) transfer_zero_copy(false, 0ull, range(), blocking, event_waitlist, event_returned);
+			else cl_queue.enqueueReadBuffer(device_buffer, blocking, 0u, capacity(), (void*)host_buffer, event_waitlist_or_null(event_waitlist), event_returned);
+			synchronize_end();
+			set_synchronized();
+		} else if(event_returned) {
+			*event_returned = device->enqueue_marker(queue_type, event_waitlist); // skipped transfer still has to signal its dependencies
+		}
 	}
-	inline void write_to_device(const bool blocking=true) {
-		if(host_buffer_exists&&device_buffer_exists) cl_queue.enqueueWriteBuffer(device_buffer, blocking, 0u, capacity(), (void*)host_buffer);
+	inline void write_to_device(const bool blocking=true, const vector<cl::Event>* event_waitlist=nullptr, cl::Event* event_returned=nullptr) { // skipped if host buffer and device buffer are already in sync; the transfer also waits for event_waitlist, event_returned completes with it
+		if(host_buffer_exists&&!parts.empty()&&!synchronized()) {
+			transfer_parts(true, 0ull, range(), blocking, event_waitlist, event_returned);
+			set_synchronized();
+		} else if(host_buffer_exists&&device_buffer_exists&&!synchronized()) {
+			synchronize_begin();
+			if(host_memory==HOST_MEMORY_ZERO_COPY) transfer_zero_copy(true, 0ull, range(), blocking, event_waitlist, event_returned);
+			else cl_queue.enqueueWriteBuffer(device_buffer, blocking, 0u, capacity(), (void*)host_buffer, event_waitlist_or_null(event_waitlist), event_returned);
+			synchronize_end();
+			set_synchronized();
+		} else if(event_returned) {
+			*event_returned = device->enqueue_marker(queue_type, event_waitlist);
+		}
 	}
-	inline void read_from_device(const ulong offset, const ulong length, const bool blocking=true) {
-		if(host_buffer_exists&&device_buffer_exists) {
-			const ulong safe_offset=min(offset, range()), safe_length=min(length, range()-safe_offset);
-			if(safe_length>0ull) cl_queue.enqueueReadBuffer(device_buffer, blocking, safe_offset*sizeof(T), safe_length*sizeof(T), (void*)(host_buffer+safe_offset));
+	inline void read_from_device(const ulong offset, const ulong length, const bool blocking=true, const vector<cl::Event>* event_waitlist=nullptr, cl::Event* event_returned=nullptr) {
+		allocate_host_buffer_on_access(); // downloads the entire buffer once
+		const ulong safe_offset=min(offset, range()), safe_length=min(length, range()-safe_offset);
+		if(host_buffer_exists&&!parts.empty()&&!synchronized()&&safe_length>0ull) {
+			transfer_parts(false, safe_offset, safe_length, blocking, event_waitlist, event_returned);
+		} else if(host_buffer_exists&&device_buffer_exists&&!synchronized()&&safe_length>0ull) { // partial transfers leave the modified flags as they are
+			synchronize_begin();
+			if(host_memory==HOST_MEMORY_ZERO_COPY) transfer_zero_copy(false, safe_offset, safe_length, blocking, event_waitlist, event_returned);
+			else cl_queue.enqueueReadBuffer(device_buffer, blocking, safe_offset*sizeof(T), safe_length*sizeof(T), (void*)(host_buffer+safe_offset), event_waitlist_or_null(event_waitlist), event_returned);
+			synchronize_end();
+		} else if(event_returned) {
+			*event_returned = device->enqueue_marker(queue_type, event_waitlist);
 		}
 	}
-	inline void write_to_device(const ulong offset, const ulong length, const bool blocking=true) {
-		if(host_buffer_exists&&device_buffer_exists) {
-			const ulong safe_offset=min(offset, range()), safe_length=min(length, range()-safe_offset);
-			if(safe_length>0ull) cl_queue.enqueueWriteBuffer(device_buffer, blocking, safe_offset*sizeof(T), safe_length*sizeof(T), (void*)(host_buffer+safe_offset));
+	inline void write_to_device(const ulong offset, const ulong length, const bool blocking=true, const vector<cl::Event>* event_waitlist=nullptr, cl::Event* event_returned=nullptr) {
+		const ulong safe_offset=min(offset, range()), safe_length=min(length, range()-safe_offset);
+		if(host_buffer_exists&&!parts.empty()&&!synchronized()&&safe_length>0ull) {
+			transfer_parts(true, safe_offset, safe_length, blocking, event_waitlist, event_returned);
+		} else if(host_buffer_exists&&device_buffer_exists&&!synchronized()&&safe_length>0ull) { // partial transfers leave the modified flags as they are
+			synchronize_begin();
+			if(host_memory==HOST_MEMORY_ZERO_COPY) transfer_zero_copy(true, safe_offset, safe_length, blocking, event_waitlist, event_returned);
+			else cl_queue.enqueueWriteBuffer(device_buffer, blocking, safe_offset*sizeof(T), safe_length*sizeof(T), (void*)(host_buffer+safe_offset), event_waitlist_or_null(event_waitlist), event_returned);
+			synchronize_end();
+		} else if(event_returned) {
+			*event_returned = device->enqueue_marker(queue_type, event_waitlist);
 		}
 	}
 	inline void read_from_device_1d(const ulong x0, const ulong x1, const int dimension=-1, const bool blocking=true) { // read 1D domain from device, either for all vector dimensions (-1) or for a specified dimension
-		if(host_buffer_exists&&device_buffer_exists) {
+		allocate_host_buffer_on_access(); // downloads the entire buffer once
+		if(host_buffer_exists&&device_side_exists()&&!synchronized()) { // partial transfers leave the modified flags as they are
+			synchronize_begin();
 			const uint i0=(uint)max(0, dimension), i1=dimension<0 ? d : i0+1u;
 			for(uint i=i0; i<i1; i++) {
 				const ulong safe_offset=min((ulong)i*N+x0, range()), safe_length=min(x1-x0, range()-safe_offset);
-				if(safe_length>0ull) cl_queue.enqueueReadBuffer(device_buffer, false, safe_offset*sizeof(T), safe_length*sizeof(T), (void*)(host_buffer+safe_offset));
+				if(safe_length>0ull&&!parts.empty()) transfer_parts(false, safe_offset, safe_length, false);
+				else if(safe_length>0ull&&host_memory==HOST_MEMORY_ZERO_COPY) transfer_zero_copy(false, safe_offset, safe_length, false);
+				else if(safe_length>0ull) cl_queue.enqueueReadBuffer(device_buffer, false, safe_offset*sizeof(T), safe_length*sizeof(T), (void*)(host_buffer+safe_offset));
 			}
-			if(blocking) cl_queue.finish();
+			synchronize_end();
+			if(blocking) finish_queue();
 		}
 	}
 	inline void write_to_device_1d(const ulong x0, const ulong x1, const int dimension=-1, const bool blocking=true) { // write 1D domain to device, either for all vector dimensions (-1) or for a specified dimension
-		if(host_buffer_exists&&device_buffer_exists) {
+		if(host_buffer_exists&&device_side_exists()&&!synchronized()) { // partial transfers leave the modified flags as they are
+			synchronize_begin();
 			const uint i0=(uint)max(0, dimension), i1=dimension<0 ? d : i0+1u;
 			for(uint i=i0; i<i1; i++) {
 				const ulong safe_offset=min((ulong)i*N+x0, range()), safe_length=min(x1-x0, range()-safe_offset);
-				if(safe_length>0ull) cl_queue.enqueueWriteBuffer(device_buffer, false, safe_offset*sizeof(T), safe_length*sizeof(T), (void*)(host_buffer+safe_offset));
+				if(safe_length>0ull&&!parts.empty()) transfer_parts(true, safe_offset, safe_length, false);
+				else if(safe_length>0ull&&host_memory==HOST_MEMORY_ZERO_COPY) transfer_zero_copy(true, safe_offset, safe_length, false);
+				else if(safe_length>0ull) cl_queue.enqueueWriteBuffer(device_buffer, false, safe_offset*sizeof(T), safe_length*sizeof(T), (void*)(host_buffer+safe_offset));
 			}
-			if(blocking) cl_queue.finish();
+			synchronize_end();
+			if(blocking) finish_queue();
 		}
 	}
-	inline void read_from_device_2d(const ulong x0, const ulong x1, const ulong y0, const ulong y1, const ulong Nx, const ulong, const int dimension=-1, const bool blocking=true) { // read 2D domain from device, either for all vector dimensions (-1) or for a specified dimension
-		if(host_buffer_exists&&device_buffer_exists) {
-			for(uint y=y0; y<y1; y++) {
-				const ulong n = x0+y*Nx;
-				const uint i0=(uint)max(0, dimension), i1=dimension<0 ? d : i0+1u;
-				for(uint i=i0; i<i1; i++) {
-					const ulong safe_offset=min((ulong)i*N+n, range()), safe_length=min(x1-x0, range()-safe_offset);
-					if(safe_length>0ull) cl_queue.enqueueReadBuffer(device_buffer, false, safe_offset*sizeof(T), safe_length*sizeof(T), (void*)(host_buffer+safe_offset));
-				}
-			}
-			if(blocking) cl_queue.finish();
-		}
+	inline void read_from_device_2d(const ulong x0, const ulong x1, const ulong y0, const ulong y1, const ulong Nx, const ulong Ny, const int dimension=-1, const bool blocking=true) { // read 2D domain from device, either for all vector dimensions (-1) or for a specified dimension
+		transfer_rect(false, x0, x1, y0, y1, 0ull, 1ull, Nx, Ny, 1ull, 1ull, dimension, blocking);
 	}
-	inline void write_to_device_2d(const ulong x0, const ulong x1, const ulong y0, const ulong y1, const ulong Nx, const ulong, const int dimension=-1, const bool blocking=true) { // write 2D domain to device, either for all vector dimensions (-1) or for a specified dimension
-		if(host_buffer_exists&&device_buffer_exists) {
-			for(uint y=y0; y<y1; y++) {
-				const ulong n = x0+y*Nx;
-				const uint i0=(uint)max(0, dimension), i1=dimension<0 ? d : i0+1u;
-				for(uint i=i0; i<i1; i++) {
-					const ulong safe_offset=min((ulong)i*N+n, range()), safe_length=min(x1-x0, range()-safe_offset);
-					if(safe_length>0ull) cl_queue.enqueueWriteBuffer(device_buffer, false, safe_offset*sizeof(T), safe_length*sizeof(T), (void*)(host_buffer+safe_offset));
-				}
-			}
-			if(blocking) cl_queue.finish();
-		}
+	inline void write_to_device_2d(const ulong x0, const ulong x1, const ulong y0, const ulong y1, const ulong Nx, const ulong Ny, const int dimension=-1, const bool blocking=true) { // write 2D domain to device, either for all vector dimensions (-1) or for a specified dimension
+		transfer_rect(true, x0, x1, y0, y1, 0ull, 1ull, Nx, Ny, 1ull, 1ull, dimension, blocking);
 	}
 	inline void read_from_device_3d(const ulong x0, const ulong x1, const ulong y0, const ulong y1, const ulong z0, const ulong z1, const ulong Nx, const ulong Ny, const ulong, const int dimension=-1, const bool blocking=true) { // read 3D domain from device, either for all vector dimensions (-1) or for a specified dimension
-		if(host_buffer_exists&&device_buffer_exists) {
-			for(uint z=z0; z<z1; z++) {
-				for(uint y=y0; y<y1; y++) {
-					const ulong n = x0+(y+z*Ny)*Nx;
-					const uint i0=(uint)max(0, dimension), i1=dimension<0 ? d : i0+1u;
-					for(uint i=i0; i<i1; i++) {
-						const ulong safe_offset=min((ulong)i*N+n, range()), safe_length=min(x1-x0, range()-safe_offset);
-						if(safe_length>0ull) cl_queue.enqueueReadBuffer(device_buffer, false, safe_offset*sizeof(T), safe_length*sizeof(T), (void*)(host_buffer+safe_offset));
-					}
-				}
-			}
-			if(blocking) cl_queue.finish();
-		}
+		transfer_rect(false, x0, x1, y0, y1, z0, z1, Nx, Ny, 1ull, 1ull, dimension, blocking);
 	}
 	inline void write_to_device_3d(const ulong x0, const ulong x1, const ulong y0, const ulong y1, const ulong z0, const ulong z1, const ulong Nx, const ulong Ny, const ulong, const int dimension=-1, const bool blocking=true) { // write 3D domain to device, either for all vector dimensions (-1) or for a specified dimension
-		if(host_buffer_exists&&device_buffer_exists) {
-			for(uint z=z0; z<z1; z++) {
-				for(uint y=y0; y<y1; y++) {
-					const ulong n = x0+(y+z*Ny)*Nx;
-					const uint i0=(uint)max(0, dimension), i1=dimension<0 ? d : i0+1u;
-					for(uint i=i0; i<i1; i++) {
-						const ulong safe_offset=min((ulong)i*N+n, range()), safe_length=min(x1-x0, range()-safe_offset);
-						if(safe_length>0ull) cl_queue.enqueueWriteBuffer(device_buffer, false, safe_offset*sizeof(T), safe_length*sizeof(T), (void*)(host_buffer+safe_offset));
-					}
-				}
-			}
-			if(blocking) cl_queue.finish();
-		}
+		transfer_rect(true, x0, x1, y0, y1, z0, z1, Nx, Ny, 1ull, 1ull, dimension, blocking);
+	}
+	inline void read_from_device_2d_strided(const ulong x0, const ulong x1, const ulong y0, const ulong y1, const ulong Nx, const ulong Ny, const ulong sy, const int dimension=-1, const bool blocking=true) { // read only every sy-th row of 2D domain from device, rows land at their regular position in the host buffer
+		transfer_rect(false, x0, x1, y0, y1, 0ull, 1ull, Nx, Ny, sy, 1ull, dimension, blocking);
 	}
-	inline void enqueue_read_from_device() {
-		read_from_device(false);
+	inline void read_from_device_3d_strided(const ulong x0, const ulong x1, const ulong y0, const ulong y1, const ulong z0, const ulong z1, const ulong Nx, const ulong Ny, const ulong, const ulong sy, const ulong sz, const int dimension=-1, const bool blocking=true) { // read only every sy-th row and every sz-th slice of 3D domain from device, rows land at their regular position in the host buffer
+		transfer_rect(false, x0, x1, y0, y1, z0, z1, Nx, Ny, sy, sz, dimension, blocking);
 	}
-	inline void enqueue_write_to_device() {
-		write_to_device(false);
+	inline void enqueue_read_from_device(const vector<cl::Event>* event_waitlist=nullptr, cl::Event* event_returned=nullptr) {
+		read_from_device(false, event_waitlist, event_returned);
 	}
-	inline void enqueue_read_from_device(const ulong offset, const ulong length) {
-		read_from_device(offset, length, false);
+	inline void enqueue_write_to_device(const vector<cl::Event>* event_waitlist=nullptr, cl::Event* event_returned=nullptr) {
+		write_to_device(false, event_waitlist, event_returned);
 	}
-	inline void enqueue_write_to_device(const ulong offset, const ulong length) {
-		write_to_device(offset, length, false);
+	inline void enqueue_read_from_device(const ulong offset, const ulong length, const vector<cl::Event>* event_waitlist=nullptr, cl::Event* event_returned=nullptr) {
+		read_from_device(offset, length, false, event_waitlist, event_returned);
+	}
+	inline void enqueue_write_to_device(const ulong offset, const ulong length, const vector<cl::Event>* event_waitlist=nullptr, cl::Event* event_returned=nullptr) {
+		write_to_device(offset, length, false, event_waitlist, event_returned);
 	}
 	inline void finish_queue() {
-		cl_queue.finish();
+		if(device_buffer_exists) cl_queue.finish();
+		for(uint p=0u; p<(uint)parts.size(); p++) parts[p].memory->cl_queue.finish();
+	}
+	inline Memory& set_queue(const Queue_Type queue_type) { // select which command queue of the Device transfers of this buffer use
+		this->queue_type = queue_type;
+		if(device) cl_queue = device->get_cl_queue(queue_type);
+		return *this;
 	}
 	inline const cl::Buffer& get_cl_buffer() const {
 		return device_buffer;
 	}
 };
 
+inline void print_transfer_benchmark(Device& device, const ulong size=268435456ull, const uint repetitions=10u) { // measure host<->device bandwidth for every host memory allocation mode
+	println("\r|----------------.------------------------------------------------------------|");
+	println("| Transfer Size  | "+alignl(58u, to_string((uint)(size/1048576ull))+" MB")+" |");
+	const Host_Memory modes[2] = { HOST_MEMORY_PAGEABLE, HOST_MEMORY_PINNED };
+	for(uint m=0u; m<2u; m++) {
+		Memory<uchar> buffer(device, size, 1u, true, true, (uchar)0, modes[m]);
+		const string name = buffer.get_host_memory()==HOST_MEMORY_PAGEABLE ? "Pageable" : buffer.get_host_memory()==HOST_MEMORY_PINNED ? "Pinned" : "Zero-Copy";
+		Clock clock;
+		buffer.invalidate();
+		buffer.write_to_device(); // warmup
+		clock.start();
+		for(uint i=0u; i<repetitions; i++) { buffer.invalidate(); buffer.write_to_device(); } // invalidate() prevents skipping of redundant transfers
+		const double bandwidth_write = (double)(size*(ulong)repetitions)*1E-9/clock.stop();
+		buffer.invalidate();
+		buffer.read_from_device(); // warmup
+		clock.start();
+		for(uint i=0u; i<repetitions; i++) { buffer.invalidate(); buffer.read_from_device(); }
+		const double bandwidth_read = (double)(size*(ulong)repetitions)*1E-9/clock.stop();
+		println("| "+alignl(14u, name)+" | "+alignl(58u, "host to device "+to_string(bandwidth_write, 2u)+" GB/s, device to host "+to_string(bandwidth_read, 2u)+" GB/s")+" |");
+	}
+	println("|----------------'------------------------------------------------------------|");
+}
+
 // Only implemented for T = unsigned char
 bool save_voxelized_mesh_to_disk(
 	std::string const& path,
@@ -511,11 +1106,22 @@ private:
 	cl::Kernel cl_kernel;
 	cl::NDRange cl_range_global, cl_range_local;
 	cl::CommandQueue cl_queue;
+	std::shared_ptr<Profiler> profiler; // only exists with PROFILING
+	uint profile_id = 0u;
+	string name; // kernel function name
+	ulong range = 0ull; // number of work items, the global range is this rounded up to a multiple of the workgroup size
+	vector<std::shared_ptr<bool>> device_modified; // modified flags of linked Memory objects by parameter position, nullptr for constants
+	inline void link_modified_flag(const uint position, const std::shared_ptr<bool>& flag) {
+		if(position>=(uint)device_modified.size()) device_modified.resize(position+1u);
+		device_modified[position] = flag;
+	}
 	template<typename T> inline void link_parameter(const uint position, const Memory<T>& memory) {
 		cl_kernel.setArg(position, memory.get_cl_buffer());
+		link_modified_flag(position, memory.get_device_modified());
 	}
 	template<typename T> inline void link_parameter(const uint position, const T& constant) {
 		cl_kernel.setArg(position, sizeof(T), (void*)&constant);
+		link_modified_flag(position, nullptr);
 	}
 	inline void link_parameters(const uint starting_position) {
 		number_of_parameters = max(number_of_parameters, starting_position);
@@ -525,7 +1131,11 @@ private:
 		link_parameter(starting_position, parameter);
 		link_parameters(starting_position+1u, parameters...);
 	}
+	inline void mark_device_modified() { // kernel may write any linked buffer, so host copies are outdated
+		for(uint i=0u; i<(uint)device_modified.size(); i++) if(device_modified[i]) *device_modified[i] = true;
+	}
 	inline void initialize_ranges(const ulong N, const ulong workgroup_size=(ulong)WORKGROUP_SIZE) {
+		range = N;
 		cl_range_global = cl::NDRange(((N+workgroup_size-1ull)/workgroup_size)*workgroup_size); // make global range a multiple of local range
 		cl_range_local = cl::NDRange(workgroup_size);
 	}
@@ -533,16 +1143,22 @@ public:
 	template<class... T> inline Kernel(const Device& device, const ulong N, const string& name, const T&... parameters) { // accepts Memory<T> objects and fundamental data type constants
 		if(!device.is_initialized()) print_error("No Device selected. Call Device constructor.");
 		cl_kernel = cl::Kernel(device.get_cl_program(), name.c_str());
+		this->name = name;
 		link_parameters(number_of_parameters, parameters...); // expand variadic template to link kernel parameters
 		initialize_ranges(N);
 		cl_queue = device.get_cl_queue();
+		profiler = device.profiler;
+		if(profiler) profile_id = profiler->add_kernel(name);
 	}
 	template<class... T> inline Kernel(const Device& device, const ulong N, const uint workgroup_size, const string& name, const T&... parameters) { // accepts Memory<T> objects and fundamental data type constants
 		if(!device.is_initialized()) print_error("No Device selected. Call Device constructor.");
 		cl_kernel = cl::Kernel(device.get_cl_program(), name.c_str());
+		this->name = name;
 		link_parameters(number_of_parameters, parameters...); // expand variadic template to link kernel parameters
 		initialize_ranges(N, (ulong)workgroup_size);
 		cl_queue = device.get_cl_queue();
+		profiler = device.profiler;
+		if(profiler) profile_id = profiler->add_kernel(name);
 	}
 	inline Kernel() {} // default constructor
 	inline uint get_number_of_parameters() const {
@@ -556,10 +1172,82 @@ public:
 		link_parameters(starting_position, parameters...); // expand variadic template to link kernel parameters
 		return *this;
 	}
-	inline Kernel& enqueue_run(const uint t=1u) {
+	inline Kernel& set_range(const ulong N) { // change global range, keeps workgroup size
+		initialize_ranges(N, get_workgroup_size());
+		return *this;
+	}
+	inline uint get_workgroup_size() const {
+		return (uint)cl_range_local[0];
+	}
+	inline Kernel& set_workgroup_size(const uint workgroup_size) {
+		initialize_ranges(range, (ulong)workgroup_size);
+		return *this;
+	}
+	inline bool autotune(const Device& device, const uint repetitions=4u) { // sets the fastest workgroup size of 32 to 256, measured once per device and program and then cached in kernel_cache/; returns true if the kernel was run for measuring, then buffers it writes have to be reinitialized
+#ifndef NO_AUTOTUNE
+		const string key = device.get_program_key()+"\n"+name;
+		uint workgroup_size = 0u;
+		if(load_workgroup_size_from_disk(key, workgroup_size)) {
+			set_workgroup_size(workgroup_size);
+			return false;
+		}
+		const uint max_workgroup_size = (uint)min(cl_kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device.info.cl_device), (size_t)256u);
+		double best_time = max_double;
+		uint best_workgroup_size = get_workgroup_size();
+		mark_device_modified();
+		for(uint candidate=32u; candidate<=max_workgroup_size; candidate*=2u) {
+			set_workgroup_size(candidate);
+			cl_queue.enqueueNDRangeKernel(cl_kernel, cl::NullRange, cl_range_global, cl_range_local); // warmup
+			cl_queue.finish();
+			Clock clock;
+			for(uint i=0u; i<repetitions; i++) cl_queue.enqueueNDRangeKernel(cl_kernel, cl::NullRange, cl_range_global, cl_range_local);
+			cl_queue.finish();
+			const double time = clock.stop();
+			if(time<best_time) {
+				best_time = time;
+				best_workgroup_size = candidate;
+			}
+		}
+		set_workgroup_size(best_workgroup_size);
+		save_workgroup_size_to_disk(key, best_workgroup_size);
+		return true;
+#else // NO_AUTOTUNE
+		return false;
+#endif // NO_AUTOTUNE
+	}
+	inline bool autotuned(const Device& device) const { // true if autotune() only loads the cached workgroup size and doesn't run the kernel
+#ifndef NO_AUTOTUNE
+		uint workgroup_size = 0u;
+		return load_workgroup_size_from_disk(device.get_program_key()+"\n"+name, workgroup_size);
+#else // NO_AUTOTUNE
+		(void)device;
+		return true;
+#endif // NO_AUTOTUNE
+	}
+	inline Kernel& set_queue(const Device& device, const Queue_Type queue_type) { // select which command queue of the Device this kernel is enqueued in
+		cl_queue = device.get_cl_queue(queue_type);
+		return *this;
+	}
+	inline Kernel& set_transfer(const ulong transfer) { // set memory transfer per launch in Byte for bandwidth in profiling table
+		if(profiler) profiler->set_transfer(profile_id, transfer);
+		return *this;
+	}
+	inline Kernel& enqueue_run(const uint t=1u, const vector<cl::Event>* event_waitlist=nullptr, cl::Event* event_returned=nullptr) { // first launch waits for event_waitlist, event_returned completes with the last launch
+		mark_device_modified();
+		const bool explicit_dependencies = event_waitlist_or_null(event_waitlist)!=nullptr||event_returned!=nullptr;
+		vector<cl::Event> previous_launch(1);
 		for(uint i=0u; i<t; i++) {
-			cl_queue.enqueueNDRangeKernel(cl_kernel, cl::NullRange, cl_range_global, cl_range_local);
+			const vector<cl::Event>* waitlist = i==0u ? event_waitlist_or_null(event_waitlist) : explicit_dependencies ? &previous_launch : nullptr; // chain launches, so they stay in order in an out-of-order queue
+			if(profiler||explicit_dependencies) {
+				cl::Event event;
+				cl_queue.enqueueNDRangeKernel(cl_kernel, cl::NullRange, cl_range_global, cl_range_local, waitlist, &event);
+				if(profiler) profiler->record(profile_id, event);
+				previous_launch[0] = event;
+			} else {
+				cl_queue.enqueueNDRangeKernel(cl_kernel, cl::NullRange, cl_range_global, cl_range_local);
+			}
 		}
+		if(event_returned&&t>0u) *event_returned = previous_launch[0];
 		return *this;
 	}
 	inline Kernel& finish_queue() {
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "utilities.hpp"
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+
+class Thread_Pool { // persistent worker threads, run() splits a range of work items into one contiguous chunk per thread and blocks until all chunks are done
+private:
+	vector<thread> workers; // the calling thread of run() processes chunk 0, so there is one worker less than threads
+	std::mutex mutex;
+	std::condition_variable condition_start, condition_finish;
+	std::function<void(const uint, const uint)> task; // processes work items [begin, end)
+	uint items = 0u; // number of work items of the current run()
+	uint pending = 0u; // workers that have not finished their chunk of the current run() yet
+	ulong generation = 0ull; // incremented by every run(), workers start when it changes
+	bool stop = false;
+	inline void execute(const uint chunk) {
+		const ulong threads = (ulong)size();
+		const uint begin=(uint)((ulong)items*(ulong)chunk/threads), end=(uint)((ulong)items*(ulong)(chunk+1u)/threads);
+		if(begin<end) task(begin, end);
+	}
+	inline void work(const uint chunk) {
+		ulong last_generation = 0ull;
+		while(true) {
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				condition_start.wait(lock, [&]() { return stop||generation!=last_generation; });
+				if(stop) return;
+				last_generation = generation;
+			}
+			execute(chunk);
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if(--pending==0u) condition_finish.notify_one();
+			}
+		}
+	}
+public:
+	inline Thread_Pool(const uint threads=max((uint)thread::hardware_concurrency(), 1u)) {
+		for(uint i=1u; i<threads; i++) workers.push_back(thread(&Thread_Pool::work, this, i));
+	}
+	inline ~Thread_Pool() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stop = true;
+		}
+		condition_start.notify_all();
+		for(uint i=0u; i<(uint)workers.size(); i++) workers[i].join();
+	}
+	Thread_Pool(const Thread_Pool&) = delete;
+	Thread_Pool& operator=(const Thread_Pool&) = delete;
+	inline uint size() const { // number of threads including the calling thread
+		return (uint)workers.size()+1u;
+	}
+	inline void run(const uint items, const std::function<void(const uint, const uint)>& task) { // task(begin, end) is called once per thread with a contiguous range of work items
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			this->task = task;
+			this->items = items;
+			pending = (uint)workers.size();
+			generation++;
+		}
+		condition_start.notify_all();
+		execute(0u);
+		std::unique_lock<std::mutex> lock(mutex);
+		condition_finish.wait(lock, [&]() { return pending==0u; });
+	}
+};
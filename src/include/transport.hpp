@@ -0,0 +1,37 @@
+#pragma once
+
+#include "utilities.hpp"
+
+class Transport { // moves data between the ranks (processes) of a distributed simulation, each rank owns a slab of the lattice along z; the base class is a single rank without communication
+public:
+	virtual ~Transport() {}
+	virtual uint rank() const { return 0u; }
+	virtual uint ranks() const { return 1u; }
+	virtual string name() const { return "single process"; }
+	virtual void send(const uint destination, const void* data, const ulong bytes) { (void)destination; (void)data; (void)bytes; } // blocks until data may be reused
+	virtual void receive(const uint source, void* data, const ulong bytes) { (void)source; (void)data; (void)bytes; } // blocks until data has arrived
+	virtual void exchange(const void* send_below, const void* send_above, void* receive_below, void* receive_above, const ulong bytes) { // send to rank-1 and rank+1 and receive from both at the same time, ranks are periodic
+		(void)send_below; (void)send_above; (void)receive_below; (void)receive_above; (void)bytes;
+	}
+	virtual void barrier() {}
+	inline void sum(double* values, const uint count) { // values are replaced by their sum over all ranks, has to be called by all ranks
+		if(ranks()==1u) return;
+		if(rank()==0u) {
+			vector<double> received(count);
+			for(uint r=1u; r<ranks(); r++) {
+				receive(r, received.data(), (ulong)count*sizeof(double));
+				for(uint i=0u; i<count; i++) values[i] += received[i];
+			}
+			for(uint r=1u; r<ranks(); r++) send(r, values, (ulong)count*sizeof(double));
+		} else {
+			send(0u, values, (ulong)count*sizeof(double));
+			receive(0u, values, (ulong)count*sizeof(double));
+		}
+	}
+	inline double sum(double value) {
+		sum(&value, 1u);
+		return value;
+	}
+};
+
+Transport& get_transport(); // implemented in transport.cpp: MPI with MPI_TRANSPORT, shared memory between local processes if the environment variable FLUIDX3D_RANKS is larger than 1, otherwise a single rank
@@ -5,48 +5,33 @@ Info info;
 
 void Info::initialize(LBM* lbm) {
 	this->lbm = lbm;
-	device_allocation = lbm->get_velocity_set()*sizeof(fpxx)+17u; // lattice.set()*fi + flags + rho + 3*u
-	device_transfer = lbm->get_velocity_set()*(2u*sizeof(fpxx))+17u; // lattice.set()*(2*fi) + flags + rho + 3*u
-#ifndef UPDATE_FIELDS
-	device_transfer -= 16u; // rho, u
-#endif // UPDATE_FIELDS
-#if defined(SRT)
-	collision = "SRT";
-#elif defined(TRT)
-	collision = "TRT";
-#endif // TRT
-#if defined(FP16S)
-	collision += " (FP32/FP16S)";
-#elif defined(FP16C)
-	collision += " (FP32/FP16C)";
-#else // FP32
-	collision += " (FP32/FP32)";
-#endif // FP32
-#if defined(MOVING_BOUNDARIES)||defined(SURFACE)||defined(TEMPERATURE)
-	device_transfer += (lbm->get_velocity_set()-1u)*1u; // neighbor flags have to be loaded
-#endif // MOVING_BOUNDARIES, SURFACE or TEMPERATURE
-#ifdef SURFACE
-	host_allocation += 4u; // phi
-	device_allocation += 12u; // mass, massex, phi
-	device_transfer += (1u+(2u*lbm->get_velocity_set()-1u)*sizeof(fpxx)+8u+(lbm->get_velocity_set()-1u)*4u) + 1u + 1u + (4u+lbm->get_velocity_set()+4u+4u+4u); // surface_0 (flags, fi, mass, massex), surface_1 (flags), surface_2 (flags), surface_3 (rho, flags, mass, massex, phi)
-#endif // SURFACE
-#ifdef TEMPERATURE
-	host_allocation += 4u; // T
-	device_allocation += 7u*sizeof(fpxx)+4u; // gi, T
-	device_transfer += 7u*2u*sizeof(fpxx)+4u; // 2*gi, T
-#endif // TEMPERATURE
-	cpu_mem_required = (uint)((ulong)lbm->get_N()*(ulong)host_allocation/1048576ull); // reset to get valid values for consecutive simulations
+	const LBM_Options& options = lbm->get_options();
+	const uint vs=options.velocity_set, fs=options.ddf_bytes();
+	host_allocation = LBM::host_bytes_per_node(options);
+	device_allocation = LBM::device_bytes_per_node(options);
+	device_transfer = vs*(2u*fs)+17u; // lattice.set()*(2*fi) + flags + rho + 3*u
+	if(!options.update_fields) device_transfer -= 16u; // rho, u
+	collision = options.name().substr(options.name().find(' ')+1u); // without velocity set, e.g. "SRT (FP32/FP32)"
+	if(options.neighbor_flags()) device_transfer += (vs-1u)*1u; // neighbor flags have to be loaded
+	if(options.surface) device_transfer += (1u+(2u*vs-1u)*fs+8u+(vs-1u)*4u) + 1u + 1u + (4u+vs+4u+4u+4u); // surface_0 (flags, fi, mass, massex), surface_1 (flags), surface_2 (flags), surface_3 (rho, flags, mass, massex, phi)
+	if(options.temperature) device_transfer += 7u*2u*fs+4u; // 2*gi, T
+	cpu_mem_required = (uint)(lbm->get_host_memory_used()/1048576ull); // reset to get valid values for consecutive simulations
+#ifndef CPU_NATIVE
 	gpu_mem_required = (uint)((ulong)lbm->get_N()*(ulong)device_allocation/1048576ull);
+#else // CPU_NATIVE
+	gpu_mem_required = 0u; // all buffers including fi are host buffers and counted in cpu_mem_required
+#endif // CPU_NATIVE
 }
 void Info::append(const ulong steps, const ulong t) {
 	this->steps = steps; // has to be executed before info.print_initialize()
 	this->steps_last = t; // reset last step count if multiple run() commands are executed consecutively
 	this->runtime_last = runtime; // reset last runtime if multiple run() commands are executed consecutively
 }
-void Info::update(const double dt) {
+void Info::update(const double dt, const ulong n) {
 	this->dt = dt; // exact dt
 	this->dt_smooth = (dt+0.3)/(0.3/dt_smooth+1.0); // smoothed dt
-	this->runtime += dt; // skip first step since it is likely slower than average
+	this->runtime += dt*(double)n; // skip first step since it is likely slower than average
+	this->cpu_mem_required = (uint)(lbm->get_host_memory_used()/1048576ull); // host buffers are allocated on first access and may be deleted, so this changes during the simulation
 }
 double Info::time() const { // returns either elapsed time or remaining time
 	return steps==max_ulong ? runtime : ((double)steps/(double)(lbm->get_t()-steps_last)-1.0)*(runtime-runtime_last); // time estimation on average so far
@@ -83,26 +68,38 @@ void Info::print_logo() const {
 	print("|                                      ");                 print("'", c);        print("                   "+copyright+" Moritz Lehmann |\n");
 }
 void Info::print_initialize() {
+	cpu_mem_required = (uint)(lbm->get_host_memory_used()/1048576ull); // host buffers of fields set in the setup are allocated by now
+	if(lbm->get_ranks()>1u) cpu_mem_required = to_uint(get_transport().sum((double)cpu_mem_required)); // of all ranks
+	if(lbm->get_rank()!=0u) return; // only rank 0 prints setup and progress
 	const float Re = lbm->get_Re_max();
 	println("|-----------------.-----------------------------------------------------------|");
 	println("| Grid Resolution | "+alignr(57u, to_string(lbm->get_Nx())+" x "+to_string(lbm->get_Ny())+" x "+to_string(lbm->get_Nz())+" = "+to_string(lbm->get_N()))+" |");
-	println("| LBM Type        | "+alignr(57u, "D"+to_string(lbm->get_velocity_set()==9?2:3)+"Q"+to_string(lbm->get_velocity_set())+" "+collision)+" |");
+	if(lbm->get_refinements()>0u) {
+		uint levels=0u, boxes=0u; ulong nodes=0ull;
+		const std::function<void(LBM&)> count = [&](LBM& level) { // all nested refinement levels
+			levels = max(levels, level.get_level());
+			for(uint i=0u; i<level.get_refinements(); i++) {
+				boxes++;
+				nodes += level.get_refinement(i).get_N();
+				count(level.get_refinement(i));
+			}
+		};
+		count(*lbm);
+		println("| Refinement      | "+alignr(57u, to_string(boxes)+" boxes, "+to_string(levels)+" finer levels, "+to_string(nodes)+" nodes")+" |");
+	}
+	println("| LBM Type        | "+alignr(57u, lbm->get_options().name())+" |");
 	println("| Memory Usage    | "+alignr(54u,                      "CPU "+to_string(cpu_mem_required)+" MB, GPU "+to_string(gpu_mem_required))+" MB |");
-	println("| Max Alloc Size  | "+alignr(54u,            (uint)((ulong)lbm->get_N()*(ulong)(lbm->get_velocity_set()*sizeof(fpxx))/1048576ull))+" MB |");
+	println("| Max Alloc Size  | "+alignr(57u, (lbm->get_ddf_buffers()>1u ? "DDFs in "+to_string(lbm->get_ddf_buffers())+" buffers, " : "")+to_string((uint)(lbm->get_largest_buffer()/1048576ull))+" MB")+" |");
 	println("| Time Steps      | "+alignr(57u,                                                 (steps==max_ulong ? "infinite" : to_string(steps)))+" |");
 	println("| Kin. Viscosity  | "+alignr(57u,                                                                       to_string(lbm->get_nu(), 8u))+" |");
 	println("| Relaxation Time | "+alignr(57u,                                                                      to_string(lbm->get_tau(), 8u))+" |");
 	println("| Reynolds Number | "+alignr(57u,                            "Re < "+string(Re>=100.0f ? to_string(to_uint(Re)) : to_string(Re, 6u)))+" |");
-#ifdef VOLUME_FORCE
-	println("| Volume Force    | "+alignr(57u, alignr(15u, to_string(lbm->get_fx(), 8u))+","+alignr(15u, to_string(lbm->get_fy(), 8u))+","+alignr(15u, to_string(lbm->get_fz(), 8u)))+" |");
-#endif // VOLUME_FORCE
-#ifdef SURFACE
-	println("| Surface Tension | "+alignr(57u,                                                                    to_string(lbm->get_sigma(), 8u))+" |");
-#endif // SURFACE
-#ifdef TEMPERATURE
-	println("| Thermal Diff.   | "+alignr(57u,                                                                    to_string(lbm->get_alpha(), 8u))+" |");
-	println("| Thermal Exp.    | "+alignr(57u,                                                                     to_string(lbm->get_beta(), 8u))+" |");
-#endif // TEMPERATURE
+	if(lbm->get_options().volume_force) println("| Volume Force    | "+alignr(57u, alignr(15u, to_string(lbm->get_fx(), 8u))+","+alignr(15u, to_string(lbm->get_fy(), 8u))+","+alignr(15u, to_string(lbm->get_fz(), 8u)))+" |");
+	if(lbm->get_options().surface) println("| Surface Tension | "+alignr(57u,                                                                    to_string(lbm->get_sigma(), 8u))+" |");
+	if(lbm->get_options().temperature) {
+		println("| Thermal Diff.   | "+alignr(57u,                                                                    to_string(lbm->get_alpha(), 8u))+" |");
+		println("| Thermal Exp.    | "+alignr(57u,                                                                     to_string(lbm->get_beta(), 8u))+" |");
+	}
 #ifndef CONSOLE_GRAPHICS
 	println("|---------.-------'-----.-----------.-------------------.---------------------|");
 	println("| MLUPs   | Bandwidth   | Steps/s   | Current Step      | "+string(steps==max_ulong?"Elapsed Time  ":"Time Remaining")+"      |");
@@ -113,8 +110,8 @@ void Info::print_initialize() {
 }
 void Info::print_update() const {
 	if(allow_rendering) reprint(
-		"|"+alignr(8, to_uint((double)lbm->get_N()*1E-6/dt_smooth))+" |"+ // MLUPs
-		alignr(7, to_uint((double)lbm->get_N()*(double)device_transfer*1E-9/dt_smooth))+" GB/s |"+ // memory bandwidth
+		"|"+alignr(8, to_uint((double)lbm->get_N_updated()*1E-6/dt_smooth))+" |"+ // MLUPs
+		alignr(7, to_uint((double)lbm->get_N_updated()*(double)device_transfer*1E-9/dt_smooth))+" GB/s |"+ // memory bandwidth
 		alignr(10, to_uint(1.0/dt_smooth))+" | "+ // steps/s
 		(steps==max_ulong ? alignr(17, lbm->get_t()) : alignr(12, lbm->get_t())+" "+print_percentage((double)(lbm->get_t()-steps_last)/(double)steps))+" | "+ // current step
 		alignr(19, print_time(time()))+" |" // either elapsed time or remaining time
@@ -132,5 +129,38 @@ void Info::print_update() const {
 }
 void Info::print_finalize() {
 	allow_rendering = false;
+	if(lbm->get_rank()!=0u) return;
 	println("\n|---------'-------------'-----------'-------------------'---------------------|");
+	print_profile();
+}
+void Info::print_profile() const {
+#ifdef PROFILING
+	const vector<Kernel_Profile> profiles = lbm->get_kernel_profiles();
+	double total = 0.0;
+	for(const Kernel_Profile& profile : profiles) total += profile.time;
+	println("|---------------------.------------.---------------.-------.------------------|");
+	println("| Kernel              | Launches   | Time/Launch   | Share | Bandwidth        |");
+	println("|---------------------+------------+---------------+-------+------------------|");
+	for(const Kernel_Profile& profile : profiles) {
+		const double time = profile.time/(double)profile.launches; // average device execution time per launch in s
+		println("| "+alignl(19u, profile.name)+" | "+alignr(10u, profile.launches)+" | "+alignr(10u, to_string(1E6*time, 1u))+" us | "+alignr(5u, print_percentage(total>0.0 ? profile.time/total : 0.0))+" | "+
+			(profile.transfer>0ull ? alignr(11u, to_uint((double)profile.transfer*1E-9/time))+" GB/s" : alignr(16u, "-"))+" |");
+	}
+	println("|---------------------'------------'---------------'-------'------------------|");
+#endif // PROFILING
+}
+string Info::profile_status() const {
+	string status = "";
+#ifdef PROFILING
+	const vector<Kernel_Profile> profiles = lbm->get_kernel_profiles();
+	double total = 0.0;
+	for(const Kernel_Profile& profile : profiles) total += profile.time;
+	for(const Kernel_Profile& profile : profiles) {
+		const double time = profile.time/(double)profile.launches;
+		status += "Kernel "+profile.name+" = "+to_string(profile.launches)+" launches, "+to_string(1E6*time, 3u)+" us/launch, "+to_string(100.0*(total>0.0 ? profile.time/total : 0.0), 1u)+" % of device time";
+		if(profile.transfer>0ull) status += ", "+to_string((double)profile.transfer*1E-9/time, 1u)+" GB/s";
+		status += "\n";
+	}
+#endif // PROFILING
+	return status;
 }
\ No newline at end of file
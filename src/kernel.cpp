@@ -375,8 +375,9 @@ unsigned screen_height;
 		convert_triangle_interpolated(p0, p1, p2, c0, c1, c2, camera_cache, bitmap, zbuffer, +1); // right eye
 	}
 }
-)+R(kernel void graphics_clear(global uint* bitmap, global int* zbuffer) {
+)+R(kernel void graphics_clear(global uint* bitmap, global int* zbuffer, unsigned w, unsigned h) {
 	const uint n = get_global_id(0);
+	if(n>=w*h) return; // tail of the last workgroup
 	bitmap[n] = def_background_color; // black background = 0x000000u, use 0xFFFFFFu for white background
 	zbuffer[n] = -2147483648;
 }
@@ -669,13 +670,13 @@ unsigned screen_height;
 		}
 		if(xyz.x<-1 || xyz.y<-1 || xyz.z<-1 || xyz.x>=(int)Nx || xyz.y>=(int)Ny || xyz.z>=(int)Nz) break;
 		else if(xyz.x<0 || xyz.y<0 || xyz.z<0 || xyz.x>=(int)Nx-1 || xyz.y>=(int)Ny-1 || xyz.z>=(int)Nz-1) continue;
-		const uint x0 =  (uint)xyz.x; // cube stencil
-		const uint xp =  (uint)xyz.x+1u;
-		const uint y0 =  (uint)xyz.y    *Nx;
-		const uint yp = ((uint)xyz.y+1u)*Nx;
-		const uint z0 =  (uint)xyz.z    *Ny*Nx;
-		const uint zp = ((uint)xyz.z+1u)*Ny*Nx;
-		uint j[8];
+		const uxx x0 =   (uxx)xyz.x; // cube stencil
+		const uxx xp =   (uxx)xyz.x+1u;
+		const uxx y0 =   (uxx)xyz.y    *(uxx)Nx;
+		const uxx yp = ((uxx)xyz.y+1u)*(uxx)Nx;
+		const uxx z0 =   (uxx)xyz.z    *(uxx)(Ny*Nx);
+		const uxx zp = ((uxx)xyz.z+1u)*(uxx)(Ny*Nx);
+		uxx j[8];
 		j[0] = x0+y0+z0; // 000
 		j[1] = xp+y0+z0; // +00
 		j[2] = xp+y0+zp; // +0+
@@ -699,12 +700,12 @@ unsigned screen_height;
 			const float3 p2 = triangles[3u*i+2u]+offset;
 			const float intersect = intersect_triangle_bidirectional(r, p0, p1, p2); // for each triangle, check ray-triangle intersection
 			if(intersect>0.0f) { // intersection found (there can only be exactly 1 intersection)
-				const uint xq =  ((uint)xyz.x   +2u)%Nx; // central difference stencil on each cube corner point
-				const uint xm =  ((uint)xyz.x+Nx-1u)%Nx;
-				const uint yq = (((uint)xyz.y   +2u)%Ny)*Nx;
-				const uint ym = (((uint)xyz.y+Ny-1u)%Ny)*Nx;
-				const uint zq = (((uint)xyz.z   +2u)%Nz)*Ny*Nx;
-				const uint zm = (((uint)xyz.z+Nz-1u)%Nz)*Ny*Nx;
+				const uxx xq =  ((uint)xyz.x   +2u)%Nx; // central difference stencil on each cube corner point
+				const uxx xm =  ((uint)xyz.x+Nx-1u)%Nx;
+				const uxx yq = (uxx)(((uint)xyz.y   +2u)%Ny)*(uxx)Nx;
+				const uxx ym = (uxx)(((uint)xyz.y+Ny-1u)%Ny)*(uxx)Nx;
+				const uxx zq = (uxx)(((uint)xyz.z   +2u)%Nz)*(uxx)(Ny*Nx);
+				const uxx zm = (uxx)(((uint)xyz.z+Nz-1u)%Nz)*(uxx)(Ny*Nx);
 				float3 n[8];
 				n[0] = (float3)(phi[xm+y0+z0]-v[1], phi[x0+ym+z0]-v[4], phi[x0+y0+zm]-v[3]); // central difference stencil on each cube corner point
 				n[1] = (float3)(v[0]-phi[xq+y0+z0], phi[xp+ym+z0]-v[5], phi[xp+y0+zm]-v[2]); // compute normal vectors from gradient
@@ -798,16 +799,28 @@ unsigned screen_height;
 
 // ################################################## LBM code ##################################################
 
-)+R(uint3 coordinates(const uint n) { // disassemble 1D index to 3D coordinates (n -> x,y,z)
-	const uint t = n%(def_Nx*def_Ny);
-	return (uint3)(t%def_Nx, t/def_Nx, n/(def_Nx*def_Ny)); // n = x+(y+z*Ny)*Nx
+)+R(uint3 coordinates(const uxx n) { // disassemble 1D index to 3D coordinates (n -> x,y,z)
+	const uint t = (uint)(n%(uxx)(def_Nx*def_Ny));
+	return (uint3)(t%def_Nx, t/def_Nx, (uint)(n/(uxx)(def_Nx*def_Ny))); // n = x+(y+z*Ny)*Nx
 }
-)+R(uint index(const uint3 xyz) { // assemble 1D index from 3D coordinates (x,y,z -> n)
-	return xyz.x+(xyz.y+xyz.z*def_Ny)*def_Nx; // n = x+(y+z*Ny)*Nx
+)+R(uxx index(const uint3 xyz) { // assemble 1D index from 3D coordinates (x,y,z -> n)
+	return (uxx)xyz.x+((uxx)xyz.y+(uxx)xyz.z*(uxx)def_Ny)*(uxx)def_Nx; // n = x+(y+z*Ny)*Nx
 }
 )+R(float3 position(const uint3 xyz) { // 3D coordinates to 3D position
 	return (float3)((float)xyz.x+0.5f-0.5f*(float)def_Nx, (float)xyz.y+0.5f-0.5f*(float)def_Ny, (float)xyz.z+0.5f-0.5f*(float)def_Nz);
 }
+)+"#ifdef SPARSE_BRICKS"+R(
+)+R(uint3 brick_origin(const uint b) { // first node of brick b, bricks are numbered like nodes
+	return (uint3)((b%def_bricks_x)*def_brick_x, ((b/def_bricks_x)%def_bricks_y)*def_brick_y, (b/(def_bricks_x*def_bricks_y))*def_brick_z);
+}
+)+R(uxx brick_node(const global uint* bricks, const global uint* active_bricks) { // node of this work item in the list of active bricks, def_N if there is none
+	const uint i = get_global_id(0)/def_brick_nodes; // position in the list of active bricks
+	if(i>=active_bricks[0]) return (uxx)def_N; // with SURFACE, kernels are launched over all bricks
+	const uint m = get_global_id(0)%def_brick_nodes; // node in the brick, consecutive work items are consecutive along x
+	const uint3 xyz = brick_origin(bricks[i])+(uint3)(m%def_brick_x, (m/def_brick_x)%def_brick_y, m/(def_brick_x*def_brick_y));
+	return xyz.x<def_Nx&&xyz.y<def_Ny&&xyz.z<def_Nz ? index(xyz) : (uxx)def_N; // bricks at the upper lattice boundaries may be cut off
+}
+)+"#endif"+R( // SPARSE_BRICKS
 )+R(float half_to_float_custom(const ushort x) { // custom 16-bit floating-point format, 1-4-11, exp-15, +-1.99951168, +-6.10351562E-5, +-2.98023224E-8, 3.612 digits
 	const uint e = (x&0x7800)>>11; // exponent
 	const uint m = (x&0x07FF)<<12; // mantissa
@@ -821,7 +834,7 @@ unsigned screen_height;
 	return (b&0x80000000)>>16 | (e>112)*((((e-112)<<11)&0x7800)|m>>12) | ((e<113)&(e>100))*((((0x007FF800+m)>>(124-e))+1)>>1); // sign : normalized : denormalized (assume [-2,2])
 }
 
-)+R(ulong index_f(const uint n, const uint i) { // 64-bit indexing (maximum 2^32 lattice points (1624^3 lattice resolution, 225GB)
+)+R(ulong index_f(const uxx n, const uint i) { // 64-bit indexing of DDFs, n itself is 64-bit only if the lattice has more than 2^32 points
 	return (ulong)i*def_N+(ulong)n; // SoA (229% faster on GPU)
 }
 )+R(float c(const uint i) { // avoid constant keyword by encapsulating data in function which gets inlined by compiler
@@ -864,20 +877,57 @@ unsigned screen_height;
 	};
 	return w[i];
 }
-)+R(void calculate_indices(const uint n, uint* x0, uint* xp, uint* xm, uint* y0, uint* yp, uint* ym, uint* z0, uint* zp, uint* zm) {
+)+R(void calculate_indices(const uxx n, uxx* x0, uxx* xp, uxx* xm, uxx* y0, uxx* yp, uxx* ym, uxx* z0, uxx* zp, uxx* zm) {
+)+"#ifndef INDEXING_WRAP"+R( // generic path with modulo
 	const uint3 xyz = coordinates(n);
-	*x0 =   xyz.x; // pre-calculate indices (periodic boundary conditions)
-	*xp =  (xyz.x       +1u)%def_Nx;
-	*xm =  (xyz.x+def_Nx-1u)%def_Nx;
-	*y0 =   xyz.y                   *def_Nx;
-	*yp = ((xyz.y       +1u)%def_Ny)*def_Nx;
-	*ym = ((xyz.y+def_Ny-1u)%def_Ny)*def_Nx;
-	*z0 =   xyz.z                   *def_Ny*def_Nx;
-	*zp = ((xyz.z       +1u)%def_Nz)*def_Ny*def_Nx;
-	*zm = ((xyz.z+def_Nz-1u)%def_Nz)*def_Ny*def_Nx;
+	*x0 =        xyz.x; // pre-calculate indices (periodic boundary conditions)
+	*xp =       (xyz.x       +1u)%def_Nx;
+	*xm =       (xyz.x+def_Nx-1u)%def_Nx;
+	*y0 = (uxx)(  xyz.y                   *def_Nx);
+	*yp = (uxx)(((xyz.y       +1u)%def_Ny)*def_Nx);
+	*ym = (uxx)(((xyz.y+def_Ny-1u)%def_Ny)*def_Nx);
+	*z0 = (uxx)(  xyz.z                   )*(uxx)(def_Ny*def_Nx);
+	*zp = (uxx)(( xyz.z       +1u)%def_Nz)*(uxx)(def_Ny*def_Nx);
+	*zm = (uxx)(( xyz.z+def_Nz-1u)%def_Nz)*(uxx)(def_Ny*def_Nx);
+)+"#else"+R( // INDEXING_WRAP
+)+"#ifdef INDEXING_POW2"+R( // Nx and Ny are powers of 2, coordinates with shifts and wrap around with bit masks
+	const uint x = (uint)n&(def_Nx-1u);
+)+"#ifdef D2Q9"+R( // D2Q9 has Nz=1, so n = x+y*Nx
+	const uint y = (uint)(n>>def_Lx);
+)+"#else"+R( // D3Q15/D3Q19/D3Q27
+	const uint y = (uint)(n>>def_Lx)&(def_Ny-1u), z = (uint)(n>>(def_Lx+def_Ly));
+)+"#endif"+R( // D3Q15/D3Q19/D3Q27
+	*x0 = (uxx)x;
+	*xp = (uxx)((x+1u)&(def_Nx-1u));
+	*xm = (uxx)((x-1u)&(def_Nx-1u));
+	*y0 = (uxx)y<<def_Lx;
+	*yp = (uxx)((y+1u)&(def_Ny-1u))<<def_Lx;
+	*ym = (uxx)((y-1u)&(def_Ny-1u))<<def_Lx;
+)+"#else"+R( // INDEXING_POW2, branchless wrap with select instead of modulo, only the boundary nodes take the other side
+)+"#ifdef D2Q9"+R( // D2Q9 has Nz=1, so n = x+y*Nx
+	const uint y = (uint)(n/(uxx)def_Nx), x = (uint)n-y*def_Nx;
+)+"#else"+R( // D3Q15/D3Q19/D3Q27
+	const uxx z = n/(uxx)(def_Nx*def_Ny);
+	const uint t = (uint)(n-z*(uxx)(def_Nx*def_Ny)), y = t/def_Nx, x = t-y*def_Nx;
+)+"#endif"+R( // D3Q15/D3Q19/D3Q27
+	*x0 = (uxx)x;
+	*xp = (uxx)(x+1u<def_Nx ? x+1u : 0u);
+	*xm = (uxx)(x>0u ? x-1u : def_Nx-1u);
+	*y0 = (uxx)(y*def_Nx);
+	*yp = (uxx)((y+1u<def_Ny ? y+1u : 0u)*def_Nx);
+	*ym = (uxx)((y>0u ? y-1u : def_Ny-1u)*def_Nx);
+)+"#endif"+R( // INDEXING_POW2
+)+"#ifdef D2Q9"+R( // skip z entirely
+	*z0 = *zp = *zm = (uxx)0;
+)+"#else"+R( // D3Q15/D3Q19/D3Q27
+	*z0 = (uxx)z*(uxx)(def_Ny*def_Nx);
+	*zp = (uxx)(z+1u<def_Nz ? z+1u : 0u)*(uxx)(def_Ny*def_Nx);
+	*zm = (uxx)(z>0u ? z-1u : def_Nz-1u)*(uxx)(def_Ny*def_Nx);
+)+"#endif"+R( // D3Q15/D3Q19/D3Q27
+)+"#endif"+R( // INDEXING_WRAP
 } // calculate_indices()
-)+R(void neighbors(const uint n, uint* j) { // calculate neighbor indices
-	uint x0, xp, xm, y0, yp, ym, z0, zp, zm;
+)+R(void neighbors(const uxx n, uxx* j) { // calculate neighbor indices
+	uxx x0, xp, xm, y0, yp, ym, z0, zp, zm;
 	calculate_indices(n, &x0, &xp, &xm, &y0, &yp, &ym, &z0, &zp, &zm);
 	j[0] = n;
 )+"#if defined(D2Q9)"+R(
@@ -1015,9 +1065,49 @@ unsigned screen_height;
 } // calculate_forcing_terms()
 )+"#endif"+R( // VOLUME_FORCE
 
+)+"#ifdef RLB"+R(
+)+R(void calculate_f_neq_regularized(const float* fhn, const float* feq, const float ux, const float uy, const float uz, float* fneq) { // project non-equilibrium DDFs onto Hermite polynomials up to third order, third order moments are reconstructed recursively from the stress tensor and all other (ghost) moments are discarded (recursive regularization, Malaspinas 2015)
+	float Jx=0.0f, Jy=0.0f, Jz=0.0f, Pxx=0.0f, Pyy=0.0f, Pzz=0.0f, Pxy=0.0f, Pxz=0.0f, Pyz=0.0f; // non-equilibrium momentum and stress tensor
+	for(uint i=1u; i<def_velocity_set; i++) {
+		const float fneqi = fhn[i]-feq[i];
+		const float cxi=c(i), cyi=c(def_velocity_set+i), czi=c(2u*def_velocity_set+i);
+		Jx += cxi*fneqi; Jy += cyi*fneqi; Jz += czi*fneqi; // Jneq is not zero with Guo forcing, keeping it conserves momentum the same way as SRT
+		Pxx += cxi*cxi*fneqi; Pxy += cxi*cyi*fneqi; Pxz += cxi*czi*fneqi;
+		Pyy += cyi*cyi*fneqi; Pyz += cyi*czi*fneqi; Pzz += czi*czi*fneqi;
+	}
+	const float Axxy=fma(2.0f*ux, Pxy, uy*Pxx), Axyy=fma(2.0f*uy, Pxy, ux*Pyy); // third order non-equilibrium moments a3 = u*a2+a2*u+..., the D2Q9 lattice only supports xxy and xyy
+)+"#ifndef D2Q9"+R(
+	const float Axxz=fma(2.0f*ux, Pxz, uz*Pxx), Axzz=fma(2.0f*uz, Pxz, ux*Pzz), Ayyz=fma(2.0f*uy, Pyz, uz*Pyy), Ayzz=fma(2.0f*uz, Pyz, uy*Pzz), Axyz=fma(ux, Pyz, fma(uy, Pxz, uz*Pxy));
+)+"#endif"+R( // D2Q9
+)+"#if defined(D3Q15)"+R( // D3Q15 only supports (xxy+yzz), (xzz+xyy), (yyz+xxz) and xyz, weighted with 1/(8*cs^6) and 1/(3*cs^6) by the discrete norms
+	const float Sxy=3.375f*(Axxy+Ayzz), Sxz=3.375f*(Axzz+Axyy), Syz=3.375f*(Ayyz+Axxz), Sxyz=9.0f*Axyz;
+)+"#elif defined(D3Q19)"+R( // D3Q19 only supports the sums (weight 1/(2*cs^6)) and differences (weight 1/(6*cs^6)) of pairs of third order moments, not xyz
+	const float Sxy=13.5f*(Axxy+Ayzz), Sxz=13.5f*(Axzz+Axyy), Syz=13.5f*(Ayyz+Axxz), Dxy=4.5f*(Axxy-Ayzz), Dxz=4.5f*(Axzz-Axyy), Dyz=4.5f*(Ayyz-Axxz);
+)+"#endif"+R( // D3Q19
+	const float trP = -1.5f*(Pxx+Pyy+Pzz); // -1/(2*cs^2)*trace
+	Pxy*=9.0f; Pxz*=9.0f; Pyz*=9.0f; // 2*1/(2*cs^4)
+	Pxx*=4.5f; Pyy*=4.5f; Pzz*=4.5f; // 1/(2*cs^4)
+	for(uint i=0u; i<def_velocity_set; i++) { // loop is entirely unrolled by compiler, no unnecessary FLOPs are happening
+		const float cxi=c(i), cyi=c(def_velocity_set+i), czi=c(2u*def_velocity_set+i);
+		const float Hxx=cxi*cxi-0.33333334f, Hyy=cyi*cyi-0.33333334f, Hzz=czi*czi-0.33333334f; // second order Hermite polynomials without off-diagonal ones
+		float fneqi = 3.0f*(cxi*Jx+cyi*Jy+czi*Jz)+cxi*(cxi*Pxx+cyi*Pxy+czi*Pxz)+cyi*(cyi*Pyy+czi*Pyz)+czi*czi*Pzz+trP; // first and second order
+)+"#if defined(D2Q9)"+R(
+		fneqi += 13.5f*(cyi*Hxx*Axxy+cxi*Hyy*Axyy); // third order, 1/(2*cs^6)
+)+"#elif defined(D3Q15)"+R(
+		fneqi += cyi*(Hxx+Hzz)*Sxy+cxi*(Hzz+Hyy)*Sxz+czi*(Hyy+Hxx)*Syz+cxi*cyi*czi*Sxyz;
+)+"#elif defined(D3Q19)"+R(
+		fneqi += cyi*((Hxx+Hzz)*Sxy+(Hxx-Hzz)*Dxy)+cxi*((Hzz+Hyy)*Sxz+(Hzz-Hyy)*Dxz)+czi*((Hyy+Hxx)*Syz+(Hyy-Hxx)*Dyz);
+)+"#elif defined(D3Q27)"+R(
+		fneqi += 13.5f*(cyi*(Hxx*Axxy+Hzz*Ayzz)+cxi*(Hyy*Axyy+Hzz*Axzz)+czi*(Hxx*Axxz+Hyy*Ayyz))+27.0f*cxi*cyi*czi*Axyz;
+)+"#endif"+R( // D3Q27
+		fneq[i] = w(i)*fneqi;
+	}
+} // calculate_f_neq_regularized()
+)+"#endif"+R( // RLB
+
 )+"#ifdef MOVING_BOUNDARIES"+R(
-)+R(void apply_moving_boundaries(float* fhn, const uint* j, const global float* u, const global uchar* flags) { // apply Dirichlet velocity boundaries if necessary (Krueger p.180, rho_solid=1)
-	uint ji; // reads velocities of only neighboring boundary nodes, which do not change during simulation
+)+R(void apply_moving_boundaries(float* fhn, const uxx* j, const global float* u, const global uchar* flags) { // apply Dirichlet velocity boundaries if necessary (Krueger p.180, rho_solid=1)
+	uxx ji; // reads velocities of only neighboring boundary nodes, which do not change during simulation
 	for(uint i=1u; i<def_velocity_set; i+=2u) { // loop is entirely unrolled by compiler, no unnecessary memory access is happening
 		const float w6 = -6.0f*w(i); // w(i) = w(i+1) if i is odd
 		ji = j[i+1u]; fhn[i   ] = (flags[ji]&TYPE_BO)==TYPE_S ? fma(w6, c(i+1u)*u[ji]+c(def_velocity_set+i+1u)*u[def_N+(ulong)ji]+c(2u*def_velocity_set+i+1u)*u[2ul*def_N+(ulong)ji], fhn[i   ]) : fhn[i   ]; // boundary : regular
@@ -1027,8 +1117,8 @@ unsigned screen_height;
 )+"#endif"+R( // MOVING_BOUNDARIES
 
 )+"#ifdef SURFACE"+R(
-)+R(void average_neighbors_non_gas(const uint n, const global float* rho, const global float* u, const global uchar* flags, float* rhon, float* uxn, float* uyn, float* uzn) { // calculate average density and velocity of neighbors of node n
-	uint j[def_velocity_set]; // neighbor indices
+)+R(void average_neighbors_non_gas(const uxx n, const global float* rho, const global float* u, const global uchar* flags, float* rhon, float* uxn, float* uyn, float* uzn) { // calculate average density and velocity of neighbors of node n
+	uxx j[def_velocity_set]; // neighbor indices
 	neighbors(n, j); // calculate neighbor indices
 	float rhot=0.0f, uxt=0.0f, uyt=0.0f, uzt=0.0f, counter=0.0f; // average over all fluid/interface neighbors
 	for(uint i=1u; i<def_velocity_set; i++) {
@@ -1046,8 +1136,8 @@ unsigned screen_height;
 	*uyn  = counter>0.0f ? uyt /counter : 0.0f;
 	*uzn  = counter>0.0f ? uzt /counter : 0.0f;
 }
-)+R(void average_neighbors_fluid(const uint n, const global float* rho, const global float* u, const global uchar* flags, float* rhon, float* uxn, float* uyn, float* uzn) { // calculate average density and velocity of neighbors of node n
-	uint j[def_velocity_set]; // neighbor indices
+)+R(void average_neighbors_fluid(const uxx n, const global float* rho, const global float* u, const global uchar* flags, float* rhon, float* uxn, float* uyn, float* uzn) { // calculate average density and velocity of neighbors of node n
+	uxx j[def_velocity_set]; // neighbor indices
 	neighbors(n, j); // calculate neighbor indices
 	float rhot=0.0f, uxt=0.0f, uyt=0.0f, uzt=0.0f, counter=0.0f; // average over all fluid/interface neighbors
 	for(uint i=1u; i<def_velocity_set; i++) {
@@ -1105,13 +1195,13 @@ unsigned screen_height;
 	const float d = plic_cube_reduced(V, n1, n2, n3); // calculate PLIC with reduced symmetry
 	return l*copysign(0.5f-d, V0-0.5f); // rescale result and apply symmetry for V0>0.5
 }
-)+R(void get_remaining_neighbor_phij(const uint n, const float* phit, const global float* phi, float* phij) { // get remaining phij for D3Q27 neighborhood
+)+R(void get_remaining_neighbor_phij(const uxx n, const float* phit, const global float* phi, float* phij) { // get remaining phij for D3Q27 neighborhood
 )+"#ifndef D3Q27"+R(
-	uint x0, xp, xm, y0, yp, ym, z0, zp, zm;
+	uxx x0, xp, xm, y0, yp, ym, z0, zp, zm;
 	calculate_indices(n, &x0, &xp, &xm, &y0, &yp, &ym, &z0, &zp, &zm);
 )+"#endif"+R( // D3Q27
 )+"#if defined(D3Q15)"+R(
-	uint j[12]; // calculate neighbor indices
+	uxx j[12]; // calculate neighbor indices
 	j[ 0] = xp+yp+z0; j[ 1] = xm+ym+z0; // ++0 --0
 	j[ 2] = xp+y0+zp; j[ 3] = xm+y0+zm; // +0+ -0-
 	j[ 4] = x0+yp+zp; j[ 5] = x0+ym+zm; // 0++ 0--
@@ -1122,7 +1212,7 @@ unsigned screen_height;
 	for(uint i=7u; i<19u; i++) phij[i] = phi[j[i-7u]];
 	for(uint i=19u; i<27u; i++) phij[i] = phit[i-12u];
 )+"#elif defined(D3Q19)"+R(
-	uint j[8]; // calculate remaining neighbor indices
+	uxx j[8]; // calculate remaining neighbor indices
 	j[0] = xp+yp+zp; j[1] = xm+ym+zm; // +++ ---
 	j[2] = xp+yp+zm; j[3] = xm+ym+zp; // ++- --+
 	j[4] = xp+ym+zp; j[5] = xm+yp+zm; // +-+ -+-
@@ -1141,7 +1231,7 @@ unsigned screen_height;
 	};
 	return c[i];
 }
-)+R(float curvature_calculation(const uint n, const float* phit, const global float* phi) { // calculate surface curvature, always use D3Q27 stencil here, source: https://doi.org/10.3390/computation10020021
+)+R(float curvature_calculation(const uxx n, const float* phit, const global float* phi) { // calculate surface curvature, always use D3Q27 stencil here, source: https://doi.org/10.3390/computation10020021
 )+"#ifndef D2Q9"+R(
 	float phij[27];
 	get_remaining_neighbor_phij(n, phit, phi, phij); // complete neighborhood from whatever velocity set is selected to D3Q27
@@ -1206,8 +1296,8 @@ unsigned screen_height;
 )+"#endif"+R( // SURFACE
 
 )+"#ifdef TEMPERATURE"+R(
-)+R(void neighbors_D3Q7(const uint n, uint* j) { // calculate neighbor indices
-	uint x0, xp, xm, y0, yp, ym, z0, zp, zm;
+)+R(void neighbors_D3Q7(const uxx n, uxx* j) { // calculate neighbor indices
+	uxx x0, xp, xm, y0, yp, ym, z0, zp, zm;
 	calculate_indices(n, &x0, &xp, &xm, &y0, &yp, &ym, &z0, &zp, &zm);
 	j[0] = n;
 	j[1] = xp+y0+z0; j[2] = xm+y0+z0; // +00 -00
@@ -1221,14 +1311,14 @@ unsigned screen_height;
 	geq[3] = fma(wsT3, uy, wsTm1); geq[4] = fma(wsT3, -uy, wsTm1); // 0+0 0-0
 	geq[5] = fma(wsT3, uz, wsTm1); geq[6] = fma(wsT3, -uz, wsTm1); // 00+ 00-
 }
-)+R(void load_g(const uint n, float* ghn, const global fpxx* gi, const uint* j7, const ulong t) {
+)+R(void load_g(const uxx n, float* ghn, const global fpxx* gi, const uxx* j7, const ulong t) {
 	ghn[0] = load(gi, index_f(n, 0u)); // Esoteric-Pull
 	for(uint i=1u; i<7u; i+=2u) {
 		ghn[i   ] = load(gi, index_f(n    , t%2ul ? i    : i+1u));
 		ghn[i+1u] = load(gi, index_f(j7[i], t%2ul ? i+1u : i   ));
 	}
 }
-)+R(void store_g(const uint n, const float* ghn, global fpxx* gi, const uint* j7, const ulong t) {
+)+R(void store_g(const uxx n, const float* ghn, global fpxx* gi, const uxx* j7, const ulong t) {
 	store(gi, index_f(n, 0u), ghn[0]); // Esoteric-Pull
 	for(uint i=1u; i<7u; i+=2u) {
 		store(gi, index_f(j7[i], t%2ul ? i+1u : i   ), ghn[i   ]);
@@ -1237,32 +1327,48 @@ unsigned screen_height;
 }
 )+"#endif"+R( // TEMPERATURE
 
-)+R(void load_f(const uint n, float* fhn, const global fpxx* fi, const uint* j, const ulong t) {
-	fhn[0] = load(fi, index_f(n, 0u)); // Esoteric-Pull
+)+R(float load_fi(const global fpxx* fi fi_split_parameters, const uxx n, const uint i) { // load DDF i of node n, with DDF_SPLIT the DDFs are split by direction across fi and the buffers after it
+)+"#ifndef DDF_SPLIT"+R(
+	return load(fi, index_f(n, i));
+)+"#else"+R( // DDF_SPLIT
+	const global fpxx* buffers[def_ddf_buffers] = { fi fi_split_arguments }; // i is known at compile time in the unrolled loops, so the buffer is selected without any memory access
+	return load(buffers[i/def_ddf_per_buffer], index_f(n, i%def_ddf_per_buffer));
+)+"#endif"+R( // DDF_SPLIT
+}
+)+R(void store_fi(global fpxx* fi fi_split_parameters, const uxx n, const uint i, const float x) { // store DDF i of node n
+)+"#ifndef DDF_SPLIT"+R(
+	store(fi, index_f(n, i), x);
+)+"#else"+R( // DDF_SPLIT
+	global fpxx* buffers[def_ddf_buffers] = { fi fi_split_arguments };
+	store(buffers[i/def_ddf_per_buffer], index_f(n, i%def_ddf_per_buffer), x);
+)+"#endif"+R( // DDF_SPLIT
+}
+)+R(void load_f(const uxx n, float* fhn, const global fpxx* fi fi_split_parameters, const uxx* j, const ulong t) {
+	fhn[0] = load_fi(fi fi_split_arguments, n, 0u); // Esoteric-Pull
 	for(uint i=1u; i<def_velocity_set; i+=2u) {
-		fhn[i   ] = load(fi, index_f(n   , t%2ul ? i    : i+1u));
-		fhn[i+1u] = load(fi, index_f(j[i], t%2ul ? i+1u : i   ));
+		fhn[i   ] = load_fi(fi fi_split_arguments, n   , t%2ul ? i    : i+1u);
+		fhn[i+1u] = load_fi(fi fi_split_arguments, j[i], t%2ul ? i+1u : i   );
 	}
 }
-)+R(void store_f(const uint n, const float* fhn, global fpxx* fi, const uint* j, const ulong t) {
-	store(fi, index_f(n, 0u), fhn[0]); // Esoteric-Pull
+)+R(void store_f(const uxx n, const float* fhn, global fpxx* fi fi_split_parameters, const uxx* j, const ulong t) {
+	store_fi(fi fi_split_arguments, n, 0u, fhn[0]); // Esoteric-Pull
 	for(uint i=1u; i<def_velocity_set; i+=2u) {
-		store(fi, index_f(j[i], t%2ul ? i+1u : i   ), fhn[i   ]);
-		store(fi, index_f(n   , t%2ul ? i    : i+1u), fhn[i+1u]);
+		store_fi(fi fi_split_arguments, j[i], t%2ul ? i+1u : i   , fhn[i   ]);
+		store_fi(fi fi_split_arguments, n   , t%2ul ? i    : i+1u, fhn[i+1u]);
 	}
 }
 
 )+"#ifdef SURFACE"+R(
-)+R(void load_f_outgoing(const uint n, float* fon, const global fpxx* fi, const uint* j, const ulong t) { // load outgoing DDFs, even: 1:1 like stream-out odd, odd: 1:1 like stream-out even
+)+R(void load_f_outgoing(const uxx n, float* fon, const global fpxx* fi fi_split_parameters, const uxx* j, const ulong t) { // load outgoing DDFs, even: 1:1 like stream-out odd, odd: 1:1 like stream-out even
 	for(uint i=1u; i<def_velocity_set; i+=2u) { // Esoteric-Pull
-		fon[i   ] = load(fi, index_f(j[i], t%2ul ? i    : i+1u));
-		fon[i+1u] = load(fi, index_f(n   , t%2ul ? i+1u : i   ));
+		fon[i   ] = load_fi(fi fi_split_arguments, j[i], t%2ul ? i    : i+1u);
+		fon[i+1u] = load_fi(fi fi_split_arguments, n   , t%2ul ? i+1u : i   );
 	}
 }
-)+R(void store_f_reconstructed(const uint n, const float* fhn, global fpxx* fi, const uint* j, const ulong t, const uchar* flagsj_su) { // store reconstructed gas DDFs, even: 1:1 like stream-in even, odd: 1:1 like stream-in odd
+)+R(void store_f_reconstructed(const uxx n, const float* fhn, global fpxx* fi fi_split_parameters, const uxx* j, const ulong t, const uchar* flagsj_su) { // store reconstructed gas DDFs, even: 1:1 like stream-in even, odd: 1:1 like stream-in odd
 	for(uint i=1u; i<def_velocity_set; i+=2u) { // Esoteric-Pull
-		if(flagsj_su[i+1u]==TYPE_G) store(fi, index_f(n   , t%2ul ? i    : i+1u), fhn[i   ]); // only store reconstructed gas DDFs to locations from which
-		if(flagsj_su[i   ]==TYPE_G) store(fi, index_f(j[i], t%2ul ? i+1u : i   ), fhn[i+1u]); // they are going to be streamed in during next stream_collide()
+		if(flagsj_su[i+1u]==TYPE_G) store_fi(fi fi_split_arguments, n   , t%2ul ? i    : i+1u, fhn[i   ]); // only store reconstructed gas DDFs to locations from which
+		if(flagsj_su[i   ]==TYPE_G) store_fi(fi fi_split_arguments, j[i], t%2ul ? i+1u : i   , fhn[i+1u]); // they are going to be streamed in during next stream_collide()
 	}
 }
 )+"#endif"+R( // SURFACE
@@ -1276,11 +1382,13 @@ unsigned screen_height;
 )+"#ifdef TEMPERATURE"+R(
 	, global fpxx* gi, const global float* T // argument order is important
 )+"#endif"+R( // TEMPERATURE
+	fi_split_parameters // DDF buffers after fi, empty without DDF_SPLIT, argument order is important
 )+") {"+R( // initialize()
-	const uint n = get_global_id(0); // n = x+(y+z*Ny)*Nx
+	const uxx n = get_global_id(0); // n = x+(y+z*Ny)*Nx
+	if(n>=(uxx)def_N) return; // tail of the last workgroup, N does not have to be a multiple of the workgroup size
 	uchar flagsn = flags[n];
 	const uchar flagsn_bo = flagsn&TYPE_BO; // extract boundary flags
-	uint j[def_velocity_set]; // neighbor indices
+	uxx j[def_velocity_set]; // neighbor indices
 	neighbors(n, j); // calculate neighbor indices
 	uchar flagsj[def_velocity_set]; // cache neighbor flags for multiple readings
 	for(uint i=1u; i<def_velocity_set; i++) flagsj[i] = flags[j[i]];
@@ -1344,20 +1452,21 @@ unsigned screen_height;
 	{ // separate block to avoid variable name conflicts
 		float geq[7];
 		calculate_g_eq(T[n], u[n], u[def_N+(ulong)n], u[2ul*def_N+(ulong)n], geq);
-		uint j7[7]; // neighbors of D3Q7 subset
+		uxx j7[7]; // neighbors of D3Q7 subset
 		neighbors_D3Q7(n, j7);
 		store_g(n, geq, gi, j7, 1ul);
 	}
 )+"#endif"+R( // TEMPERATURE
-	store_f(n, feq, fi, j, 1ul); // write to fi
+	store_f(n, feq, fi fi_split_arguments, j, 1ul); // write to fi
 } // initialize()
 
 )+"#ifdef MOVING_BOUNDARIES"+R(
 )+R(kernel void update_moving_boundaries(const global float* u, global uchar* flags) { // mark/unmark nodes next to TYPE_S nodes with velocity!=0 with TYPE_MS
-	const uint n = get_global_id(0); // n = x+(y+z*Ny)*Nx
+	const uxx n = get_global_id(0); // n = x+(y+z*Ny)*Nx
+	if(n>=(uxx)def_N) return; // tail of the last workgroup, N does not have to be a multiple of the workgroup size
 	const uchar flagsn = flags[n];
 	const uchar flagsn_bo = flagsn&TYPE_BO; // extract boundary flags
-	uint j[def_velocity_set]; // neighbor indices
+	uxx j[def_velocity_set]; // neighbor indices
 	neighbors(n, j); // calculate neighbor indices
 	uchar flagsj[def_velocity_set]; // cache neighbor flags for multiple readings
 	for(uint i=1u; i<def_velocity_set; i++) flagsj[i] = flags[j[i]];
@@ -1373,6 +1482,26 @@ unsigned screen_height;
 
 
 
+)+"#ifdef SPARSE_BRICKS"+R(
+)+R(kernel void update_bricks(const global uchar* flags, global uint* bricks, volatile global uint* active_bricks) { // list all bricks that contain at least one node which is not solid or gas, the order of the list does not matter
+	const uint b = get_global_id(0);
+	if(b>=(uint)def_bricks) return;
+	const uint3 o = brick_origin(b);
+	const uint x1=min(o.x+def_brick_x, def_Nx), y1=min(o.y+def_brick_y, def_Ny), z1=min(o.z+def_brick_z, def_Nz);
+	for(uint z=o.z; z<z1; z++) {
+		for(uint y=o.y; y<y1; y++) {
+			for(uint x=o.x; x<x1; x++) {
+				const uchar flagsn = flags[index((uint3)(x, y, z))];
+				if((flagsn&TYPE_BO)!=TYPE_S&&(flagsn&TYPE_SU)!=TYPE_G) { // same condition as the early return in stream_collide
+					bricks[atomic_inc(active_bricks)] = b;
+					return;
+				}
+			}
+		}
+	}
+} // update_bricks()
+)+"#endif"+R( // SPARSE_BRICKS
+
 )+R(kernel void stream_collide)+"("+R(global fpxx* fi, global float* rho, global float* u, global uchar* flags, const ulong t, const float fx, const float fy, const float fz // ) { // main LBM kernel
 )+"#ifdef FORCE_FIELD"+R(
 	, global float* F // argument order is important
@@ -1383,17 +1512,33 @@ unsigned screen_height;
 )+"#ifdef TEMPERATURE"+R(
 	, global fpxx* gi, global float* T // argument order is important
 )+"#endif"+R( // TEMPERATURE
+)+"#ifdef DOMAINS"+R(
+	, const ulong n0, const ulong n1 // only nodes [n0, n1) are updated, so boundary layers and interior of the domain can be launched separately
+)+"#endif"+R( // DOMAINS
+)+"#ifdef SPARSE_BRICKS"+R(
+	, const global uint* bricks, const global uint* active_bricks // argument order is important
+)+"#endif"+R( // SPARSE_BRICKS
+	fi_split_parameters // DDF buffers after fi, empty without DDF_SPLIT, argument order is important
 )+") {"+R( // stream_collide()
-	const uint n = get_global_id(0); // n = x+(y+z*Ny)*Nx
+)+"#if defined(SPARSE_BRICKS)"+R(
+	const uxx n = brick_node(bricks, active_bricks); // n = x+(y+z*Ny)*Nx, only nodes in bricks that are not entirely solid or gas
+	if(n>=(uxx)def_N) return; // past the active bricks or outside of the lattice
+)+"#elif !defined(DOMAINS)"+R(
+	const uxx n = get_global_id(0); // n = x+(y+z*Ny)*Nx
+	if(n>=(uxx)def_N) return; // tail of the last workgroup, N does not have to be a multiple of the workgroup size
+)+"#else"+R( // DOMAINS
+	const uxx n = (uxx)n0+get_global_id(0); // n = x+(y+z*Ny)*Nx, halo layers z=0 and z=Nz-1 are never updated
+	if(n>=n1) return; // tail of the last workgroup
+)+"#endif"+R( // DOMAINS
 	const uchar flagsn = flags[n]; // cache flags[n] for multiple readings
 	const uchar flagsn_bo=flagsn&TYPE_BO, flagsn_su=flagsn&TYPE_SU; // extract boundary and surface flags
 	if(flagsn_bo==TYPE_S||flagsn_su==TYPE_G) return; // if node is solid boundary or gas, just return
 
-	uint j[def_velocity_set]; // neighbor indices
+	uxx j[def_velocity_set]; // neighbor indices
 	neighbors(n, j); // calculate neighbor indices
 
 	float fhn[def_velocity_set]; // local DDFs
-	load_f(n, fhn, fi, j, t); // perform streaming (part 2)
+	load_f(n, fhn, fi fi_split_arguments, j, t); // perform streaming (part 2)
 
 )+"#ifdef MOVING_BOUNDARIES"+R(
 	if(flagsn_bo==TYPE_MS) apply_moving_boundaries(fhn, j, u, flags); // apply Dirichlet velocity boundaries if necessary (reads velocities of only neighboring boundary nodes, which do not change during simulation)
@@ -1439,7 +1584,7 @@ unsigned screen_height;
 
 )+"#ifdef TEMPERATURE"+R(
 	{ // separate block to avoid variable name conflicts
-		uint j7[7]; // neighbors of D3Q7 subset
+		uxx j7[7]; // neighbors of D3Q7 subset
 		neighbors_D3Q7(n, j7);
 		float ghn[7]; // read from gA and stream to gh (D3Q7 subset, periodic boundary conditions)
 		load_g(n, ghn, gi, j7, t); // perform streaming (part 2)
@@ -1559,25 +1704,38 @@ unsigned screen_height;
 )+"#else"+R( // EQUILIBRIUM_BOUNDARIES
 	for(uint i=0u; i<def_velocity_set; i++) fhn[i] = flagsn_bo==TYPE_E ? feq[i] : fma(0.5f*wp, feq[i]-fhn[i]+feb[i]-fhb[i], fma(0.5f*wm, feq[i]-feb[i]-fhn[i]+fhb[i], fhn[i]+Fin[i])); // perform collision (TRT)
 )+"#endif"+R( // EQUILIBRIUM_BOUNDARIES
-)+"#endif"+R( // TRT
+)+"#elif defined(RLB)"+R(
+)+"#ifdef VOLUME_FORCE"+R(
+	const float c_tau = fma(w, -0.5f, 1.0f);
+	for(uint i=0u; i<def_velocity_set; i++) Fin[i] *= c_tau;
+)+"#endif"+R( // VOLUME_FORCE
+	float fneq[def_velocity_set]; // regularized non-equilibrium DDFs
+	calculate_f_neq_regularized(fhn, feq, uxn, uyn, uzn, fneq);
+)+"#ifndef EQUILIBRIUM_BOUNDARIES"+R(
+	for(uint i=0u; i<def_velocity_set; i++) fhn[i] = fma(1.0f-w, fneq[i], feq[i]+Fin[i]); // perform collision (RLB)
+)+"#else"+R( // EQUILIBRIUM_BOUNDARIES
+	for(uint i=0u; i<def_velocity_set; i++) fhn[i] = flagsn_bo==TYPE_E ? feq[i] : fma(1.0f-w, fneq[i], feq[i]+Fin[i]); // perform collision (RLB)
+)+"#endif"+R( // EQUILIBRIUM_BOUNDARIES
+)+"#endif"+R( // RLB
 
-	store_f(n, fhn, fi, j, t); // perform streaming (part 1)
+	store_f(n, fhn, fi fi_split_arguments, j, t); // perform streaming (part 1)
 } // stream_collide()
 
 )+"#ifdef SURFACE"+R(
-)+R(kernel void surface_0(global fpxx* fi, const global float* rho, const global float* u, const global uchar* flags, global float* mass, const global float* massex, const global float* phi, const ulong t, const float fx, const float fy, const float fz) { // capture outgoing DDFs before streaming
-	const uint n = get_global_id(0); // n = x+(y+z*Ny)*Nx
+)+R(kernel void surface_0(global fpxx* fi, const global float* rho, const global float* u, const global uchar* flags, global float* mass, const global float* massex, const global float* phi, const ulong t, const float fx, const float fy, const float fz fi_split_parameters) { // capture outgoing DDFs before streaming
+	const uxx n = get_global_id(0); // n = x+(y+z*Ny)*Nx
+	if(n>=(uxx)def_N) return; // tail of the last workgroup, N does not have to be a multiple of the workgroup size
 	const uchar flagsn = flags[n]; // cache flags[n] for multiple readings
 	const uchar flagsn_bo=flagsn&TYPE_BO, flagsn_su=flagsn&TYPE_SU; // extract boundary and surface flags
 	if(flagsn_bo==TYPE_S||flagsn_su==TYPE_G) return; // node processed here is fluid or interface
 
-	uint j[def_velocity_set]; // neighbor indices
+	uxx j[def_velocity_set]; // neighbor indices
 	neighbors(n, j); // calculate neighbor indices
 	float fhn[def_velocity_set]; // incoming DDFs
-	load_f(n, fhn, fi, j, t); // load incoming DDFs
+	load_f(n, fhn, fi fi_split_arguments, j, t); // load incoming DDFs
 	float fon[def_velocity_set]; // outgoing DDFs
 	fon[0] = fhn[0]; // fon[0] is already loaded in fhn[0]
-	load_f_outgoing(n, fon, fi, j, t); // load outgoing DDFs
+	load_f_outgoing(n, fon, fi fi_split_arguments, j, t); // load outgoing DDFs
 
 	float massn = mass[n];
 	for(uint i=1u; i<def_velocity_set; i++) {
@@ -1622,15 +1780,16 @@ unsigned screen_height;
 			fhn[i   ] = feg[i+1u]-fon[i+1u]+feg[i   ];
 			fhn[i+1u] = feg[i   ]-fon[i   ]+feg[i+1u];
 		}
-		store_f_reconstructed(n, fhn, fi, j, t, flagsj_su); // store reconstructed gas DDFs that are streamed in during the following stream_collide()
+		store_f_reconstructed(n, fhn, fi fi_split_arguments, j, t, flagsj_su); // store reconstructed gas DDFs that are streamed in during the following stream_collide()
 	}
 	mass[n] = massn;
 }
 )+R(kernel void surface_1(global uchar* flags) { // prevent neighbors from interface->fluid nodes to become/be gas nodes
-	const uint n = get_global_id(0); // n = x+(y+z*Ny)*Nx
+	const uxx n = get_global_id(0); // n = x+(y+z*Ny)*Nx
+	if(n>=(uxx)def_N) return; // tail of the last workgroup, N does not have to be a multiple of the workgroup size
 	const uchar flagsn_sus = flags[n]&(TYPE_SU|TYPE_S); // extract SURFACE flags
 	if(flagsn_sus==TYPE_IF) { // flag interface->fluid is set
-		uint j[def_velocity_set]; // neighbor indices
+		uxx j[def_velocity_set]; // neighbor indices
 		neighbors(n, j); // calculate neighbor indices
 		for(uint i=1u; i<def_velocity_set; i++) {
 			const uchar flagsji = flags[j[i]];
@@ -1641,19 +1800,20 @@ unsigned screen_height;
 		}
 	}
 } // possible types at the end of surface_1(): TYPE_F / TYPE_I / TYPE_G / TYPE_IF / TYPE_IG / TYPE_GI
-)+R(kernel void surface_2(global fpxx* fi, const global float* rho, const global float* u, global uchar* flags, const ulong t) {  // apply flag changes and calculate excess mass
-	const uint n = get_global_id(0); // n = x+(y+z*Ny)*Nx
+)+R(kernel void surface_2(global fpxx* fi, const global float* rho, const global float* u, global uchar* flags, const ulong t fi_split_parameters) {  // apply flag changes and calculate excess mass
+	const uxx n = get_global_id(0); // n = x+(y+z*Ny)*Nx
+	if(n>=(uxx)def_N) return; // tail of the last workgroup, N does not have to be a multiple of the workgroup size
 	const uchar flagsn_sus = flags[n]&(TYPE_SU|TYPE_S); // extract SURFACE flags
 	if(flagsn_sus==TYPE_GI) { // initialize the fi of gas nodes that should become interface
 		float rhon, uxn, uyn, uzn; // average over all fluid/interface neighbors
 		average_neighbors_non_gas(n, rho, u, flags, &rhon, &uxn, &uyn, &uzn); // get average rho/u from all fluid/interface neighbors
 		float feq[def_velocity_set];
 		calculate_f_eq(rhon, uxn, uyn, uzn, feq); // calculate equilibrium DDFs
-		uint j[def_velocity_set];
+		uxx j[def_velocity_set];
 		neighbors(n, j);
-		store_f(n, feq, fi, j, t); // write feq to fi in video memory
+		store_f(n, feq, fi fi_split_arguments, j, t); // write feq to fi in video memory
 	} else if(flagsn_sus==TYPE_IG) { // flag interface->gas is set
-		uint j[def_velocity_set]; // neighbor indices
+		uxx j[def_velocity_set]; // neighbor indices
 		neighbors(n, j); // calculate neighbor indices
 		for(uint i=1u; i<def_velocity_set; i++) {
 			const uchar flagsji = flags[j[i]];
@@ -1666,7 +1826,8 @@ unsigned screen_height;
 	}
 } // possible types at the end of surface_2(): TYPE_F / TYPE_I / TYPE_G / TYPE_IF / TYPE_IG / TYPE_GI
 )+R(kernel void surface_3(const global float* rho, global uchar* flags, global float* mass, global float* massex, global float* phi) { // apply flag changes and calculate excess mass
-	const uint n = get_global_id(0); // n = x+(y+z*Ny)*Nx
+	const uxx n = get_global_id(0); // n = x+(y+z*Ny)*Nx
+	if(n>=(uxx)def_N) return; // tail of the last workgroup, N does not have to be a multiple of the workgroup size
 	const uchar flagsn_sus = flags[n]&(TYPE_SU|TYPE_S); // extract SURFACE flags
 	if(flagsn_sus&TYPE_S) return;
 	const float rhon = rho[n]; // density of node n
@@ -1701,7 +1862,7 @@ unsigned screen_height;
 		massn = clamp(massn, 0.0f, rhon);
 		phin = calculate_phi(rhon, massn, TYPE_I); // calculate fill level for next step (only necessary for interface nodes)
 	}
-	uint j[def_velocity_set]; // neighbor indices
+	uxx j[def_velocity_set]; // neighbor indices
 	neighbors(n, j); // calculate neighbor indices
 	uint counter = 0u; // count (fluid|interface) neighbors
 	for(uint i=1u; i<def_velocity_set; i++) { // simple model: distribute excess mass equally to all interface and fluid neighbors
@@ -1723,16 +1884,25 @@ unsigned screen_height;
 )+"#ifdef TEMPERATURE"+R(
 	, const global fpxx* gi, global float* T // argument order is important
 )+"#endif"+R( // TEMPERATURE
+)+"#ifdef SPARSE_BRICKS"+R(
+	, const global uint* bricks, const global uint* active_bricks // argument order is important
+)+"#endif"+R( // SPARSE_BRICKS
+	fi_split_parameters // DDF buffers after fi, empty without DDF_SPLIT, argument order is important
 )+") {"+R( // update_fields()
-	const uint n = get_global_id(0); // n = x+(y+z*Ny)*Nx
+)+"#ifdef SPARSE_BRICKS"+R(
+	const uxx n = brick_node(bricks, active_bricks); // n = x+(y+z*Ny)*Nx
+)+"#else"+R( // SPARSE_BRICKS
+	const uxx n = get_global_id(0); // n = x+(y+z*Ny)*Nx
+)+"#endif"+R( // SPARSE_BRICKS
+	if(n>=(uxx)def_N) return; // tail of the last workgroup, N does not have to be a multiple of the workgroup size
 	const uchar flagsn = flags[n];
 	const uchar flagsn_bo=flagsn&TYPE_BO, flagsn_su=flagsn&TYPE_SU; // extract boundary and surface flags
 	if(flagsn_bo==TYPE_S||flagsn_su==TYPE_G) return; // don't update fields for boundary or gas lattice points
 
-	uint j[def_velocity_set]; // neighbor indices
+	uxx j[def_velocity_set]; // neighbor indices
 	neighbors(n, j); // calculate neighbor indices
 	float fhn[def_velocity_set]; // local DDFs
-	load_f(n, fhn, fi, j, t); // perform streaming (part 2)
+	load_f(n, fhn, fi fi_split_arguments, j, t); // perform streaming (part 2)
 
 )+"#ifdef MOVING_BOUNDARIES"+R(
 	if(flagsn_bo==TYPE_MS) apply_moving_boundaries(fhn, j, u, flags); // apply Dirichlet velocity boundaries if necessary (reads velocities of only neighboring boundary nodes, which do not change during simulation)
@@ -1752,7 +1922,7 @@ unsigned screen_height;
 
 )+"#ifdef TEMPERATURE"+R(
 	{ // separate block to avoid variable name conflicts
-		uint j7[7]; // neighbors of D3Q7 subset
+		uxx j7[7]; // neighbors of D3Q7 subset
 		neighbors_D3Q7(n, j7);
 		float ghn[7]; // read from gA and stream to gh (D3Q7 subset, periodic boundary conditions)
 		load_g(n, ghn, gi, j7, t); // perform streaming (part 2)
@@ -1799,14 +1969,92 @@ unsigned screen_height;
 )+"#endif"+R( // EQUILIBRIUM_BOUNDARIES
 } // update_fields()
 
+)+R(kernel void gather_moments(const global fpxx* fi, const global ulong* nodes, global float* moments, const uint count, const ulong t, const float fx, const float fy, const float fz fi_split_parameters) { // density, velocity and non-equilibrium stress tensor of the listed nodes at time step t, for coupling refinement levels
+	const uint k = get_global_id(0); // k-th listed node
+	if(k>=count) return; // tail of the last workgroup
+	const uxx n = (uxx)nodes[k];
+	uxx j[def_velocity_set]; // neighbor indices
+	neighbors(n, j); // calculate neighbor indices
+	float fhn[def_velocity_set]; // local DDFs
+	load_f(n, fhn, fi fi_split_arguments, j, t); // perform streaming (part 2)
+	float rhon, uxn, uyn, uzn;
+	calculate_rho_u(fhn, &rhon, &uxn, &uyn, &uzn); // calculate density and velocity fields from fi
+)+"#ifdef VOLUME_FORCE"+R(
+	const float rho2 = 0.5f/rhon; // same velocity as in stream_collide(), the force field is not included
+	uxn = clamp(fma(fx, rho2, uxn), -def_c, def_c);
+	uyn = clamp(fma(fy, rho2, uyn), -def_c, def_c);
+	uzn = clamp(fma(fz, rho2, uzn), -def_c, def_c);
+)+"#else"+R( // VOLUME_FORCE
+	uxn = clamp(uxn, -def_c, def_c);
+	uyn = clamp(uyn, -def_c, def_c);
+	uzn = clamp(uzn, -def_c, def_c);
+)+"#endif"+R( // VOLUME_FORCE
+	float feq[def_velocity_set]; // equilibrium DDFs
+	calculate_f_eq(rhon, uxn, uyn, uzn, feq);
+	float Pxx=0.0f, Pyy=0.0f, Pzz=0.0f, Pxy=0.0f, Pxz=0.0f, Pyz=0.0f; // non-equilibrium stress tensor
+	for(uint i=1u; i<def_velocity_set; i++) {
+		const float fneqi = fhn[i]-feq[i];
+		const float cxi=c(i), cyi=c(def_velocity_set+i), czi=c(2u*def_velocity_set+i);
+		Pxx += cxi*cxi*fneqi; Pxy += cxi*cyi*fneqi; Pxz += cxi*czi*fneqi;
+		Pyy += cyi*cyi*fneqi; Pyz += cyi*czi*fneqi; Pzz += czi*czi*fneqi;
+	}
+	moments[        k] = rhon; // structure of arrays, like u
+	moments[   count+k] = uxn;
+	moments[2u*count+k] = uyn;
+	moments[3u*count+k] = uzn;
+	moments[4u*count+k] = Pxx;
+	moments[5u*count+k] = Pyy;
+	moments[6u*count+k] = Pzz;
+	moments[7u*count+k] = Pxy;
+	moments[8u*count+k] = Pxz;
+	moments[9u*count+k] = Pyz;
+} // gather_moments()
+)+R(kernel void scatter_moments(global fpxx* fi, const global ulong* nodes, const global float* moments, const uint count, const ulong t, const float fx, const float fy, const float fz, const float scale fi_split_parameters) { // overwrite the DDFs that the listed nodes stream out in time step t-1 with post-collision DDFs rebuilt from (interpolated) moments of the other refinement level, scale = (1-w)*tau/tau_other
+	const uint k = get_global_id(0); // k-th listed node
+	if(k>=count) return; // tail of the last workgroup
+	const uxx n = (uxx)nodes[k];
+	const float rhon=moments[k], uxn=moments[count+k], uyn=moments[2u*count+k], uzn=moments[3u*count+k];
+	const float Pxx=scale*moments[4u*count+k], Pyy=scale*moments[5u*count+k], Pzz=scale*moments[6u*count+k], Pxy=scale*moments[7u*count+k], Pxz=scale*moments[8u*count+k], Pyz=scale*moments[9u*count+k];
+	float fhn[def_velocity_set]; // post-collision DDFs
+	calculate_f_eq(rhon, uxn, uyn, uzn, fhn);
+)+"#ifdef VOLUME_FORCE"+R(
+	float Fin[def_velocity_set]; // forcing terms
+	calculate_forcing_terms(uxn, uyn, uzn, fx, fy, fz, Fin);
+)+"#endif"+R( // VOLUME_FORCE
+	const float trP = -1.5f*(Pxx+Pyy+Pzz);
+	for(uint i=0u; i<def_velocity_set; i++) { // regularized non-equilibrium part from the second order Hermite moment only
+		const float cxi=c(i), cyi=c(def_velocity_set+i), czi=c(2u*def_velocity_set+i);
+		fhn[i] += w(i)*(4.5f*(cxi*cxi*Pxx+cyi*cyi*Pyy+czi*czi*Pzz)+9.0f*(cxi*cyi*Pxy+cxi*czi*Pxz+cyi*czi*Pyz)+trP);
+)+"#ifdef VOLUME_FORCE"+R(
+		fhn[i] += (1.0f-0.5f*def_w)*Fin[i]-(1.0f-def_w)*1.5f*w(i)*(cxi*fx+cyi*fy+czi*fz); // the non-equilibrium DDFs before collision carry momentum -F/2
+)+"#endif"+R( // VOLUME_FORCE
+	}
+	uxx j[def_velocity_set]; // neighbor indices
+	neighbors(n, j); // calculate neighbor indices
+	store_f(n, fhn, fi fi_split_arguments, j, t); // perform streaming (part 1)
+} // scatter_moments()
+)+R(kernel void interpolate_ghosts(const global float* last, const global float* next, const global uint* sources, const global float* weights, global float* ghost, const uint C, const uint G, const float a) { // moments of the C coarse nodes in the previous (last) and current (next) time step, interpolated in space and by a in time to the G ghost nodes of the finer level
+	const uint g = get_global_id(0); // g-th ghost node
+	if(g>=G) return; // tail of the last workgroup
+	for(uint m=0u; m<10u; m++) {
+		float x = 0.0f;
+		for(uint k=0u; k<8u; k++) {
+			const uint s = sources[8u*g+k]; // 8 coarse nodes per ghost node, unused entries have weight 0
+			x += weights[8u*g+k]*((1.0f-a)*last[m*C+s]+a*next[m*C+s]);
+		}
+		ghost[m*G+g] = x;
+	}
+} // interpolate_ghosts()
+
 )+"#ifdef FORCE_FIELD"+R(
-)+R(kernel void calculate_force_on_boundaries(const global fpxx* fi, const global uchar* flags, const ulong t, global float* F) { // calculate force from the fluid on solid boundaries from fi directly
-	const uint n = get_global_id(0); // n = x+(y+z*Ny)*Nx
+)+R(kernel void calculate_force_on_boundaries(const global fpxx* fi, const global uchar* flags, const ulong t, global float* F fi_split_parameters) { // calculate force from the fluid on solid boundaries from fi directly
+	const uxx n = get_global_id(0); // n = x+(y+z*Ny)*Nx
+	if(n>=(uxx)def_N) return; // tail of the last workgroup, N does not have to be a multiple of the workgroup size
 	if((flags[n]&TYPE_BO)!=TYPE_S) return; // only continue for solid boundary nodes
-	uint j[def_velocity_set]; // neighbor indices
+	uxx j[def_velocity_set]; // neighbor indices
 	neighbors(n, j); // calculate neighbor indices
 	float fhn[def_velocity_set]; // local DDFs
-	load_f(n, fhn, fi, j, t); // perform streaming (part 2)
+	load_f(n, fhn, fi fi_split_arguments, j, t); // perform streaming (part 2)
 	float Fb=1.0f, fx=0.0f, fy=0.0f, fz=0.0f;
 	calculate_rho_u(fhn, &Fb, &fx, &fy, &fz); // abuse calculate_rho_u() method for calculating force
 	F[                 n] = 2.0f*fx*Fb; // 2 times because fi are reflected on solid boundary nodes (bounced-back)
@@ -1817,14 +2065,14 @@ unsigned screen_height;
 
 
 
-)+R(float3 load_u(const uint n, const global float* u) {
+)+R(float3 load_u(const uxx n, const global float* u) {
 	return (float3)(u[n], u[def_N+(ulong)n], u[2ul*def_N+(ulong)n]);
 }
 )+R(float3 closest_u(const float3 p, const global float* u) { // return velocity of closest lattice point to point p
 	const uint x = (uint)(p.x+1.5f*(float)def_Nx)%def_Nx;
 	const uint y = (uint)(p.y+1.5f*(float)def_Ny)%def_Ny;
 	const uint z = (uint)(p.z+1.5f*(float)def_Nz)%def_Nz;
-	const uint n = x+(y+z*def_Ny)*def_Nx;
+	const uxx n = index((uint3)(x, y, z));
 	return load_u(n, u);
 } // closest_u()
 )+R(float3 interpolate_u(const float3 p, const global float* u) { // trilinear interpolation of velocity at point p
@@ -1835,7 +2083,7 @@ unsigned screen_height;
 	for(uint c=0u; c<8u; c++) { // count over eight corner points
 		const uint i=(c&0x04)>>2, j=(c&0x02)>>1, k=c&0x01; // disassemble c into corner indices ijk
 		const uint x=(xb+i)%def_Nx, y=(yb+j)%def_Ny, z=(zb+k)%def_Nz; // calculate corner lattice positions
-		const uint n = x+(y+z*def_Ny)*def_Nx; // calculate lattice linear index
+		const uxx n = index((uint3)(x, y, z)); // calculate lattice linear index
 		un[c] = load_u(n, u); // load velocity from lattice point
 	}
 	return (x0*y0*z0)*un[0]+(x0*y0*z1)*un[1]+(x0*y1*z0)*un[2]+(x0*y1*z1)*un[3]+(x1*y0*z0)*un[4]+(x1*y0*z1)*un[5]+(x1*y1*z0)*un[6]+(x1*y1*z1)*un[7]; // perform trilinear interpolation
@@ -1851,10 +2099,10 @@ unsigned screen_height;
 	const float s2 = 2.0f*(sq(s_xx2)+sq(s_yy2)+sq(s_zz2))+sq(s_xy)+sq(s_xz)+sq(s_yz); // ||s||_2^2
 	return 0.25f*(omega2-s2); // Q = 1/2*(||omega||_2^2-||s||_2^2), addidional factor 1/2 from cental finite differences of velocity
 } // calculate_Q_cached()
-)+R(float calculate_Q(const uint n, const global float* u) { // Q-criterion
-	uint x0, xp, xm, y0, yp, ym, z0, zp, zm;
+)+R(float calculate_Q(const uxx n, const global float* u) { // Q-criterion
+	uxx x0, xp, xm, y0, yp, ym, z0, zp, zm;
 	calculate_indices(n, &x0, &xp, &xm, &y0, &yp, &ym, &z0, &zp, &zm);
-	uint j[6];
+	uxx j[6];
 	j[0] = xp+y0+z0; j[1] = xm+y0+z0; // +00 -00
 	j[2] = x0+yp+z0; j[3] = x0+ym+z0; // 0+0 0-0
 	j[4] = x0+y0+zp; j[5] = x0+y0+zm; // 00+ 00-
@@ -1866,9 +2114,12 @@ unsigned screen_height;
 
 
 )+R(kernel void voxelize_mesh(global uchar* flags, const uchar flag, const global float* p0, const global float* p1, const global float* p2, const uint triangle_number, float x0, float y0, float z0, float x1, float y1, float z1) { // voxelize triangle mesh
-	const uint n = get_global_id(0); // n = x+(y+z*Ny)*Nx
-	const float3 p = position(coordinates(n))+(float3)(0.5f*(float)def_Nx-0.5f, 0.5f*(float)def_Ny-0.5f, 0.5f*(float)def_Nz-0.5f);
-	const bool condition = p.x<x0||p.y<y0||p.z<z0||p.x>x1||p.y>y1||p.z>z1;
+	const uxx n = get_global_id(0); // n = x+(y+z*Ny)*Nx
+	float3 p = position(coordinates(n))+(float3)(0.5f*(float)def_Nx-0.5f, 0.5f*(float)def_Ny-0.5f, 0.5f*(float)def_Nz-0.5f);
+)+"#ifdef DOMAINS"+R(
+	p.z = (float)((coordinates(n).z+def_Oz)%def_Gz); // z position in the whole lattice, halo layers are voxelized like the layers of the neighbor domains
+)+"#endif"+R( // DOMAINS
+	const bool condition = n>=(uxx)def_N||p.x<x0||p.y<y0||p.z<z0||p.x>x1||p.y>y1||p.z>z1; // tail of the last workgroup counts as outside, but has to take part in the barriers
 	volatile local uint workgroup_condition;
 	workgroup_condition = 1u;
 	barrier(CLK_LOCAL_MEM_FENCE);
@@ -1906,7 +2157,7 @@ unsigned screen_height;
 		}
 		barrier(CLK_LOCAL_MEM_FENCE);
 	}
-	if(intersections_0%2u&&intersections_1%2u) flags[n] = flag;
+	if(n<(uxx)def_N&&intersections_0%2u&&intersections_1%2u) flags[n] = flag;
 } // voxelize_mesh()
 
 
@@ -1923,18 +2174,20 @@ unsigned screen_height;
 	screen_width = w;
 	screen_height = h;
 
-	const uint n = get_global_id(0);
+	const uxx n = get_global_id(0);
+	if(n>=(uxx)def_N) return; // tail of the last workgroup
 	const uchar flagsn = flags[n]; // cache flags
 	const uchar flagsn_bo = flagsn&TYPE_BO; // extract boundary flags
 	if(flagsn==0u||flagsn==TYPE_G) return; // don't draw regular fluid nodes
 	//if(flagsn&TYPE_SU) return; // don't draw surface
 	float camera_cache[15]; // cache camera parameters in case the kernel draws more than one shape
 	for(uint i=0u; i<15u; i++) camera_cache[i] = camera[i];
-	uint x0, xp, xm, y0, yp, ym, z0, zp, zm;
+	uxx x0, xp, xm, y0, yp, ym, z0, zp, zm;
 	calculate_indices(n, &x0, &xp, &xm, &y0, &yp, &ym, &z0, &zp, &zm);
 	const uint3 xyz = coordinates(n);
 	const float3 p = position(xyz);
 	const uint c =  // coloring scheme
+		flagsn==(TYPE_S|TYPE_Y) ? COLOR_Y : // covered by a finer refinement level or ghost node of a refinement level
 		flagsn_bo==TYPE_S ? COLOR_S : // solid boundary
 		((flagsn&TYPE_T)&&flagsn_bo==TYPE_E) ? color_mix(COLOR_T, COLOR_E, 0.5f) : // both temperature boundary and equilibrium boundary
 		((flagsn&TYPE_T)&&flagsn_bo==TYPE_MS) ? color_mix(COLOR_T, COLOR_M, 0.5f) : // both temperature boundary and moving boundary
@@ -1989,7 +2242,8 @@ unsigned screen_height;
 )+R(kernel void graphics_field(const global uchar* flags, const global float* u, const global float* camera, global uint* bitmap, global int* zbuffer, unsigned w, unsigned h) {
 	screen_width = w;
 	screen_height = h;
-	const uint n = get_global_id(0);
+	const uxx n = get_global_id(0);
+	if(n>=(uxx)def_N) return; // tail of the last workgroup
 )+"#ifndef MOVING_BOUNDARIES"+R(
 	if(flags[n]&(TYPE_S|TYPE_E|TYPE_I|TYPE_G)) return;
 )+"#else"+R( // EQUILIBRIUM_BOUNDARIES
@@ -2013,10 +2267,10 @@ unsigned screen_height;
 	screen_width = w;
 	screen_height = h;
 
-	const uint n = get_global_id(0);
-	if(n>=(uint)def_N/cb(def_streamline_sparse)) return;
-	const uint z = n/((def_Nx/def_streamline_sparse)*(def_Ny/def_streamline_sparse)); // disassemble 1D index to 3D coordinates
-	const uint t = n%((def_Nx/def_streamline_sparse)*(def_Ny/def_streamline_sparse));
+	const uxx n = get_global_id(0);
+	if(n>=(uxx)def_N/cb(def_streamline_sparse)) return;
+	const uint z = (uint)(n/(uxx)((def_Nx/def_streamline_sparse)*(def_Ny/def_streamline_sparse))); // disassemble 1D index to 3D coordinates
+	const uint t = (uint)(n%(uxx)((def_Nx/def_streamline_sparse)*(def_Ny/def_streamline_sparse)));
 	const uint y = t/(def_Nx/def_streamline_sparse);
 	const uint x = t%(def_Nx/def_streamline_sparse);
 	float3 p = (float)def_streamline_sparse*((float3)((float)x+0.5f, (float)y+0.5f, (float)z+0.5f))-0.5f*((float3)((float)def_Nx, (float)def_Ny, (float)def_Nz));
@@ -2029,7 +2283,7 @@ unsigned screen_height;
 			const uint x = (uint)(p1.x+1.5f*(float)def_Nx)%def_Nx;
 			const uint y = (uint)(p1.y+1.5f*(float)def_Ny)%def_Ny;
 			const uint z = (uint)(p1.z+1.5f*(float)def_Nz)%def_Nz;
-			const uint n = x+(y+z*def_Ny)*def_Nx;
+			const uxx n = index((uint3)(x, y, z));
 			if(flags[n]&(TYPE_S|TYPE_E|TYPE_I|TYPE_G)) return;
 			const float3 un = load_u(n, u); // interpolate_u(p1, u)
 			const float ul = length(un);
@@ -2047,7 +2301,8 @@ unsigned screen_height;
 }
 
 )+R(kernel void graphics_q_field(const global uchar* flags, const global float* u, const global float* camera, global uint* bitmap, global int* zbuffer) {
-	const uint n = get_global_id(0);
+	const uxx n = get_global_id(0);
+	if(n>=(uxx)def_N) return; // tail of the last workgroup
 	if(flags[n]&(TYPE_S|TYPE_E|TYPE_I|TYPE_G)) return;
 	float3 un = load_u(n, u); // cache velocity
 	const float ul = length(un);
@@ -2063,22 +2318,23 @@ unsigned screen_height;
 )+R(kernel void graphics_q(const global uchar* flags, const global float* u, const global float* camera, global uint* bitmap, global int* zbuffer, unsigned w, unsigned h) {
 	screen_width = w;
 	screen_height = h;
-	const uint n = get_global_id(0);
+	const uxx n = get_global_id(0);
+	if(n>=(uxx)def_N) return; // tail of the last workgroup
 	const uint3 xyz = coordinates(n);
 	if(xyz.x==def_Nx-1u || xyz.y==def_Ny-1u || xyz.z==def_Nz-1u) return;
-	const uint x0 =  xyz.x; // cube stencil
-	const uint xp =  xyz.x+1u;
-	const uint y0 =  xyz.y    *def_Nx;
-	const uint yp = (xyz.y+1u)*def_Nx;
-	const uint z0 =  xyz.z    *def_Ny*def_Nx;
-	const uint zp = (xyz.z+1u)*def_Ny*def_Nx;
-	const uint xq =  (xyz.x       +2u)%def_Nx; // central difference stencil on each cube corner point
-	const uint xm =  (xyz.x+def_Nx-1u)%def_Nx;
-	const uint yq = ((xyz.y       +2u)%def_Ny)*def_Nx;
-	const uint ym = ((xyz.y+def_Ny-1u)%def_Ny)*def_Nx;
-	const uint zq = ((xyz.z       +2u)%def_Nz)*def_Ny*def_Nx;
-	const uint zm = ((xyz.z+def_Nz-1u)%def_Nz)*def_Ny*def_Nx;
-	uint j[32];
+	const uxx x0 =   xyz.x; // cube stencil
+	const uxx xp =   xyz.x+1u;
+	const uxx y0 = (uxx)( xyz.y    *def_Nx);
+	const uxx yp = (uxx)((xyz.y+1u)*def_Nx);
+	const uxx z0 = (uxx)  xyz.z    *(uxx)(def_Ny*def_Nx);
+	const uxx zp = (uxx)( xyz.z+1u)*(uxx)(def_Ny*def_Nx);
+	const uxx xq =   (xyz.x       +2u)%def_Nx; // central difference stencil on each cube corner point
+	const uxx xm =   (xyz.x+def_Nx-1u)%def_Nx;
+	const uxx yq = (uxx)(((xyz.y       +2u)%def_Ny)*def_Nx);
+	const uxx ym = (uxx)(((xyz.y+def_Ny-1u)%def_Ny)*def_Nx);
+	const uxx zq = (uxx)(( xyz.z       +2u)%def_Nz)*(uxx)(def_Ny*def_Nx);
+	const uxx zm = (uxx)(( xyz.z+def_Nz-1u)%def_Nz)*(uxx)(def_Ny*def_Nx);
+	uxx j[32];
 	j[ 0] = n       ; // 000 // cube stencil
 	j[ 1] = xp+y0+z0; // +00
 	j[ 2] = xp+y0+zp; // +0+
@@ -2166,16 +2422,17 @@ unsigned screen_height;
 )+R(kernel void graphics_rasterize_phi(const global float* phi, const global float* camera, global uint* bitmap, global int* zbuffer, unsigned w, unsigned h) { // marching cubes
 	screen_width = w;
 	screen_height = h;
-	const uint n = get_global_id(0);
+	const uxx n = get_global_id(0);
+	if(n>=(uxx)def_N) return; // tail of the last workgroup
 	const uint3 xyz = coordinates(n);
 	if(xyz.x==def_Nx-1u || xyz.y==def_Ny-1u || xyz.z==def_Nz-1u) return;
-	uint j[8];
-	const uint x0 =  xyz.x; // cube stencil
-	const uint xp =  xyz.x+1u;
-	const uint y0 =  xyz.y    *def_Nx;
-	const uint yp = (xyz.y+1u)*def_Nx;
-	const uint z0 =  xyz.z    *def_Ny*def_Nx;
-	const uint zp = (xyz.z+1u)*def_Ny*def_Nx;
+	uxx j[8];
+	const uxx x0 =   xyz.x; // cube stencil
+	const uxx xp =   xyz.x+1u;
+	const uxx y0 = (uxx)( xyz.y    *def_Nx);
+	const uxx yp = (uxx)((xyz.y+1u)*def_Nx);
+	const uxx z0 = (uxx)  xyz.z    *(uxx)(def_Ny*def_Nx);
+	const uxx zp = (uxx)( xyz.z+1u)*(uxx)(def_Ny*def_Nx);
 	j[0] = n       ; // 000
 	j[1] = xp+y0+z0; // +00
 	j[2] = xp+y0+zp; // +0+
@@ -2244,6 +2501,7 @@ unsigned screen_height;
 	const int lx=lid%tile_width, ly=lid/tile_width;
 	const int tx=(gid/lsi)%tiles_x, ty=(gid/lsi)/tiles_x;
 	const int x=tx*tile_width+lx, y=ty*tile_height+ly;
+	if(x>=(int)screen_width||y>=(int)screen_height) return; // tail of the last workgroup
 	const uint n = x+y*screen_width;
 	float camera_cache[15]; // cache parameters in case the kernel draws more than one shape
 	for(uint i=0u; i<15u; i++) camera_cache[i] = camera[i];
@@ -8,7 +8,22 @@ using namespace std::literals;
 
 Units units; // for unit conversion
 
-LBM::LBM(const uint Nx, const uint Ny, const uint Nz, const float nu, const float fx, const float fy, const float fz, const float sigma, const float alpha, const float beta) { // compiles OpenCL C code and allocates memory
+LBM::LBM(const uint Nx, const uint Ny, const uint Nz, const float nu, const float fx, const float fy, const float fz, const float sigma, const float alpha, const float beta) // with the options of defines.hpp
+	: LBM(LBM_Options(), Nx, Ny, Nz, nu, fx, fy, fz, sigma, alpha, beta) {
+}
+LBM::LBM(const LBM_Options& options, const uint Nx, const uint Ny, const uint Nz, const float nu, const float fx, const float fy, const float fz, const float sigma, const float alpha, const float beta) // compiles OpenCL C code for the options and allocates memory
+	: LBM(nullptr, options, Nx, Ny, Nz, nu, fx, fy, fz, sigma, alpha, beta) {
+}
+LBM::LBM(const LBM* parent, const LBM_Options& options, const uint Nx, const uint Ny, const uint Nz, const float nu, const float fx, const float fy, const float fz, const float sigma, const float alpha, const float beta) { // finer levels run on the device of their parent
+	this->options = options;
+	this->options.with_implied();
+	velocity_set = options.velocity_set;
+	ddf_per_buffer = velocity_set; // all DDFs are in fi, unless they are split on a single device below
+	dimensions = this->options.dimensions();
+#ifdef SPARSE_BRICKS
+	brick_y = dimensions==2u ? 16u : 4u;
+	brick_z = dimensions==2u ? 1u : 4u;
+#endif // SPARSE_BRICKS
 	this->Nx = Nx; this->Ny = Ny; this->Nz = Nz;
 	this->nu = nu;
 	this->fx = fx; this->fy = fy; this->fz = fz;
@@ -16,17 +31,54 @@ LBM::LBM(const uint Nx, const uint Ny, const uint Nz, const float nu, const floa
 	this->alpha = alpha;
 	this->beta = beta;
 	sanity_checks_constructor();
-	string opencl_c_code;
 #ifdef GRAPHICS
 	graphics = Graphics(this);
-	opencl_c_code = device_defines()+graphics.device_defines()+get_opencl_c_code();
+#endif // GRAPHICS
+	Transport& transport = get_transport();
+	rank = transport.rank();
+	ranks = transport.ranks();
+#ifndef CPU_NATIVE
+	const vector<Device_Info> devices = parent ? vector<Device_Info>{ parent->device.info } : select_lbm_devices();
+	Dz = (uint)devices.size();
+	if(ranks>1u&&(uint)transport.sum((double)Dz)!=ranks*Dz) print_error("All ranks have to select the same number of devices.");
+	const uint D = ranks*Dz; // number of domains across all ranks
+	if(D==1u) {
+		ddf_buffers = this->options.ddf_buffers;
+		if(ddf_buffers==0u) { // fewest DDF buffers that each fit into the maximum buffer size of the device
+			ddf_buffers = 1u;
+			while(ddf_buffers<velocity_set&&get_N()*(ulong)(this->options.ddf_per_buffer(ddf_buffers)*this->options.ddf_bytes())>(ulong)devices[0].max_global_buffer*1048576ull) ddf_buffers++;
+		}
+		ddf_per_buffer = this->options.ddf_per_buffer(ddf_buffers);
+		ddf_buffers = (velocity_set+ddf_per_buffer-1u)/ddf_per_buffer; // for example 19 directions in 4 buffers are 5+5+5+4, 19 in 6 are 4+4+4+4+3, which also fits into 5 buffers
+		if(ddf_buffers>1u) print_info("DDFs are split into "+to_string(ddf_buffers)+" buffers of "+to_string(ddf_per_buffer)+" directions ("+to_string((uint)(get_N()*(ulong)(ddf_per_buffer*this->options.ddf_bytes())/1048576ull))+" MB each) to fit into the maximum buffer size of "+to_string(devices[0].max_global_buffer)+" MB.");
+#ifdef GRAPHICS
+		const string opencl_c_code = device_defines()+graphics.device_defines()+get_opencl_c_code();
 #else // GRAPHICS
-	opencl_c_code = device_defines()+get_opencl_c_code();
+		const string opencl_c_code = device_defines()+get_opencl_c_code();
 #endif // GRAPHICS
-	int select_device = -1;
-	if((int)main_arguments.size()>0) select_device = to_int(main_arguments[0]);
-	const vector<Device_Info>& devices = get_devices();
-	this->device = Device(select_device<0 ? select_device_with_most_flops(devices) : select_device_with_id((uint)select_device, devices), opencl_c_code);
+		this->device = parent ? Device(parent->device, opencl_c_code) : Device(devices[0], opencl_c_code); // a finer level only compiles its own program, buffers and queues are shared with its parent
+	} else { // each device gets a slab of layers along z, so its halo layers are contiguous in memory
+		if(dimensions==2u) print_error("D2Q9 has only one layer along z and can't be split across "+to_string(D)+" devices. Select only one device.");
+		if(D>Nz) print_error("Lattice with "+to_string(Nz)+" layers along z can't be split across "+to_string(D)+" devices. Select fewer devices.");
+		if(this->options.neighbor_flags()) print_error("The MOVING_BOUNDARIES, SURFACE and TEMPERATURE extensions don't support splitting the lattice across several devices. Select only one device.");
+		if(this->options.ddf_buffers>1u) print_error("Splitting the DDFs into several buffers is not supported when the lattice is split across several devices, there each device only holds a slab. Set options.ddf_buffers to 0 or select only one device.");
+#ifdef GRAPHICS
+		print_error("Graphics can't render a lattice that is split across several devices. Disable graphics or select only one device.");
+#endif // GRAPHICS
+		domains = new Domain[Dz];
+		for(uint d=0u; d<Dz; d++) {
+			const uint g = rank*Dz+d; // domain index across all ranks
+			domains[d].z0 = (uint)((ulong)Nz*(ulong)g/(ulong)D);
+			domains[d].Nz = (uint)((ulong)Nz*(ulong)(g+1u)/(ulong)D)-domains[d].z0;
+			domains[d].device = Device(devices[d], device_defines(&domains[d])+get_opencl_c_code());
+		}
+		print_info("Lattice is split along z into "+to_string(D)+" domains of "+to_string(domains[0].Nz)+(domains[Dz-1u].Nz!=domains[0].Nz ? " to "+to_string(domains[Dz-1u].Nz) : "")+" layers, one per device"+(ranks>1u ? ", "+to_string(Dz)+" on each of "+to_string(ranks)+" ranks" : "")+".");
+	}
+#else // CPU_NATIVE
+	(void)parent; // the native CPU backend has no device to share
+	if(ranks>1u) print_error("The native CPU backend can't split the lattice across several ranks. Comment out \"#define CPU_NATIVE\" in defines.hpp or start a single process.");
+	print_info("Native CPU backend uses "+to_string(thread_pool.size())+" threads, no OpenCL device is selected.");
+#endif // CPU_NATIVE
 	allocate(device); // lbm first
 #ifdef GRAPHICS
 	graphics.allocate(device, true); // graphics after lbm
@@ -34,7 +86,14 @@ LBM::LBM(const uint Nx, const uint Ny, const uint Nz, const float nu, const floa
 	info.initialize(this);
 }
 LBM::~LBM() {
-	info.print_finalize();
+	if(level==0u) info.print_finalize(); // finer levels are deleted together with level 0
+	for(Refinement* refinement : refinements) {
+		LBM* finer = refinement->lbm;
+		delete refinement; // buffers and kernels on the device of the finer level are released before it
+		delete finer;
+	}
+	delete[] domains;
+	delete[] fi_split;
 }
 
 #ifdef GRAPHICS
@@ -49,184 +108,741 @@ void LBM::do_reallocate_graphics()
 	{
 		graphics.allocate(device, false);
 		schedule_graphics_reallocation = false;
+		for(Refinement* refinement : refinements) { // finer levels render frames of the same size
+			refinement->lbm->schedule_graphics_reallocation = true;
+			refinement->lbm->do_reallocate_graphics();
+		}
 	}
 }
 #endif // GRAPHICS
 
-void LBM::sanity_checks_constructor() { // sanity checks on grid resolution and parameters
-	if(Nx*Ny*Nz==0u || (Nx*Ny*Nz)%WORKGROUP_SIZE!=0u) { // sanity checks for simulation box size
-		int ws=WORKGROUP_SIZE;
-		string error = "";
-		if(Nx*Ny*Nz!=0u) {
-			error += "Lattice point number is not a multiple of \"WORKGROUP_SIZE\": ("+to_string(Nx)+"x"+to_string(Ny)+"x"+to_string(Nz)+") % "+to_string(ws)+" = "+to_string((Nx*Ny*Nz)%ws)+". ";
-		} else {
-			error += "Lattice point number is 0: "+to_string(Nx)+"x"+to_string(Ny)+"x"+to_string(Nz)+" = 0. ";
-		}
-		bool suggestion = false; // find the closest suitable box size based on minimum percentage correction for each component
-		Nx = max(Nx, 1u); // box dimensions need to be at least 1 for the algorithm to work
-		Ny = max(Ny, 1u);
-		Nz = max(Nz, 1u);
-		const int ix=(int)Nx, iy=(int)Ny, iz=(int)Nz, imax=max(max(ix,iy),iz); // integer variables for later arithmetic
-		while(ws>=32&&!suggestion) { // if search is unsuccessful, try again with threadblock size halved, until it is 32
-			for(int k=1; k<imax&&!suggestion; k++) { // slowly extend search range k
-				for(int kx=0; abs(kx)<=k*ix/imax&&!suggestion; kx=kx<=0?1-kx:-kx) { // 0  1 -1  2 -2  3 -3 ...
-					for(int ky=0; abs(ky)<=k*iy/imax&&!suggestion; ky=ky<=0?1-ky:-ky) { // 0  1 -1  2 -2  3 -3 ...
-						for(int kz=0; abs(kz)<=k*iz/imax&&!suggestion; kz=kz<=0?1-kz:-kz) { // 0  1 -1  2 -2  3 -3 ...
-							if(((ix+kx)*(iy+ky)*(iz+kz))%ws==0 && ix+kx>0 && iy+ky>0 && iz+kz>0) { // criteria for suitable box size
-								Nx = (uint)(ix+kx); // set new box size
-								Ny = (uint)(iy+ky);
-								Nz = (uint)(iz+kz);
-								suggestion = true; // possible box size found -> exit all loops
-							}
-						}
-					}
-				}
-			}
-			if(!suggestion) ws /= 2;
-		}
-		if(suggestion && ws==WORKGROUP_SIZE) {
-			error += "Change grid resolution in setup.cpp to ("+to_string(Nx)+"x"+to_string(Ny)+"x"+to_string(Nz)+").";
-		} else {
-			if(suggestion&&ws!=WORKGROUP_SIZE) {
-				error += "Change \"WORKGROUP_SIZE\" to "+to_string(ws)+", then ("+to_string(Nx)+"x"+to_string(Ny)+"x"+to_string(Nz)+") would be a suitable grid resolution.";
-			} else {
-				error += "Grid resolution in setup.cpp is too small.";
+Device_Info select_lbm_device() {
+	int select_device = -1;
+	if((int)main_arguments.size()>0) select_device = to_int(main_arguments[0]);
+	const vector<Device_Info>& devices = get_devices();
+	return select_device<0 ? select_device_with_most_mlups(devices) : select_device_with_id((uint)select_device, devices);
+}
+vector<Device_Info> select_lbm_devices() {
+	vector<uint> ids; // device IDs in the order of the domains along z
+	for(uint i=0u; i<(uint)main_arguments.size()&&equals_regex(trim(main_arguments[i]), "\\d+"); i++) ids.push_back(to_uint(main_arguments[i]));
+	if((uint)ids.size()<=1u) return vector<Device_Info>{ select_lbm_device() };
+	const vector<Device_Info>& devices = get_devices();
+	vector<Device_Info> selected((uint)ids.size());
+	vector<bool> assigned((uint)ids.size(), false);
+	for(uint i=0u; i<(uint)ids.size(); i++) {
+		if(assigned[i]) continue;
+		uint count = 0u; // a device that is selected several times is partitioned into that many sub-devices
+		for(uint j=i; j<(uint)ids.size(); j++) count += (uint)(ids[j]==ids[i]);
+		const vector<Device_Info> sub_devices = get_sub_devices(select_device_with_id(ids[i], devices), count);
+		for(uint j=i, k=0u; j<(uint)ids.size(); j++) {
+			if(ids[j]==ids[i]) {
+				selected[j] = sub_devices[k++];
+				assigned[j] = true;
 			}
 		}
-		print_error(error);
 	}
+	return selected;
+}
+uint LBM::device_bytes_per_node(const LBM_Options& options) { // has to match the buffers in LBM::allocate()
+	uint bytes = options.velocity_set*options.ddf_bytes()+17u; // fi, flags, rho, 3*u
+	if(options.force_field) bytes += 12u; // F
+	if(options.surface) bytes += 12u; // phi, mass, massex
+	if(options.temperature) bytes += 7u*options.ddf_bytes()+4u; // gi, T
+#if defined(GRAPHICS)&&defined(GRAPHICS_SNAPSHOT)
+	bytes += 13u+(options.force_field ? 12u : 0u)+(options.surface ? 4u : 0u)+(options.temperature ? 4u : 0u); // copies of the fields that Graphics renders from
+#endif // GRAPHICS and GRAPHICS_SNAPSHOT
+	return bytes;
+}
+uint LBM::host_bytes_per_node(const LBM_Options& options) { // has to match the buffers in LBM::allocate()
+	uint bytes = 17u; // flags, rho, 3*u
+	if(options.force_field) bytes += 12u; // F
+	if(options.surface) bytes += 4u; // phi
+	if(options.temperature) bytes += 4u; // T
+	return bytes;
+}
+uint3 LBM::resolution(const float3& box_aspect_ratio, const ulong memory, const ulong max_buffer, const LBM_Options& options) {
+	const ulong largest_buffer = (ulong)options.largest_buffer_bytes(options.ddf_buffers==0u ? options.velocity_set : options.ddf_buffers); // with options.ddf_buffers=0, the DDFs can be split into as many buffers as there are directions
+	const ulong N_max = min(memory/(ulong)device_bytes_per_node(options), max_buffer/largest_buffer);
+	const bool d2 = options.dimensions()==2u; // D2Q9 only has Nz=1
+	const float ax=fmax(box_aspect_ratio.x, 1E-6f), ay=fmax(box_aspect_ratio.y, 1E-6f), az=d2 ? 1.0f : fmax(box_aspect_ratio.z, 1E-6f);
+	const double scale = d2 ? sqrt((double)N_max/((double)ax*(double)ay)) : cbrt((double)N_max/((double)ax*(double)ay*(double)az));
+	ulong Nx=max((ulong)((double)ax*scale), 1ull), Ny=max((ulong)((double)ay*scale), 1ull), Nz=d2 ? 1ull : max((ulong)((double)az*scale), 1ull);
+#ifndef CPU_NATIVE
+	while(Nx*Ny*Nz>N_max&&Nx*Ny*Nz>1ull) { // rounding may exceed the limit slightly
+#else // CPU_NATIVE
+	while((Nx*Ny*Nz>N_max||Nx*Ny*Nz>(ulong)max_uint)&&Nx*Ny*Nz>1ull) { // the native kernels use 32-bit node indices
+#endif // CPU_NATIVE
+		if(Nx>=Ny&&Nx>=Nz) Nx--; else if(Ny>=Nz) Ny--; else Nz--;
+	}
+	if(N_max==0ull) print_error("There is not enough memory for any grid resolution.");
+	return uint3((uint)Nx, (uint)Ny, (uint)Nz);
+}
+uint3 LBM::resolution(const float3& box_aspect_ratio, const Device_Info& device_info, const uint reserved, const LBM_Options& options) {
+	const ulong memory = (ulong)(device_info.memory>reserved ? device_info.memory-reserved : 0u)*1048576ull;
+	return resolution(box_aspect_ratio, memory, (ulong)device_info.max_global_buffer*1048576ull, options);
+}
+
+void LBM::sanity_checks_constructor() { // sanity checks on grid resolution and parameters
+	if(Nx*Ny*Nz==0u) print_error("Lattice point number is 0: "+to_string(Nx)+"x"+to_string(Ny)+"x"+to_string(Nz)+" = 0. Change grid resolution in setup.cpp."); // sanity checks for simulation box size, kernels guard the tail of the last workgroup, so any size works
+#ifdef CPU_NATIVE
+	if((ulong)Nx*(ulong)Ny*(ulong)Nz>(ulong)max_uint) print_error("Lattice point number "+to_string(Nx)+"x"+to_string(Ny)+"x"+to_string(Nz)+" is too large for CPU_NATIVE, it has to fit into 32-bit."); // the OpenCL kernels switch to 64-bit node indices for such lattices
+#endif // CPU_NATIVE
 	if(nu==0.0f) print_error("Viscosity cannot be 0. Change it in setup.cpp."); // sanity checks for viscosity
 	else if(nu<0.0f) print_error("Viscosity cannot be negative. Remove the \"-\" in setup.cpp.");
-#ifndef VOLUME_FORCE
-	if(fx!=0.0f||fy!=0.0f||fz!=0.0f) print_error("Volume force is set in LBM constructor in main_setup(), but VOLUME_FORCE is not enabled. Uncomment \"#define VOLUME_FORCE\" in defines.hpp.");
-#else // VOLUME_FORCE
-#ifndef FORCE_FIELD
-	if(fx==0.0f&&fy==0.0f&&fz==0.0f) print_warning("The VOLUME_FORCE extension is enabled but the volume force in LBM constructor is set to zero. You may disable the extension by commenting out \"#define VOLUME_FORCE\" in defines.hpp.");
-#endif // FORCE_FIELD
-#endif // VOLUME_FORCE
-#ifndef SURFACE
-	if(sigma!=0.0f) print_error("Surface tension is set in LBM constructor in main_setup(), but SURFACE is not enabled. Uncomment \"#define SURFACE\" in defines.hpp.");
-#endif // SURFACE
-#ifndef TEMPERATURE
-	if(alpha!=0.0f||beta!=0.0f) print_error("Thermal diffusion/expansion coefficients are set in LBM constructor in main_setup(), but TEMPERATURE is not enabled. Uncomment \"#define TEMPERATURE\" in defines.hpp.");
-#else // TEMPERATURE
-	if(alpha==0.0f&&beta==0.0f) print_warning("The TEMPERATURE extension is enabled but the thermal diffusion/expansion coefficients alpha/beta in the LBM constructor are both set to zero. You may disable the extension by commenting out \"#define TEMPERATURE\" in defines.hpp.");
-#endif // TEMPERATURE
+	if(velocity_set!=9u&&velocity_set!=15u&&velocity_set!=19u&&velocity_set!=27u) print_error("Velocity set "+to_string(velocity_set)+" in LBM options does not exist. Choose 9 (D2Q9), 15 (D3Q15), 19 (D3Q19) or 27 (D3Q27).");
+	if(options.ddf_buffers>velocity_set) print_error("The DDFs can't be split into "+to_string(options.ddf_buffers)+" buffers, there are only "+to_string(velocity_set)+" directions. Set options.ddf_buffers to at most "+to_string(velocity_set)+", or to 0 to choose automatically.");
+	if(!options.volume_force) {
+		if(fx!=0.0f||fy!=0.0f||fz!=0.0f) print_error("Volume force is set in LBM constructor in main_setup(), but VOLUME_FORCE is not enabled. Set options.volume_force in the LBM constructor or uncomment \"#define VOLUME_FORCE\" in defines.hpp.");
+	} else if(!options.force_field&&!options.temperature) {
+		if(fx==0.0f&&fy==0.0f&&fz==0.0f) print_warning("The VOLUME_FORCE extension is enabled but the volume force in LBM constructor is set to zero. You may disable the extension in the LBM options or by commenting out \"#define VOLUME_FORCE\" in defines.hpp.");
+	}
+	if(!options.surface&&sigma!=0.0f) print_error("Surface tension is set in LBM constructor in main_setup(), but SURFACE is not enabled. Set options.surface in the LBM constructor or uncomment \"#define SURFACE\" in defines.hpp.");
+	if(!options.temperature) {
+		if(alpha!=0.0f||beta!=0.0f) print_error("Thermal diffusion/expansion coefficients are set in LBM constructor in main_setup(), but TEMPERATURE is not enabled. Set options.temperature in the LBM constructor or uncomment \"#define TEMPERATURE\" in defines.hpp.");
+	} else {
+		if(alpha==0.0f&&beta==0.0f) print_warning("The TEMPERATURE extension is enabled but the thermal diffusion/expansion coefficients alpha/beta in the LBM constructor are both set to zero. You may disable the extension in the LBM options or by commenting out \"#define TEMPERATURE\" in defines.hpp.");
+	}
+#ifdef CPU_NATIVE
+	const LBM_Options compiled = LBM_Options().with_implied(); // the native kernels are compiled for the options of defines.hpp
+	if(velocity_set!=compiled.velocity_set||options.collision!=compiled.collision||options.ddf_format!=compiled.ddf_format||options.volume_force!=compiled.volume_force||options.force_field!=compiled.force_field||options.equilibrium_boundaries!=compiled.equilibrium_boundaries||options.subgrid!=compiled.subgrid||options.update_fields!=compiled.update_fields) {
+		print_error("The native CPU backend is compiled for "+compiled.name()+" and the extensions in defines.hpp, but the LBM options differ. Change defines.hpp instead of the LBM options or comment out \"#define CPU_NATIVE\" in defines.hpp.");
+	}
+	if(options.neighbor_flags()) print_error("The native CPU backend does not support the MOVING_BOUNDARIES, SURFACE and TEMPERATURE extensions. Comment out \"#define CPU_NATIVE\" in defines.hpp to run on an OpenCL device.");
+#ifdef GRAPHICS
+	print_error("Graphics are rendered with OpenCL, which the native CPU backend does not use. Disable graphics or comment out \"#define CPU_NATIVE\" in defines.hpp.");
+#endif // GRAPHICS
+#endif // CPU_NATIVE
 }
 void LBM::sanity_checks_initialization() { // sanity checks during initialization on used extensions based on used flags
+	if(!flags.host_buffer_allocated()) return; // flags were never set on the host or host buffers were deleted already, don't download them only for checking
 	bool moving_boundaries_used=false, equilibrium_boundaries_used=false, surface_used=false, temperature_used=false; // identify used extensions based used flags
-	for(uint n=0u; n<get_N(); n++) {
-		const uchar flagsn = flags[n];
+	const bool u_on_host = u.host_buffer_allocated(); // otherwise velocity was never set and is 0 everywhere
+	for(ulong n=0ull; n<get_N(); n++) {
+		const uchar flagsn = flags(n); // const access does not mark flags as modified on the host
 		const uchar flagsn_bo = flagsn&(TYPE_S|TYPE_E);
 		const uchar flagsn_su = flagsn&(TYPE_F|TYPE_I|TYPE_G);
-		moving_boundaries_used = moving_boundaries_used || (((flagsn_bo==TYPE_S)&&(u.x[n]!=0.0f||u.y[n]!=0.0f||u.z[n]!=0.0f))||(flagsn_bo==(TYPE_S|TYPE_E)));
+		moving_boundaries_used = moving_boundaries_used || (((flagsn_bo==TYPE_S)&&u_on_host&&(u(n, 0u)!=0.0f||u(n, 1u)!=0.0f||u(n, 2u)!=0.0f))||(flagsn_bo==(TYPE_S|TYPE_E)));
 		equilibrium_boundaries_used = equilibrium_boundaries_used || (flagsn_bo==TYPE_E);
 		surface_used = surface_used || flagsn_su;
 		temperature_used = temperature_used || (flagsn&TYPE_T);
 	}
-#ifndef MOVING_BOUNDARIES
-	if(moving_boundaries_used) print_warning("Some boundary nodes have non-zero velocity, but MOVING_BOUNDARIES is not enabled. If you intend to use moving boundaries, uncomment \"#define MOVING_BOUNDARIES\" in defines.hpp.");
-#else // MOVING_BOUNDARIES
-	if(!moving_boundaries_used) print_warning("The MOVING_BOUNDARIES extension is enabled but no moving boundary nodes (TYPE_S flag and velocity unequal to zero) are placed in the simulation box. You may disable the extension by commenting out \"#define MOVING_BOUNDARIES\" in defines.hpp.");
-#endif // MOVING_BOUNDARIES
-#ifndef EQUILIBRIUM_BOUNDARIES
-	if(equilibrium_boundaries_used) print_error("Some nodes are set as equilibrium boundaries with the TYPE_E flag, but EQUILIBRIUM_BOUNDARIES is not enabled. Uncomment \"#define EQUILIBRIUM_BOUNDARIES\" in defines.hpp.");
-#else // EQUILIBRIUM_BOUNDARIES
-	if(!equilibrium_boundaries_used) print_warning("The EQUILIBRIUM_BOUNDARIES extension is enabled but no equilibrium boundary nodes (TYPE_E flag) are placed in the simulation box. You may disable the extension by commenting out \"#define EQUILIBRIUM_BOUNDARIES\" in defines.hpp.");
-#endif // EQUILIBRIUM_BOUNDARIES
-#ifndef SURFACE
-	if(surface_used) print_error("Some nodes are set as fluid/interface/gas with the TYPE_F/TYPE_I/TYPE_G flags, but SURFACE is not enabled. Uncomment \"#define SURFACE\" in defines.hpp.");
-#else // SURFACE
-	if(!surface_used) print_error("The SURFACE extension is enabled but no fluid/interface/gas nodes (TYPE_F/TYPE_I/TYPE_G flags) are placed in the simulation box. Disable the extension by commenting out \"#define SURFACE\" in defines.hpp.");
-#endif // SURFACE
-#ifndef TEMPERATURE
-	if(temperature_used) print_error("Some nodes are set as temperature boundary with the TYPE_T flag, but TEMPERATURE is not enabled. Uncomment \"#define TEMPERATURE\" in defines.hpp.");
-#endif // TEMPERATURE
+	if(!options.moving_boundaries&&moving_boundaries_used) print_warning("Some boundary nodes have non-zero velocity, but MOVING_BOUNDARIES is not enabled. If you intend to use moving boundaries, set options.moving_boundaries in the LBM constructor or uncomment \"#define MOVING_BOUNDARIES\" in defines.hpp.");
+	if(options.moving_boundaries&&!moving_boundaries_used) print_warning("The MOVING_BOUNDARIES extension is enabled but no moving boundary nodes (TYPE_S flag and velocity unequal to zero) are placed in the simulation box. You may disable the extension in the LBM options or by commenting out \"#define MOVING_BOUNDARIES\" in defines.hpp.");
+	if(!options.equilibrium_boundaries&&equilibrium_boundaries_used) print_error("Some nodes are set as equilibrium boundaries with the TYPE_E flag, but EQUILIBRIUM_BOUNDARIES is not enabled. Set options.equilibrium_boundaries in the LBM constructor or uncomment \"#define EQUILIBRIUM_BOUNDARIES\" in defines.hpp.");
+	if(options.equilibrium_boundaries&&!equilibrium_boundaries_used) print_warning("The EQUILIBRIUM_BOUNDARIES extension is enabled but no equilibrium boundary nodes (TYPE_E flag) are placed in the simulation box. You may disable the extension in the LBM options or by commenting out \"#define EQUILIBRIUM_BOUNDARIES\" in defines.hpp.");
+	if(!options.surface&&surface_used) print_error("Some nodes are set as fluid/interface/gas with the TYPE_F/TYPE_I/TYPE_G flags, but SURFACE is not enabled. Set options.surface in the LBM constructor or uncomment \"#define SURFACE\" in defines.hpp.");
+	if(options.surface&&!surface_used) print_error("The SURFACE extension is enabled but no fluid/interface/gas nodes (TYPE_F/TYPE_I/TYPE_G flags) are placed in the simulation box. Disable the extension in the LBM options or by commenting out \"#define SURFACE\" in defines.hpp.");
+	if(!options.temperature&&temperature_used) print_error("Some nodes are set as temperature boundary with the TYPE_T flag, but TEMPERATURE is not enabled. Set options.temperature in the LBM constructor or uncomment \"#define TEMPERATURE\" in defines.hpp.");
 }
 
 string LBM::default_filename(const string& path, const string& name, const string& extension) {
-	string time = "00000000"+to_string(t);
+	string time = "00000000"+to_string(t>>level); // finer levels do 2^level time steps per time step of level 0
 	time = substring(time, length(time)-9u, 9u);
-	return create_file_extension((path=="" ? get_exe_path()+"export/" : path)+(name=="" ? "file" : name)+"-"+time, extension);
+	return create_file_extension((path=="" ? get_exe_path()+"export/" : path)+(name=="" ? "file" : name)+(level>0u ? "-level"+to_string(level) : "")+"-"+time, extension);
 }
 string LBM::default_filename(const string& name, const string& extension) {
 	return default_filename("", name, extension);
 }
 
 void LBM::allocate(Device& device) {
-	const uint N = Nx*Ny*Nz;
-	rho = Memory<float>(device, N, 1u, true, true, 1.0f);
-	u = Memory<float>(device, N, 3u);
-	flags = Memory<uchar>(device, N);
-	fi = Memory<fpxx>(device, N, velocity_set, false);
+	const ulong N = get_N();
+#ifdef CPU_NATIVE
+	rho = Memory<float>(device, N, 1u, true, false, 1.0f); // without OpenCL device, all buffers only exist in host memory and the native kernels work on them directly
+	u = Memory<float>(device, N, 3u, true, false, 0.0f);
+	flags = Memory<uchar>(device, N, 1u, true, false, (uchar)0u);
+	fi = Memory<uchar>(device, N, velocity_set*(uint)sizeof(fpxx), true, false); // the native kernels are compiled for fpxx, sanity_checks_constructor() made sure that it matches options.ddf_format
+	if(options.force_field) F = Memory<float>(device, N, 3u, true, false);
+	return;
+#endif // CPU_NATIVE
+	if(domains) {
+		allocate_domains();
+		return;
+	}
+	rho = Memory<float>(device, N, 1u, false, true, 1.0f, HOST_MEMORY_PINNED); // host buffers are allocated on first host access or export, pinned host memory for fast transfers of data fields
+	u = Memory<float>(device, N, 3u, false, true, 0.0f, HOST_MEMORY_PINNED);
+	flags = Memory<uchar>(device, N, 1u, false, true, (uchar)0u, HOST_MEMORY_PINNED);
+	rho.set_queue(QUEUE_TRANSFER); // host<->device transfers of data fields don't queue up behind rendering
+	u.set_queue(QUEUE_TRANSFER);
+	flags.set_queue(QUEUE_TRANSFER);
+	fi = Memory<uchar>(device, N, ddf_per_buffer*options.ddf_bytes(), false);
+	if(ddf_buffers>1u) {
+		fi_split = new Memory<uchar>[ddf_buffers-1u];
+		for(uint b=1u; b<ddf_buffers; b++) fi_split[b-1u] = Memory<uchar>(device, N, (min((b+1u)*ddf_per_buffer, velocity_set)-b*ddf_per_buffer)*options.ddf_bytes(), false); // the last buffer may hold fewer directions
+	}
 	kernel_initialize = Kernel(device, N, "initialize", fi, rho, u, flags);
 	kernel_stream_collide = Kernel(device, N, "stream_collide", fi, rho, u, flags, t, fx, fy, fz);
 	kernel_update_fields = Kernel(device, N, "update_fields", fi, rho, u, flags, t, fx, fy, fz);
 
-#ifdef FORCE_FIELD
-	F = Memory<float>(device, N, 3u);
-	kernel_stream_collide.add_parameters(F);
-	kernel_update_fields.add_parameters(F);
-	kernel_calculate_force_on_boundaries = Kernel(device, N, "calculate_force_on_boundaries", fi, flags, t, F);
-#endif // FORCE_FIELD
-
-#ifdef MOVING_BOUNDARIES
-	kernel_update_moving_boundaries = Kernel(device, N, "update_moving_boundaries", u, flags);
-#endif // MOVING_BOUNDARIES
-
-#ifdef SURFACE
-	phi = Memory<float>(device, N);
-	mass = Memory<float>(device, N);
-	massex = Memory<float>(device, N);
-	kernel_initialize.add_parameters(mass, massex, phi);
-	kernel_stream_collide.add_parameters(mass);
-	kernel_surface_0 = Kernel(device, N, "surface_0", fi, rho, u, flags, mass, massex, phi, t, fx, fy, fz);
-	kernel_surface_1 = Kernel(device, N, "surface_1", flags);
-	kernel_surface_2 = Kernel(device, N, "surface_2", fi, rho, u, flags, t);
-	kernel_surface_3 = Kernel(device, N, "surface_3", rho, flags, mass, massex, phi);
-#endif // SURFACE
-
-#ifdef TEMPERATURE
-	T = Memory<float>(device, N, 1u, true, true, 1.0f);
-	gi = Memory<fpxx>(device, N, 7u, false);
-	kernel_initialize.add_parameters(gi, T);
-	kernel_stream_collide.add_parameters(gi, T);
-	kernel_update_fields.add_parameters(gi, T);
-#endif // TEMPERATURE
+	if(options.force_field) {
+		F = Memory<float>(device, N, 3u, false);
+		F.set_queue(QUEUE_TRANSFER);
+		kernel_stream_collide.add_parameters(F);
+		kernel_update_fields.add_parameters(F);
+		kernel_calculate_force_on_boundaries = Kernel(device, N, "calculate_force_on_boundaries", fi, flags, t, F);
+	}
+
+	if(options.moving_boundaries) {
+		kernel_update_moving_boundaries = Kernel(device, N, "update_moving_boundaries", u, flags);
+	}
+
+	if(options.surface) {
+		phi = Memory<float>(device, N, 1u, false);
+		phi.set_queue(QUEUE_TRANSFER);
+		mass = Memory<float>(device, N);
+		massex = Memory<float>(device, N);
+		kernel_initialize.add_parameters(mass, massex, phi);
+		kernel_stream_collide.add_parameters(mass);
+		kernel_surface_0 = Kernel(device, N, "surface_0", fi, rho, u, flags, mass, massex, phi, t, fx, fy, fz);
+		kernel_surface_1 = Kernel(device, N, "surface_1", flags);
+		kernel_surface_2 = Kernel(device, N, "surface_2", fi, rho, u, flags, t);
+		kernel_surface_3 = Kernel(device, N, "surface_3", rho, flags, mass, massex, phi);
+	}
+
+	if(options.temperature) {
+		T = Memory<float>(device, N, 1u, false, true, 1.0f);
+		T.set_queue(QUEUE_TRANSFER);
+		gi = Memory<uchar>(device, N, 7u*options.ddf_bytes(), false);
+		kernel_initialize.add_parameters(gi, T);
+		kernel_stream_collide.add_parameters(gi, T);
+		kernel_update_fields.add_parameters(gi, T);
+	}
+
+#ifdef SPARSE_BRICKS
+	bricks = Memory<uint>(device, get_bricks(), 1u, false);
+	active_bricks = Memory<uint>(device, 1u);
+	kernel_update_bricks = Kernel(device, get_bricks(), "update_bricks", flags, bricks, active_bricks);
+	kernel_stream_collide.add_parameters(bricks, active_bricks).set_range(get_bricks()*(ulong)(brick_x*brick_y*brick_z)); // update_bricks() narrows the range to the active bricks
+	kernel_update_fields.add_parameters(bricks, active_bricks).set_range(get_bricks()*(ulong)(brick_x*brick_y*brick_z));
+#endif // SPARSE_BRICKS
+
+	for(uint b=1u; b<ddf_buffers; b++) { // DDF buffers after fi are the last parameters of all kernels that access DDFs
+		kernel_initialize.add_parameters(fi_split[b-1u]);
+		kernel_stream_collide.add_parameters(fi_split[b-1u]);
+		kernel_update_fields.add_parameters(fi_split[b-1u]);
+		if(options.force_field) kernel_calculate_force_on_boundaries.add_parameters(fi_split[b-1u]);
+		if(options.surface) {
+			kernel_surface_0.add_parameters(fi_split[b-1u]);
+			kernel_surface_2.add_parameters(fi_split[b-1u]);
+		}
+	}
+
+#ifdef PROFILING // memory transfer per launch for the bandwidth column of the profiling table, see Info::initialize() for the per-node breakdown
+	const ulong vs=(ulong)velocity_set, fs=(ulong)options.ddf_bytes();
+	const ulong neighbor_flags = options.neighbor_flags() ? vs-1ull : 0ull; // neighbor flags have to be loaded
+	const ulong fields = options.update_fields ? 16ull : 0ull; // rho, u
+	const ulong thermal = options.temperature ? 7ull*2ull*fs+4ull : 0ull; // 2*gi, T
+	kernel_initialize.set_transfer((ulong)N*(vs*fs+17ull)); // fi, flags, rho, u
+	kernel_stream_collide.set_transfer((ulong)N*(vs*2ull*fs+1ull+fields+neighbor_flags+thermal)); // 2*fi, flags, rho, u
+	kernel_update_fields.set_transfer((ulong)N*(vs*fs+17ull)); // fi, flags, rho, u
+	if(options.surface) {
+		kernel_surface_0.set_transfer((ulong)N*(1ull+(2ull*vs-1ull)*fs+8ull+(vs-1ull)*4ull)); // flags, fi, mass, massex
+		kernel_surface_1.set_transfer((ulong)N*1ull); // flags
+		kernel_surface_2.set_transfer((ulong)N*1ull); // flags
+		kernel_surface_3.set_transfer((ulong)N*(4ull+vs+4ull+4ull+4ull)); // rho, flags, mass, massex, phi
+	}
+#endif // PROFILING
+}
+
+static const vector<int>& domain_transfers(const uint velocity_set) { // odd DDF indices i with c_z!=0, signed like c_z, for each of them one slot of the pair (i, i+1) crosses the interface of two domains in each direction
+	static const vector<int> d3q15 = { +5, +7, -9, +11, +13 };
+	static const vector<int> d3q19 = { +5, +9, +11, -15, -17 };
+	static const vector<int> d3q27 = { +5, +9, +11, -15, -17, +19, -21, +23, +25 };
+	static const vector<int> d2q9 = {}; // D2Q9 can't be split along z
+	return velocity_set==15u ? d3q15 : velocity_set==19u ? d3q19 : velocity_set==27u ? d3q27 : d2q9;
+}
+
+void LBM::allocate_domains() { // public fields only have host buffers, which are split into the slabs of all domains, each domain device additionally holds a copy of the layer below and above its slab
+	const ulong N = get_N();
+	const ulong A=(ulong)Nx*(ulong)Ny, B=(ulong)domain_transfers(velocity_set).size(), bytes=A*(ulong)options.ddf_bytes(); // nodes per layer, DDF slots per layer that cross the interface in each direction, size of one DDF slot of a layer
+	rho = Memory<float>(device, N, 1u, false, false, 1.0f); // host buffers are allocated on first host access or export
+	u = Memory<float>(device, N, 3u, false, false, 0.0f);
+	flags = Memory<uchar>(device, N, 1u, false, false, (uchar)0u);
+	if(options.force_field) F = Memory<float>(device, N, 3u, false, false);
+	for(uint d=0u; d<Dz; d++) {
+		Domain& domain = domains[d];
+		const ulong N_d = A*(ulong)(domain.Nz+2u); // slab and both halo layers
+		const ulong z=A*(ulong)domain.z0, below=A*(ulong)((domain.z0+Nz-1u)%Nz), above=A*(ulong)((domain.z0+domain.Nz)%Nz); // first node of slab, halo layer below and halo layer above in the whole lattice
+		const bool read_below=ranks>1u&&d==0u, read_above=ranks>1u&&d==Dz-1u; // layers next to the slabs of this rank are owned by another rank, so they are only available from the halo layers
+		const auto split = [&](auto& field, auto& part) { // halo layers are only uploaded, on download the slab of their own domain is used
+			field.add_part(part, z, z+A*(ulong)domain.Nz, A);
+			field.add_part(part, below, below+A, 0ull, read_below);
+			field.add_part(part, above, above+A, A*(ulong)(domain.Nz+1u), read_above);
+		};
+		domain.rho = Memory<float>(domain.device, N_d, 1u, false, true, 1.0f);
+		domain.u = Memory<float>(domain.device, N_d, 3u, false, true, 0.0f);
+		domain.flags = Memory<uchar>(domain.device, N_d, 1u, false, true, (uchar)0u);
+		domain.rho.set_queue(QUEUE_TRANSFER);
+		domain.u.set_queue(QUEUE_TRANSFER);
+		domain.flags.set_queue(QUEUE_TRANSFER);
+		split(rho, domain.rho);
+		split(u, domain.u);
+		split(flags, domain.flags);
+		domain.fi = Memory<uchar>(domain.device, N_d, velocity_set*options.ddf_bytes(), false);
+		domain.transfer = Memory<uchar>(domain.device, 2ull*B*bytes, 1u, true, false, (uchar)0u, HOST_MEMORY_PINNED);
+		domain.kernel_initialize = Kernel(domain.device, N_d, "initialize", domain.fi, domain.rho, domain.u, domain.flags);
+		domain.kernel_stream_collide = Kernel(domain.device, N_d, "stream_collide", domain.fi, domain.rho, domain.u, domain.flags, t, fx, fy, fz);
+		domain.kernel_update_fields = Kernel(domain.device, N_d, "update_fields", domain.fi, domain.rho, domain.u, domain.flags, t, fx, fy, fz);
+		if(options.force_field) {
+			domain.F = Memory<float>(domain.device, N_d, 3u, false);
+			domain.F.set_queue(QUEUE_TRANSFER);
+			split(F, domain.F);
+			domain.kernel_stream_collide.add_parameters(domain.F);
+			domain.kernel_update_fields.add_parameters(domain.F);
+			domain.kernel_calculate_force_on_boundaries = Kernel(domain.device, N_d, "calculate_force_on_boundaries", domain.fi, domain.flags, t, domain.F);
+		}
+		domain.kernel_stream_collide.add_parameters(A, N_d-A); // n0, n1, halo layers are never updated
+	}
+	if(ranks>1u) {
+		received_below = Memory<uchar>(domains[0].device, B*bytes, 1u, true, false, (uchar)0u, HOST_MEMORY_PINNED);
+		received_above = Memory<uchar>(domains[Dz-1u].device, B*bytes, 1u, true, false, (uchar)0u, HOST_MEMORY_PINNED);
+	}
+}
+
+static const uchar TYPE_REFINED = TYPE_S|TYPE_Y; // nodes covered by a finer level and ghost nodes of a finer level, stream_collide skips them and the coupling writes their outgoing DDFs
+static bool is_coupled(const uchar flags) { return (flags&(TYPE_S|TYPE_E))!=TYPE_S||flags==TYPE_REFINED; } // not a solid boundary, so the node takes part in the coupling of refinement levels
+
+LBM& LBM::refine(const uint x0, const uint y0, const uint z0, const uint x1, const uint y1, const uint z1) { // add a finer level with half the lattice spacing in the box of nodes [x0, x1] x [y0, y1] x [z0, z1]
+	const bool d2 = dimensions==2u;
+	const string box = "["+to_string(x0)+", "+to_string(x1)+"] x ["+to_string(y0)+", "+to_string(y1)+"] x ["+to_string(z0)+", "+to_string(z1)+"]";
+	if(initialized) print_error("Refinement levels have to be added before the first run() call.");
+	if(domains) print_error("Refinement levels are not supported when the lattice is split across several devices. Select only one device.");
+	if(options.surface||options.temperature||options.moving_boundaries) print_error("The SURFACE, TEMPERATURE and MOVING_BOUNDARIES extensions don't support refinement levels. Disable them or don't call refine().");
+	if(d2 ? z0!=0u||z1!=0u : z0<1u||z1+2u>Nz) print_error("Refinement box "+box+" has to keep a distance of at least 1 node to the lattice boundaries"+(d2 ? " and stay in layer z=0 with D2Q9." : "."));
+	if(x0<1u||x1+2u>Nx||y0<1u||y1+2u>Ny) print_error("Refinement box "+box+" has to keep a distance of at least 1 node to the lattice boundaries.");
+	if(x1<x0+3u||y1<y0+3u||(!d2&&z1<z0+3u)) print_error("Refinement box "+box+" has to span at least 4 nodes along every axis.");
+	for(const Refinement* other : refinements) { // the interfaces of two boxes must not touch
+		if(x0<=other->x1+1u&&other->x0<=x1+1u&&y0<=other->y1+1u&&other->y0<=y1+1u&&(d2||(z0<=other->z1+1u&&other->z0<=z1+1u))) print_error("Refinement box "+box+" overlaps or touches another refinement box of this level. Merge them into one box or nest them.");
+	}
+	LBM* lbm_info = info.lbm; // the constructor of the finer level registers it for printing, but info reports level 0
+	Refinement* refinement = new Refinement();
+	refinement->x0 = x0; refinement->y0 = y0; refinement->z0 = z0;
+	refinement->x1 = x1; refinement->y1 = y1; refinement->z1 = z1;
+	refinement->lbm = new LBM(this, options, 2u*(x1-x0)+1u, 2u*(y1-y0)+1u, d2 ? 1u : 2u*(z1-z0)+1u, 2.0f*nu, 0.5f*fx, 0.5f*fy, 0.5f*fz); // with acoustic scaling (dt and dx halved), the viscosity in lattice units doubles and the force per volume halves
+	LBM& finer = *refinement->lbm;
+	finer.level = level+1u;
+	finer.level_center = level_center+get_spacing()*(float3(0.5f*(float)(x0+x1), 0.5f*(float)(y0+y1), 0.5f*(float)(z0+z1))-center());
+	refinements.push_back(refinement);
+	info.initialize(lbm_info);
+#ifdef GRAPHICS
+	set_zoom(0.5f*(float)lbm_info->largest_side_length()); // the graphics of the finer level set the zoom for their own size
+#endif // GRAPHICS
+	print_info("Refinement level "+to_string(finer.level)+" with "+to_string(finer.Nx)+"x"+to_string(finer.Ny)+"x"+to_string(finer.Nz)+" nodes covers the box "+box+" of level "+to_string(level)+".");
+	return finer;
+}
+
+void LBM::initialize_refinements() { // has to be called before the flags of this level are uploaded
+	const bool d2 = dimensions==2u;
+	for(Refinement* refinement : refinements) {
+		Refinement& r = *refinement;
+		LBM& finer = *r.lbm;
+		const uint Bx=r.x1-r.x0+1u, By=r.y1-r.y0+1u, Bz=r.z1-r.z0+1u; // box size on this level
+		const auto depth = [&](const uint x, const uint y, const uint z, const uint Mx, const uint My, const uint Mz) { // distance of box node (x, y, z) to the box surface, z is ignored in 2D
+			const uint dx=min(x, Mx-1u-x), dy=min(y, My-1u-y), dz=min(z, Mz-1u-z);
+			return d2 ? min(dx, dy) : min(min(dx, dy), dz);
+		};
+		const auto sources = [&](const uint xf, const uint yf, const uint zf, ulong* n, float* weight) { // nodes of this level and weights for linear interpolation to node (xf, yf, zf) of the finer level
+			uint count = 0u;
+			for(uint k=0u; k<8u; k++) {
+				const uint dx=k&1u, dy=(k>>1)&1u, dz=(k>>2)&1u;
+				if((dx&&xf%2u==0u)||(dy&&yf%2u==0u)||(dz&&zf%2u==0u)) continue; // even fine coordinates coincide with a node of this level
+				n[count] = index(r.x0+xf/2u+dx, r.y0+yf/2u+dy, r.z0+zf/2u+dz);
+				weight[count++] = (xf%2u ? 0.5f : 1.0f)*(yf%2u ? 0.5f : 1.0f)*(zf%2u ? 0.5f : 1.0f);
+			}
+			return count;
+		};
+		for(uint z=0u; z<Bz; z++) for(uint y=0u; y<By; y++) for(uint x=0u; x<Bx; x++) { // nodes inside the box surface are computed on the finer level
+			const ulong n = index(r.x0+x, r.y0+y, r.z0+z);
+			if(depth(x, y, z, Bx, By, Bz)>=1u&&is_coupled(flags[n])) flags[n] = TYPE_REFINED;
+		}
+		if(!finer.initialized) { // the finer level starts from the interpolated fields of this level
+			for(uint zf=0u; zf<finer.Nz; zf++) for(uint yf=0u; yf<finer.Ny; yf++) for(uint xf=0u; xf<finer.Nx; xf++) {
+				ulong n[8]; float weight[8];
+				const uint count = sources(xf, yf, zf, n, weight);
+				float rhon=0.0f, uxn=0.0f, uyn=0.0f, uzn=0.0f, sum=0.0f;
+				for(uint k=0u; k<count; k++) {
+					if(!is_coupled(flags[n[k]])) continue; // solid nodes don't contribute
+					rhon += weight[k]*rho[n[k]];
+					uxn += weight[k]*u.x[n[k]];
+					uyn += weight[k]*u.y[n[k]];
+					uzn += weight[k]*u.z[n[k]];
+					sum += weight[k];
+				}
+				if(sum==0.0f) continue;
+				const ulong nf = finer.index(xf, yf, zf);
+				finer.rho[nf] = rhon/sum;
+				finer.u.x[nf] = uxn/sum;
+				finer.u.y[nf] = uyn/sum;
+				finer.u.z[nf] = uzn/sum;
+			}
+		}
+		vector<ulong> coarse_nodes, ghost_nodes, fine_nodes, restricted_nodes;
+		vector<uint> slot((ulong)Bx*(ulong)By*(ulong)Bz, max_uint); // entry in coarse_nodes of every box node
+		for(uint z=0u; z<Bz; z++) for(uint y=0u; y<By; y++) for(uint x=0u; x<Bx; x++) {
+			const ulong n = index(r.x0+x, r.y0+y, r.z0+z);
+			const uint d = depth(x, y, z, Bx, By, Bz);
+			if(d==0u&&is_coupled(flags[n])) {
+				slot[(ulong)x+((ulong)y+(ulong)z*(ulong)By)*(ulong)Bx] = (uint)coarse_nodes.size();
+				coarse_nodes.push_back(n);
+			} else if(d==1u&&flags[n]==TYPE_REFINED) {
+				const ulong nf = finer.index(2u*x, 2u*y, 2u*z);
+				if(is_coupled(finer.flags[nf])) {
+					restricted_nodes.push_back(n);
+					fine_nodes.push_back(nf);
+				} else {
+					flags[n] = TYPE_S; // solid on the finer level, so it is a solid boundary here as well
+				}
+			}
+		}
+		vector<uint> ghost_sources;
+		vector<float> ghost_weights;
+		for(uint zf=0u; zf<finer.Nz; zf++) for(uint yf=0u; yf<finer.Ny; yf++) for(uint xf=0u; xf<finer.Nx; xf++) { // outermost layer of the finer level
+			const ulong nf = finer.index(xf, yf, zf);
+			if(depth(xf, yf, zf, finer.Nx, finer.Ny, finer.Nz)!=0u||!is_coupled(finer.flags[nf])) continue;
+			ulong n[8]; float weight[8];
+			const uint count = sources(xf, yf, zf, n, weight);
+			uint k_slot[8]; float sum = 0.0f;
+			for(uint k=0u; k<8u; k++) {
+				k_slot[k] = 0u;
+				if(k>=count) { weight[k] = 0.0f; continue; }
+				uint x, y, z;
+				coordinates(n[k], x, y, z);
+				k_slot[k] = slot[(ulong)(x-r.x0)+((ulong)(y-r.y0)+(ulong)(z-r.z0)*(ulong)By)*(ulong)Bx];
+				if(k_slot[k]==max_uint) { k_slot[k] = 0u; weight[k] = 0.0f; } // solid node
+				sum += weight[k];
+			}
+			if(sum==0.0f) { // surrounded by solid nodes, so it is a solid boundary
+				finer.flags[nf] = TYPE_S;
+				continue;
+			}
+			finer.flags[nf] = TYPE_REFINED;
+			ghost_nodes.push_back(nf);
+			for(uint k=0u; k<8u; k++) {
+				ghost_sources.push_back(k_slot[k]);
+				ghost_weights.push_back(weight[k]/sum);
+			}
+		}
+#ifndef CPU_NATIVE
+		const bool device_buffers = true; // moments only exist on the device, the levels exchange them without the host
+#else // CPU_NATIVE
+		const bool device_buffers = false; // the native CPU backend only has host buffers
+#endif // CPU_NATIVE
+		const auto upload = [&](Device& device, const auto& values, auto& list) { // lists are uploaded once, empty lists are skipped
+			if(values.empty()) return;
+			list = std::remove_reference_t<decltype(list)>(device, (ulong)values.size(), 1u, true, device_buffers);
+			for(ulong i=0ull; i<(ulong)values.size(); i++) list[i] = values[i];
+			list.write_to_device();
+		};
+		const auto allocate = [&](Device& device, const vector<ulong>& nodes, Memory<ulong>& list, Memory<float>& moments) {
+			if(nodes.empty()) return;
+			upload(device, nodes, list);
+			moments = Memory<float>(device, (ulong)nodes.size(), 10u, !device_buffers, device_buffers);
+		};
+		allocate(device, coarse_nodes, r.coarse_nodes, r.coarse_moments);
+		if(!coarse_nodes.empty()) r.coarse_moments_last = Memory<float>(device, (ulong)coarse_nodes.size(), 10u, !device_buffers, device_buffers);
+		allocate(finer.device, ghost_nodes, r.ghost_nodes, r.ghost_moments);
+		upload(finer.device, ghost_sources, r.ghost_sources);
+		upload(finer.device, ghost_weights, r.ghost_weights);
+		allocate(finer.device, fine_nodes, r.fine_nodes, r.fine_moments);
+		if(!restricted_nodes.empty()) upload(device, restricted_nodes, r.restricted_nodes);
+#ifndef CPU_NATIVE
+		const auto kernel = [](LBM& lbm, const string& name, Memory<ulong>& nodes, Memory<float>& moments, const bool scatter) {
+			const uint count = (uint)nodes.length();
+			Kernel kernel(lbm.device, (ulong)count, name, lbm.fi, nodes, moments, count, lbm.t, lbm.fx, lbm.fy, lbm.fz);
+			if(scatter) kernel.add_parameters(0.0f); // scale
+			for(uint b=1u; b<lbm.ddf_buffers; b++) kernel.add_parameters(lbm.fi_split[b-1u]);
+			return kernel;
+		};
+		if(!coarse_nodes.empty()) r.kernel_gather_coarse = kernel(*this, "gather_moments", r.coarse_nodes, r.coarse_moments, false);
+		if(!restricted_nodes.empty()) {
+			r.kernel_scatter_restricted = kernel(*this, "scatter_moments", r.restricted_nodes, r.fine_moments, true);
+			r.kernel_gather_fine = kernel(finer, "gather_moments", r.fine_nodes, r.fine_moments, false);
+		}
+		if(!ghost_nodes.empty()) {
+			r.kernel_scatter_ghost = kernel(finer, "scatter_moments", r.ghost_nodes, r.ghost_moments, true);
+			r.kernel_interpolate_ghosts = Kernel(finer.device, (ulong)ghost_nodes.size(), "interpolate_ghosts", r.coarse_moments_last, r.coarse_moments, r.ghost_sources, r.ghost_weights, r.ghost_moments, (uint)coarse_nodes.size(), (uint)ghost_nodes.size(), 0.0f);
+		}
+#endif // CPU_NATIVE
+		print_info("Refinement level "+to_string(finer.level)+" is coupled through "+to_string(ghost_nodes.size())+" ghost nodes and "+to_string(restricted_nodes.size())+" restricted nodes.");
+		finer.t = 2ull*t;
+		finer.set_f(0.5f*fx, 0.5f*fy, 0.5f*fz);
+		finer.initialize(); // initializes its own finer levels as well
+	}
+}
+
+void LBM::restrict_refinement(Refinement& r) { // the finer level overwrites the DDFs that the nodes next to the box surface stream out in the next time step of this level
+	LBM& finer = *r.lbm;
+	finer.gather_moments(r.kernel_gather_fine, r.fine_nodes, r.fine_moments);
+	scatter_moments(r.kernel_scatter_restricted, r.restricted_nodes, r.fine_moments, 2.0f*get_tau()/finer.get_tau()); // Pi_neq scales with tau*dt
+}
+void LBM::interpolate_ghosts(Refinement& r, const float a) { // the ghost nodes of the finer level get the moments of this level, interpolated in space and by a between the previous and the current time step
+	LBM& finer = *r.lbm;
+	const ulong G = r.ghost_nodes.length(); // number of ghost nodes
+	if(G==0ull) return;
+#ifndef CPU_NATIVE
+	r.kernel_interpolate_ghosts.set_parameters(7u, a).enqueue_run(); // both levels enqueue into the same compute queue, so this is ordered with their time steps without the host waiting
+#else // CPU_NATIVE
+	const ulong C = r.coarse_nodes.length(); // number of coarse nodes
+	const float* last = ((const Memory<float>&)r.coarse_moments_last).data();
+	const float* next = ((const Memory<float>&)r.coarse_moments).data();
+	float* ghost = r.ghost_moments.data();
+	for(ulong g=0ull; g<G; g++) { // same as kernel interpolate_ghosts()
+		const uint* source = ((const Memory<uint>&)r.ghost_sources).data()+8ull*g;
+		const float* weight = ((const Memory<float>&)r.ghost_weights).data()+8ull*g;
+		for(ulong m=0ull; m<10ull; m++) {
+			float x = 0.0f;
+			for(uint k=0u; k<8u; k++) x += weight[k]*((1.0f-a)*last[m*C+(ulong)source[k]]+a*next[m*C+(ulong)source[k]]);
+			ghost[m*G+g] = x;
+		}
+	}
+#endif // CPU_NATIVE
+	finer.scatter_moments(r.kernel_scatter_ghost, r.ghost_nodes, r.ghost_moments, 0.5f*finer.get_tau()/get_tau()); // Pi_neq scales with tau*dt
+}
+void LBM::keep_coarse_moments(Refinement& r) {
+	if(r.coarse_nodes.length()==0ull) return;
+#ifndef CPU_NATIVE
+	device.get_cl_queue(QUEUE_COMPUTE).enqueueCopyBuffer(r.coarse_moments.get_cl_buffer(), r.coarse_moments_last.get_cl_buffer(), 0u, 0u, r.coarse_moments.capacity()); // in order with the kernels, the host does not wait
+#else // CPU_NATIVE
+	const float* next = ((const Memory<float>&)r.coarse_moments).data();
+	std::copy(next, next+r.coarse_moments.range(), r.coarse_moments_last.data());
+#endif // CPU_NATIVE
+}
+void LBM::couple_refinements() { // per time step of this level, each finer level does two time steps, after each of them the DDFs of the interface nodes are rebuilt from the other level (Lagrava et al. 2012)
+	for(Refinement* refinement : refinements) {
+		Refinement& r = *refinement;
+		LBM& finer = *r.lbm;
+		finer.set_f(0.5f*fx, 0.5f*fy, 0.5f*fz); // force per volume may have been changed since the last time step
+		restrict_refinement(r); // both levels are at the same time now
+		keep_coarse_moments(r);
+		gather_moments(r.kernel_gather_coarse, r.coarse_nodes, r.coarse_moments); // needs the DDFs restricted above
+		finer.do_time_step();
+		interpolate_ghosts(r, 0.0f); // a time step streams the DDFs of the previous one, so the ghost nodes lag one time step of the finer level behind
+		finer.do_time_step();
+		interpolate_ghosts(r, 0.5f);
+	}
+}
+
+void LBM::gather_moments(Kernel& kernel, const Memory<ulong>& nodes, Memory<float>& moments) {
+	if(nodes.length()==0ull) return;
+#ifndef CPU_NATIVE
+	kernel.set_parameters(4u, t, fx, fy, fz).enqueue_run(); // moments stay on the device
+	(void)moments;
+#else // CPU_NATIVE
+	(void)kernel;
+	native_gather_moments(nodes, moments);
+#endif // CPU_NATIVE
+}
+void LBM::scatter_moments(Kernel& kernel, const Memory<ulong>& nodes, Memory<float>& moments, const float ratio) {
+	if(nodes.length()==0ull) return;
+	const float scale = (1.0f-1.0f/get_tau())*ratio; // post-collision non-equilibrium part on this level
+#ifndef CPU_NATIVE
+	(void)moments; // already on the device
+	kernel.set_parameters(4u, t+1ull, fx, fy, fz, scale).enqueue_run(); // DDFs are stored like after time step t-1, which is the same parity as t+1
+#else // CPU_NATIVE
+	(void)kernel;
+	native_scatter_moments(nodes, moments, scale);
+#endif // CPU_NATIVE
 }
 
 void LBM::initialize() {
+	initialize_refinements(); // flags nodes that are covered by finer levels before the flags are uploaded
 	sanity_checks_initialization();
-	rho.write_to_device();
-	u.write_to_device();
-	flags.write_to_device();
-#ifdef FORCE_FIELD
-	F.write_to_device();
-#endif // FORCE_FIELD
-#ifdef SURFACE
-	phi.write_to_device();
-#endif // SURFACE
-#ifdef TEMPERATURE
-	T.write_to_device();
-#endif // TEMPERATURE
-	kernel_initialize.run();
+#ifdef CPU_NATIVE
+	native_initialize();
+#else // CPU_NATIVE
+	if(options.surface&&!flags.host_buffer_allocated()) flags.add_host_buffer(); // surface kernels change the flags, keep the initial flags on the host for the second pass and for reset()
+	for(uint pass=0u; pass<2u; pass++) {
+		if(pass>0u) restore_device_fields(); // measuring advanced the fields that only exist on the device
+		rho.write_to_device();
+		u.write_to_device();
+		flags.write_to_device();
+		if(options.force_field) F.write_to_device();
+		if(options.surface) phi.write_to_device();
+		if(options.temperature) T.write_to_device();
+		if(pass==0u&&autotune_kernels(false)) save_device_fields(); // only on the first run on a device, otherwise the workgroup sizes come from kernel_cache/
+		if(!domains) kernel_initialize.run();
+		else for(uint d=0u; d<Dz; d++) domains[d].kernel_initialize.run();
+#ifdef SPARSE_BRICKS
+		update_bricks(true); // kernel_initialize may change flags, and autotuning needs the final launch range
+#endif // SPARSE_BRICKS
+		if(pass>0u||!autotune_kernels()) break; // measuring ran the kernels on the initialized fields, so initialize again
+	}
+	for(Memory<float>* field : downloaded_fields) field->delete_host_buffer(); // uploaded again in the second pass
+	downloaded_fields.clear();
+	if(domains) domains_exchange(1ull); // kernel_initialize stores DDFs like a time step with odd t
+#endif // CPU_NATIVE
+	for(Refinement* refinement : refinements) { // restrict the initial state of the finer levels, then keep the moments at the interface for interpolation in time
+		Refinement& r = *refinement;
+		restrict_refinement(r);
+		gather_moments(r.kernel_gather_coarse, r.coarse_nodes, r.coarse_moments);
+		keep_coarse_moments(r);
+		interpolate_ghosts(r, 0.0f);
+	}
 	initialized = true;
 }
 
+void LBM::save_device_fields() {
+#ifndef CPU_NATIVE
+	const auto save = [&](Memory<float>& field, Memory<float> Domain::* slab) { // slab is the buffer of field on each domain, only F, rho and u are split across domains
+		if(field.host_buffer_allocated()) return; // initialize() uploads it again
+		vector<std::pair<Device*, Memory<float>*>> buffers; // one per domain if the lattice is split
+		if(!domains) buffers.push_back({ &device, &field });
+		else for(uint d=0u; d<Dz; d++) buffers.push_back({ &domains[d].device, &(domains[d].*slab) });
+		for(const auto& [buffer_device, buffer] : buffers) {
+			if(buffer_device->info.memory_used+buffer->capacity()>(ulong)buffer_device->info.memory*1048576ull) { // no room for a copy, keep the field on the host until the second pass has uploaded it
+				field.add_host_buffer();
+				downloaded_fields.push_back(&field);
+				return;
+			}
+		}
+		for(const auto& [buffer_device, buffer] : buffers) {
+			Saved_Field* saved = new Saved_Field();
+			saved->device = buffer_device;
+			saved->field = buffer;
+			saved->copy = Memory<float>(*buffer_device, buffer->length(), buffer->dimensions(), false);
+			buffer_device->get_cl_queue(QUEUE_COMPUTE).enqueueCopyBuffer(buffer->get_cl_buffer(), saved->copy.get_cl_buffer(), 0u, 0u, buffer->capacity()); // in order with the kernels that measure
+			saved_fields.push_back(saved);
+		}
+	};
+	save(rho, &Domain::rho);
+	save(u, &Domain::u);
+	if(options.force_field) save(F, &Domain::F);
+	if(options.surface) save(phi, nullptr);
+	if(options.temperature) save(T, nullptr);
+#endif // CPU_NATIVE
+}
+void LBM::restore_device_fields() {
+#ifndef CPU_NATIVE
+	for(Saved_Field* saved : saved_fields) {
+		saved->device->get_cl_queue(QUEUE_COMPUTE).enqueueCopyBuffer(saved->copy.get_cl_buffer(), saved->field->get_cl_buffer(), 0u, 0u, saved->field->capacity());
+		delete saved; // OpenCL keeps the buffer of the copy alive until the copy back has read it
+	}
+	saved_fields.clear();
+#endif // CPU_NATIVE
+}
+
+bool LBM::autotune_kernels(const bool measure) { // returns true if any kernel was run for measuring
+	bool measured = false;
+	const auto autotune = [&](Kernel& kernel, const Device& device) { measured |= measure ? kernel.autotune(device) : !kernel.autotuned(device); };
+	for(uint d=0u; d<Dz&&domains; d++) { // stream_collide is measured on the whole slab, do_time_step() launches it for parts of it with the same workgroup size
+		Domain& domain = domains[d];
+		const ulong A=(ulong)Nx*(ulong)Ny, n1=A*(ulong)(domain.Nz+1u);
+		domain.kernel_stream_collide.set_parameters(domain.kernel_stream_collide.get_number_of_parameters()-2u, A, n1).set_range(n1-A);
+		autotune(domain.kernel_stream_collide, domain.device);
+		autotune(domain.kernel_update_fields, domain.device);
+	}
+	if(domains) return measured;
+	autotune(kernel_stream_collide, device);
+	autotune(kernel_update_fields, device);
+	if(options.surface) {
+		autotune(kernel_surface_0, device);
+		autotune(kernel_surface_1, device);
+		autotune(kernel_surface_2, device);
+		autotune(kernel_surface_3, device);
+	}
+	return measured;
+}
+
 void LBM::do_time_step() {
-#ifdef SURFACE
-	kernel_surface_0.set_parameters(7u, t, fx, fy, fz).run();
-#endif // SURFACE
-	kernel_stream_collide.set_parameters(4u, t, fx, fy, fz).run();
-#ifdef SURFACE
-	kernel_surface_1.run();
-	kernel_surface_2.set_parameters(4u, t).run();
-	kernel_surface_3.run();
-#endif // SURFACE
+	if(options.surface) kernel_surface_0.set_parameters(7u, t, fx, fy, fz).enqueue_run();
+#ifndef CPU_NATIVE
+	if(!domains) {
+		kernel_stream_collide.set_parameters(4u, t, fx, fy, fz).enqueue_run(); // kernel arguments are captured at enqueue time, so t can be incremented right away
+	} else {
+		for(uint d=0u; d<Dz; d++) { // boundary layers first, so the exchange with the neighbor domains overlaps with the interior
+			Domain& domain = domains[d];
+			Kernel& kernel = domain.kernel_stream_collide;
+			const ulong A=(ulong)Nx*(ulong)Ny, n0=A, n1=A*(ulong)(domain.Nz+1u); // n0, n1 are 64-bit kernel parameters
+			const uint p = kernel.get_number_of_parameters()-2u; // p is the position of parameters n0, n1
+			kernel.set_parameters(4u, t, fx, fy, fz);
+			if(domain.Nz<=2u) { // no interior
+				kernel.set_parameters(p, n0, n1).set_range(n1-n0).enqueue_run(1u, nullptr, &domain.event_boundary);
+				continue;
+			}
+			kernel.set_parameters(p, n0, n0+A).set_range(A).enqueue_run(); // bottom layer
+			kernel.set_parameters(p, n1-A, n1).enqueue_run(1u, nullptr, &domain.event_boundary); // top layer
+			kernel.set_parameters(p, n0+A, n1-A).set_range(n1-n0-2ull*A).enqueue_run(); // interior
+		}
+		domains_exchange(t);
+	}
+#else // CPU_NATIVE
+	native_stream_collide();
+#endif // CPU_NATIVE
+	if(options.surface) {
+		kernel_surface_1.enqueue_run();
+		kernel_surface_2.set_parameters(4u, t).enqueue_run();
+		kernel_surface_3.enqueue_run();
+#ifdef SPARSE_BRICKS
+		update_bricks(); // interface may have moved into a gas brick
+#endif // SPARSE_BRICKS
+	}
 	t++; // increment time step
-#ifdef UPDATE_FIELDS
-	t_last_update_fields = t;
-#endif // UPDATE_FIELDS
+	if(options.update_fields) t_last_update_fields = t;
+	couple_refinements();
+}
+
+#ifdef SPARSE_BRICKS
+void LBM::update_bricks(const bool wait) { // kernel_stream_collide and kernel_update_fields are only launched over bricks that contain nodes which are not solid or gas
+#ifndef CPU_NATIVE // native CPU kernels don't use bricks
+	if(domains) return;
+	active_bricks.reset_device(0u); // reset the counter in order with the kernels on the compute queue, without waiting for the device
+	kernel_update_bricks.enqueue_run();
+	if(options.surface) return; // with SURFACE, flags change in every time step, so the number of active bricks is never read back, kernels are launched over all bricks and the ones past the list return right away
+	const ulong range = get_bricks()*(ulong)(brick_x*brick_y*brick_z); // until the number of active bricks is known, kernels are launched over all bricks
+	kernel_stream_collide.set_range(range);
+	kernel_update_fields.set_range(range);
+	active_bricks.enqueue_read_from_device();
+	bricks_pending = true;
+	if(wait) {
+		active_bricks.finish_queue();
+		narrow_bricks();
+	}
+#else // CPU_NATIVE
+	(void)wait;
+#endif // CPU_NATIVE
+}
+void LBM::narrow_bricks() { // call only after the device has finished the read back that update_bricks() enqueued
+	if(!bricks_pending) return;
+	bricks_pending = false;
+	const ulong range = (ulong)max(((const Memory<uint>&)active_bricks)[0], 1u)*(ulong)(brick_x*brick_y*brick_z); // a launch can't be empty
+	kernel_stream_collide.set_range(range);
+	kernel_update_fields.set_range(range);
+}
+#endif // SPARSE_BRICKS
+
+void LBM::domains_exchange(const ulong t) { // DDFs that were streamed from a slab into a halo layer belong to the first layer of the neighbor slab, and DDFs the neighbor slab streams into its first layer in the next time step are loaded from the halo layer
+	const vector<int>& transfers = domain_transfers(velocity_set);
+	const ulong A=(ulong)Nx*(ulong)Ny, B=(ulong)transfers.size(), bytes=A*(ulong)options.ddf_bytes(); // nodes per layer, DDF slots per layer that cross the interface in each direction, size of one DDF slot of a layer
+	const bool odd = t%2ull; // Esoteric-Pull stores every DDF pair in swapped slots in odd time steps
+	for(uint d=0u; d<Dz; d++) domains[d].device.finish_queue(QUEUE_TRANSFER); // previous exchange is done with the transfer buffers
+	for(uint d=0u; d<Dz; d++) { // download DDFs leaving each slab, once its boundary layers are done
+		Domain& domain = domains[d];
+		const ulong N_d = A*(ulong)(domain.Nz+2u);
+		vector<cl::Event> boundary;
+		if(domain.event_boundary()) boundary.push_back(domain.event_boundary); // there is no time step yet after initialization
+		for(ulong k=0ull; k<B; k++) {
+			const uint i=(uint)abs(transfers[k]); const bool up = transfers[k]>0;
+			const uint slot_up=up==odd ? i+1u : i, slot_down=up==odd ? i : i+1u; // slots of the DDFs that cross the interface upward and downward
+			const ulong z_up=up ? domain.Nz+1u : domain.Nz, z_down=up ? 1ull : 0ull;
+			domain.device.get_cl_queue(QUEUE_TRANSFER).enqueueReadBuffer(domain.fi.get_cl_buffer(), false, (ulong)slot_down*N_d*(ulong)options.ddf_bytes()+z_down*bytes, bytes, (void*)(domain.transfer.data()+k*bytes), event_waitlist_or_null(&boundary));
+			domain.device.get_cl_queue(QUEUE_TRANSFER).enqueueReadBuffer(domain.fi.get_cl_buffer(), false, (ulong)slot_up*N_d*(ulong)options.ddf_bytes()+z_up*bytes, bytes, (void*)(domain.transfer.data()+(B+k)*bytes), event_waitlist_or_null(&boundary));
+		}
+	}
+	for(uint d=0u; d<Dz; d++) domains[d].device.finish_queue(QUEUE_TRANSFER); // events can't be shared between devices, so the host waits for all downloads
+	if(ranks>1u) get_transport().exchange(domains[0].transfer.data(), domains[Dz-1u].transfer.data()+B*bytes, received_below.data(), received_above.data(), B*bytes); // the outermost domains exchange with the neighbor ranks
+	for(uint d=0u; d<Dz; d++) { // upload DDFs entering each slab from the domains below and above
+		Domain& domain = domains[d];
+		const uchar* from_below = ranks>1u&&d==0u ? received_below.data() : domains[(d+Dz-1u)%Dz].transfer.data()+B*bytes; // upper half of the domain below
+		const uchar* from_above = ranks>1u&&d==Dz-1u ? received_above.data() : domains[(d+1u)%Dz].transfer.data(); // lower half of the domain above
+		const ulong N_d = A*(ulong)(domain.Nz+2u);
+		for(ulong k=0ull; k<B; k++) {
+			const uint i=(uint)abs(transfers[k]); const bool up = transfers[k]>0;
+			const uint slot_up=up==odd ? i+1u : i, slot_down=up==odd ? i : i+1u;
+			const ulong z_up=up ? 1ull : 0ull, z_down=up ? domain.Nz+1u : domain.Nz;
+			domain.device.get_cl_queue(QUEUE_TRANSFER).enqueueWriteBuffer(domain.fi.get_cl_buffer(), false, (ulong)slot_up*N_d*(ulong)options.ddf_bytes()+z_up*bytes, bytes, (void*)(from_below+k*bytes));
+			domain.device.get_cl_queue(QUEUE_TRANSFER).enqueueWriteBuffer(domain.fi.get_cl_buffer(), false, (ulong)slot_down*N_d*(ulong)options.ddf_bytes()+z_down*bytes, bytes, (void*)(from_above+k*bytes));
+		}
+		domain.device.queue_wait_for(QUEUE_COMPUTE, QUEUE_TRANSFER); // next time step starts only after the upload
+	}
 }
 
 void LBM::run(const ulong steps) { // initializes the LBM simulation (copies data to device and runs initialize kernel), then runs LBM
@@ -235,64 +851,114 @@ void LBM::run(const ulong steps) { // initializes the LBM simulation (copies dat
 		initialize(); // only initialize if run() was not called before
 		info.print_initialize(); // only print setup info if the setup is new (run() was not called before)
 	}
+#ifdef SPARSE_BRICKS
+	update_bricks(); // flags may have been changed on the host since the last run(), the first batch runs over all bricks while the number of active bricks is read back
+#endif // SPARSE_BRICKS
 	Clock clock;
-	for(ulong i=1ull; i<=steps; i++) { // run LBM in loop, runs infinitely long if steps = max_ulong
+	for(ulong i=0ull; i<steps; ) { // run LBM in loop, runs infinitely long if steps = max_ulong
 #if defined(CONSOLE_GRAPHICS)||defined(WINDOWS_GRAPHICS)||defined(SDL_GRAPHICS)
 		while(!keys['P']&&running) sleep(0.016);
 		if(!running) break;
 #endif // CONSOLE_GRAPHICS || WINDOWS_GRAPHICS || SDL_GRAPHICS
+		const ulong batch = min((ulong)sync_interval, steps-i); // number of time steps to enqueue back-to-back
 		clock.start();
-		do_time_step(); // execute one LBM time step
-		info.update(clock.stop());
+		for(ulong j=0ull; j<batch; j++) do_time_step(); // enqueue LBM time steps without waiting for the device in between
+#ifndef CPU_NATIVE
+		if(!domains) device.finish_queue(); // sync only once per batch, run() always returns with all time steps completed
+		else for(uint d=0u; d<Dz; d++) domains[d].device.finish_queue();
+#ifdef SPARSE_BRICKS
+		narrow_bricks(); // the number of active bricks has arrived with the sync
+#endif // SPARSE_BRICKS
+#endif // CPU_NATIVE
+		info.update(clock.stop()/(double)batch, batch);
+		i += batch;
 	}
 }
 
 void LBM::update_fields() { // update fields (rho, u, T) manually
-#ifndef UPDATE_FIELDS
-	if(t>t_last_update_fields) { // only run kernel_update_fields if the time step has changed since last update
-		kernel_update_fields.set_parameters(4u, t, fx, fy, fz).run();
+	if(!options.update_fields&&t>t_last_update_fields) { // only run kernel_update_fields if the time step has changed since last update
+#ifndef CPU_NATIVE
+		if(!domains) kernel_update_fields.set_parameters(4u, t, fx, fy, fz).run();
+		else for(uint d=0u; d<Dz; d++) domains[d].kernel_update_fields.set_parameters(4u, t, fx, fy, fz).run();
+#else // CPU_NATIVE
+		native_update_fields();
+#endif // CPU_NATIVE
 		t_last_update_fields = t;
 	}
-#endif // UPDATE_FIELDS
+	for(Refinement* refinement : refinements) refinement->lbm->update_fields();
 }
 
-void LBM::reset() { // reset simulation (takes effect in following run() call)
+void LBM::reset() { // reset simulation (takes effect in following run() call), fields without host buffer start from their current values on the device
 	initialized = false;
+	for(Refinement* refinement : refinements) refinement->lbm->reset(); // finer levels start again from the interpolated fields
+}
+
+void LBM::delete_host_buffers() { // upload pending host changes, then free host buffers of all fields; they are allocated and downloaded again on next host access or export
+#ifdef CPU_NATIVE
+	return; // the host buffers are the only copy of the fields
+#endif // CPU_NATIVE
+	rho.write_to_device();
+	rho.delete_host_buffer();
+	u.write_to_device();
+	u.delete_host_buffer();
+	flags.write_to_device();
+	flags.delete_host_buffer();
+	if(options.force_field) {
+		F.write_to_device();
+		F.delete_host_buffer();
+	}
+	if(options.surface) {
+		phi.write_to_device();
+		phi.delete_host_buffer();
+	}
+	if(options.temperature) {
+		T.write_to_device();
+		T.delete_host_buffer();
+	}
 }
 
-#ifdef FORCE_FIELD
 void LBM::calculate_force_on_boundaries() { // calculate forces from fluid on TYPE_S nodes
-	kernel_calculate_force_on_boundaries.set_parameters(2u, t).run();
+	if(!options.force_field) print_error("Forces on boundaries are only computed with FORCE_FIELD. Set options.force_field in the LBM constructor or uncomment \"#define FORCE_FIELD\" in defines.hpp.");
+#ifndef CPU_NATIVE
+	if(!domains) kernel_calculate_force_on_boundaries.set_parameters(2u, t).run();
+	else for(uint d=0u; d<Dz; d++) domains[d].kernel_calculate_force_on_boundaries.set_parameters(2u, t).run();
+#else // CPU_NATIVE
+	native_calculate_force_on_boundaries();
+#endif // CPU_NATIVE
 }
 float3 LBM::calculate_force_on_object(const uchar flag_marker) { // add up force for all nodes flagged with flag_marker
+	if(!options.force_field) print_error("Forces on objects are only computed with FORCE_FIELD. Set options.force_field in the LBM constructor or uncomment \"#define FORCE_FIELD\" in defines.hpp.");
 	double3 force(0.0, 0.0, 0.0);
-	for(uint n=0u; n<get_N(); n++) {
+	for(ulong n=rank_begin(rank); n<rank_begin(rank+1u); n++) { // with several ranks, each rank adds up its own slabs
 		if(flags[n]==flag_marker) {
 			force.x += (double)F.x[n];
 			force.y += (double)F.y[n];
 			force.z += (double)F.z[n];
 		}
 	}
+	get_transport().sum(&force.x, 3u);
 	return float3(force.x, force.y, force.z);
 }
 float3 LBM::calculate_torque_on_object(const uchar flag_marker) { // add up torque around center of mass for all nodes flagged with flag_marker
-	double3 center_of_mass(0.0, 0.0, 0.0);
-	uint counter = 0u;
-	for(uint n=0u; n<get_N(); n++) {
+	double center_of_mass[4] = { 0.0, 0.0, 0.0, 0.0 }; // x, y, z, number of nodes
+	for(ulong n=rank_begin(rank); n<rank_begin(rank+1u); n++) {
 		if(flags[n]==flag_marker) {
 			const float3 p = position(n);
-			center_of_mass.x += (double)p.x;
-			center_of_mass.y += (double)p.y;
-			center_of_mass.z += (double)p.z;
-			counter++;
+			center_of_mass[0] += (double)p.x;
+			center_of_mass[1] += (double)p.y;
+			center_of_mass[2] += (double)p.z;
+			center_of_mass[3] += 1.0;
 		}
 	}
-	return calculate_torque_on_object(float3(center_of_mass.x/(double)counter, center_of_mass.y/(double)counter, center_of_mass.z/(double)counter)+center(), flag_marker);
+	get_transport().sum(center_of_mass, 4u);
+	const double counter = center_of_mass[3];
+	return calculate_torque_on_object(float3(center_of_mass[0]/counter, center_of_mass[1]/counter, center_of_mass[2]/counter)+center(), flag_marker);
 }
 float3 LBM::calculate_torque_on_object(const float3& rotation_center, const uchar flag_marker) { // add up torque around specified rotation center for all nodes flagged with flag_marker
+	if(!options.force_field) print_error("Torques on objects are only computed with FORCE_FIELD. Set options.force_field in the LBM constructor or uncomment \"#define FORCE_FIELD\" in defines.hpp.");
 	double3 torque(0.0, 0.0, 0.0);
 	const float3 rotation_center_in_box = rotation_center-center();
-	for(uint n=0u; n<get_N(); n++) {
+	for(ulong n=rank_begin(rank); n<rank_begin(rank+1u); n++) {
 		if(flags[n]==flag_marker) {
 			const float3 t = cross(position(n)-rotation_center_in_box, float3(F.x[n], F.y[n], F.z[n]));
 			torque.x += (double)t.x;
@@ -300,36 +966,32 @@ float3 LBM::calculate_torque_on_object(const float3& rotation_center, const ucha
 			torque.z += (double)t.z;
 		}
 	}
+	get_transport().sum(&torque.x, 3u);
 	return float3(torque.x, torque.y, torque.z);
 }
-#endif // FORCE_FIELD
 
-#ifdef MOVING_BOUNDARIES
 void LBM::update_moving_boundaries() { // mark/unmark nodes next to TYPE_S nodes with velocity!=0 with TYPE_MS
+	if(!options.moving_boundaries) print_error("Moving boundaries are only updated with MOVING_BOUNDARIES. Set options.moving_boundaries in the LBM constructor or uncomment \"#define MOVING_BOUNDARIES\" in defines.hpp.");
 	kernel_update_moving_boundaries.run();
 }
-#endif // MOVING_BOUNDARIES
 
 void LBM::write_status(const string& path) { // write LBM status report to a .txt file
 	string status = "";
 	status += "Grid Resolution = ("+to_string(Nx)+", "+to_string(Ny)+", "+to_string(Nz)+")\n";
-	status += "LBM type = D"+string(velocity_set==9 ? "2" : "3")+"Q"+to_string(velocity_set)+" "+info.collision+"\n";
+	status += "LBM type = "+options.name()+"\n";
 	status += "Memory Usage = "+to_string(info.cpu_mem_required)+" MB (CPU), "+to_string(info.gpu_mem_required)+" MB (GPU)\n";
-	status += "Maximum Allocation Size = "+to_string((uint)((ulong)get_N()*(ulong)(velocity_set*sizeof(fpxx))/1048576ull))+" MB\n";
+	status += "Maximum Allocation Size = "+to_string((uint)(get_largest_buffer()/1048576ull))+" MB"+(ddf_buffers>1u ? " (DDFs split into "+to_string(ddf_buffers)+" buffers)" : "")+"\n";
 	status += "Time Step = "+to_string(t)+" / "+(info.steps==max_ulong ? "infinite" : to_string(info.steps))+"\n";
 	status += "Kinematic Viscosity = "+to_string(nu)+"\n";
 	status += "Relaxation Time = "+to_string(get_tau())+"\n";
 	status += "Maximum Reynolds Number = "+to_string(get_Re_max())+"\n";
-#ifdef VOLUME_FORCE
-	status += "Volume Force = ("+to_string(fx)+", "+to_string(fy)+", "+to_string(fz)+")\n";
-#endif // VOLUME_FORCE
-#ifdef SURFACE
-	status += "Surface Tension Coefficient = "+to_string(sigma)+"\n";
-#endif // SURFACE
-#ifdef TEMPERATURE
-	status += "Thermal Diffusion Coefficient = "+to_string(alpha)+"\n";
-	status += "Thermal Expansion Coefficient = "+to_string(beta)+"\n";
-#endif // TEMPERATURE
+	if(options.volume_force) status += "Volume Force = ("+to_string(fx)+", "+to_string(fy)+", "+to_string(fz)+")\n";
+	if(options.surface) status += "Surface Tension Coefficient = "+to_string(sigma)+"\n";
+	if(options.temperature) {
+		status += "Thermal Diffusion Coefficient = "+to_string(alpha)+"\n";
+		status += "Thermal Expansion Coefficient = "+to_string(beta)+"\n";
+	}
+	status += info.profile_status();
 	const string filename = default_filename(path, "status", ".txt");
 	write_file(filename, status);
 }
@@ -348,15 +1010,16 @@ template<typename T> static string vtk_type() {
 	else print_error("Error in vtk_type(): Type not supported.");
 	return "";
 }
-template<typename T> void write_vtk(const string& path, const Memory<T>& memory, const uint Nx, const uint Ny, const uint Nz) { // write binary .vtk file
-	const float spacing = units.si_x(1.0f);
-	const float3 origin = spacing*float3(0.5f-0.5f*(float)Nx, 0.5f-0.5f*(float)Ny, 0.5f-0.5f*(float)Nz);
+template<typename T> void write_vtk(const string& path, Memory<T>& memory, const uint Nx, const uint Ny, const uint Nz, const float spacing_lattice=1.0f, const float3& center=float3(0.0f)) { // write binary .vtk file, finer levels pass their lattice spacing and center in lattice units of level 0
+	memory.add_host_buffer(); // a field that was never accessed on the host is downloaded first
+	const float spacing = units.si_x(spacing_lattice);
+	const float3 origin = units.si_x(1.0f)*center+spacing*float3(0.5f-0.5f*(float)Nx, 0.5f-0.5f*(float)Ny, 0.5f-0.5f*(float)Nz);
 	const string header =
 		"# vtk DataFile Version 3.0\nData\nBINARY\nDATASET STRUCTURED_POINTS\n"
 		"DIMENSIONS "+to_string(Nx)+" "+to_string(Ny)+" "+to_string(Nz)+"\n"
 		"ORIGIN "+to_string(origin.x)+" "+to_string(origin.y)+" "+to_string(origin.z)+"\n"
 		"SPACING "+to_string(spacing)+" "+to_string(spacing)+" "+to_string(spacing)+"\n"
-		"POINT_DATA "+to_string(Nx*Ny*Nz)+"\nSCALARS data "+vtk_type<T>()+" "+to_string(memory.dimensions())+"\nLOOKUP_TABLE default\n"
+		"POINT_DATA "+to_string((ulong)Nx*(ulong)Ny*(ulong)Nz)+"\nSCALARS data "+vtk_type<T>()+" "+to_string(memory.dimensions())+"\nLOOKUP_TABLE default\n"
 	;
 	T* data = new T[memory.range()];
 	for(uint d=0u; d<memory.dimensions(); d++) {
@@ -376,101 +1039,147 @@ template<typename T> void write_vtk(const string& path, const Memory<T>& memory,
 	info.allow_rendering = true;
 }
 
+template<typename U> bool LBM::gather(Memory<U>& field) { // has to be called by all ranks, other ranks keep the slabs of rank 0 outdated in their host buffers
+	if(ranks==1u) return true;
+	Transport& transport = get_transport();
+	if(!field.host_buffer_allocated()) field.add_host_buffer();
+	for(uint r=1u; r<ranks; r++) {
+		const ulong n0=rank_begin(r), n1=rank_begin(r+1u);
+		for(uint d=0u; d<field.dimensions(); d++) {
+			if(rank==0u) transport.receive(r, field.data(d)+n0, (n1-n0)*sizeof(U));
+			else if(rank==r) transport.send(0u, ((const Memory<U>&)field).data(d)+n0, (n1-n0)*sizeof(U));
+		}
+	}
+	return rank==0u;
+}
+
 void LBM::rho_write_host_to_vtk(const string& path) {
+	if(!gather(rho)) return; // only rank 0 writes the file
 	const string filename = default_filename(path, "rho", ".vtk");
-	write_vtk(filename, rho, Nx, Ny, Nz);
+	write_vtk(filename, rho, Nx, Ny, Nz, get_spacing(), level_center);
 }
 void LBM::rho_write_device_to_vtk(const string& path) {
-#ifndef UPDATE_FIELDS
-	update_fields();
-#endif // UPDATE_FIELDS
+	update_fields(); // does nothing with UPDATE_FIELDS
 	rho.read_from_device();
 	rho_write_host_to_vtk(path);
+	for(Refinement* refinement : refinements) refinement->lbm->rho_write_device_to_vtk(path); // finer levels are written to their own files
 }
 void LBM::u_write_host_to_vtk(const string& path) {
+	if(!gather(u)) return; // only rank 0 writes the file
 	const string filename = default_filename(path, "u", ".vtk");
-	write_vtk(filename, u, Nx, Ny, Nz);
+	write_vtk(filename, u, Nx, Ny, Nz, get_spacing(), level_center);
 }
 void LBM::u_write_device_to_vtk(const string& path) {
-#ifndef UPDATE_FIELDS
-	update_fields();
-#endif // UPDATE_FIELDS
+	update_fields(); // does nothing with UPDATE_FIELDS
 	u.read_from_device();
 	u_write_host_to_vtk(path);
+	for(Refinement* refinement : refinements) refinement->lbm->u_write_device_to_vtk(path); // finer levels are written to their own files
 }
 void LBM::flags_write_host_to_vtk(const string& path) {
+	if(!gather(flags)) return; // only rank 0 writes the file
 	const string filename = default_filename(path, "flags", ".vtk");
-	write_vtk(filename, flags, Nx, Ny, Nz);
+	write_vtk(filename, flags, Nx, Ny, Nz, get_spacing(), level_center);
 }
 void LBM::flags_write_device_to_vtk(const string& path) {
 	flags.read_from_device();
 	flags_write_host_to_vtk(path);
+	for(Refinement* refinement : refinements) refinement->lbm->flags_write_device_to_vtk(path); // finer levels are written to their own files
 }
 
-#ifdef FORCE_FIELD
 void LBM::F_write_host_to_vtk(const string& path) {
+	if(!options.force_field) print_error("F only exists with FORCE_FIELD. Set options.force_field in the LBM constructor or uncomment \"#define FORCE_FIELD\" in defines.hpp.");
+	if(!gather(F)) return; // only rank 0 writes the file
 	const string filename = default_filename(path, "F", ".vtk");
-	write_vtk(filename, F, Nx, Ny, Nz);
+	write_vtk(filename, F, Nx, Ny, Nz, get_spacing(), level_center);
 }
 void LBM::F_write_device_to_vtk(const string& path) {
-	F.read_from_device();
+	if(options.force_field) F.read_from_device(); // otherwise F_write_host_to_vtk() reports the missing extension
 	F_write_host_to_vtk(path);
+	for(Refinement* refinement : refinements) refinement->lbm->F_write_device_to_vtk(path); // finer levels are written to their own files
 }
-#endif // FORCE_FIELD
 
-#ifdef SURFACE
 void LBM::phi_write_host_to_vtk(const string& path) {
+	if(!options.surface) print_error("phi only exists with SURFACE. Set options.surface in the LBM constructor or uncomment \"#define SURFACE\" in defines.hpp.");
 	const string filename = default_filename(path, "phi", ".vtk");
-	write_vtk(filename, phi, Nx, Ny, Nz);
+	write_vtk(filename, phi, Nx, Ny, Nz, get_spacing(), level_center);
 }
 void LBM::phi_write_device_to_vtk(const string& path) {
-	phi.read_from_device();
+	if(options.surface) phi.read_from_device(); // otherwise phi_write_host_to_vtk() reports the missing extension
 	phi_write_host_to_vtk(path);
 }
-#endif // SURFACE
 
-#ifdef TEMPERATURE
 void LBM::T_write_host_to_vtk(const string& path) {
+	if(!options.temperature) print_error("T only exists with TEMPERATURE. Set options.temperature in the LBM constructor or uncomment \"#define TEMPERATURE\" in defines.hpp.");
 	const string filename = default_filename(path, "T", ".vtk");
-	write_vtk(filename, T, Nx, Ny, Nz);
+	write_vtk(filename, T, Nx, Ny, Nz, get_spacing(), level_center);
 }
 void LBM::T_write_device_to_vtk(const string& path) {
-#ifndef UPDATE_FIELDS
-	update_fields();
-#endif // UPDATE_FIELDS
-	T.read_from_device();
+	update_fields(); // does nothing with UPDATE_FIELDS
+	if(options.temperature) T.read_from_device(); // otherwise T_write_host_to_vtk() reports the missing extension
 	T_write_host_to_vtk(path);
 }
-#endif // TEMPERATURE
 
-void LBM::voxelize_mesh(const Mesh* mesh, const uchar flag) { // voxelize triangle mesh
+void LBM::voxelize_mesh(const Mesh* mesh, const uchar flag) { // voxelize triangle mesh on this level and all finer levels
+	voxelize_mesh_on_device(mesh, flag);
+	for(Refinement* refinement : refinements) { // mesh coordinates in node units of the finer level
+		const float3 origin((float)refinement->x0, (float)refinement->y0, (float)refinement->z0);
+		Mesh* finer_mesh = new Mesh(mesh->triangle_number, 2.0f*(mesh->center-origin));
+		for(uint i=0u; i<mesh->triangle_number; i++) {
+			finer_mesh->p0[i] = 2.0f*(mesh->p0[i]-origin);
+			finer_mesh->p1[i] = 2.0f*(mesh->p1[i]-origin);
+			finer_mesh->p2[i] = 2.0f*(mesh->p2[i]-origin);
+		}
+		finer_mesh->find_bounds();
+		refinement->lbm->voxelize_mesh(finer_mesh, flag);
+		delete finer_mesh;
+	}
+}
+void LBM::voxelize_mesh_on_device(const Mesh* mesh, const uchar flag) {
+#ifdef CPU_NATIVE
+	print_error("Mesh voxelization runs on the OpenCL device, which the native CPU backend does not use. Comment out \"#define CPU_NATIVE\" in defines.hpp.");
+#endif // CPU_NATIVE
 	print_info("Voxelizing mesh. This may take a few minutes.");
-	Memory<float3> p0(device, mesh->triangle_number, 1u, mesh->p0);
-	Memory<float3> p1(device, mesh->triangle_number, 1u, mesh->p1);
-	Memory<float3> p2(device, mesh->triangle_number, 1u, mesh->p2);
 	const float x0=mesh->pmin.x, y0=mesh->pmin.y, z0=mesh->pmin.z, x1=mesh->pmax.x, y1=mesh->pmax.y, z1=mesh->pmax.z; // use bounding box of mesh to speed up voxelization
-	Kernel kernel_voxelize_mesh(device, get_N(), "voxelize_mesh", flags, flag, p0, p1, p2, mesh->triangle_number, x0, y0, z0, x1, y1, z1);
-	p0.write_to_device();
-	p1.write_to_device();
-	p2.write_to_device();
+	const auto voxelize = [&](Device& device, Memory<uchar>& device_flags) { // with several domains, every device voxelizes its slab and halo layers
+		Memory<float3> p0(device, mesh->triangle_number, 1u, mesh->p0);
+		Memory<float3> p1(device, mesh->triangle_number, 1u, mesh->p1);
+		Memory<float3> p2(device, mesh->triangle_number, 1u, mesh->p2);
+		Kernel kernel_voxelize_mesh(device, device_flags.length(), "voxelize_mesh", device_flags, flag, p0, p1, p2, mesh->triangle_number, x0, y0, z0, x1, y1, z1);
+		p0.write_to_device();
+		p1.write_to_device();
+		p2.write_to_device();
+		kernel_voxelize_mesh.run();
+	};
 	flags.write_to_device();
-	kernel_voxelize_mesh.run();
+	if(!domains) voxelize(device, flags);
+	else for(uint d=0u; d<Dz; d++) voxelize(domains[d].device, domains[d].flags);
 	flags.read_from_device();
 }
 void LBM::voxelize_stl(const string& path, const float3& center, const float3x3& rotation, const float size, const uchar flag) { // voxelize triangle mesh
 	float3 box_size{get_Nx(), get_Ny(), get_Nz()};
-	auto const cache_path = path + ".cache";
+	auto const cache_path = path+(level>0u ? ".level"+to_string(level) : "")+".cache"; // every level voxelizes the mesh at its own resolution
 
-	if (load_voxelized_mesh_from_disk(cache_path, flags, device, box_size, center, rotation, size))
+	const Device& cache_device = domains ? domains[0].device : device; // cache is specific to the device that voxelized the mesh
+	const bool cache = ranks==1u; // with several ranks, each rank only has the flags of its own slabs on the host
+	const Mesh* mesh = nullptr;
+	if (cache && load_voxelized_mesh_from_disk(cache_path, flags, cache_device, box_size, center, rotation, size))
 	{
 		flags.write_to_device();
-		return;
+	} else {
+		mesh = read_stl(path, box_size, center, rotation, size);
+		voxelize_mesh_on_device(mesh, flag);
+		if (cache) save_voxelized_mesh_to_disk(cache_path, flags, cache_device, box_size, center, rotation, size);
+	}
+	float size_effective = size; // finer levels get the size the mesh has on this level, so that it lines up
+	if(size<=0.0f&&!refinements.empty()) {
+		if(!mesh) mesh = read_stl(path, box_size, center, rotation, size);
+		size_effective = fmax(fmax(mesh->pmax.x-mesh->pmin.x, mesh->pmax.y-mesh->pmin.y), mesh->pmax.z-mesh->pmin.z);
 	}
-
-	const Mesh* mesh = read_stl(path, box_size, center, rotation, size);
-	voxelize_mesh(mesh, flag);
-	save_voxelized_mesh_to_disk(cache_path, flags, device, box_size, center, rotation, size);
 	delete mesh;
+	for(Refinement* refinement : refinements) {
+		const float3 origin((float)refinement->x0, (float)refinement->y0, (float)refinement->z0);
+		refinement->lbm->voxelize_stl(path, 2.0f*(center-origin), rotation, 2.0f*size_effective, flag);
+	}
 }
 void LBM::voxelize_stl(const string& path, const float3x3& rotation, const float size, const uchar flag) { // read and voxelize binary .stl file (place in box center)
 	voxelize_stl(path, center(), rotation, size, flag);
@@ -482,11 +1191,38 @@ void LBM::voxelize_stl(const string& path, const float size, const uchar flag) {
 	voxelize_stl(path, center(), float3x3(1.0f), size, flag);
 }
 
-string LBM::device_defines() const { return
+string LBM::device_defines(const Domain* domain) const {
+	const uint Nz_local = domain ? domain->Nz+2u : Nz; // a domain holds its slab and one halo layer below and above
+	string fi_split_parameters="", fi_split_arguments="";
+	for(uint b=1u; b<ddf_buffers; b++) {
+		fi_split_parameters += ", global fpxx* fi"+to_string(b);
+		fi_split_arguments += ", fi"+to_string(b);
+	}
+	string defines =
 	"\n	#define def_Nx "+to_string(Nx)+"u"
 	"\n	#define def_Ny "+to_string(Ny)+"u"
-	"\n	#define def_Nz "+to_string(Nz)+"u"
-	"\n	#define def_N "+to_string(get_N())+"ul"
+	"\n	#define def_Nz "+to_string(Nz_local)+"u"
+	"\n	#define def_N "+to_string((ulong)Nx*(ulong)Ny*(ulong)Nz_local)+"ul"
+	"\n	#define uxx "+string((ulong)Nx*(ulong)Ny*(ulong)Nz_local<=(ulong)max_uint ? "uint" : "ulong") // node index type, 32-bit fast path if all nodes fit, otherwise 64-bit
+	+(options.specialized_indexing ? string(
+	"\n	#define INDEXING_WRAP" // calculate_indices() wraps around the lattice boundaries without modulo
+	)+((Nx&(Nx-1u))==0u&&(Ny&(Ny-1u))==0u ? string(
+	"\n	#define INDEXING_POW2" // Nx and Ny are powers of 2, so coordinates and wrap-around work with shifts and bit masks
+	"\n	#define def_Lx "+to_string(log2_fast(Nx))+"u"
+	"\n	#define def_Ly "+to_string(log2_fast(Ny))+"u"
+	) : string()) : string())
+	+(ddf_buffers>1u ? string(
+	"\n	#define DDF_SPLIT"
+	"\n	#define def_ddf_buffers "+to_string(ddf_buffers)+"u" // the DDFs are split by direction into def_ddf_buffers buffers, fi holds the first def_ddf_per_buffer directions
+	"\n	#define def_ddf_per_buffer "+to_string(ddf_per_buffer)+"u"
+	) : string())+
+	"\n	#define fi_split_parameters"+fi_split_parameters+ // trailing kernel parameters of the DDF buffers after fi, empty without DDF_SPLIT
+	"\n	#define fi_split_arguments"+fi_split_arguments
+	+(domain ? string(
+	"\n	#define DOMAINS"
+	"\n	#define def_Oz "+to_string(domain->z0+Nz-1u)+"u" // global z of local layer z is (z+def_Oz)%def_Gz
+	"\n	#define def_Gz "+to_string(Nz)+"u"
+	) : string())+
 
 	"\n	#define D"+to_string(dimensions)+"Q"+to_string(velocity_set)+"" // D2Q9/D3Q15/D3Q19/D3Q27
 	"\n	#define def_velocity_set "+to_string(velocity_set)+"u" // LBM velocity set (D2Q9/D3Q15/D3Q19/D3Q27)
@@ -494,31 +1230,32 @@ string LBM::device_defines() const { return
 
 	"\n	#define def_c 0.57735027f" // lattice speed of sound c = 1/sqrt(3)*dt
 	"\n	#define def_w " +to_string(1.0f/get_tau())+"f" // relaxation rate w = dt/tau = dt/(nu/c^2+dt/2) = 1/(3*nu+1/2)
-#if defined(D2Q9)
-	"\n	#define def_w0 (1.0f/2.25f)" // center (0)
-	"\n	#define def_ws (1.0f/9.0f)" // straight (1-4)
-	"\n	#define def_we (1.0f/36.0f)" // edge (5-8)
-#elif defined(D3Q15)
-	"\n	#define def_w0 (1.0f/4.5f)" // center (0)
-	"\n	#define def_ws (1.0f/9.0f)" // straight (1-6)
-	"\n	#define def_wc (1.0f/72.0f)" // corner (7-14)
-#elif defined(D3Q19)
-	"\n	#define def_w0 (1.0f/3.0f)" // center (0)
-	"\n	#define def_ws (1.0f/18.0f)" // straight (1-6)
-	"\n	#define def_we (1.0f/36.0f)" // edge (7-18)
-#elif defined(D3Q27)
-	"\n	#define def_w0 (1.0f/3.375f)" // center (0)
-	"\n	#define def_ws (1.0f/13.5f)" // straight (1-6)
-	"\n	#define def_we (1.0f/54.0f)" // edge (7-18)
-	"\n	#define def_wc (1.0f/216.0f)" // corner (19-26)
-#endif // D3Q27
-
-#if defined(SRT)
-	"\n	#define SRT"
-#elif defined(TRT)
-	"\n	#define TRT"
-#endif // TRT
-
+	;
+	switch(velocity_set) {
+		case 9u: defines +=
+			"\n	#define def_w0 (1.0f/2.25f)" // center (0)
+			"\n	#define def_ws (1.0f/9.0f)" // straight (1-4)
+			"\n	#define def_we (1.0f/36.0f)" // edge (5-8)
+			; break;
+		case 15u: defines +=
+			"\n	#define def_w0 (1.0f/4.5f)" // center (0)
+			"\n	#define def_ws (1.0f/9.0f)" // straight (1-6)
+			"\n	#define def_wc (1.0f/72.0f)" // corner (7-14)
+			; break;
+		case 19u: defines +=
+			"\n	#define def_w0 (1.0f/3.0f)" // center (0)
+			"\n	#define def_ws (1.0f/18.0f)" // straight (1-6)
+			"\n	#define def_we (1.0f/36.0f)" // edge (7-18)
+			; break;
+		case 27u: defines +=
+			"\n	#define def_w0 (1.0f/3.375f)" // center (0)
+			"\n	#define def_ws (1.0f/13.5f)" // straight (1-6)
+			"\n	#define def_we (1.0f/54.0f)" // edge (7-18)
+			"\n	#define def_wc (1.0f/216.0f)" // corner (19-26)
+			; break;
+	}
+	defines += options.collision==COLLISION_TRT ? "\n	#define TRT" : options.collision==COLLISION_RLB ? "\n	#define RLB" : "\n	#define SRT";
+	defines +=
 	"\n	#define TYPE_S 0b00000001" // (stationary or moving) solid boundary
 	"\n	#define TYPE_E 0b00000010" // equilibrium boundary (inflow/outflow)
 	"\n	#define TYPE_T 0b00000100" // temperature boundary
@@ -534,98 +1271,149 @@ string LBM::device_defines() const { return
 	"\n	#define TYPE_IG 0b00110000" // change from interface to gas
 	"\n	#define TYPE_GI 0b00111000" // change from gas to interface
 	"\n	#define TYPE_SU 0b00111000" // any flag bit used for SURFACE
-
-#if defined(FP16S)
-	"\n	#define fpxx half" // switchable data type (scaled IEEE-754 16-bit floating-point format: 1-5-10, exp-30, +-1.99902344, +-1.86446416E-9, +-1.81898936E-12, 3.311 digits)
-	"\n	#define load(p,o) vload_half(o,p)*3.0517578E-5f" // special function for loading half
-	"\n	#define store(p,o,x) vstore_half_rte((x)*32768.0f,o,p)" // special function for storing half
-#elif defined(FP16C)
-	"\n	#define fpxx ushort" // switchable data type (custom 16-bit floating-point format: 1-4-11, exp-15, +-1.99951168, +-6.10351562E-5, +-2.98023224E-8, 3.612 digits), 12.5% slower than IEEE-754 16-bit
-	"\n	#define load(p,o) half_to_float_custom(p[o])" // special function for loading half
-	"\n	#define store(p,o,x) p[o]=float_to_half_custom(x)" // special function for storing half
-#else // FP32
-	"\n	#define fpxx float" // switchable data type (regular 32-bit float)
-	"\n	#define load(p,o) p[o]" // regular float read
-	"\n	#define store(p,o,x) p[o]=x" // regular float write
-#endif // FP32
-
-#ifdef UPDATE_FIELDS
-	"\n	#define UPDATE_FIELDS"
-#endif // UPDATE_FIELDS
-
-#ifdef VOLUME_FORCE
-	"\n	#define VOLUME_FORCE"
-#endif // VOLUME_FORCE
-
-#ifdef MOVING_BOUNDARIES
-	"\n	#define MOVING_BOUNDARIES"
-#endif // MOVING_BOUNDARIES
-
-#ifdef EQUILIBRIUM_BOUNDARIES
-	"\n	#define EQUILIBRIUM_BOUNDARIES"
-#endif // EQUILIBRIUM_BOUNDARIES
-
-#ifdef FORCE_FIELD
-	"\n	#define FORCE_FIELD"
-#endif // FORCE_FIELD
-
-#ifdef SURFACE
-	"\n	#define SURFACE"
-	"\n	#define def_6_sigma "+to_string(6.0f*sigma)+"f" // rho_laplace = 2*o*K, rho = 1-rho_laplace/c^2 = 1-(6*o)*K
-#endif // SURFACE
-
-#ifdef TEMPERATURE
-	"\n	#define TEMPERATURE"
-	"\n	#define def_w_T "+to_string(1.0f/(2.0f*alpha+0.5f))+"f" // wT = dt/tauT = 1/(2*alpha+1/2), alpha = thermal diffusion coefficient
-	"\n	#define def_beta "+to_string(beta)+"f" // thermal expansion coefficient
-	"\n	#define def_T_avg "+to_string(T_avg)+"f" // average temperature
-#endif // TEMPERATURE
-
-#ifdef SUBGRID
-	"\n	#define SUBGRID"
-#endif // SUBGRID
-;}
+	;
+	switch(options.ddf_format) {
+		case DDF_FP16S: defines +=
+			"\n	#define fpxx half" // switchable data type (scaled IEEE-754 16-bit floating-point format: 1-5-10, exp-30, +-1.99902344, +-1.86446416E-9, +-1.81898936E-12, 3.311 digits)
+			"\n	#define load(p,o) vload_half(o,p)*3.0517578E-5f" // special function for loading half
+			"\n	#define store(p,o,x) vstore_half_rte((x)*32768.0f,o,p)" // special function for storing half
+			; break;
+		case DDF_FP16C: defines +=
+			"\n	#define fpxx ushort" // switchable data type (custom 16-bit floating-point format: 1-4-11, exp-15, +-1.99951168, +-6.10351562E-5, +-2.98023224E-8, 3.612 digits), 12.5% slower than IEEE-754 16-bit
+			"\n	#define load(p,o) half_to_float_custom(p[o])" // special function for loading half
+			"\n	#define store(p,o,x) p[o]=float_to_half_custom(x)" // special function for storing half
+			; break;
+		default: defines +=
+			"\n	#define fpxx float" // switchable data type (regular 32-bit float)
+			"\n	#define load(p,o) p[o]" // regular float read
+			"\n	#define store(p,o,x) p[o]=x" // regular float write
+			; break;
+	}
+	if(options.update_fields) defines += "\n	#define UPDATE_FIELDS";
+	if(options.volume_force) defines += "\n	#define VOLUME_FORCE";
+	if(options.moving_boundaries) defines += "\n	#define MOVING_BOUNDARIES";
+	if(options.equilibrium_boundaries) defines += "\n	#define EQUILIBRIUM_BOUNDARIES";
+	if(options.force_field) defines += "\n	#define FORCE_FIELD";
+	if(options.surface) defines +=
+		"\n	#define SURFACE"
+		"\n	#define def_6_sigma "+to_string(6.0f*sigma)+"f" // rho_laplace = 2*o*K, rho = 1-rho_laplace/c^2 = 1-(6*o)*K
+	;
+	if(options.temperature) defines +=
+		"\n	#define TEMPERATURE"
+		"\n	#define def_w_T "+to_string(1.0f/(2.0f*alpha+0.5f))+"f" // wT = dt/tauT = 1/(2*alpha+1/2), alpha = thermal diffusion coefficient
+		"\n	#define def_beta "+to_string(beta)+"f" // thermal expansion coefficient
+		"\n	#define def_T_avg "+to_string(T_avg)+"f" // average temperature
+	;
+	if(options.subgrid) defines += "\n	#define SUBGRID";
+#ifdef SPARSE_BRICKS
+	if(!domain) defines += // domains launch stream_collide over layers, so they don't use bricks
+		"\n	#define SPARSE_BRICKS"
+		"\n	#define def_brick_x "+to_string(brick_x)+"u"
+		"\n	#define def_brick_y "+to_string(brick_y)+"u"
+		"\n	#define def_brick_z "+to_string(brick_z)+"u"
+		"\n	#define def_brick_nodes "+to_string(brick_x*brick_y*brick_z)+"u"
+		"\n	#define def_bricks_x "+to_string((Nx+brick_x-1u)/brick_x)+"u"
+		"\n	#define def_bricks_y "+to_string((Ny+brick_y-1u)/brick_y)+"u"
+		"\n	#define def_bricks "+to_string(get_bricks())+"ul"
+	;
+#endif // SPARSE_BRICKS
+	return defines;
+}
 
 #ifdef GRAPHICS
 void LBM::Graphics::default_settings() {
 	keys['1'] = true;
 }
 
-void LBM::Graphics::allocate(Device& device, bool set_defaults) {
-	bitmap = Memory<uint>(device, camera.width*camera.height);
-	zbuffer = Memory<int>(device, camera.width*camera.height, 1u, false);
-	camera_parameters = Memory<float>(device, 15u);
-	kernel_clear = Kernel(device, bitmap.length(), "graphics_clear", bitmap, zbuffer);
+void LBM::Graphics::allocate(Device& device, bool set_defaults) { // also called on window resize, then buffers and kernels are kept if possible
+	const ulong pixels = (ulong)camera.width*(ulong)camera.height;
+	bool link_kernels = true;
+	if(bitmap.length()==0ull) {
+		bitmap = Memory<uint>(device, pixels, 1u, true, true, 0u, HOST_MEMORY_PINNED); // read back every frame
+		zbuffer = Memory<int>(device, pixels, 1u, false);
+		bitmap.set_queue(QUEUE_GRAPHICS); // rendering runs in its own queue and can overlap with LBM kernels
+		zbuffer.set_queue(QUEUE_GRAPHICS);
+	} else {
+		device.finish_queue(QUEUE_GRAPHICS); // no rendering kernel may still use the buffers
+		const bool bitmap_reallocated = bitmap.resize(pixels);
+		const bool zbuffer_reallocated = zbuffer.resize(pixels);
+		link_kernels = bitmap_reallocated||zbuffer_reallocated; // buffers only grow, so shrinking the window or enlarging it a little does not allocate
+	}
+	if(camera_parameters.length()==0ull) {
+		camera_parameters = Memory<float>(device, 15u);
+		camera_parameters.set_queue(QUEUE_GRAPHICS);
+	}
+#ifdef GRAPHICS_SNAPSHOT
+	if(snapshot_flags.length()==0ull) { // device-only copies of the fields the rendering kernels read
+		snapshot_flags = Memory<uchar>(device, lbm->flags.length(), 1u, false);
+		snapshot_u = Memory<float>(device, lbm->u.length(), 3u, false);
+		if(lbm->options.force_field) snapshot_F = Memory<float>(device, lbm->F.length(), 3u, false);
+		if(lbm->options.surface) snapshot_phi = Memory<float>(device, lbm->phi.length(), 1u, false);
+		if(lbm->options.temperature) snapshot_T = Memory<float>(device, lbm->T.length(), 1u, false);
+	}
+	Memory<uchar>& flags = snapshot_flags; // rendering kernels read the snapshots
+	Memory<float> &u=snapshot_u, &F=snapshot_F, &phi=snapshot_phi, &T=snapshot_T;
+#else // GRAPHICS_SNAPSHOT
+	Memory<uchar>& flags = lbm->flags; // rendering kernels read the fields, time steps wait for each frame
+	Memory<float> &u=lbm->u, &F=lbm->F, &phi=lbm->phi, &T=lbm->T;
+#endif // GRAPHICS_SNAPSHOT
 
 	if (set_defaults) {
 		set_zoom(0.5f*(float)fmax(fmax(lbm->get_Nx(), lbm->get_Ny()), lbm->get_Nz()));
 		default_settings();
 	}
 
-	kernel_graphics_flags = Kernel(device, lbm->flags.length(), "graphics_flags", lbm->flags, camera_parameters, bitmap, zbuffer, camera.width, camera.height);
-	kernel_graphics_field = Kernel(device, lbm->flags.length(), "graphics_field", lbm->flags, lbm->u, camera_parameters, bitmap, zbuffer, camera.width, camera.height);
-	kernel_graphics_streamline = Kernel(device, lbm->flags.length()/(cb(GRAPHICS_STREAMLINE_SPARSE)), "graphics_streamline", lbm->flags, lbm->u, camera_parameters, bitmap, zbuffer, camera.width, camera.height);
-	kernel_graphics_q = Kernel(device, lbm->flags.length(), "graphics_q", lbm->flags, lbm->u, camera_parameters, bitmap, zbuffer, camera.width, camera.height);
+	if(!link_kernels) { // only update screen size in existing kernels
+		kernel_clear.set_parameters(2u, camera.width, camera.height).set_range(pixels);
+		kernel_graphics_flags.set_parameters(4u, camera.width, camera.height);
+		kernel_graphics_field.set_parameters(5u, camera.width, camera.height);
+		kernel_graphics_streamline.set_parameters(5u, camera.width, camera.height);
+		kernel_graphics_q.set_parameters(5u, camera.width, camera.height);
+		if(lbm->options.surface) {
+			kernel_graphics_rasterize_phi.set_parameters(4u, camera.width, camera.height);
+			kernel_graphics_raytrace_phi.set_parameters(5u, camera.width, camera.height).set_range(pixels);
+		}
+		return;
+	}
+	kernel_clear = Kernel(device, bitmap.length(), "graphics_clear", bitmap, zbuffer, camera.width, camera.height).set_queue(device, QUEUE_GRAPHICS);
+
+	kernel_graphics_flags = Kernel(device, lbm->flags.length(), "graphics_flags", flags, camera_parameters, bitmap, zbuffer, camera.width, camera.height).set_queue(device, QUEUE_GRAPHICS);
+	kernel_graphics_field = Kernel(device, lbm->flags.length(), "graphics_field", flags, u, camera_parameters, bitmap, zbuffer, camera.width, camera.height).set_queue(device, QUEUE_GRAPHICS);
+	kernel_graphics_streamline = Kernel(device, lbm->flags.length()/(cb(GRAPHICS_STREAMLINE_SPARSE)), "graphics_streamline", flags, u, camera_parameters, bitmap, zbuffer, camera.width, camera.height).set_queue(device, QUEUE_GRAPHICS);
+	kernel_graphics_q = Kernel(device, lbm->flags.length(), "graphics_q", flags, u, camera_parameters, bitmap, zbuffer, camera.width, camera.height).set_queue(device, QUEUE_GRAPHICS);
+
+	if(lbm->options.force_field) kernel_graphics_flags.add_parameters(F);
 
-#ifdef FORCE_FIELD
-	kernel_graphics_flags.add_parameters(lbm->F);
-#endif // FORCE_FIELD
+	if(lbm->options.surface) {
+		if(skybox.length()==0ull) skybox = Memory<uint>(device, skybox_image->width()*skybox_image->height(), 1u, (uint*)skybox_image->data()); // uploaded only once
+		kernel_graphics_rasterize_phi = Kernel(device, lbm->phi.length(), "graphics_rasterize_phi", phi, camera_parameters, bitmap, zbuffer, camera.width, camera.height).set_queue(device, QUEUE_GRAPHICS);
+		kernel_graphics_raytrace_phi = Kernel(device, bitmap.length(), "graphics_raytrace_phi", phi, flags, skybox, camera_parameters, bitmap, camera.width, camera.height).set_queue(device, QUEUE_GRAPHICS);
+	}
 
-#ifdef SURFACE
-	skybox = Memory<uint>(device, skybox_image->width()*skybox_image->height(), 1u, (uint*)skybox_image->data());
-	kernel_graphics_rasterize_phi = Kernel(device, lbm->phi.length(), "graphics_rasterize_phi", lbm->phi, camera_parameters, bitmap, zbuffer, camera.width, camera.height);
-	kernel_graphics_raytrace_phi = Kernel(device, bitmap.length(), "graphics_raytrace_phi", lbm->phi, lbm->flags, skybox, camera_parameters, bitmap, camera.width, camera.height);
-#endif // SURFACE
+	if(lbm->options.temperature) kernel_graphics_streamline.add_parameters(T);
 
-#ifdef TEMPERATURE
-	kernel_graphics_streamline.add_parameters(lbm->T);
-#endif // TEMPERATURE
+	update_camera(); // rendering kernels only write bitmap and zbuffer, so they can be measured right away with a valid camera
+	camera_parameters.write_to_device();
+	kernel_clear.autotune(device);
+	kernel_graphics_flags.autotune(device);
+	kernel_graphics_field.autotune(device);
+	kernel_graphics_streamline.autotune(device);
+	kernel_graphics_q.autotune(device);
+	if(lbm->options.surface) {
+		kernel_graphics_rasterize_phi.autotune(device);
+		kernel_graphics_raytrace_phi.autotune(device);
+	}
+	camera.key_update = true; // update_camera() above would otherwise make the first frame look unchanged
 }
 bool LBM::Graphics::update_camera() {
 	camera.update_matrix();
+	const float spacing = lbm->get_spacing();
+	const float center[3] = { lbm->level_center.x, lbm->level_center.y, lbm->level_center.z };
 	bool change = false;
 	for(uint i=0u; i<15u; i++) {
-		const float data = camera.data(i);
+		float data = camera.data(i);
+		if(lbm->level>0u&&i==0u) data *= spacing; // finer levels render in their own node coordinates, with the same projection as level 0
+		if(lbm->level>0u&&i>=2u&&i<=4u) data = (data-center[i-2u])/spacing;
 		change |= (camera_parameters[i]!=data);
 		camera_parameters[i] = data;
 	}
@@ -637,26 +1425,72 @@ void* LBM::Graphics::draw_frame() {
 	if(!camera_update&&!camera.key_update&&lbm->get_t()==t_last_frame) return (void*)bitmap.data(); // don't render a new frame if the scene hasn't changed since last frame
 #endif // WINDOWS_GRAPHICS or CONSOLE_GRAPHICS
 	t_last_frame = lbm->get_t();
-#ifndef UPDATE_FIELDS
-	if(keys['2']||keys['3']||keys['4']) lbm->update_fields(); // only call update_fields() if the time step has changed since the last rendered frame
-#endif // UPDATE_FIELDS
-	camera.key_update = false;
-
-	if(camera_update) camera_parameters.write_to_device(false); // camera_parameters PCIe transfer and kernel_clear execution can happen simulataneously
-	kernel_clear.run();
-#ifdef SURFACE
-	if(keys['6']) kernel_graphics_raytrace_phi.run();
-	if(keys['5']) kernel_graphics_rasterize_phi.run();
-#endif // SURFACE
-	if(keys['1']) kernel_graphics_flags.run();
-	if(keys['2']) kernel_graphics_field.run();
-	if(keys['3']) kernel_graphics_streamline.run();
-	if(keys['4']) kernel_graphics_q.run();
-
-	bitmap.read_from_device();
+	if(!lbm->options.update_fields&&(keys['2']||keys['3']||keys['4'])) lbm->update_fields(); // only call update_fields() if the time step has changed since the last rendered frame
+
+	vector<cl::Event> scene(2); // QUEUE_GRAPHICS may be out-of-order, so every rendering command lists what it waits for
+#ifdef GRAPHICS_SNAPSHOT
+	snapshot_fields(scene); // render the last enqueued time step from copies, LBM kernels that are enqueued later neither wait for rendering nor overwrite what it reads
+#else // GRAPHICS_SNAPSHOT
+	scene[0] = lbm->device.enqueue_marker(QUEUE_COMPUTE); // render the last enqueued time step
+#endif // GRAPHICS_SNAPSHOT
+	kernel_clear.enqueue_run(1u, nullptr, &scene[1]); // camera_parameters PCIe transfer and kernel_clear execution can happen simulataneously
+	if(camera_update) {
+		cl::Event camera_event;
+		camera_parameters.write_to_device(false, nullptr, &camera_event);
+		scene.push_back(camera_event);
+	}
+	if(lbm->options.surface&&keys['6']) { // raytracing overwrites every pixel without zbuffer, so it has to finish before the other kernels draw on top
+		cl::Event raytrace_event;
+		kernel_graphics_raytrace_phi.enqueue_run(1u, &scene, &raytrace_event);
+		scene = { raytrace_event };
+	}
+	vector<cl::Event> frame = scene; // zbuffered kernels only depend on the scene, not on each other
+	cl::Event event;
+	if(lbm->options.surface&&keys['5']) { kernel_graphics_rasterize_phi.enqueue_run(1u, &scene, &event); frame.push_back(event); }
+	if(keys['1']) { kernel_graphics_flags.enqueue_run(1u, &scene, &event); frame.push_back(event); }
+	if(keys['2']) { kernel_graphics_field.enqueue_run(1u, &scene, &event); frame.push_back(event); }
+	if(keys['3']) { kernel_graphics_streamline.enqueue_run(1u, &scene, &event); frame.push_back(event); }
+	if(keys['4']) { kernel_graphics_q.enqueue_run(1u, &scene, &event); frame.push_back(event); }
+#ifndef GRAPHICS_SNAPSHOT
+	lbm->device.queue_wait_for(QUEUE_COMPUTE, QUEUE_GRAPHICS); // LBM kernels enqueued from now on wait for the frame, so they don't overwrite fields it is still reading
+#endif // GRAPHICS_SNAPSHOT
+
+	bitmap.read_from_device(true, &frame); // blocking read waits for all rendering kernels
+	if(lbm->level>0u||!lbm->refinements.empty()) zbuffer.read_from_device(); // levels are composited on the host
+	for(Refinement* refinement : lbm->refinements) { // the finer level is drawn over this level where it is closer to the camera
+		Graphics& finer = refinement->lbm->graphics;
+		finer.draw_frame();
+		const uint* finer_bitmap = ((const Memory<uint>&)finer.bitmap).data();
+		const int* finer_zbuffer = ((const Memory<int>&)finer.zbuffer).data();
+		uint* bitmap_data = bitmap.data();
+		int* zbuffer_data = zbuffer.data();
+		const ulong pixels = (ulong)camera.width*(ulong)camera.height;
+		for(ulong i=0ull; i<pixels; i++) {
+			if(finer_zbuffer[i]==min_int) continue; // nothing drawn there
+			const float z = 0.5f*(float)finer_zbuffer[i]; // z of the finer level is in units of its half lattice spacing
+			if(z>(float)zbuffer_data[i]) {
+				bitmap_data[i] = finer_bitmap[i];
+				zbuffer_data[i] = (int)z;
+			}
+		}
+	}
+	if(lbm->level==0u) camera.key_update = false; // the finer levels check it as well, so it is only cleared once all of them are drawn
 	return (void*)bitmap.data();
 }
-string LBM::Graphics::device_defines() const { return
+#ifdef GRAPHICS_SNAPSHOT
+void LBM::Graphics::snapshot_fields(vector<cl::Event>& scene) {
+	cl::CommandQueue queue = lbm->device.get_cl_queue(QUEUE_COMPUTE); // in-order, so each copy sees all time steps enqueued before it, and time steps enqueued later only start after it
+	const auto copy = [&](const auto& field, auto& snapshot) { queue.enqueueCopyBuffer(field.get_cl_buffer(), snapshot.get_cl_buffer(), 0u, 0u, snapshot.capacity()); };
+	const bool surface=lbm->options.surface&&(keys['5']||keys['6']), velocity=keys['2']||keys['3']||keys['4'];
+	if(keys['1']||velocity||(surface&&keys['6'])) copy(lbm->flags, snapshot_flags);
+	if(velocity) copy(lbm->u, snapshot_u);
+	if(lbm->options.force_field&&keys['1']) copy(lbm->F, snapshot_F);
+	if(surface) copy(lbm->phi, snapshot_phi);
+	if(lbm->options.temperature&&keys['3']) copy(lbm->T, snapshot_T);
+	scene[0] = lbm->device.enqueue_marker(QUEUE_COMPUTE); // completes with the copies
+}
+#endif // GRAPHICS_SNAPSHOT
+string LBM::Graphics::device_defines() const { return string()+
 	"\n	#define GRAPHICS"
 	"\n	#define def_background_color " +to_string(GRAPHICS_BACKGROUND_COLOR)+"u"
 	"\n	#define def_n "                +to_string(1.333f)+"f" // refractive index of water
@@ -676,17 +1510,10 @@ string LBM::Graphics::device_defines() const { return
 	"\n	#define COLOR_Y (255<<16|255<<8|  0)"
 	"\n	#define COLOR_0 (127<<16|127<<8|127)"
 
-#ifndef SURFACE
-	"\n	#define def_skybox_width 1u"
-	"\n	#define def_skybox_height 1u"
-#else // SURFACE
-	"\n	#define def_skybox_width " +to_string(skybox_image->width() )+"u"
-	"\n	#define def_skybox_height "+to_string(skybox_image->height())+"u"
-#endif // SURFACE
-
-#ifdef TEMPERATURE
-	"\n	#define GRAPHICS_TEMPERATURE"
-#endif // TEMPERATURE
+	"\n	#define def_skybox_width " +to_string(lbm->options.surface ? skybox_image->width()  : 1u)+"u"
+	"\n	#define def_skybox_height "+to_string(lbm->options.surface ? skybox_image->height() : 1u)+"u"
+
+	+(lbm->options.temperature ? "\n	#define GRAPHICS_TEMPERATURE" : "")
 ;}
 
 void LBM::Graphics::set_camera_centered(const float rx, const float ry, const float fov, const float zoom) {
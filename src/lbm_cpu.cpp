@@ -0,0 +1,531 @@
+#include "lbm.hpp"
+
+#ifdef CPU_NATIVE // native multithreaded C++ implementation of the LBM kernels in kernel.cpp, used instead of OpenCL
+
+struct Native_Step { // arguments of the native kernels, same as the arguments of the OpenCL kernels and the def_* constants
+	uint Nx=1u, Ny=1u, Nz=1u;
+	ulong N = 1ull;
+	fpxx* fi = nullptr;
+	float* rho = nullptr;
+	float* u = nullptr;
+	const uchar* flags = nullptr;
+	float* F = nullptr; // only with FORCE_FIELD
+	ulong t = 0ull;
+	float fx=0.0f, fy=0.0f, fz=0.0f;
+	float w = 1.0f; // LBM relaxation rate w = dt/tau = dt/(nu/c^2+dt/2) = 1/(3*nu+1/2)
+};
+
+namespace {
+
+#if defined(D2Q9)
+constexpr uint velocity_set = 9u;
+constexpr int c[3u*velocity_set] = {
+	0, 1,-1, 0, 0, 1,-1, 1,-1, // x
+	0, 0, 0, 1,-1, 1,-1,-1, 1, // y
+	0, 0, 0, 0, 0, 0, 0, 0, 0  // z
+};
+constexpr float w0=1.0f/2.25f, ws=1.0f/9.0f, we=1.0f/36.0f; // center (0), straight (1-4), edge (5-8)
+constexpr float w[velocity_set] = { w0, ws, ws, ws, ws, we, we, we, we };
+#elif defined(D3Q15)
+constexpr uint velocity_set = 15u;
+constexpr int c[3u*velocity_set] = {
+	0, 1,-1, 0, 0, 0, 0, 1,-1, 1,-1, 1,-1,-1, 1, // x
+	0, 0, 0, 1,-1, 0, 0, 1,-1, 1,-1,-1, 1, 1,-1, // y
+	0, 0, 0, 0, 0, 1,-1, 1,-1,-1, 1, 1,-1, 1,-1  // z
+};
+constexpr float w0=1.0f/4.5f, ws=1.0f/9.0f, wc=1.0f/72.0f; // center (0), straight (1-6), corner (7-14)
+constexpr float w[velocity_set] = { w0, ws, ws, ws, ws, ws, ws, wc, wc, wc, wc, wc, wc, wc, wc };
+#elif defined(D3Q19)
+constexpr uint velocity_set = 19u;
+constexpr int c[3u*velocity_set] = {
+	0, 1,-1, 0, 0, 0, 0, 1,-1, 1,-1, 0, 0, 1,-1, 1,-1, 0, 0, // x
+	0, 0, 0, 1,-1, 0, 0, 1,-1, 0, 0, 1,-1,-1, 1, 0, 0, 1,-1, // y
+	0, 0, 0, 0, 0, 1,-1, 0, 0, 1,-1, 1,-1, 0, 0,-1, 1,-1, 1  // z
+};
+constexpr float w0=1.0f/3.0f, ws=1.0f/18.0f, we=1.0f/36.0f; // center (0), straight (1-6), edge (7-18)
+constexpr float w[velocity_set] = { w0, ws, ws, ws, ws, ws, ws, we, we, we, we, we, we, we, we, we, we, we, we };
+#elif defined(D3Q27)
+constexpr uint velocity_set = 27u;
+constexpr int c[3u*velocity_set] = {
+	0, 1,-1, 0, 0, 0, 0, 1,-1, 1,-1, 0, 0, 1,-1, 1,-1, 0, 0, 1,-1, 1,-1, 1,-1,-1, 1, // x
+	0, 0, 0, 1,-1, 0, 0, 1,-1, 0, 0, 1,-1,-1, 1, 0, 0, 1,-1, 1,-1, 1,-1,-1, 1, 1,-1, // y
+	0, 0, 0, 0, 0, 1,-1, 0, 0, 1,-1, 1,-1, 0, 0,-1, 1,-1, 1, 1,-1,-1, 1, 1,-1, 1,-1  // z
+};
+constexpr float w0=1.0f/3.375f, ws=1.0f/13.5f, we=1.0f/54.0f, wc=1.0f/216.0f; // center (0), straight (1-6), edge (7-18), corner (19-26)
+constexpr float w[velocity_set] = { w0, ws, ws, ws, ws, ws, ws, we, we, we, we, we, we, we, we, we, we, we, we, wc, wc, wc, wc, wc, wc, wc, wc };
+#endif // D3Q27
+
+constexpr float def_c = 0.57735027f; // lattice speed of sound c = 1/sqrt(3)*dt
+constexpr uchar TYPE_BO = 0b00000011; // any flag bit used for boundaries (temperature excluded)
+constexpr uint block_size = 64u; // nodes per block, the DDFs of one block stay in L1 cache between streaming and collision
+#ifdef UPDATE_FIELDS
+constexpr bool update_fields_in_step = true; // stream_collide() also writes (rho, u)
+#else // UPDATE_FIELDS
+constexpr bool update_fields_in_step = false;
+#endif // UPDATE_FIELDS
+
+inline float to_float(const fpxx x) { // same as load() in kernel.cpp
+#if defined(FP16S)
+	return half_to_float(x)*3.0517578E-5f;
+#elif defined(FP16C)
+	return half_to_float_custom(x);
+#else // FP32
+	return x;
+#endif // FP32
+}
+inline fpxx to_fpxx(const float x) { // same as store() in kernel.cpp
+#if defined(FP16S)
+	return float_to_half(x*32768.0f);
+#elif defined(FP16C)
+	return float_to_half_custom(x);
+#else // FP32
+	return x;
+#endif // FP32
+}
+
+inline uint wrap(const uint x, const int c, const uint N) { // x+c with periodic wrap-around for c in {-1, 0, 1}, branchless select instead of modulo
+	const uint xc = x+(uint)c;
+	return xc==N ? 0u : xc==max_uint ? N-1u : xc;
+}
+void neighbors(const Native_Step& s, const uint n, uint* j) { // calculate neighbor indices (periodic boundary conditions)
+	const uint yz=n/s.Nx, x=n-yz*s.Nx, z=yz/s.Ny, y=yz-z*s.Ny; // two divisions per call instead of one modulo per direction and axis
+	for(uint i=0u; i<velocity_set; i++) {
+		const uint xj=wrap(x, c[i], s.Nx), yj=wrap(y, c[velocity_set+i], s.Ny), zj=wrap(z, c[2u*velocity_set+i], s.Nz);
+		j[i] = xj+(yj+zj*s.Ny)*s.Nx;
+	}
+}
+void calculate_f_eq(const float rho, float ux, float uy, float uz, float* feq) { // calculate f_equilibrium from density and velocity field (perturbation method / DDF-shifting)
+	const float c3=-3.0f*(sq(ux)+sq(uy)+sq(uz)), rhom1=rho-1.0f; // c3 = -2*sq(u)/(2*sq(c)), rhom1 is arithmetic optimization to minimize digit extinction
+	ux *= 3.0f;
+	uy *= 3.0f;
+	uz *= 3.0f;
+	for(uint i=0u; i<velocity_set; i++) { // loop is entirely unrolled by compiler, multiplications with 0 and 1 are optimized away
+		const float cu = (float)c[i]*ux+(float)c[velocity_set+i]*uy+(float)c[2u*velocity_set+i]*uz;
+		feq[i] = w[i]*rho*(0.5f*(cu*cu+c3)+cu)+w[i]*rhom1;
+	}
+}
+void calculate_rho_u(const float* f, float& rhon, float& uxn, float& uyn, float& uzn) { // calculate density and velocity fields from fi
+	float rho=f[0], ux=0.0f, uy=0.0f, uz=0.0f;
+	for(uint i=1u; i<velocity_set; i++) {
+		rho += f[i]; // calculate density from fi
+		ux += (float)c[i]*f[i]; // calculate velocity from fi
+		uy += (float)c[velocity_set+i]*f[i];
+		uz += (float)c[2u*velocity_set+i]*f[i];
+	}
+	rho += 1.0f; // add 1.0f last to avoid digit extinction effects when summing up fi (perturbation method / DDF-shifting)
+	rhon = rho;
+	uxn = ux/rho;
+	uyn = uy/rho;
+	uzn = uz/rho;
+}
+#ifdef VOLUME_FORCE
+void calculate_forcing_terms(const float ux, const float uy, const float uz, const float fx, const float fy, const float fz, float* Fin) { // calculate volume force terms Fin from velocity field (Guo forcing, Krueger p.233f)
+	const float uF = -0.33333334f*(ux*fx+uy*fy+uz*fz);
+	for(uint i=0u; i<velocity_set; i++) {
+		const float cxi=(float)c[i], cyi=(float)c[velocity_set+i], czi=(float)c[2u*velocity_set+i];
+		Fin[i] = 9.0f*w[i]*((cxi*fx+cyi*fy+czi*fz)*(cxi*ux+cyi*uy+czi*uz+0.33333334f)+uF);
+	}
+}
+#endif // VOLUME_FORCE
+inline float f_eq(const uint i, const float rho, const float ux, const float uy, const float uz, const float c3) { // equilibrium DDF in direction i with c3 = -3*sq(u), same arithmetic as calculate_f_eq()
+	const float cu = (float)c[i]*(3.0f*ux)+(float)c[velocity_set+i]*(3.0f*uy)+(float)c[2u*velocity_set+i]*(3.0f*uz);
+	return w[i]*rho*(0.5f*(cu*cu+c3)+cu)+w[i]*(rho-1.0f);
+}
+inline float clamp_select(const float x, const float a, const float b) { // same as clamp() for finite x, but with selects instead of fmin()/fmax(), which GCC does not vectorize without -ffast-math
+	const float y = x<a ? a : x;
+	return y>b ? b : y;
+}
+#ifdef VOLUME_FORCE
+inline float forcing_term(const uint i, const float ux, const float uy, const float uz, const float fx, const float fy, const float fz) { // forcing term in direction i, same arithmetic as calculate_forcing_terms()
+	const float uF = -0.33333334f*(ux*fx+uy*fy+uz*fz);
+	const float cxi=(float)c[i], cyi=(float)c[velocity_set+i], czi=(float)c[2u*velocity_set+i];
+	return 9.0f*w[i]*((cxi*fx+cyi*fy+czi*fz)*(cxi*ux+cyi*uy+czi*uz+0.33333334f)+uF);
+}
+#endif // VOLUME_FORCE
+void load_f(const Native_Step& s, const uint n, float* fhn, const uint* j) { // same as load_f() in kernel.cpp, for single nodes
+	fhn[0] = to_float(s.fi[n]); // Esoteric-Pull
+	for(uint i=1u; i<velocity_set; i+=2u) {
+		fhn[i   ] = to_float(s.fi[(ulong)(s.t%2ull ? i    : i+1u)*s.N+(ulong)n   ]);
+		fhn[i+1u] = to_float(s.fi[(ulong)(s.t%2ull ? i+1u : i   )*s.N+(ulong)j[i]]);
+	}
+}
+void store_f(const Native_Step& s, const uint n, const float* fhn, const uint* j) { // same as store_f() in kernel.cpp, for single nodes
+	s.fi[n] = to_fpxx(fhn[0]); // Esoteric-Pull
+	for(uint i=1u; i<velocity_set; i+=2u) {
+		s.fi[(ulong)(s.t%2ull ? i+1u : i   )*s.N+(ulong)j[i]] = to_fpxx(fhn[i   ]);
+		s.fi[(ulong)(s.t%2ull ? i    : i+1u)*s.N+(ulong)n   ] = to_fpxx(fhn[i+1u]);
+	}
+}
+
+template<bool collide> void lbm_block(const Native_Step& s, const uint n0, const uint count, const uint* j0) { // stream_collide() (collide=true) or update_fields() (collide=false) for count<=block_size consecutive nodes from n0 on, whose neighbors in direction i are consecutive from j0[i] on
+	// all data of the block is stored as structure of arrays and every loop over the nodes k is innermost without function calls, so the compiler vectorizes each of them along x
+	const ulong N = s.N;
+	const bool odd = s.t%2ull;
+	fpxx fr[velocity_set][block_size]; // DDFs as loaded, in storage format
+	float fh[velocity_set][block_size]; // DDFs as float, overwritten with the DDFs after collision
+	float rho[block_size], ux[block_size], uy[block_size], uz[block_size]; // local density and velocity
+	uint active[block_size]; // solid nodes are skipped, their DDFs are stored back unchanged, which is the same as not storing them (uint instead of bool, masks with the width of float keep the loops vectorizable)
+	uint equilibrium[block_size]; // TYPE_E nodes get the equilibrium DDFs of their preset density and velocity
+	{ // perform streaming (part 2), Esoteric-Pull, every memory location is accessed by only one node, so nodes of different threads never collide
+		const fpxx* const f0 = s.fi+(ulong)n0;
+		for(uint k=0u; k<count; k++) fr[0][k] = f0[k];
+		for(uint i=1u; i<velocity_set; i+=2u) {
+			const fpxx* const fa = s.fi+(ulong)(odd ? i    : i+1u)*N+(ulong)n0;
+			const fpxx* const fb = s.fi+(ulong)(odd ? i+1u : i   )*N+(ulong)j0[i];
+			for(uint k=0u; k<count; k++) {
+				fr[i   ][k] = fa[k];
+				fr[i+1u][k] = fb[k];
+			}
+		}
+	}
+	for(uint i=0u; i<velocity_set; i++) for(uint k=0u; k<count; k++) fh[i][k] = to_float(fr[i][k]);
+	for(uint k=0u; k<count; k++) { // calculate local density and velocity, same summation order as calculate_rho_u()
+		rho[k] = fh[0][k];
+		ux[k] = uy[k] = uz[k] = 0.0f;
+	}
+	for(uint i=1u; i<velocity_set; i++) {
+		const float cxi=(float)c[i], cyi=(float)c[velocity_set+i], czi=(float)c[2u*velocity_set+i];
+		for(uint k=0u; k<count; k++) {
+			rho[k] += fh[i][k];
+			ux[k] += cxi*fh[i][k];
+			uy[k] += cyi*fh[i][k];
+			uz[k] += czi*fh[i][k];
+		}
+	}
+	uint flagsn_bo[block_size]; // boundary flags as uint, loops that mix uchar and float data do not vectorize
+	for(uint k=0u; k<count; k++) flagsn_bo[k] = (uint)(s.flags[(ulong)n0+(ulong)k]&TYPE_BO); // extract boundary flags
+	for(uint k=0u; k<count; k++) {
+		active[k] = flagsn_bo[k]!=(uint)TYPE_S;
+#ifdef EQUILIBRIUM_BOUNDARIES
+		equilibrium[k] = collide&&flagsn_bo[k]==(uint)TYPE_E; // apply preset velocity/density
+#else // EQUILIBRIUM_BOUNDARIES
+		equilibrium[k] = 0u;
+#endif // EQUILIBRIUM_BOUNDARIES
+	}
+	float* const __restrict rho_field = s.rho+(ulong)n0; // fields of the block, __restrict tells the compiler they do not overlap the arrays above, otherwise it gives up on the run-time alias checks
+	float* const __restrict ux_field = s.u+(ulong)n0;
+	float* const __restrict uy_field = s.u+N+(ulong)n0;
+	float* const __restrict uz_field = s.u+2ull*N+(ulong)n0;
+	for(uint k=0u; k<count; k++) {
+		const float rhon = rho[k]+1.0f; // add 1.0f last to avoid digit extinction effects when summing up fi (perturbation method / DDF-shifting)
+#ifdef EQUILIBRIUM_BOUNDARIES
+		rho[k] = equilibrium[k] ? rho_field[k] : rhon;
+		ux[k] = equilibrium[k] ? ux_field[k] : ux[k]/rhon;
+		uy[k] = equilibrium[k] ? uy_field[k] : uy[k]/rhon;
+		uz[k] = equilibrium[k] ? uz_field[k] : uz[k]/rhon;
+#else // EQUILIBRIUM_BOUNDARIES
+		rho[k] = rhon;
+		ux[k] /= rhon;
+		uy[k] /= rhon;
+		uz[k] /= rhon;
+#endif // EQUILIBRIUM_BOUNDARIES
+	}
+#ifdef VOLUME_FORCE
+	float fx[block_size], fy[block_size], fz[block_size]; // force per node
+	for(uint k=0u; k<count; k++) {
+		fx[k] = s.fx; // force starts as constant volume force
+		fy[k] = s.fy;
+		fz[k] = s.fz;
+#ifdef FORCE_FIELD
+		const ulong n = (ulong)n0+(ulong)k;
+		fx[k] += s.F[       n]; // apply force field
+		fy[k] += s.F[     N+n];
+		fz[k] += s.F[2ull*N+n];
+#endif // FORCE_FIELD
+		const float rho2 = 0.5f/rho[k]; // apply external volume force (Guo forcing, Krueger p.233f)
+		ux[k] = clamp_select(ux[k]+fx[k]*rho2, -def_c, def_c); // limit velocity (for stability purposes)
+		uy[k] = clamp_select(uy[k]+fy[k]*rho2, -def_c, def_c); // force term: F*dt/(2*rho)
+		uz[k] = clamp_select(uz[k]+fz[k]*rho2, -def_c, def_c);
+	}
+#else // VOLUME_FORCE
+	for(uint k=0u; k<count; k++) {
+		ux[k] = clamp_select(ux[k], -def_c, def_c); // limit velocity (for stability purposes)
+		uy[k] = clamp_select(uy[k], -def_c, def_c);
+		uz[k] = clamp_select(uz[k], -def_c, def_c);
+	}
+#endif // VOLUME_FORCE
+	if constexpr(!collide||update_fields_in_step) {
+		for(uint k=0u; k<count; k++) { // select instead of branch keeps the loop vectorizable
+#ifdef EQUILIBRIUM_BOUNDARIES
+			const bool update = active[k]&&flagsn_bo[k]!=(uint)TYPE_E; // only update fields for non-TYPE_E nodes
+#else // EQUILIBRIUM_BOUNDARIES
+			const bool update = active[k];
+#endif // EQUILIBRIUM_BOUNDARIES
+			rho_field[k] = update ? rho[k] : rho_field[k]; // update density field
+			ux_field[k] = update ? ux[k] : ux_field[k]; // update velocity field
+			uy_field[k] = update ? uy[k] : uy_field[k];
+			uz_field[k] = update ? uz[k] : uz_field[k];
+		}
+	}
+	float c3[block_size]; // -3*sq(u) of the equilibrium DDFs
+	for(uint k=0u; k<count; k++) c3[k] = -3.0f*(sq(ux[k])+sq(uy[k])+sq(uz[k])); // c3 = -2*sq(u)/(2*sq(c))
+	if constexpr(!collide) return;
+	float wn[block_size]; // LBM relaxation rate
+	for(uint k=0u; k<count; k++) wn[k] = s.w;
+#if defined(SUBGRID)||defined(RLB)
+	float Pxx[block_size], Pyy[block_size], Pzz[block_size], Pxy[block_size], Pxz[block_size], Pyz[block_size]; // non-equilibrium stress tensor
+#ifdef RLB
+	float Jx[block_size], Jy[block_size], Jz[block_size]; // non-equilibrium momentum
+#endif // RLB
+	for(uint k=0u; k<count; k++) {
+		Pxx[k] = Pyy[k] = Pzz[k] = Pxy[k] = Pxz[k] = Pyz[k] = 0.0f;
+#ifdef RLB
+		Jx[k] = Jy[k] = Jz[k] = 0.0f;
+#endif // RLB
+	}
+	for(uint i=1u; i<velocity_set; i++) {
+		const float cxi=(float)c[i], cyi=(float)c[velocity_set+i], czi=(float)c[2u*velocity_set+i];
+		for(uint k=0u; k<count; k++) {
+			const float fneqi = fh[i][k]-f_eq(i, rho[k], ux[k], uy[k], uz[k], c3[k]);
+#ifdef RLB
+			Jx[k] += cxi*fneqi; Jy[k] += cyi*fneqi; Jz[k] += czi*fneqi;
+#endif // RLB
+			Pxx[k] += cxi*cxi*fneqi;
+			Pxy[k] += cxi*cyi*fneqi; Pyy[k] += cyi*cyi*fneqi;
+			Pxz[k] += cxi*czi*fneqi; Pyz[k] += cyi*czi*fneqi; Pzz[k] += czi*czi*fneqi;
+		}
+	}
+#endif // SUBGRID||RLB
+#ifdef SUBGRID
+	for(uint k=0u; k<count; k++) { // Smagorinsky-Lilly subgrid turbulence model, same as in kernel.cpp
+		const float tau0 = 1.0f/wn[k];
+		const float Q = sq(Pxx[k])+sq(Pyy[k])+sq(Pzz[k])+2.0f*(sq(Pxy[k])+sq(Pxz[k])+sq(Pyz[k])); // Q = H*H
+		wn[k] = 2.0f/(tau0+sqrt(sq(tau0)+0.76421222f*sqrt(Q)/rho[k])); // modify LBM relaxation rate by adding turbulent eddy viscosity
+	}
+#endif // SUBGRID
+#if defined(SRT)
+	for(uint i=0u; i<velocity_set; i++) {
+		for(uint k=0u; k<count; k++) {
+			const float feqi = f_eq(i, rho[k], ux[k], uy[k], uz[k], c3[k]);
+#ifdef VOLUME_FORCE
+			const float Fin = forcing_term(i, ux[k], uy[k], uz[k], fx[k], fy[k], fz[k])*(1.0f-0.5f*wn[k]);
+#else // VOLUME_FORCE
+			const float Fin = 0.0f;
+#endif // VOLUME_FORCE
+			fh[i][k] = equilibrium[k] ? feqi : (1.0f-wn[k])*fh[i][k]+(wn[k]*feqi+Fin); // perform collision (SRT)
+		}
+	}
+#elif defined(TRT)
+	for(uint i=0u; i<velocity_set; i+=(i==0u ? 1u : 2u)) { // direction 0 is its own inverse, then pairs of inverse directions i and i+1
+		const uint ib = i==0u ? 0u : i+1u; // inverse direction
+		for(uint k=0u; k<count; k++) {
+			const float wp = wn[k]; // TRT: inverse of "+" relaxation time
+			const float wm = 1.0f/(0.1875f/(1.0f/wn[k]-0.5f)+0.5f); // TRT: inverse of "-" relaxation time
+			const float feqa=f_eq(i, rho[k], ux[k], uy[k], uz[k], c3[k]), feqb=f_eq(ib, rho[k], ux[k], uy[k], uz[k], c3[k]);
+			const float fha=fh[i][k], fhb=fh[ib][k];
+#ifdef VOLUME_FORCE
+			const float c_taup=0.5f-0.25f*wp, c_taum=0.5f-0.25f*wm; // source: https://arxiv.org/pdf/1901.08766.pdf
+			const float Fa=forcing_term(i, ux[k], uy[k], uz[k], fx[k], fy[k], fz[k]), Fb=forcing_term(ib, ux[k], uy[k], uz[k], fx[k], fy[k], fz[k]);
+			const float Fina=c_taup*(Fa+Fb)+c_taum*(Fa-Fb), Finb=c_taup*(Fb+Fa)+c_taum*(Fb-Fa);
+#else // VOLUME_FORCE
+			const float Fina=0.0f, Finb=0.0f;
+#endif // VOLUME_FORCE
+			fh[i ][k] = equilibrium[k] ? feqa : 0.5f*wp*(feqa-fha+feqb-fhb)+(0.5f*wm*(feqa-feqb-fha+fhb)+(fha+Fina)); // perform collision (TRT)
+			fh[ib][k] = equilibrium[k] ? feqb : 0.5f*wp*(feqb-fhb+feqa-fha)+(0.5f*wm*(feqb-feqa-fhb+fha)+(fhb+Finb));
+		}
+	}
+#elif defined(RLB)
+	float Axxy[block_size], Axyy[block_size]; // third order non-equilibrium moments, reconstructed recursively
+#ifndef D2Q9
+	float Axxz[block_size], Axzz[block_size], Ayyz[block_size], Ayzz[block_size], Axyz[block_size];
+#endif // D2Q9
+	for(uint k=0u; k<count; k++) {
+		Axxy[k] = 2.0f*ux[k]*Pxy[k]+uy[k]*Pxx[k];
+		Axyy[k] = 2.0f*uy[k]*Pxy[k]+ux[k]*Pyy[k];
+#ifndef D2Q9
+		Axxz[k] = 2.0f*ux[k]*Pxz[k]+uz[k]*Pxx[k];
+		Axzz[k] = 2.0f*uz[k]*Pxz[k]+ux[k]*Pzz[k];
+		Ayyz[k] = 2.0f*uy[k]*Pyz[k]+uz[k]*Pyy[k];
+		Ayzz[k] = 2.0f*uz[k]*Pyz[k]+uy[k]*Pzz[k];
+		Axyz[k] = ux[k]*Pyz[k]+uy[k]*Pxz[k]+uz[k]*Pxy[k];
+#endif // D2Q9
+	}
+	for(uint i=0u; i<velocity_set; i++) { // same as calculate_f_neq_regularized() in kernel.cpp
+		const float cxi=(float)c[i], cyi=(float)c[velocity_set+i], czi=(float)c[2u*velocity_set+i];
+		const float Hxx=cxi*cxi-0.33333334f, Hyy=cyi*cyi-0.33333334f, Hzz=czi*czi-0.33333334f;
+		for(uint k=0u; k<count; k++) {
+			float fneqi = 3.0f*(cxi*Jx[k]+cyi*Jy[k]+czi*Jz[k])+4.5f*(cxi*cxi*Pxx[k]+cyi*cyi*Pyy[k]+czi*czi*Pzz[k])+9.0f*(cxi*cyi*Pxy[k]+cxi*czi*Pxz[k]+cyi*czi*Pyz[k])-1.5f*(Pxx[k]+Pyy[k]+Pzz[k]);
+#if defined(D2Q9)
+			fneqi += 13.5f*(cyi*Hxx*Axxy[k]+cxi*Hyy*Axyy[k]);
+#elif defined(D3Q15)
+			const float Sxy=3.375f*(Axxy[k]+Ayzz[k]), Sxz=3.375f*(Axzz[k]+Axyy[k]), Syz=3.375f*(Ayyz[k]+Axxz[k]), Sxyz=9.0f*Axyz[k];
+			fneqi += cyi*(Hxx+Hzz)*Sxy+cxi*(Hzz+Hyy)*Sxz+czi*(Hyy+Hxx)*Syz+cxi*cyi*czi*Sxyz;
+#elif defined(D3Q19)
+			const float Sxy=13.5f*(Axxy[k]+Ayzz[k]), Sxz=13.5f*(Axzz[k]+Axyy[k]), Syz=13.5f*(Ayyz[k]+Axxz[k]), Dxy=4.5f*(Axxy[k]-Ayzz[k]), Dxz=4.5f*(Axzz[k]-Axyy[k]), Dyz=4.5f*(Ayyz[k]-Axxz[k]);
+			fneqi += cyi*((Hxx+Hzz)*Sxy+(Hxx-Hzz)*Dxy)+cxi*((Hzz+Hyy)*Sxz+(Hzz-Hyy)*Dxz)+czi*((Hyy+Hxx)*Syz+(Hyy-Hxx)*Dyz);
+#elif defined(D3Q27)
+			fneqi += 13.5f*(cyi*(Hxx*Axxy[k]+Hzz*Ayzz[k])+cxi*(Hyy*Axyy[k]+Hzz*Axzz[k])+czi*(Hxx*Axxz[k]+Hyy*Ayyz[k]))+27.0f*cxi*cyi*czi*Axyz[k];
+#endif // D3Q27
+			const float feqi = f_eq(i, rho[k], ux[k], uy[k], uz[k], c3[k]);
+#ifdef VOLUME_FORCE
+			const float Fin = forcing_term(i, ux[k], uy[k], uz[k], fx[k], fy[k], fz[k])*(1.0f-0.5f*wn[k]);
+#else // VOLUME_FORCE
+			const float Fin = 0.0f;
+#endif // VOLUME_FORCE
+			fh[i][k] = equilibrium[k] ? feqi : (1.0f-wn[k])*(w[i]*fneqi)+(feqi+Fin); // perform collision (RLB)
+		}
+	}
+#endif // RLB
+	{ // perform streaming (part 1), stores go to the same memory locations the loads came from
+		fpxx* const f0 = s.fi+(ulong)n0;
+		for(uint k=0u; k<count; k++) f0[k] = active[k] ? to_fpxx(fh[0][k]) : fr[0][k];
+		for(uint i=1u; i<velocity_set; i+=2u) {
+			fpxx* const fa = s.fi+(ulong)(odd ? i+1u : i   )*N+(ulong)j0[i]; // fr[i+1] was loaded from here
+			fpxx* const fb = s.fi+(ulong)(odd ? i    : i+1u)*N+(ulong)n0; // fr[i] was loaded from here
+			for(uint k=0u; k<count; k++) {
+				fa[k] = active[k] ? to_fpxx(fh[i   ][k]) : fr[i+1u][k];
+				fb[k] = active[k] ? to_fpxx(fh[i+1u][k]) : fr[i   ][k];
+			}
+		}
+	}
+}
+template<bool collide> void lbm_rows(const Native_Step& s, const uint r0, const uint r1) { // process x-rows r0 to r1-1, row r = y+z*Ny
+	uint j[velocity_set]; // neighbor indices of the first node of a block
+	for(uint r=r0; r<r1; r++) {
+		const uint n = r*s.Nx; // first node of the row
+		neighbors(s, n, j);
+		lbm_block<collide>(s, n, 1u, j); // x=0, neighbors in -x direction wrap around
+		for(uint x=1u; x+1u<s.Nx; x+=block_size) { // neighbors of consecutive inner nodes are consecutive
+			neighbors(s, n+x, j);
+			lbm_block<collide>(s, n+x, min(block_size, s.Nx-1u-x), j);
+		}
+		if(s.Nx>1u) { // x=Nx-1, neighbors in +x direction wrap around
+			neighbors(s, n+s.Nx-1u, j);
+			lbm_block<collide>(s, n+s.Nx-1u, 1u, j);
+		}
+	}
+}
+
+} // namespace
+
+Native_Step LBM::native_step() {
+	Native_Step s;
+	s.Nx = Nx; s.Ny = Ny; s.Nz = Nz;
+	s.N = (ulong)get_N();
+	s.fi = (fpxx*)fi.data(); // sanity_checks_constructor() made sure that options.ddf_format is the compiled fpxx format
+	s.rho = rho.data();
+	s.u = u.data();
+	s.flags = flags.data();
+	if(options.force_field) s.F = F.data();
+	s.t = t;
+	s.fx = fx; s.fy = fy; s.fz = fz;
+	s.w = 1.0f/get_tau();
+	return s;
+}
+
+void LBM::native_initialize() { // same as kernel initialize() without MOVING_BOUNDARIES, SURFACE and TEMPERATURE
+	Native_Step s = native_step();
+	s.t = 1ull; // DDFs are stored as after an odd time step
+	thread_pool.run(Ny*Nz, [&](const uint r0, const uint r1) {
+		uint j[::velocity_set]; // neighbor indices, ::velocity_set is the compiled velocity set and the same as LBM::velocity_set
+		for(uint n=r0*Nx; n<r1*Nx; n++) {
+			if((s.flags[n]&TYPE_BO)==TYPE_S) { // reset velocity for all solid lattice points
+				s.u[                n] = 0.0f;
+				s.u[    s.N+(ulong)n] = 0.0f;
+				s.u[2ull*s.N+(ulong)n] = 0.0f;
+			}
+			float feq[::velocity_set]; // f_equilibrium
+			calculate_f_eq(s.rho[n], s.u[n], s.u[s.N+(ulong)n], s.u[2ull*s.N+(ulong)n], feq);
+			neighbors(s, n, j);
+			store_f(s, n, feq, j); // write to fi
+		}
+	});
+}
+void LBM::native_stream_collide() { // same as kernel stream_collide()
+	const Native_Step s = native_step();
+	thread_pool.run(Ny*Nz, [&](const uint r0, const uint r1) { lbm_rows<true>(s, r0, r1); });
+}
+void LBM::native_update_fields() { // same as kernel update_fields()
+	const Native_Step s = native_step();
+	thread_pool.run(Ny*Nz, [&](const uint r0, const uint r1) { lbm_rows<false>(s, r0, r1); });
+}
+void LBM::native_calculate_force_on_boundaries() { // same as kernel calculate_force_on_boundaries()
+	const Native_Step s = native_step();
+	thread_pool.run(Ny*Nz, [&](const uint r0, const uint r1) {
+		uint j[::velocity_set]; // neighbor indices
+		for(uint n=r0*Nx; n<r1*Nx; n++) {
+			if((s.flags[n]&TYPE_BO)!=TYPE_S) continue; // only continue for solid boundary nodes
+			neighbors(s, n, j);
+			float fhn[::velocity_set]; // local DDFs
+			load_f(s, n, fhn, j);
+			float Fb=1.0f, fxn=0.0f, fyn=0.0f, fzn=0.0f;
+			calculate_rho_u(fhn, Fb, fxn, fyn, fzn); // abuse calculate_rho_u() method for calculating force
+			s.F[                n] = 2.0f*fxn*Fb; // 2 times because fi are reflected on solid boundary nodes (bounced-back)
+			s.F[    s.N+(ulong)n] = 2.0f*fyn*Fb;
+			s.F[2ull*s.N+(ulong)n] = 2.0f*fzn*Fb;
+		}
+	});
+}
+void LBM::native_gather_moments(const Memory<ulong>& nodes, Memory<float>& moments) { // same as kernel gather_moments()
+	const Native_Step s = native_step();
+	const uint count = (uint)nodes.length();
+	const ulong* node = nodes.data();
+	float* m = moments.data();
+	thread_pool.run(count, [&](const uint k0, const uint k1) {
+		uint j[::velocity_set]; // neighbor indices
+		for(uint k=k0; k<k1; k++) {
+			const uint n = (uint)node[k];
+			neighbors(s, n, j);
+			float fhn[::velocity_set]; // local DDFs
+			load_f(s, n, fhn, j);
+			float rhon, uxn, uyn, uzn;
+			calculate_rho_u(fhn, rhon, uxn, uyn, uzn);
+#ifdef VOLUME_FORCE
+			const float rho2 = 0.5f/rhon; // same velocity as in stream_collide(), the force field is not included
+			uxn = clamp(uxn+s.fx*rho2, -def_c, def_c);
+			uyn = clamp(uyn+s.fy*rho2, -def_c, def_c);
+			uzn = clamp(uzn+s.fz*rho2, -def_c, def_c);
+#else // VOLUME_FORCE
+			uxn = clamp(uxn, -def_c, def_c);
+			uyn = clamp(uyn, -def_c, def_c);
+			uzn = clamp(uzn, -def_c, def_c);
+#endif // VOLUME_FORCE
+			float feq[::velocity_set]; // equilibrium DDFs
+			calculate_f_eq(rhon, uxn, uyn, uzn, feq);
+			float Pxx=0.0f, Pyy=0.0f, Pzz=0.0f, Pxy=0.0f, Pxz=0.0f, Pyz=0.0f; // non-equilibrium stress tensor
+			for(uint i=1u; i<::velocity_set; i++) {
+				const float fneqi = fhn[i]-feq[i];
+				const float cxi=(float)c[i], cyi=(float)c[::velocity_set+i], czi=(float)c[2u*::velocity_set+i];
+				Pxx += cxi*cxi*fneqi; Pxy += cxi*cyi*fneqi; Pxz += cxi*czi*fneqi;
+				Pyy += cyi*cyi*fneqi; Pyz += cyi*czi*fneqi; Pzz += czi*czi*fneqi;
+			}
+			const float mk[10] = { rhon, uxn, uyn, uzn, Pxx, Pyy, Pzz, Pxy, Pxz, Pyz };
+			for(uint i=0u; i<10u; i++) m[(ulong)i*(ulong)count+(ulong)k] = mk[i]; // structure of arrays, like u
+		}
+	});
+}
+void LBM::native_scatter_moments(const Memory<ulong>& nodes, const Memory<float>& moments, const float scale) { // same as kernel scatter_moments()
+	Native_Step s = native_step();
+	s.t = t+1ull; // DDFs are stored like after time step t-1
+	const uint count = (uint)nodes.length();
+	const ulong* node = nodes.data();
+	const float* m = moments.data();
+	thread_pool.run(count, [&](const uint k0, const uint k1) {
+		uint j[::velocity_set]; // neighbor indices
+		for(uint k=k0; k<k1; k++) {
+			const uint n = (uint)node[k];
+			float mk[10];
+			for(uint i=0u; i<10u; i++) mk[i] = m[(ulong)i*(ulong)count+(ulong)k];
+			const float rhon=mk[0], uxn=mk[1], uyn=mk[2], uzn=mk[3];
+			const float Pxx=scale*mk[4], Pyy=scale*mk[5], Pzz=scale*mk[6], Pxy=scale*mk[7], Pxz=scale*mk[8], Pyz=scale*mk[9];
+			float fhn[::velocity_set]; // post-collision DDFs
+			calculate_f_eq(rhon, uxn, uyn, uzn, fhn);
+#ifdef VOLUME_FORCE
+			float Fin[::velocity_set]; // forcing terms
+			calculate_forcing_terms(uxn, uyn, uzn, s.fx, s.fy, s.fz, Fin);
+#endif // VOLUME_FORCE
+			const float trP = -1.5f*(Pxx+Pyy+Pzz);
+			for(uint i=0u; i<::velocity_set; i++) { // regularized non-equilibrium part from the second order Hermite moment only
+				const float cxi=(float)c[i], cyi=(float)c[::velocity_set+i], czi=(float)c[2u*::velocity_set+i];
+				fhn[i] += w[i]*(4.5f*(cxi*cxi*Pxx+cyi*cyi*Pyy+czi*czi*Pzz)+9.0f*(cxi*cyi*Pxy+cxi*czi*Pxz+cyi*czi*Pyz)+trP);
+#ifdef VOLUME_FORCE
+				fhn[i] += (1.0f-0.5f*s.w)*Fin[i]-(1.0f-s.w)*1.5f*w[i]*(cxi*s.fx+cyi*s.fy+czi*s.fz); // the non-equilibrium DDFs before collision carry momentum -F/2
+#endif // VOLUME_FORCE
+			}
+			neighbors(s, n, j);
+			store_f(s, n, fhn, j);
+		}
+	});
+}
+
+#endif // CPU_NATIVE
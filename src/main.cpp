@@ -18,7 +18,7 @@ void main_label(const double frametime) {
 		draw_label(c, "Kin. Viscosity "s +alignr(21u,                                                                                  to_string(info.lbm->get_nu(), 8u)), camera.width+ox, camera.height+oy+i); i+=global_font_height;
 		draw_label(c, "Relaxation Time "s+alignr(20u,                                                                                 to_string(info.lbm->get_tau(), 8u)), camera.width+ox, camera.height+oy+i); i+=global_font_height;
 		draw_label(c, "Reynolds Number "s+alignr(20u,                                            "Re < "s+string(Re>=100.0f ? to_string(to_uint(Re)) : to_string(Re, 6u))), camera.width+ox, camera.height+oy+i); i+=global_font_height;
-		draw_label(c, "LBM Type "s       +alignr(27u, "D"s+to_string(info.lbm->get_velocity_set()==9u?2:3)+"Q"s+to_string(info.lbm->get_velocity_set())+" "s+info.collision), camera.width+ox, camera.height+oy+i); i+=global_font_height;
+		draw_label(c, "LBM Type "s       +alignr(27u, info.lbm->get_options().name()), camera.width+ox, camera.height+oy+i); i+=global_font_height;
 		draw_label(c, "RAM Usage "s      +alignr(26u,                         "CPU "s+to_string(info.cpu_mem_required)+" MB, GPU "s+to_string(info.gpu_mem_required)+" MB"s), camera.width+ox, camera.height+oy+i); i+=global_font_height;
 		draw_label(c, (info.steps==max_ulong ? "Elapsed Time   "s : "Remaining Time "s)+alignr(21u,                                               print_time(info.time())), camera.width+ox, camera.height+oy+i); i+=global_font_height;
 		draw_label(c, "Simulation Time "s+alignr(20u,             (units.si_t(1ull)==1.0f?to_string(info.lbm->get_t()):to_string(units.si_t(info.lbm->get_t()), 6u))+"s"s), camera.width+ox, camera.height+oy+i); i+=global_font_height;
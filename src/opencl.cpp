@@ -10,6 +10,10 @@
 #include <type_traits>
 #include <optional>
 #include <tuple>
+#include <random>
+#include <cstdio>
+#include <filesystem>
+#include <string_view>
 
 using namespace std::literals;
 
@@ -225,3 +229,379 @@ bool load_voxelized_mesh_from_disk(
 
     return true;
 }
+
+namespace
+{
+
+inline constexpr auto PROGRAM_CACHE_MAGIC = "FluidX3D program binary v1"sv;
+inline constexpr auto PROGRAM_CACHE_MAX_SIZE = 1ull << 30;
+
+// 64-bit FNV-1a, stable across compilers and runs unlike std::hash
+std::uint64_t fnv1a(std::string_view const data, std::uint64_t hash = 0xCBF29CE484222325ull)
+{
+    for (auto const c : data)
+    {
+        hash = (hash ^ static_cast<unsigned char>(c)) * 0x100000001B3ull;
+    }
+    return hash;
+}
+
+std::string to_hex(std::uint64_t const value)
+{
+    std::string ret(16, '0');
+    for (auto i = 0u; i < 16u; ++i)
+    {
+        ret[15u - i] = "0123456789abcdef"[(value >> (4u * i)) & 0xFu];
+    }
+    return ret;
+}
+
+} // namespace
+
+std::string program_cache_key(
+	Device_Info const& info,
+	std::string const& kernel_code,
+	std::string const& build_options)
+{
+    // Everything that can change the compiled binary goes into the key. The full
+    // source includes LBM::device_defines() and Graphics::device_defines().
+    return info.name + "\n" + info.vendor + "\n" + info.driver_version + "\n" + info.opencl_c_version + "\n" +
+        build_options + "\n" + std::to_string(kernel_code.length()) + "\n" + to_hex(fnv1a(kernel_code));
+}
+
+std::string program_cache_path(std::string const& key)
+{
+    return get_exe_path() + "kernel_cache/" + to_hex(fnv1a(key)) + ".bin";
+}
+
+bool save_program_binary_to_disk(
+	std::string const& path,
+	std::string const& key,
+	std::string const& binary)
+{
+    create_folder(path);
+    // Write to a temporary file first and rename it, so concurrent jobs never see a partial binary
+    auto const tmp_path = path + "." + to_hex(std::random_device{}()) + ".tmp";
+    {
+        std::ofstream out_file{tmp_path, std::ios::binary | std::ios::out | std::ios::trunc};
+        if (!out_file.good())
+        {
+            print_info(tmp_path + ": could not open file to write");
+            return false;
+        }
+        write_bin(out_file, std::string{PROGRAM_CACHE_MAGIC});
+        write_bin(out_file, key);
+        write_bin(out_file, static_cast<std::uint64_t>(binary.length()));
+        write_bin(out_file, fnv1a(binary));
+        out_file.write(binary.data(), binary.length());
+        if (!out_file.good())
+        {
+            out_file.close();
+            std::remove(tmp_path.c_str());
+            return false;
+        }
+    }
+    std::error_code error;
+    std::filesystem::rename(tmp_path, path, error);
+    if (error)
+    {
+        std::remove(tmp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool load_program_binary_from_disk(
+	std::string const& path,
+	std::string const& key,
+	std::string& binary)
+{
+    std::ifstream in_file{path, std::ios::binary | std::ios::in};
+    if (!in_file.good())
+    {
+        return false; // no cache entry yet
+    }
+
+    if (!check_header(in_file, std::string{PROGRAM_CACHE_MAGIC}) ||
+        !check_header(in_file, key))
+    {
+        print_info(path + ": program cache header does not match");
+        return false;
+    }
+
+    auto const size = read_bin<std::uint64_t>(in_file);
+    auto const hash = read_bin<std::uint64_t>(in_file);
+    if (!size || !hash || *size == 0 || *size > PROGRAM_CACHE_MAX_SIZE)
+    {
+        print_info(path + ": program cache entry is corrupt");
+        return false;
+    }
+
+    binary = std::string(*size, '\0');
+    in_file.read(binary.data(), binary.length());
+    if (static_cast<std::uint64_t>(in_file.gcount()) != *size || fnv1a(binary) != *hash)
+    {
+        print_info(path + ": program cache entry is corrupt");
+        binary.clear();
+        return false;
+    }
+
+    return true;
+}
+
+namespace
+{
+
+inline constexpr auto WORKGROUP_SIZE_MAGIC = "FluidX3D workgroup size v1"sv;
+
+std::string workgroup_size_path(std::string const& key)
+{
+    return get_exe_path() + "kernel_cache/" + to_hex(fnv1a(key)) + ".wgs";
+}
+
+} // namespace
+
+bool save_workgroup_size_to_disk(std::string const& key, uint const workgroup_size)
+{
+    auto const path = workgroup_size_path(key);
+    create_folder(path);
+    auto const tmp_path = path + "." + to_hex(std::random_device{}()) + ".tmp";
+    {
+        std::ofstream out_file{tmp_path, std::ios::binary | std::ios::out | std::ios::trunc};
+        if (!out_file.good())
+        {
+            return false;
+        }
+        write_bin(out_file, std::string{WORKGROUP_SIZE_MAGIC});
+        write_bin(out_file, to_hex(fnv1a(key))); // the key itself can be longer than read_bin allows for strings
+        write_bin(out_file, workgroup_size);
+    }
+    std::error_code error;
+    std::filesystem::rename(tmp_path, path, error);
+    if (error)
+    {
+        std::remove(tmp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool load_workgroup_size_from_disk(std::string const& key, uint& workgroup_size)
+{
+    std::ifstream in_file{workgroup_size_path(key), std::ios::binary | std::ios::in};
+    if (!in_file.good() ||
+        !check_header(in_file, std::string{WORKGROUP_SIZE_MAGIC}) ||
+        !check_header(in_file, to_hex(fnv1a(key))))
+    {
+        return false;
+    }
+    auto const read = read_bin<uint>(in_file);
+    if (!read || *read == 0u || *read > 1024u)
+    {
+        return false;
+    }
+    workgroup_size = *read;
+    return true;
+}
+
+namespace
+{
+
+inline constexpr auto DEVICE_BENCHMARK_MAGIC = "FluidX3D device benchmark v1"sv;
+
+// Minimal D3Q19 FP32 pull-streaming BGK step on a periodic cube, plus a plain copy for bandwidth.
+// It is independent of LBM::device_defines(), so it can run before any LBM object exists.
+inline constexpr auto DEVICE_BENCHMARK_SOURCE = R"CL(
+constant int c[57] = {
+	0, 1,-1, 0, 0, 0, 0, 1,-1, 1,-1, 0, 0, 1,-1, 1,-1, 0, 0,
+	0, 0, 0, 1,-1, 0, 0, 1,-1, 0, 0, 1,-1,-1, 1, 0, 0, 1,-1,
+	0, 0, 0, 0, 0, 1,-1, 0, 0, 1,-1, 1,-1, 0, 0,-1, 1,-1, 1
+};
+float probe_w(const uint i) {
+	return i==0u ? 1.0f/3.0f : i<7u ? 1.0f/18.0f : 1.0f/36.0f;
+}
+kernel void probe_initialize(global float* fi) {
+	const uint n = get_global_id(0);
+	for(uint i=0u; i<19u; i++) fi[(ulong)i*def_N+n] = probe_w(i);
+}
+kernel void probe_stream_collide(const global float* fa, global float* fb) {
+	const uint n = get_global_id(0);
+	const int x=(int)(n%def_L), y=(int)((n/def_L)%def_L), z=(int)(n/(def_L*def_L));
+	float f[19], rho=0.0f, ux=0.0f, uy=0.0f, uz=0.0f;
+	for(uint i=0u; i<19u; i++) {
+		const uint j = (uint)((x+def_L-c[i])%def_L+((y+def_L-c[19u+i])%def_L+((z+def_L-c[38u+i])%def_L)*def_L)*def_L);
+		f[i] = fa[(ulong)i*def_N+j];
+		rho += f[i];
+		ux += (float)c[i]*f[i];
+		uy += (float)c[19u+i]*f[i];
+		uz += (float)c[38u+i]*f[i];
+	}
+	ux /= rho;
+	uy /= rho;
+	uz /= rho;
+	const float uu = 1.5f*(ux*ux+uy*uy+uz*uz);
+	for(uint i=0u; i<19u; i++) {
+		const float cu = 3.0f*((float)c[i]*ux+(float)c[19u+i]*uy+(float)c[38u+i]*uz);
+		const float feq = probe_w(i)*rho*(1.0f+cu+0.5f*cu*cu-uu);
+		fb[(ulong)i*def_N+n] = f[i]+0.8f*(feq-f[i]);
+	}
+}
+kernel void probe_copy(const global float4* a, global float4* b) {
+	const uint n = get_global_id(0);
+	b[n] = a[n];
+}
+)CL"sv;
+
+std::string device_benchmark_key(Device_Info const& info)
+{
+    return info.name + "\n" + info.vendor + "\n" + info.driver_version + "\n" + info.opencl_c_version + "\n" + to_hex(fnv1a(DEVICE_BENCHMARK_SOURCE));
+}
+
+std::string device_benchmark_path(std::string const& key)
+{
+    return get_exe_path() + "kernel_cache/device_" + to_hex(fnv1a(key)) + ".bin";
+}
+
+bool load_device_benchmark_from_disk(std::string const& path, std::string const& key, Device_Benchmark& result)
+{
+    std::ifstream in_file{path, std::ios::binary | std::ios::in};
+    if (!in_file.good() ||
+        !check_header(in_file, std::string{DEVICE_BENCHMARK_MAGIC}) ||
+        !check_header(in_file, key))
+    {
+        return false;
+    }
+    auto const mlups = read_bin<float>(in_file);
+    auto const bandwidth = read_bin<float>(in_file);
+    if (!mlups || !bandwidth || *mlups <= 0.0f)
+    {
+        return false;
+    }
+    result.mlups = *mlups;
+    result.bandwidth = *bandwidth;
+    return true;
+}
+
+void save_device_benchmark_to_disk(std::string const& path, std::string const& key, Device_Benchmark const& result)
+{
+    create_folder(path);
+    auto const tmp_path = path + "." + to_hex(std::random_device{}()) + ".tmp";
+    {
+        std::ofstream out_file{tmp_path, std::ios::binary | std::ios::out | std::ios::trunc};
+        if (!out_file.good())
+        {
+            return;
+        }
+        write_bin(out_file, std::string{DEVICE_BENCHMARK_MAGIC});
+        write_bin(out_file, key);
+        write_bin(out_file, result.mlups);
+        write_bin(out_file, result.bandwidth);
+    }
+    std::error_code error;
+    std::filesystem::rename(tmp_path, path, error);
+    if (error)
+    {
+        std::remove(tmp_path.c_str());
+    }
+}
+
+Device_Benchmark run_device_benchmark(Device_Info const& info)
+{
+    Device_Benchmark result;
+    // Largest cube of 32, 64, 96 or 128 whose two DDF buffers use at most a quarter of the device memory
+    auto const max_buffer = std::min<std::uint64_t>(info.max_global_buffer, info.memory / 8u) * 1048576ull;
+    auto L = 128u;
+    while (L > 32u && 19ull * 4ull * L * L * L > max_buffer)
+    {
+        L -= 32u;
+    }
+    auto const N = L * L * L;
+    auto const bytes = 19ull * 4ull * N;
+    if (bytes > max_buffer)
+    {
+        return result;
+    }
+
+    int error = 0;
+    cl::Context context(info.cl_device, nullptr, nullptr, nullptr, &error);
+    if (error)
+    {
+        return result;
+    }
+    cl::Program::Sources source;
+    source.push_back({DEVICE_BENCHMARK_SOURCE.data(), DEVICE_BENCHMARK_SOURCE.length()});
+    cl::Program program(context, source);
+    auto const options = "-cl-fast-relaxed-math -D def_L=" + std::to_string(L) + " -D def_N=" + std::to_string(N) + "u";
+    if (program.build(options.c_str()))
+    {
+        return result;
+    }
+    cl::CommandQueue queue(context, info.cl_device, 0, &error);
+    cl::Buffer fa(context, CL_MEM_READ_WRITE, bytes, nullptr, &error);
+    cl::Buffer fb(context, CL_MEM_READ_WRITE, bytes, nullptr, &error);
+    if (error)
+    {
+        return result;
+    }
+    cl::Kernel initialize(program, "probe_initialize");
+    cl::Kernel step_ab(program, "probe_stream_collide");
+    cl::Kernel step_ba(program, "probe_stream_collide");
+    cl::Kernel copy(program, "probe_copy");
+    initialize.setArg(0, fa);
+    step_ab.setArg(0, fa);
+    step_ab.setArg(1, fb);
+    step_ba.setArg(0, fb);
+    step_ba.setArg(1, fa);
+    copy.setArg(0, fa);
+    copy.setArg(1, fb);
+
+    auto const range = cl::NDRange(N);
+    queue.enqueueNDRangeKernel(initialize, cl::NullRange, range, cl::NullRange);
+    queue.enqueueNDRangeKernel(step_ab, cl::NullRange, range, cl::NullRange); // warmup
+    queue.enqueueNDRangeKernel(step_ba, cl::NullRange, range, cl::NullRange);
+    if (queue.finish())
+    {
+        return result;
+    }
+    auto constexpr steps = 20u;
+    Clock clock;
+    for (auto i = 0u; i < steps / 2u; ++i)
+    {
+        queue.enqueueNDRangeKernel(step_ab, cl::NullRange, range, cl::NullRange);
+        queue.enqueueNDRangeKernel(step_ba, cl::NullRange, range, cl::NullRange);
+    }
+    queue.finish();
+    result.mlups = static_cast<float>(1E-6 * static_cast<double>(N) * steps / clock.stop());
+
+    auto const copy_range = cl::NDRange(bytes / 16ull);
+    queue.enqueueNDRangeKernel(copy, cl::NullRange, copy_range, cl::NullRange); // warmup
+    queue.finish();
+    clock.start();
+    for (auto i = 0u; i < steps; ++i)
+    {
+        queue.enqueueNDRangeKernel(copy, cl::NullRange, copy_range, cl::NullRange);
+    }
+    queue.finish();
+    result.bandwidth = static_cast<float>(1E-9 * 2.0 * static_cast<double>(bytes) * steps / clock.stop());
+    return result;
+}
+
+} // namespace
+
+Device_Benchmark benchmark_device(Device_Info const& info)
+{
+    auto const key = device_benchmark_key(info);
+    auto const path = device_benchmark_path(key);
+    Device_Benchmark result;
+    if (load_device_benchmark_from_disk(path, key, result))
+    {
+        return result;
+    }
+    print_info("Benchmarking device \"" + info.name + "\", this is only done once per device and driver.");
+    result = run_device_benchmark(info);
+    if (result.mlups > 0.0f)
+    {
+        save_device_benchmark_to_disk(path, key, result);
+    }
+    return result;
+}
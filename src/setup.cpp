@@ -7,7 +7,7 @@
 	// ######################################################### define simulation box size, viscosity and volume force ############################################################################
 	LBM lbm(128u, 128u, 128u, 0.01f);
 	// #############################################################################################################################################################################################
-	const uint N=lbm.get_N(), Nx=lbm.get_Nx(), Ny=lbm.get_Ny(), Nz=lbm.get_Nz(); for(uint n=0u, x=0u, y=0u, z=0u; n<N; n++, lbm.coordinates(n, x, y, z)) {
+	const ulong N=lbm.get_N(); uint Nx=lbm.get_Nx(), Ny=lbm.get_Ny(), Nz=lbm.get_Nz(); for(ulong n=0ull; n<N; n++) { uint x=0u, y=0u, z=0u; lbm.coordinates(n, x, y, z);
 		// ########################################################################### define geometry #############################################################################################
 		const float A = 0.25f;
 		const uint periodicity = 1u;
@@ -29,7 +29,7 @@
 	// ######################################################### define simulation box size, viscosity and volume force ############################################################################
 	LBM lbm(1024u, 1024u, 1u, 0.01f);
 	// #############################################################################################################################################################################################
-	const uint N=lbm.get_N(), Nx=lbm.get_Nx(), Ny=lbm.get_Ny(), Nz=lbm.get_Nz(); for(uint n=0u, x=0u, y=0u, z=0u; n<N; n++, lbm.coordinates(n, x, y, z)) {
+	const ulong N=lbm.get_N(); uint Nx=lbm.get_Nx(), Ny=lbm.get_Ny(), Nz=lbm.get_Nz(); for(ulong n=0ull; n<N; n++) { uint x=0u, y=0u, z=0u; lbm.coordinates(n, x, y, z);
 		// ########################################################################### define geometry #############################################################################################
 		const float A = 0.2f;
 		const uint periodicity = 5u;
@@ -58,7 +58,7 @@
 	LBM lbm(lcm(H, WORKGROUP_SIZE)/H, H, 1u, nu, units.f_from_u_Poiseuille_2D(umax, 1.0f, nu, R), 0.0f, 0.0f); // 2D
 #endif // D2Q9
 	// #############################################################################################################################################################################################
-	const uint N=lbm.get_N(), Nx=lbm.get_Nx(), Ny=lbm.get_Ny(), Nz=lbm.get_Nz(); for(uint n=0u, x=0u, y=0u, z=0u; n<N; n++, lbm.coordinates(n, x, y, z)) {
+	const ulong N=lbm.get_N(); uint Nx=lbm.get_Nx(), Ny=lbm.get_Ny(), Nz=lbm.get_Nz(); for(ulong n=0ull; n<N; n++) { uint x=0u, y=0u, z=0u; lbm.coordinates(n, x, y, z);
 		// ########################################################################### define geometry #############################################################################################
 #ifndef D2Q9
 		if(!cylinder(x, y, z, lbm.center(), float3(0u, Ny, 0u), 0.5f*(float)min(Nx, Nz)-1.0f)) lbm.flags[n] = TYPE_S; // 3D
@@ -77,7 +77,7 @@
 		for(uint x=0u; x<Nx; x++) {
 			for(uint y=Ny/2u; y<Ny/2u+1u; y++) {
 				for(uint z=0; z<Nz; z++) {
-					const uint n = x+(y+z*Ny)*Nx;
+					const ulong n = lbm.index(x, y, z);
 					const double r = (double)sqrt(sq(x+0.5f-0.5f*(float)Nx)+sq(z+0.5f-0.5f*(float)Nz)); // radius from channel center
 					if(r<R) {
 						const double unum = (double)sqrt(sq(lbm.u.x[n])+sq(lbm.u.y[n])+sq(lbm.u.z[n])); // numerical velocity
@@ -92,7 +92,7 @@
 #else // D2Q9
 		for(uint x=Nx/2u; x<Nx/2u+1u; x++) {
 			for(uint y=1u; y<Ny-1u; y++) {
-				const uint n = x+(y+0u*Ny)*Nx;
+				const ulong n = lbm.index(x, y, 0u);
 				const double r = (double)(y+0.5f-0.5f*(float)Ny); // radius from channel center
 				const double unum = (double)sqrt(sq(lbm.u.x[n])+sq(lbm.u.y[n])); // numerical velocity
 				const double uref = umax*(sq(R)-sq(r))/sq(R); // theoretical velocity profile u = G*(R^2-r^2)
@@ -125,7 +125,7 @@
 	// ######################################################### define simulation box size, viscosity and volume force ############################################################################
 	LBM lbm(L, L, L, nu); // flow driven by equilibrium boundaries
 	// #############################################################################################################################################################################################
-	const uint N=lbm.get_N(), Nx=lbm.get_Nx(), Ny=lbm.get_Ny(), Nz=lbm.get_Nz(); for(uint n=0u, x=0u, y=0u, z=0u; n<N; n++, lbm.coordinates(n, x, y, z)) {
+	const ulong N=lbm.get_N(); uint Nx=lbm.get_Nx(), Ny=lbm.get_Ny(), Nz=lbm.get_Nz(); for(ulong n=0ull; n<N; n++) { uint x=0u, y=0u, z=0u; lbm.coordinates(n, x, y, z);
 		// ########################################################################### define geometry #############################################################################################
 		if(x==0u||x==Nx-1u||y==0u||y==Ny-1u||z==0u||z==Nz-1u) lbm.flags[n] = TYPE_E;
 		if(sphere(x, y, z, lbm.center(), R)) {
@@ -171,7 +171,7 @@
 	const float f = units.f_from_u_rectangular_duct(w, D, 1.0f, nu, u);
 	LBM lbm(to_uint(w), 12u*to_uint(D), to_uint(h), nu, 0.0f, f, 0.0f);
 	// #############################################################################################################################################################################################
-	const uint N=lbm.get_N(), Nx=lbm.get_Nx(), Nz=lbm.get_Nz(); for(uint n=0u, x=0u, y=0u, z=0u; n<N; n++, lbm.coordinates(n, x, y, z)) {
+	const ulong N=lbm.get_N(); uint Nx=lbm.get_Nx(), Nz=lbm.get_Nz(); for(ulong n=0ull; n<N; n++) { uint x=0u, y=0u, z=0u; lbm.coordinates(n, x, y, z);
 		// ########################################################################### define geometry #############################################################################################
 		lbm.u.y[n] = 0.1f*u;
 		if(cylinder(x, y, z, float3(lbm.center().x, 2.0f*D, lbm.center().z), float3(Nx, 0u, 0u), 0.5f*D)) lbm.flags[n] = TYPE_S;
@@ -186,7 +186,7 @@
 	// ######################################################### define simulation box size, viscosity and volume force ############################################################################
 	LBM lbm(96u, 96u, 192u, 0.04f);
 	// #############################################################################################################################################################################################
-	const uint N=lbm.get_N(), Nx=lbm.get_Nx(), Ny=lbm.get_Ny(), Nz=lbm.get_Nz(); for(uint n=0u, x=0u, y=0u, z=0u; n<N; n++, lbm.coordinates(n, x, y, z)) {
+	const ulong N=lbm.get_N(); uint Nx=lbm.get_Nx(), Ny=lbm.get_Ny(), Nz=lbm.get_Nz(); for(ulong n=0ull; n<N; n++) { uint x=0u, y=0u, z=0u; lbm.coordinates(n, x, y, z);
 		// ########################################################################### define geometry #############################################################################################
 		if(!cylinder(x, y, z, lbm.center(), float3(0u, 0u, Nz), (float)(Nx/2u-1u))) lbm.flags[n] = TYPE_S;
 		if( cylinder(x, y, z, lbm.center(), float3(0u, 0u, Nz), (float)(Nx/4u   ))) {
@@ -209,7 +209,7 @@
 	const float u = 0.4f;
 	LBM lbm(L, L, L, units.nu_from_Re(Re, (float)L, u));
 	// #############################################################################################################################################################################################
-	const uint N=lbm.get_N(), Nx=lbm.get_Nx(), Ny=lbm.get_Ny(), Nz=lbm.get_Nz(); for(uint n=0u, x=0u, y=0u, z=0u; n<N; n++, lbm.coordinates(n, x, y, z)) {
+	const ulong N=lbm.get_N(); uint Nx=lbm.get_Nx(), Ny=lbm.get_Ny(), Nz=lbm.get_Nz(); for(ulong n=0ull; n<N; n++) { uint x=0u, y=0u, z=0u; lbm.coordinates(n, x, y, z);
 		// ########################################################################### define geometry #############################################################################################
 		if(z==Nz-1) lbm.u.y[n] = u;
 		if(x==0u||x==Nx-1u||y==0u||y==Ny-1u||z==0u||z==Nz-1u) lbm.flags[n] = TYPE_S; // all non periodic
@@ -230,7 +230,7 @@
 	const float3 p0 = offset+float3(  0*(int)L/64,  5*(int)L/64,  20*(int)L/64);
 	const float3 p1 = offset+float3(-20*(int)L/64, 90*(int)L/64, -10*(int)L/64);
 	const float3 p2 = offset+float3(+20*(int)L/64, 90*(int)L/64, -10*(int)L/64);
-	const uint N=lbm.get_N(), Nx=lbm.get_Nx(), Ny=lbm.get_Ny(), Nz=lbm.get_Nz(); for(uint n=0u, x=0u, y=0u, z=0u; n<N; n++, lbm.coordinates(n, x, y, z)) {
+	const ulong N=lbm.get_N(); uint Nx=lbm.get_Nx(), Ny=lbm.get_Ny(), Nz=lbm.get_Nz(); for(ulong n=0ull; n<N; n++) { uint x=0u, y=0u, z=0u; lbm.coordinates(n, x, y, z);
 		// ########################################################################### define geometry #############################################################################################
 		if(triangle(x, y, z, p0, p1, p2)) lbm.flags[n] = TYPE_S;
 		else lbm.u.y[n] = u;
@@ -253,7 +253,7 @@
 	const float3 center = float3(lbm.center().x, 0.52f*size, lbm.center().z+0.03f*size);
 	const float3x3 rotation = float3x3(float3(1, 0, 0), radians(-10.0f))*float3x3(float3(0, 0, 1), radians(90.0f))*float3x3(float3(1, 0, 0), radians(90.0f));
 	lbm.voxelize_stl(get_exe_path()+"../../stl/Concorde.stl", center, rotation, size); // https://www.thingiverse.com/thing:1176931/files
-	const uint N=lbm.get_N(), Nx=lbm.get_Nx(), Ny=lbm.get_Ny(), Nz=lbm.get_Nz(); for(uint n=0u, x=0u, y=0u, z=0u; n<N; n++, lbm.coordinates(n, x, y, z)) {
+	const ulong N=lbm.get_N(); uint Nx=lbm.get_Nx(), Ny=lbm.get_Ny(), Nz=lbm.get_Nz(); for(ulong n=0ull; n<N; n++) { uint x=0u, y=0u, z=0u; lbm.coordinates(n, x, y, z);
 		// ########################################################################### define geometry #############################################################################################
 		if(lbm.flags[n]!=TYPE_S) lbm.u.y[n] = u;
 		if(x==0u||x==Nx-1u||y==0u||y==Ny-1u||z==0u||z==Nz-1u) lbm.flags[n] = TYPE_E; // all non periodic
@@ -305,7 +305,7 @@
 	const float3 center = float3(lbm.center().x, 32.0f+0.5f*size, lbm.center().z);
 	const float3x3 rotation = float3x3(float3(1, 0, 0), radians(75.0f));
 	lbm.voxelize_stl(get_exe_path()+"../stl/757.stl", center, rotation, size); // https://www.thingiverse.com/thing:5091064/files
-	const uint N=lbm.get_N(), Nx=lbm.get_Nx(), Ny=lbm.get_Ny(), Nz=lbm.get_Nz(); for(uint n=0u, x=0u, y=0u, z=0u; n<N; n++, lbm.coordinates(n, x, y, z)) {
+	const ulong N=lbm.get_N(); uint Nx=lbm.get_Nx(), Ny=lbm.get_Ny(), Nz=lbm.get_Nz(); for(ulong n=0ull; n<N; n++) { uint x=0u, y=0u, z=0u; lbm.coordinates(n, x, y, z);
 		// ########################################################################### define geometry #############################################################################################
 		if(lbm.flags[n]!=TYPE_S) lbm.u.y[n] = u;
 		if(x==0u||x==Nx-1u||y==0u||y==Ny-1u||z==0u||z==Nz-1u) lbm.flags[n] = TYPE_E; // all non periodic
@@ -341,7 +341,7 @@
 	const float3 center = float3(lbm.center().x, 32.0f+0.5f*size, lbm.center().z);
 	const float3x3 rotation = float3x3(float3(0, 0, 1), radians(180.0f));
 	voxelize_stl_hull(lbm, get_exe_path()+"../stl/X-wing.stl", center, rotation, size); // https://www.thingiverse.com/thing:353276/files
-	const uint N=lbm.get_N(), Nx=lbm.get_Nx(), Ny=lbm.get_Ny(), Nz=lbm.get_Nz(); for(uint n=0u, x=0u, y=0u, z=0u; n<N; n++, lbm.coordinates(n, x, y, z)) {
+	const ulong N=lbm.get_N(); uint Nx=lbm.get_Nx(), Ny=lbm.get_Ny(), Nz=lbm.get_Nz(); for(ulong n=0ull; n<N; n++) { uint x=0u, y=0u, z=0u; lbm.coordinates(n, x, y, z);
 		// ########################################################################### define geometry #############################################################################################
 		if(lbm.flags[n]!=TYPE_S) lbm.u.y[n] = u;
 		if(x==0u||x==Nx-1u||y==0u||y==Ny-1u||z==0u||z==Nz-1u) lbm.flags[n] = TYPE_E; // all non periodic
@@ -368,7 +368,7 @@
 
 /*std::atomic_bool revoxelizing = false;
 void revoxelize(LBM* lbm, Mesh* mesh) { // voxelize new frames in detached thread in parallel while LBM is running
-	for(uint n=0u; n<lbm->get_N(); n++) lbm->flags[n] &= ~TYPE_S; // clear flags
+	for(ulong n=0ull; n<lbm->get_N(); n++) lbm->flags[n] &= ~TYPE_S; // clear flags
 	const float3x3 rotation = float3x3(float3(0.2f, 1.0f, 0.1f), radians(0.4032f)); // create rotation matrix to rotate mesh
 	mesh->rotate(rotation); // rotate mesh
 	voxelize_mesh_hull(*lbm, mesh, TYPE_S); // voxelize rotated mesh in lbm.flags
@@ -386,7 +386,7 @@ void main_setup() { // Star Wars TIE fighter
 	const float3x3 rotation = float3x3(float3(1, 0, 0), radians(90.0f));
 	Mesh* mesh = read_stl(get_exe_path()+"../stl/TIE-fighter.stl", lbm.size(), center, rotation, size); // https://www.thingiverse.com/thing:2919109/files
 	voxelize_mesh_hull(lbm, mesh, TYPE_S);
-	const uint N=lbm.get_N(), Nx=lbm.get_Nx(), Ny=lbm.get_Ny(), Nz=lbm.get_Nz(); for(uint n=0u, x=0u, y=0u, z=0u; n<N; n++, lbm.coordinates(n, x, y, z)) {
+	const ulong N=lbm.get_N(); uint Nx=lbm.get_Nx(), Ny=lbm.get_Ny(), Nz=lbm.get_Nz(); for(ulong n=0ull; n<N; n++) { uint x=0u, y=0u, z=0u; lbm.coordinates(n, x, y, z);
 		// ########################################################################### define geometry #############################################################################################
 		if(lbm.flags[n]!=TYPE_S) lbm.u.y[n] = u;
 		if(x==0u||x==Nx-1u||y==0u||y==Ny-1u||z==0u||z==Nz-1u) lbm.flags[n] = TYPE_E; // all non periodic
@@ -426,7 +426,7 @@ void main_setup() { // Star Wars TIE fighter
 	const float3 center = float3(lbm.center().x, 16.0f+0.5f*size, lbm.center().z);
 	const float3x3 rotation = float3x3(float3(0, 0, 1), radians(90.0f));
 	lbm.voxelize_stl(get_exe_path()+"../stl/Enterprise-E.stl", center, rotation, size); // https://www.thingiverse.com/thing:1423364/files
-	const uint N=lbm.get_N(), Nx=lbm.get_Nx(), Ny=lbm.get_Ny(), Nz=lbm.get_Nz(); for(uint n=0u, x=0u, y=0u, z=0u; n<N; n++, lbm.coordinates(n, x, y, z)) {
+	const ulong N=lbm.get_N(); uint Nx=lbm.get_Nx(), Ny=lbm.get_Ny(), Nz=lbm.get_Nz(); for(ulong n=0ull; n<N; n++) { uint x=0u, y=0u, z=0u; lbm.coordinates(n, x, y, z);
 		// ########################################################################### define geometry #############################################################################################
 		if(lbm.flags[n]!=TYPE_S) lbm.u.y[n] = u;
 		if(x==0u||x==Nx-1u||y==0u||y==Ny-1u||z==0u||z==Nz-1u) lbm.flags[n] = TYPE_E; // all non periodic
@@ -464,7 +464,7 @@ void main_setup() { // Star Wars TIE fighter
 	// #############################################################################################################################################################################################
 	const float3 center = float3(lbm.center().x, 0.525f*size, 0.116f*size);
 	lbm.voxelize_stl(get_exe_path()+"../../stl/Ferrari_SF71H_V5.stl", center, size); // https://www.thingiverse.com/thing:2990512/files
-	const uint N=lbm.get_N(), Nx=lbm.get_Nx(), Ny=lbm.get_Ny(), Nz=lbm.get_Nz(); for(uint n=0u, x=0u, y=0u, z=0u; n<N; n++, lbm.coordinates(n, x, y, z)) {
+	const ulong N=lbm.get_N(); uint Nx=lbm.get_Nx(), Ny=lbm.get_Ny(), Nz=lbm.get_Nz(); for(ulong n=0ull; n<N; n++) { uint x=0u, y=0u, z=0u; lbm.coordinates(n, x, y, z);
 		// ########################################################################### define geometry #############################################################################################
 		if(lbm.flags[n]!=TYPE_S) lbm.u.y[n] = u;
 		if(x==0u||x==Nx-1u||y==0u||y==Ny-1u||z==Nz-1u) lbm.flags[n] = TYPE_E;
@@ -496,7 +496,7 @@ void main_setup() { // Star Wars TIE fighter
 	// ######################################################### define simulation box size, viscosity and volume force ############################################################################
 	LBM lbm(96u, 352u, 96u, 0.007f, 0.0f, 0.0f, -0.0005f);
 	// #############################################################################################################################################################################################
-	const uint N=lbm.get_N(), Nx=lbm.get_Nx(), Ny=lbm.get_Ny(), Nz=lbm.get_Nz(); for(uint n=0u, x=0u, y=0u, z=0u; n<N; n++, lbm.coordinates(n, x, y, z)) {
+	const ulong N=lbm.get_N(); uint Nx=lbm.get_Nx(), Ny=lbm.get_Ny(), Nz=lbm.get_Nz(); for(ulong n=0ull; n<N; n++) { uint x=0u, y=0u, z=0u; lbm.coordinates(n, x, y, z);
 		// ########################################################################### define geometry #############################################################################################
 		const uint H2 = Nz*3u/5u;
 		const uint H1 = Nz*2u/5u;
@@ -525,7 +525,7 @@ void main_setup() { // Star Wars TIE fighter
 	// ######################################################### define simulation box size, viscosity and volume force ############################################################################
 	LBM lbm(128u, 256u, 256u, 0.005f, 0.0f, 0.0f, -0.0002f, 0.0001f);
 	// #############################################################################################################################################################################################
-	const uint N=lbm.get_N(), Nx=lbm.get_Nx(), Ny=lbm.get_Ny(), Nz=lbm.get_Nz(); for(uint n=0u, x=0u, y=0u, z=0u; n<N; n++, lbm.coordinates(n, x, y, z)) {
+	const ulong N=lbm.get_N(); uint Nx=lbm.get_Nx(), Ny=lbm.get_Ny(), Nz=lbm.get_Nz(); for(ulong n=0ull; n<N; n++) { uint x=0u, y=0u, z=0u; lbm.coordinates(n, x, y, z);
 		// ########################################################################### define geometry #############################################################################################
 		if(z<Nz*6u/8u && y<Ny/8u) lbm.flags[n] = TYPE_F;
 		if(x==0u||x==Nx-1u||y==0u||y==Ny-1u||z==0u||z==Nz-1u) lbm.flags[n] = TYPE_S; // all non periodic
@@ -541,7 +541,7 @@ void main_setup() { // Star Wars TIE fighter
 	// ######################################################### define simulation box size, viscosity and volume force ############################################################################
 	LBM lbm(D, D, D, 0.005f, 0.0f, 0.0f, -f);
 	// #############################################################################################################################################################################################
-	const uint N=lbm.get_N(), Nx=lbm.get_Nx(), Ny=lbm.get_Ny(), Nz=lbm.get_Nz(); for(uint n=0u, x=0u, y=0u, z=0u; n<N; n++, lbm.coordinates(n, x, y, z)) {
+	const ulong N=lbm.get_N(); uint Nx=lbm.get_Nx(), Ny=lbm.get_Ny(), Nz=lbm.get_Nz(); for(ulong n=0ull; n<N; n++) { uint x=0u, y=0u, z=0u; lbm.coordinates(n, x, y, z);
 		// ########################################################################### define geometry #############################################################################################
 		const uint H = D*5u/6u;
 		const uint R = D/4u-1u;
@@ -571,7 +571,7 @@ void main_setup() { // Star Wars TIE fighter
 	// ######################################################### define simulation box size, viscosity and volume force ############################################################################
 	LBM lbm(L, L, L*3u/4u, nu, 0.0f, 0.0f, -f, sigma);
 	// #############################################################################################################################################################################################
-	const uint N=lbm.get_N(), Nx=lbm.get_Nx(), Ny=lbm.get_Ny(), Nz=lbm.get_Nz(); for(uint n=0u, x=0u, y=0u, z=0u; n<N; n++, lbm.coordinates(n, x, y, z)) {
+	const ulong N=lbm.get_N(); uint Nx=lbm.get_Nx(), Ny=lbm.get_Ny(), Nz=lbm.get_Nz(); for(ulong n=0ull; n<N; n++) { uint x=0u, y=0u, z=0u; lbm.coordinates(n, x, y, z);
 		// ########################################################################### define geometry #############################################################################################
 		if(z<Nz/3u && x>0u&&x<Nx-1u&&y>0u&&y<Ny-1u&&z>0u&&z<Nz-1u) {
 			lbm.rho[n] = units.rho_hydrostatic(f, (float)z, (float)(Nz/3u));
@@ -589,7 +589,7 @@ void main_setup() { // Star Wars TIE fighter
 		for(uint z=0u; z<1u; z++) {
 			for(uint y=1u; y<Ny-1u; y++) {
 				for(uint x=1u; x<Nx-1u; x++) {
-					const uint n = x+(y+z*Ny)*Nx;
+					const ulong n = lbm.index(x, y, z);
 					lbm.u.z[n] = uz;
 				}
 			}
@@ -608,7 +608,7 @@ void main_setup() { // Star Wars TIE fighter
 	// ######################################################### define simulation box size, viscosity and volume force ############################################################################
 	LBM lbm(128u, 640u, 96u, 0.01f, 0.0f, 0.0f, -f);
 	// #############################################################################################################################################################################################
-	const uint N=lbm.get_N(), Nx=lbm.get_Nx(), Ny=lbm.get_Ny(), Nz=lbm.get_Nz(); for(uint n=0u, x=0u, y=0u, z=0u; n<N; n++, lbm.coordinates(n, x, y, z)) {
+	const ulong N=lbm.get_N(); uint Nx=lbm.get_Nx(), Ny=lbm.get_Ny(), Nz=lbm.get_Nz(); for(ulong n=0ull; n<N; n++) { uint x=0u, y=0u, z=0u; lbm.coordinates(n, x, y, z);
 		// ########################################################################### define geometry #############################################################################################
 		const uint H = Nz/2u;
 		if(z<H) {
@@ -628,7 +628,7 @@ void main_setup() { // Star Wars TIE fighter
 		for(uint z=1u; z<Nz-1u; z++) {
 			for(uint y=0u; y<1u; y++) {
 				for(uint x=1u; x<Nx-1u; x++) {
-					const uint n = x+(y+z*Ny)*Nx;
+					const ulong n = lbm.index(x, y, z);
 					lbm.u.y[n] = uy;
 					lbm.u.z[n] = uz;
 				}
@@ -646,7 +646,7 @@ void main_setup() { // Star Wars TIE fighter
 	// ######################################################### define simulation box size, viscosity and volume force ############################################################################
 	LBM lbm(128u, 384u, 96u, 0.02f, 0.0f, -0.00007f, -0.0005f, 0.01f);
 	// #############################################################################################################################################################################################
-	const uint N=lbm.get_N(), Nx=lbm.get_Nx(), Ny=lbm.get_Ny(), Nz=lbm.get_Nz(); for(uint n=0u, x=0u, y=0u, z=0u; n<N; n++, lbm.coordinates(n, x, y, z)) {
+	const ulong N=lbm.get_N(); uint Nx=lbm.get_Nx(), Ny=lbm.get_Ny(), Nz=lbm.get_Nz(); for(ulong n=0ull; n<N; n++) { uint x=0u, y=0u, z=0u; lbm.coordinates(n, x, y, z);
 		// ########################################################################### define geometry #############################################################################################
 		const int R = 20, H = 32;
 		if(z==0) lbm.flags[n] = TYPE_S;
@@ -709,7 +709,7 @@ void main_setup() { // Star Wars TIE fighter
 	// ######################################################### define simulation box size, viscosity and volume force ############################################################################
 	LBM lbm(to_uint(Lx), to_uint(Lx), to_uint(Lz), nu, 0.0f, 0.0f, -f, sigma); // largest box size on Titan Xp with FP32: 384^2, FP16: 464^3
 	// #############################################################################################################################################################################################
-	const uint N=lbm.get_N(), Nx=lbm.get_Nx(), Ny=lbm.get_Ny(), Nz=lbm.get_Nz(); for(uint n=0u, x=0u, y=0u, z=0u; n<N; n++, lbm.coordinates(n, x, y, z)) {
+	const ulong N=lbm.get_N(); uint Nx=lbm.get_Nx(), Ny=lbm.get_Ny(), Nz=lbm.get_Nz(); for(ulong n=0ull; n<N; n++) { uint x=0u, y=0u, z=0u; lbm.coordinates(n, x, y, z);
 		// ########################################################################### define geometry #############################################################################################
 		lbm.rho[n] = rho; // set density everywhere
 		if(sphere(x, y, z, float3(0.5f*(float)Nx, 0.5f*(float)Ny-2.0f*R*tan(alpha*pif/180.0f), H+R+2.5f)+0.5f, R+2.0f)) {
@@ -792,7 +792,7 @@ void main_setup() { // Star Wars TIE fighter
 	// ######################################################### define simulation box size, viscosity and volume force ############################################################################
 	LBM lbm(Lx, Ly, Lz, nu, 0.0f, 0.0f, -f, sigma);
 	// #############################################################################################################################################################################################
-	const uint N=lbm.get_N(), Nx=lbm.get_Nx(), Ny=lbm.get_Ny(), Nz=lbm.get_Nz(); for(uint n=0u, x=0u, y=0u, z=0u; n<N; n++, lbm.coordinates(n, x, y, z)) {
+	const ulong N=lbm.get_N(); uint Nx=lbm.get_Nx(), Ny=lbm.get_Ny(), Nz=lbm.get_Nz(); for(ulong n=0ull; n<N; n++) { uint x=0u, y=0u, z=0u; lbm.coordinates(n, x, y, z);
 		// ########################################################################### define geometry #############################################################################################
 		if(z<H) { // pool
 			lbm.flags[n] = TYPE_F;
@@ -819,7 +819,7 @@ void main_setup() { // Star Wars TIE fighter
 	// ######################################################### define simulation box size, viscosity and volume force ############################################################################
 	LBM lbm(96u, 96u, 96u, 0.02f, 0.0f, 0.0f, -0.001f, 0.001f);
 	// #############################################################################################################################################################################################
-	const uint N=lbm.get_N(), Nx=lbm.get_Nx(), Ny=lbm.get_Ny(), Nz=lbm.get_Nz(); for(uint n=0u, x=0u, y=0u, z=0u; n<N; n++, lbm.coordinates(n, x, y, z)) {
+	const ulong N=lbm.get_N(); uint Nx=lbm.get_Nx(), Ny=lbm.get_Ny(), Nz=lbm.get_Nz(); for(ulong n=0ull; n<N; n++) { uint x=0u, y=0u, z=0u; lbm.coordinates(n, x, y, z);
 		// ########################################################################### define geometry #############################################################################################
 		if(x<Nx*2u/3u&&y<Ny*2u/3u) lbm.flags[n] = TYPE_F;
 		if(x==0u||x==Nx-1u||y==0u||y==Ny-1u||z==0u||z==Nz-1u) lbm.flags[n] = TYPE_S;
@@ -844,7 +844,7 @@ void main_setup() { // Star Wars TIE fighter
 	// ######################################################### define simulation box size, viscosity and volume force ############################################################################
 	LBM lbm(96u, 192u, 128u, 0.02f, 0.0f, 0.0f, -0.001f);
 	// #############################################################################################################################################################################################
-	const uint N=lbm.get_N(), Nx=lbm.get_Nx(), Ny=lbm.get_Ny(), Nz=lbm.get_Nz(); for(uint n=0u, x=0u, y=0u, z=0u; n<N; n++, lbm.coordinates(n, x, y, z)) {
+	const ulong N=lbm.get_N(); uint Nx=lbm.get_Nx(), Ny=lbm.get_Ny(), Nz=lbm.get_Nz(); for(ulong n=0ull; n<N; n++) { uint x=0u, y=0u, z=0u; lbm.coordinates(n, x, y, z);
 		// ########################################################################### define geometry #############################################################################################
 		if(y>Ny*5/6) lbm.flags[n] = TYPE_F;
 		const uint D = max(Nx, Nz);
@@ -862,7 +862,7 @@ void main_setup() { // Star Wars TIE fighter
 	// ######################################################### define simulation box size, viscosity and volume force ############################################################################
 	LBM lbm(256u, 256u, 128u, 0.014f, 0.0f, 0.0f, 0.0f, 0.0001f);
 	// #############################################################################################################################################################################################
-	const uint N=lbm.get_N(), Nx=lbm.get_Nx(), Ny=lbm.get_Ny(), Nz=lbm.get_Nz(); for(uint n=0u, x=0u, y=0u, z=0u; n<N; n++, lbm.coordinates(n, x, y, z)) {
+	const ulong N=lbm.get_N(); uint Nx=lbm.get_Nx(), Ny=lbm.get_Ny(), Nz=lbm.get_Nz(); for(ulong n=0ull; n<N; n++) { uint x=0u, y=0u, z=0u; lbm.coordinates(n, x, y, z);
 		// ########################################################################### define geometry #############################################################################################
 		if(sphere(x, y, z, lbm.center()-float3(0u, 10u, 0u), 32.0f)) {
 			lbm.flags[n] = TYPE_F;
@@ -891,7 +891,7 @@ void main_setup() { // Star Wars TIE fighter
 	// ######################################################### define simulation box size, viscosity and volume force ############################################################################
 	LBM lbm(256u, 256u, 64u, 0.02f, 0.0f, 0.0f, -0.001f, 0.0f, 1.0f, 1.0f);
 	// #############################################################################################################################################################################################
-	const uint N=lbm.get_N(), Nx=lbm.get_Nx(), Ny=lbm.get_Ny(), Nz=lbm.get_Nz(); for(uint n=0u, x=0u, y=0u, z=0u; n<N; n++, lbm.coordinates(n, x, y, z)) {
+	const ulong N=lbm.get_N(); uint Nx=lbm.get_Nx(), Ny=lbm.get_Ny(), Nz=lbm.get_Nz(); for(ulong n=0ull; n<N; n++) { uint x=0u, y=0u, z=0u; lbm.coordinates(n, x, y, z);
 		// ########################################################################### define geometry #############################################################################################
 		lbm.u.x[n] = random_symmetric(0.015f);
 		lbm.u.y[n] = random_symmetric(0.015f);
@@ -915,7 +915,7 @@ void main_setup() { // Star Wars TIE fighter
 	// ######################################################### define simulation box size, viscosity and volume force ############################################################################
 	LBM lbm(32u, 196u, 60u, 0.02f, 0.0f, 0.0f, -0.001f, 0.0f, 1.0f, 1.0f);
 	// #############################################################################################################################################################################################
-	const uint N=lbm.get_N(), Nx=lbm.get_Nx(), Ny=lbm.get_Ny(), Nz=lbm.get_Nz(); for(uint n=0u, x=0u, y=0u, z=0u; n<N; n++, lbm.coordinates(n, x, y, z)) {
+	const ulong N=lbm.get_N(); uint Nx=lbm.get_Nx(), Ny=lbm.get_Ny(), Nz=lbm.get_Nz(); for(ulong n=0ull; n<N; n++) { uint x=0u, y=0u, z=0u; lbm.coordinates(n, x, y, z);
 		// ########################################################################### define geometry #############################################################################################
 		if(y==1) {
 			lbm.T[n] = 1.8f;
@@ -934,6 +934,46 @@ void main_setup() { // Star Wars TIE fighter
 #endif // TEMPERATURE
 #else // BENCHMARK
 #include "info.hpp"
+/*void main_setup() { // host<->device transfer benchmark for pageable and pinned/zero-copy host memory
+	Device device(select_device_with_most_flops(), "kernel void dummy() {}");
+	print_transfer_benchmark(device);
+#if defined(_WIN32)
+	wait();
+#endif // Windows
+} /**/
+/*void main_setup() { // neighbor indexing benchmark, generic modulo path versus specialized indexing on every device, for lattices with power-of-2 and other sizes
+	const vector<Device_Info>& devices = get_devices();
+	const vector<string> arguments = main_arguments;
+	vector<string> results;
+	for(uint id=0u; id<(uint)devices.size(); id++) {
+		main_arguments = vector<string>{ to_string(id) }; // the LBM constructor selects the device with the ID in the first console argument
+		for(const uint velocity_set : { 9u, 19u }) {
+			for(const uint L : { 256u, 250u }) { // D2Q9 uses 16L x 16L, D3Q19 uses L x L x L, about 16M nodes either way
+				const uint Nx=velocity_set==9u ? 16u*L : L, Ny=Nx, Nz=velocity_set==9u ? 1u : L;
+				uint mlups[2] = { 0u, 0u };
+				for(uint specialized=0u; specialized<2u; specialized++) {
+					LBM_Options options;
+					options.velocity_set = velocity_set;
+					options.specialized_indexing = specialized==1u;
+					LBM lbm(options, Nx, Ny, Nz, 1.0f);
+					lbm.set_sync_interval(10u);
+					for(uint i=0u; i<100u; i++) {
+						lbm.run(10u);
+						mlups[specialized] = max(mlups[specialized], to_uint((double)lbm.get_N()*1E-6/info.dt_smooth));
+					}
+				}
+				results.push_back("| "+alignl(14u, "Device "+to_string(id))+" | "+alignl(58u, string(velocity_set==9u ? "D2Q9 " : "D3Q19 ")+to_string(Nx)+"x"+to_string(Ny)+"x"+to_string(Nz)+": "+to_string(mlups[0])+" -> "+to_string(mlups[1])+" MLUPs/s ("+(mlups[1]>=mlups[0] ? "+" : "")+to_string(100.0*((double)mlups[1]/(double)max(mlups[0], 1u)-1.0), 1u)+"%)")+" |");
+			}
+		}
+	}
+	main_arguments = arguments;
+	println("\r|----------------.------------------------------------------------------------|");
+	for(const string& result : results) println(result);
+	println("|----------------'------------------------------------------------------------|");
+#if defined(_WIN32)
+	wait();
+#endif // Windows
+} /**/
 void main_setup() { // benchmark
 	uint mlups = 0u;
 	{ // ######################################################## define simulation box size, viscosity and volume force ###########################################################################
@@ -949,6 +989,7 @@ void main_setup() { // benchmark
 		//LBM lbm(480u, 480u, 480u, 1.0f);
 		//LBM lbm(512u, 512u, 512u, 1.0f);
 		// #########################################################################################################################################################################################
+		lbm.set_sync_interval(10u); // enqueue 10 time steps back-to-back, host only waits for the device after each run(10u)
 		for(uint i=0u; i<1000u; i++) {
 			lbm.run(10u);
 			mlups = max(mlups, to_uint((double)lbm.get_N()*1E-6/info.dt_smooth));
@@ -0,0 +1,230 @@
+#include "transport.hpp"
+#include "defines.hpp"
+#include <atomic>
+#include <cstdlib> // for getenv()
+#include <cstring> // for memcpy()
+#include <memory> // for unique_ptr
+
+#ifdef MPI_TRANSPORT
+#include <mpi.h>
+
+class Transport_MPI : public Transport { // ranks are the processes started by mpirun
+private:
+	int world_rank=0, world_size=1;
+	static constexpr ulong chunk = 1073741824ull; // MPI counts are int, so large messages are split
+	static constexpr int tag_below=0, tag_above=1, tag_other=2; // with 2 ranks, the rank below is also the rank above, so the direction is kept apart by tags
+public:
+	inline Transport_MPI() {
+		int initialized = 0;
+		MPI_Initialized(&initialized);
+		if(!initialized) {
+			int provided = 0;
+			MPI_Init_thread(nullptr, nullptr, MPI_THREAD_SERIALIZED, &provided); // all MPI calls come from the compute thread
+		}
+		MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+		MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+	}
+	inline ~Transport_MPI() override {
+		int finalized = 0;
+		MPI_Finalized(&finalized);
+		if(!finalized) MPI_Finalize();
+	}
+	inline uint rank() const override { return (uint)world_rank; }
+	inline uint ranks() const override { return (uint)world_size; }
+	inline string name() const override { return "MPI"; }
+	inline void send(const uint destination, const void* data, const ulong bytes) override {
+		for(ulong i=0ull; i<bytes; i+=chunk) MPI_Send((const char*)data+i, (int)min(chunk, bytes-i), MPI_BYTE, (int)destination, tag_other, MPI_COMM_WORLD);
+	}
+	inline void receive(const uint source, void* data, const ulong bytes) override {
+		for(ulong i=0ull; i<bytes; i+=chunk) MPI_Recv((char*)data+i, (int)min(chunk, bytes-i), MPI_BYTE, (int)source, tag_other, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+	}
+	inline void exchange(const void* send_below, const void* send_above, void* receive_below, void* receive_above, const ulong bytes) override {
+		const int below=(world_rank+world_size-1)%world_size, above=(world_rank+1)%world_size;
+		for(ulong i=0ull; i<bytes; i+=chunk) {
+			const int count = (int)min(chunk, bytes-i);
+			MPI_Sendrecv((const char*)send_below+i, count, MPI_BYTE, below, tag_below, (char*)receive_above+i, count, MPI_BYTE, above, tag_below, MPI_COMM_WORLD, MPI_STATUS_IGNORE); // downward
+			MPI_Sendrecv((const char*)send_above+i, count, MPI_BYTE, above, tag_above, (char*)receive_below+i, count, MPI_BYTE, below, tag_above, MPI_COMM_WORLD, MPI_STATUS_IGNORE); // upward
+		}
+	}
+	inline void barrier() override {
+		MPI_Barrier(MPI_COMM_WORLD);
+	}
+};
+#endif // MPI_TRANSPORT
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define VC_EXTRALEAN
+#include <Windows.h> // for CreateFileMappingA() and MapViewOfFile()
+#undef min
+#undef max
+#else // Linux/macOS
+#include <fcntl.h> // for O_CREAT
+#include <sys/mman.h> // for shm_open() and mmap()
+#include <sys/stat.h> // for fstat()
+#include <unistd.h> // for ftruncate()
+#endif // Linux/macOS
+
+class Transport_Shared_Memory : public Transport { // ranks are processes on the same machine that share one memory segment, for testing distributed setups without MPI
+private:
+	static constexpr ulong chunk = 262144ull; // capacity of one channel, larger messages are sent in pieces
+	static constexpr uint tag_below=0u, tag_above=1u, tag_other=2u, tags=3u;
+	static_assert(std::atomic<ulong>::is_always_lock_free, "Atomics in shared memory have to be lock-free.");
+	struct Header { // zero-initialized memory is a valid state for everything in the segment
+		std::atomic<ulong> ready; // set by rank 0 once the segment is complete
+		std::atomic<ulong> arrived, generation; // barrier
+	};
+	struct Channel { // one direction between two ranks, data holds one piece of a message while filled>0
+		std::atomic<ulong> filled;
+		char padding[56]; // keep flags of different channels in different cache lines
+		char data[chunk];
+	};
+	uint world_rank=0u, world_size=1u;
+	string key; // name of the shared memory segment
+	ulong segment_size = 0ull;
+	char* segment = nullptr;
+#if defined(_WIN32)
+	HANDLE mapping = nullptr;
+#endif // _WIN32
+	static constexpr ulong ready_value = 0x46583344ull; // "FX3D"
+	inline Header* header() const { return (Header*)segment; }
+	inline Channel* channel(const uint source, const uint destination, const uint tag) const {
+		return (Channel*)(segment+sizeof(Header)+((ulong)(source*world_size+destination)*(ulong)tags+(ulong)tag)*sizeof(Channel));
+	}
+	struct Operation { // one message that is sent or received piece by piece
+		Channel* channel;
+		char* data;
+		ulong bytes, done;
+		bool send;
+		inline bool progress() { // returns true if a piece was transferred
+			if(done>=bytes) return false;
+			if(send) {
+				if(channel->filled.load(std::memory_order_acquire)!=0ull) return false; // receiver has not taken the previous piece yet
+				const ulong n = min(chunk, bytes-done);
+				memcpy(channel->data, data+done, n);
+				done += n;
+				channel->filled.store(n, std::memory_order_release);
+			} else {
+				const ulong n = channel->filled.load(std::memory_order_acquire);
+				if(n==0ull) return false;
+				memcpy(data+done, channel->data, n);
+				done += n;
+				channel->filled.store(0ull, std::memory_order_release);
+			}
+			return true;
+		}
+	};
+	inline void complete(Operation* operations, const uint count) { // progress all operations until they are done, so that ranks that send to each other at the same time don't block each other
+		while(true) {
+			bool done=true, progressed=false;
+			for(uint i=0u; i<count; i++) {
+				progressed = operations[i].progress()||progressed;
+				done = done&&operations[i].done>=operations[i].bytes;
+			}
+			if(done) return;
+			if(!progressed) std::this_thread::yield();
+		}
+	}
+	inline void attach() {
+#if defined(_WIN32)
+		mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, (DWORD)(segment_size>>32), (DWORD)(segment_size&0xFFFFFFFFull), ("Local\\"+key).c_str()); // creates or opens the zero-initialized segment
+		if(mapping==nullptr) print_error("Shared memory segment \""+key+"\" can't be created.");
+		segment = (char*)MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, (SIZE_T)segment_size);
+		if(segment==nullptr) print_error("Shared memory segment \""+key+"\" can't be mapped.");
+		if(world_rank==0u) header()->ready.store(ready_value, std::memory_order_release);
+#else // Linux/macOS
+		const string name = "/"+key;
+		int file = -1;
+		if(world_rank==0u) { // rank 0 creates a new segment, a segment with the same name can only be left over from a crashed run
+			file = shm_open(name.c_str(), O_CREAT|O_EXCL|O_RDWR, 0600);
+			if(file<0) print_error("Shared memory segment \""+name+"\" already exists. Remove /dev/shm"+name+" left over from a previous run or set another FLUIDX3D_SHM_KEY.");
+			if(ftruncate(file, (off_t)segment_size)!=0) print_error("Shared memory segment \""+name+"\" can't be resized to "+to_string((uint)(segment_size/1048576ull))+" MB.");
+		} else { // other ranks wait until rank 0 has created and resized the segment
+			Clock clock;
+			struct stat status;
+			while(file<0||fstat(file, &status)!=0||(ulong)status.st_size<segment_size) {
+				if(file<0) file = shm_open(name.c_str(), O_RDWR, 0600);
+				if(clock.stop()>60.0) print_error("Rank 0 did not create shared memory segment \""+name+"\" within 60 seconds.");
+				sleep(0.01);
+			}
+		}
+		segment = (char*)mmap(nullptr, (size_t)segment_size, PROT_READ|PROT_WRITE, MAP_SHARED, file, 0);
+		close(file); // the mapping keeps the segment alive
+		if(segment==(char*)MAP_FAILED) print_error("Shared memory segment \""+name+"\" can't be mapped.");
+		if(world_rank==0u) header()->ready.store(ready_value, std::memory_order_release);
+		while(header()->ready.load(std::memory_order_acquire)!=ready_value) std::this_thread::yield();
+#endif // Linux/macOS
+	}
+public:
+	inline Transport_Shared_Memory(const uint rank, const uint ranks, const string& key) {
+		world_rank = rank;
+		world_size = ranks;
+		this->key = key;
+		segment_size = (ulong)sizeof(Header)+(ulong)ranks*(ulong)ranks*(ulong)tags*(ulong)sizeof(Channel);
+		attach();
+		barrier(); // all ranks are attached
+	}
+	inline ~Transport_Shared_Memory() override {
+#if defined(_WIN32)
+		if(segment) UnmapViewOfFile(segment);
+		if(mapping) CloseHandle(mapping);
+#else // Linux/macOS
+		if(segment) munmap(segment, (size_t)segment_size);
+		if(world_rank==0u) shm_unlink(("/"+key).c_str()); // ranks that are still attached keep their mapping
+#endif // Linux/macOS
+	}
+	inline uint rank() const override { return world_rank; }
+	inline uint ranks() const override { return world_size; }
+	inline string name() const override { return "shared memory"; }
+	inline void send(const uint destination, const void* data, const ulong bytes) override {
+		Operation operation = { channel(world_rank, destination, tag_other), (char*)data, bytes, 0ull, true };
+		complete(&operation, 1u);
+	}
+	inline void receive(const uint source, void* data, const ulong bytes) override {
+		Operation operation = { channel(source, world_rank, tag_other), (char*)data, bytes, 0ull, false };
+		complete(&operation, 1u);
+	}
+	inline void exchange(const void* send_below, const void* send_above, void* receive_below, void* receive_above, const ulong bytes) override {
+		const uint below=(world_rank+world_size-1u)%world_size, above=(world_rank+1u)%world_size;
+		Operation operations[4] = {
+			{ channel(world_rank, below, tag_below), (char*)send_below, bytes, 0ull, true },
+			{ channel(world_rank, above, tag_above), (char*)send_above, bytes, 0ull, true },
+			{ channel(below, world_rank, tag_above), (char*)receive_below, bytes, 0ull, false }, // the rank below sent this upward
+			{ channel(above, world_rank, tag_below), (char*)receive_above, bytes, 0ull, false } // the rank above sent this downward
+		};
+		complete(operations, 4u);
+	}
+	inline void barrier() override {
+		const ulong generation = header()->generation.load(std::memory_order_acquire);
+		if(header()->arrived.fetch_add(1ull, std::memory_order_acq_rel)+1ull==(ulong)world_size) { // last rank to arrive releases the others
+			header()->arrived.store(0ull, std::memory_order_relaxed);
+			header()->generation.fetch_add(1ull, std::memory_order_release);
+		} else {
+			while(header()->generation.load(std::memory_order_acquire)==generation) std::this_thread::yield();
+		}
+	}
+};
+
+static uint environment_uint(const char* name, const uint default_value) {
+	const char* value = std::getenv(name);
+	return value ? to_uint(string(value), default_value) : default_value;
+}
+
+static std::unique_ptr<Transport> create_transport() {
+#ifdef MPI_TRANSPORT
+	Transport* transport = new Transport_MPI();
+#else // MPI_TRANSPORT
+	const uint ranks = max(environment_uint("FLUIDX3D_RANKS", 1u), 1u);
+	const uint rank = environment_uint("FLUIDX3D_RANK", 0u);
+	if(ranks>1u&&rank>=ranks) print_error("FLUIDX3D_RANK="+to_string(rank)+" has to be smaller than FLUIDX3D_RANKS="+to_string(ranks)+".");
+	const char* key = std::getenv("FLUIDX3D_SHM_KEY");
+	Transport* transport = ranks>1u ? (Transport*)new Transport_Shared_Memory(rank, ranks, key ? string(key) : "fluidx3d") : new Transport(); // simulations that run at the same time need different keys
+#endif // MPI_TRANSPORT
+	if(transport->ranks()>1u) print_info("Rank "+to_string(transport->rank())+" of "+to_string(transport->ranks())+", connected via "+transport->name()+".");
+	return std::unique_ptr<Transport>(transport);
+}
+
+Transport& get_transport() {
+	static std::unique_ptr<Transport> transport = create_transport(); // created on first use, MPI is finalized at exit
+	return *transport;
+}